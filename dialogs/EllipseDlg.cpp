@@ -10,7 +10,8 @@
 #include "tlibs/string/spec_char.h"
 #include "tlibs/helper/flags.h"
 
-#include <future>
+#include <array>
+#include <algorithm>
 
 
 EllipseDlg::EllipseDlg(QWidget* pParent, QSettings* pSett)
@@ -179,7 +180,7 @@ void EllipseDlg::Calc()
 			Q_avg = ublas::zero_vector<t_real_reso>(Q_avg.size());
 
 
-		std::vector<std::future<Ellipse2d<t_real_reso>>> tasks_ell_proj, tasks_ell_slice;
+		std::vector<std::array<int, 5>> vecParams(8);
 
 		for(unsigned int iEll=0; iEll<4; ++iEll)
 		{
@@ -219,19 +220,8 @@ void EllipseDlg::Calc()
 			const int *iP = iParams[0][iEll];
 			const int *iS = iParams[1][iEll];
 
-			std::future<Ellipse2d<t_real_reso>> ell_proj =
-				std::async(std::launch::deferred|std::launch::async,
-				[=, &reso, &Q_avg]()
-				{ return ::calc_res_ellipse<t_real_reso>(
-					reso, reso_v, reso_s, Q_avg, iP[0], iP[1], iP[2], iP[3], iP[4]); });
-			std::future<Ellipse2d<t_real_reso>> ell_slice =
-				std::async(std::launch::deferred|std::launch::async,
-				[=, &reso, &Q_avg]()
-				{ return ::calc_res_ellipse<t_real_reso>(
-					reso, reso_v, reso_s, Q_avg, iS[0], iS[1], iS[2], iS[3], iS[4]); });
-
-			tasks_ell_proj.push_back(std::move(ell_proj));
-			tasks_ell_slice.push_back(std::move(ell_slice));
+			std::copy(iP, iP+5, vecParams[iEll].begin());
+			std::copy(iS, iS+5, vecParams[iEll+4].begin());
 
 
 			// MC neutrons
@@ -260,10 +250,14 @@ void EllipseDlg::Calc()
 			}
 		}
 
+		// all projections and slices from one decomposition of the resolution matrix
+		const ResoProjections<t_real_reso> proj =
+			::calc_res_projections<t_real_reso>(reso, reso_v, reso_s, Q_avg, vecParams);
+
 		for(unsigned int iEll=0; iEll<4; ++iEll)
 		{
-			m_elliProj[iEll] = tasks_ell_proj[iEll].get();
-			m_elliSlice[iEll] = tasks_ell_slice[iEll].get();
+			m_elliProj[iEll] = proj.ell2d[iEll];
+			m_elliSlice[iEll] = proj.ell2d[iEll+4];
 
 			/*m_elliProj[iEll] = ::calc_res_ellipse(res.reso, Q_avg, iParams[0][iEll][0], iParams[0][iEll][1],
 				iParams[0][iEll][2], iParams[0][iEll][3], iParams[0][iEll][4]);
@@ -7,6 +7,7 @@
 
 #include "EllipseDlg3D.h"
 #include <QGridLayout>
+#include <array>
 
 
 EllipseDlg3D::EllipseDlg3D(QWidget* pParent, QSettings* pSett)
@@ -174,12 +175,20 @@ void EllipseDlg3D::Calc()
 	if(bCenterOn0)
 		Q_avg = ublas::zero_vector<t_real_reso>(Q_avg.size());
 
+	// all projections and slices from one decomposition of the resolution matrix
+	std::vector<std::array<int, 5>> vecParams;
 	for(std::size_t i=0; i<m_pPlots.size(); ++i)
 	{
-		m_elliProj[i] = ::calc_res_ellipsoid(
-			reso, reso_v, reso_s, Q_avg, iX[i], iY[i], iZ[i], iIntOrRem[i], -1);
-		m_elliSlice[i] = ::calc_res_ellipsoid(
-			reso, reso_v, reso_s, Q_avg, iX[i], iY[i], iZ[i], -1, iIntOrRem[i]);
+		vecParams.push_back({{ iX[i], iY[i], iZ[i], iIntOrRem[i], -1 }});
+		vecParams.push_back({{ iX[i], iY[i], iZ[i], -1, iIntOrRem[i] }});
+	}
+	const ResoProjections<t_real_reso> proj = ::calc_res_projections<t_real_reso>(
+		reso, reso_v, reso_s, Q_avg, {}, vecParams);
+
+	for(std::size_t i=0; i<m_pPlots.size(); ++i)
+	{
+		m_elliProj[i] = proj.ell3d[i*2 + 0];
+		m_elliSlice[i] = proj.ell3d[i*2 + 1];
 
 		ublas::vector<t_real_reso> vecWProj(3), vecWSlice(3);
 		ublas::vector<t_real_reso> vecOffsProj(3), vecOffsSlice(3);
@@ -14,6 +14,8 @@
 #include "libs/globals.h"
 #include "libs/globals_qt.h"
 #include "libs/qthelper.h"
+#include "libs/workers.h"
+#include "tools/monteconvo/sqwfactory.h"
 
 #include <QFileDialog>
 #include <QFontDialog>
@@ -119,6 +121,7 @@ SettingsDlg::SettingsDlg(QWidget* pParent, QSettings* pSett)
 		t_tupCheck("main/native_dialogs", 0, checkNativeDlg),
 		t_tupCheck("net/flip_orient2", 1, checkFlipOrient2),
 		t_tupCheck("net/sth_stt_corr", 0, checkSthSttCorr),
+		t_tupCheck("main/pin_threads", 0, checkPinThreads),
 	};
 
 	m_vecSpins =
@@ -130,6 +133,8 @@ SettingsDlg::SettingsDlg(QWidget* pParent, QSettings* pSett)
 		t_tupSpin("main/max_peaks", 10, spinBragg),
 		t_tupSpin("gl/font_size", 24, spinGLFont),
 		t_tupSpin("net/poll", 750, spinNetPoll),
+		t_tupSpin("main/max_threads", 0, spinMaxThreads),
+		t_tupSpin("main/sqw_procs", 1, spinSqwProcs),
 	};
 
 	m_vecCombos =
@@ -303,6 +308,13 @@ void SettingsDlg::SetGlobals() const
 	GFX_NUM_POINTS = spinPtsGfx->value();
 	g_iMaxNN = spinMaxNN->value();
 
+	// thread budget and pinning of the worker pool, only used before the pool is started
+	set_max_threads(spinMaxThreads->value());
+	set_pin_threads(checkPinThreads->isChecked());
+
+	// child processes of the out-of-process S(q,w) models
+	set_sqw_procs(spinSqwProcs->value());
+
 
 	g_bShowFsq = (comboSFact->currentIndex() == 1);
 	g_b3dBZ = (comboBZ->currentIndex() == 0);
@@ -0,0 +1,382 @@
+/**
+ * process-wide work-stealing worker pool
+ * @author agent <agent@local>
+ * @date oct-2026
+ * @license GPLv2
+ */
+
+#ifndef __TAKIN_WORKERS_H__
+#define __TAKIN_WORKERS_H__
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+#if defined(__linux__)
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
+#include "tlibs/math/rand.h"
+#include "tlibs/log/log.h"
+
+
+/**
+ * pool of persistent worker threads, each with its own task deque;
+ * idle workers steal tasks from the others.
+ *
+ * top-level jobs are added with Submit(), loops running inside a worker
+ * (e.g. mc neutron generation) use ParallelFor(), which never blocks on
+ * queued tasks and thus never needs additional threads.
+ *
+ * optionally, the workers are pinned to the cores, so they don't move between
+ * numa nodes and the buffers they touch first (e.g. neutron banks) stay local.
+ */
+class WorkerPool
+{
+public:
+	using t_task = std::function<void()>;
+
+protected:
+	struct TaskQueue
+	{
+		std::mutex mtx;
+		std::deque<t_task> tasks;
+	};
+
+	std::vector<std::unique_ptr<TaskQueue>> m_vecQueues;
+	std::vector<std::thread> m_vecThreads;
+
+	std::mutex m_mtxWake;
+	std::condition_variable m_cvWake;
+	std::atomic<bool> m_bStop;
+	std::atomic<std::size_t> m_iPending;
+	std::atomic<std::size_t> m_iNextQueue;
+
+	// cores the workers are pinned to, empty: no pinning
+	std::vector<int> m_vecCores;
+
+protected:
+	// pool and queue index of the calling thread
+	static WorkerPool*& cur_pool() { thread_local WorkerPool* pPool = nullptr; return pPool; }
+	static std::size_t& cur_queue() { thread_local std::size_t iQueue = 0; return iQueue; }
+
+	void Push(t_task&& task)
+	{
+		std::size_t iQueue = IsWorkerThread()
+			? cur_queue() : (m_iNextQueue++ % m_vecQueues.size());
+
+		// count the task before it becomes visible, so that a worker
+		// popping it right away cannot decrement the counter below zero
+		{
+			std::lock_guard<std::mutex> lock(m_mtxWake);
+			++m_iPending;
+		}
+
+		{
+			TaskQueue& queue = *m_vecQueues[iQueue];
+			std::lock_guard<std::mutex> lock(queue.mtx);
+			queue.tasks.emplace_back(std::move(task));
+		}
+		m_cvWake.notify_one();
+	}
+
+	/**
+	 * get a task from the own queue (newest first) or steal one from another (oldest first)
+	 */
+	bool Pop(std::size_t iOwnQueue, t_task& task)
+	{
+		const std::size_t iNumQueues = m_vecQueues.size();
+
+		for(std::size_t iOffs=0; iOffs<iNumQueues; ++iOffs)
+		{
+			TaskQueue& queue = *m_vecQueues[(iOwnQueue + iOffs) % iNumQueues];
+			std::lock_guard<std::mutex> lock(queue.mtx);
+			if(queue.tasks.empty())
+				continue;
+
+			if(iOffs == 0)
+			{
+				task = std::move(queue.tasks.back());
+				queue.tasks.pop_back();
+			}
+			else
+			{
+				task = std::move(queue.tasks.front());
+				queue.tasks.pop_front();
+			}
+
+			--m_iPending;
+			return true;
+		}
+
+		return false;
+	}
+
+	/**
+	 * cores available to the process, in the order of their indices
+	 */
+	static std::vector<int> GetCores()
+	{
+		std::vector<int> vecCores;
+#if defined(__linux__)
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		if(sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+		{
+			for(int iCore=0; iCore<CPU_SETSIZE; ++iCore)
+				if(CPU_ISSET(iCore, &cpus))
+					vecCores.push_back(iCore);
+		}
+#endif
+		return vecCores;
+	}
+
+	/**
+	 * pins the calling thread to a core
+	 */
+	static bool PinThread(int iCore)
+	{
+#if defined(__linux__)
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(iCore, &cpus);
+		return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+		(void)iCore;
+		return false;
+#endif
+	}
+
+	void WorkerLoop(std::size_t iQueue)
+	{
+		cur_pool() = this;
+		cur_queue() = iQueue;
+		if(m_vecCores.size())
+		{
+			int iCore = m_vecCores[iQueue % m_vecCores.size()];
+			if(!PinThread(iCore))
+				tl::log_warn("Could not pin worker thread ", iQueue, " to core ", iCore, ".");
+		}
+		tl::init_rand();
+
+		while(1)
+		{
+			t_task task;
+			if(Pop(iQueue, task))
+			{
+				task();
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(m_mtxWake);
+			m_cvWake.wait(lock, [this]() -> bool
+				{ return m_bStop.load() || m_iPending.load() > 0; });
+			if(m_bStop.load() && m_iPending.load() == 0)
+				break;
+		}
+
+		cur_pool() = nullptr;
+	}
+
+public:
+	WorkerPool(unsigned int iNumThreads, bool bPin = false)
+		: m_bStop(false), m_iPending(0), m_iNextQueue(0)
+	{
+		if(iNumThreads == 0)
+			iNumThreads = 1;
+
+		if(bPin)
+		{
+			m_vecCores = GetCores();
+			if(m_vecCores.empty())
+				tl::log_warn("Pinning worker threads is not supported on this system.");
+		}
+
+		for(unsigned int iThread=0; iThread<iNumThreads; ++iThread)
+			m_vecQueues.emplace_back(new TaskQueue());
+		for(unsigned int iThread=0; iThread<iNumThreads; ++iThread)
+			m_vecThreads.emplace_back(&WorkerPool::WorkerLoop, this, iThread);
+	}
+
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mtxWake);
+			m_bStop.store(true);
+		}
+		m_cvWake.notify_all();
+
+		for(std::thread& th : m_vecThreads)
+			th.join();
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	const WorkerPool& operator=(const WorkerPool&) = delete;
+
+	std::size_t GetNumThreads() const { return m_vecThreads.size(); }
+	bool IsPinned() const { return m_vecCores.size() != 0; }
+	bool IsWorkerThread() const { return cur_pool() == this; }
+
+	/**
+	 * add a top-level task, the result can be fetched from the returned future
+	 * (don't block on the future from within a worker, use ParallelFor there)
+	 */
+	template<class t_func>
+	std::future<typename std::result_of<t_func()>::type> Submit(t_func&& func)
+	{
+		using t_ret = typename std::result_of<t_func()>::type;
+
+		auto pTask = std::make_shared<std::packaged_task<t_ret()>>(std::forward<t_func>(func));
+		std::future<t_ret> fut = pTask->get_future();
+		Push([pTask]() { (*pTask)(); });
+
+		return fut;
+	}
+
+	/**
+	 * calls func(iBegin, iEnd) on iNumChunks sub-ranges of [0, iNum) in parallel.
+	 * the calling thread processes chunks itself until none are left,
+	 * the workers only help out if they are idle.
+	 */
+	template<class t_func>
+	void ParallelFor(std::size_t iNum, std::size_t iNumChunks, t_func&& func)
+	{
+		if(iNum == 0) return;
+		if(iNumChunks == 0) iNumChunks = GetNumThreads();
+		if(iNumChunks > iNum) iNumChunks = iNum;
+
+		struct LoopState
+		{
+			std::atomic<std::size_t> iNextChunk{0};
+			std::size_t iDone = 0;
+			std::mutex mtx;
+			std::condition_variable cv;
+		};
+		auto pState = std::make_shared<LoopState>();
+		t_func* pFunc = &func;
+
+		const std::size_t iNumPerChunk = iNum / iNumChunks;
+		const std::size_t iRemaining = iNum % iNumChunks;
+
+		// process chunks until none are left
+		auto fktRun = [pState, pFunc, iNumChunks, iNumPerChunk, iRemaining]() -> void
+		{
+			while(1)
+			{
+				std::size_t iChunk = pState->iNextChunk++;
+				if(iChunk >= iNumChunks)
+					break;
+
+				std::size_t iBegin = iNumPerChunk*iChunk;
+				std::size_t iEnd = iBegin + iNumPerChunk;
+				if(iChunk == iNumChunks-1)
+					iEnd += iRemaining;
+
+				(*pFunc)(iBegin, iEnd);
+
+				std::lock_guard<std::mutex> lock(pState->mtx);
+				if(++pState->iDone == iNumChunks)
+					pState->cv.notify_all();
+			}
+		};
+
+		for(std::size_t iHelper=1; iHelper<std::min(iNumChunks, GetNumThreads()); ++iHelper)
+			Push(fktRun);
+		fktRun();
+
+		// wait for the chunks still being processed by other workers
+		std::unique_lock<std::mutex> lock(pState->mtx);
+		pState->cv.wait(lock, [&pState, iNumChunks]() -> bool
+			{ return pState->iDone == iNumChunks; });
+	}
+};
+
+
+// ----------------------------------------------------------------------------
+// global worker pool, thread budget and pinning
+// (inline, not static, so that all translation units share the same pool)
+
+inline unsigned int& _max_threads()
+{
+	static unsigned int iMaxThreads = 0;
+	return iMaxThreads;
+}
+
+inline bool& _pin_threads()
+{
+	static bool bPin = false;
+	return bPin;
+}
+
+inline std::unique_ptr<WorkerPool>& _worker_pool()
+{
+	static std::unique_ptr<WorkerPool> pPool;
+	return pPool;
+}
+
+inline std::mutex& _worker_pool_mutex()
+{
+	static std::mutex mtx;
+	return mtx;
+}
+
+/**
+ * number of threads used by the global worker pool, 0: use all cores
+ */
+inline unsigned int get_max_threads()
+{
+	unsigned int iMaxThreads = _max_threads();
+	if(iMaxThreads == 0)
+		iMaxThreads = std::thread::hardware_concurrency();
+	if(iMaxThreads == 0)
+		iMaxThreads = 1;
+	return iMaxThreads;
+}
+
+/**
+ * set the thread budget; only has an effect before the pool is first used
+ */
+inline void set_max_threads(unsigned int iMaxThreads)
+{
+	std::lock_guard<std::mutex> lock(_worker_pool_mutex());
+	if(_worker_pool() && iMaxThreads != _max_threads())
+		tl::log_warn("Worker pool is already running, thread budget will not change.");
+	else
+		_max_threads() = iMaxThreads;
+}
+
+/**
+ * pin the workers to the cores; only has an effect before the pool is first used
+ */
+inline void set_pin_threads(bool bPin)
+{
+	std::lock_guard<std::mutex> lock(_worker_pool_mutex());
+	if(_worker_pool() && bPin != _pin_threads())
+		tl::log_warn("Worker pool is already running, thread pinning will not change.");
+	else
+		_pin_threads() = bPin;
+}
+
+inline bool get_pin_threads()
+{
+	return _pin_threads();
+}
+
+inline WorkerPool& get_worker_pool()
+{
+	std::lock_guard<std::mutex> lock(_worker_pool_mutex());
+	if(!_worker_pool())
+		_worker_pool().reset(new WorkerPool(get_max_threads(), _pin_threads()));
+	return *_worker_pool();
+}
+// ----------------------------------------------------------------------------
+
+#endif
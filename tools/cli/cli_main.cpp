@@ -11,7 +11,8 @@
 #include "tools/monteconvo/TASReso.h"
 
 #include <map>
-#include <future>
+#include <array>
+#include <algorithm>
 
 namespace ublas = boost::numeric::ublas;
 
@@ -201,38 +202,21 @@ void calc(const std::vector<std::string>& vecArgs)
 		<< res.dBraggFWHMs[3] << "\n";
 
 
-	std::vector<std::future<Ellipse2d<t_real>>> tasks_ell_proj, tasks_ell_slice;
-
+	// all projections and slices from one decomposition of the resolution matrix
+	std::vector<std::array<int, 5>> vecParams(8);
 	for(unsigned int iEll=0; iEll<4; ++iEll)
 	{
-		const int *iP = iParams[0][iEll];
-		const int *iS = iParams[1][iEll];
-
-		const t_vec& Q_avg = res.Q_avg;
-		const t_mat& reso = res.reso;
-		const t_vec& reso_v = res.reso_v;
-		const t_real& reso_s = res.reso_s;
-
-		std::future<Ellipse2d<t_real>> ell_proj =
-			std::async(std::launch::deferred|std::launch::async,
-			[=, &reso, &Q_avg]()
-			{ return ::calc_res_ellipse<t_real>(
-				reso, reso_v, reso_s,
-				Q_avg, iP[0], iP[1], iP[2], iP[3], iP[4]); });
-		std::future<Ellipse2d<t_real>> ell_slice =
-			std::async(std::launch::deferred|std::launch::async,
-			[=, &reso, &Q_avg]()
-			{ return ::calc_res_ellipse<t_real>(
-				reso, reso_v, reso_s,
-				Q_avg, iS[0], iS[1], iS[2], iS[3], iS[4]); });
-
-		tasks_ell_proj.push_back(std::move(ell_proj));
-		tasks_ell_slice.push_back(std::move(ell_slice));
+		std::copy(iParams[0][iEll], iParams[0][iEll]+5, vecParams[iEll].begin());
+		std::copy(iParams[1][iEll], iParams[1][iEll]+5, vecParams[iEll+4].begin());
 	}
+
+	const ResoProjections<t_real> proj = ::calc_res_projections<t_real>(
+		res.reso, res.reso_v, res.reso_s, res.Q_avg, vecParams);
+
 	for(unsigned int iEll=0; iEll<4; ++iEll)
 	{
-		Ellipse2d<t_real> elliProj = tasks_ell_proj[iEll].get();
-		Ellipse2d<t_real> elliSlice = tasks_ell_slice[iEll].get();
+		const Ellipse2d<t_real>& elliProj = proj.ell2d[iEll];
+		const Ellipse2d<t_real>& elliSlice = proj.ell2d[iEll+4];
 		const std::string& strLabX = ::ellipse_labels(iParams[0][iEll][0], EllipseCoordSys::Q_AVG);
 		const std::string& strLabY = ::ellipse_labels(iParams[0][iEll][1], EllipseCoordSys::Q_AVG);
 
@@ -14,6 +14,7 @@
 #include <iostream>
 #include <fstream>
 #include <locale>
+#include <mutex>
 
 #include "convofit.h"
 #include "convofit_import.h"
@@ -222,19 +223,59 @@ bool Convofit::run_job(const std::string& _strJob)
 	unsigned iNumNeutrons = prop.Query<unsigned>("montecarlo/neutrons", 1000);
 	unsigned iNumSample = prop.Query<unsigned>("montecarlo/sample_positions", 1);
 	bool bRecycleMC = prop.Query<bool>("montecarlo/recycle_neutrons", 1);
+	bool bFreezeMC = prop.Query<bool>("montecarlo/freeze_neutrons", 0);
+	// memory budget for the frozen neutrons in MiB, the least recently used banks are dropped
+	std::size_t iFreezeMem = prop.Query<std::size_t>("montecarlo/freeze_neutrons_mem", 1024);
+	// adaptive neutron count, 0: off
+	t_real dMCTargetErr = prop.Query<t_real>("montecarlo/target_error", 0.);
+	unsigned iMaxNeutrons = prop.Query<unsigned>("montecarlo/max_neutrons", 0);
+	std::string strSampler = prop.Query<std::string>("montecarlo/sampler", "pseudo");
+	// "mc", "cubature" or "analytic"
+	std::string strConvoMethod = prop.Query<std::string>("montecarlo/method", "mc");
+	std::string strCubOrder = prop.Query<std::string>("montecarlo/cubature_order", "5");
+	// analytic method: maximum curvature of the branches relative to the line width, else mc
+	t_real dAnalyticMaxCurv = prop.Query<t_real>("montecarlo/analytic_max_curvature", 0.1);
+	// importance sampling towards the dispersion branches of the model
+	bool bImportance = prop.Query<bool>("montecarlo/importance", 0);
+	t_real dImportanceMix = prop.Query<t_real>("montecarlo/importance_mix", 0.5);
+	t_real dImportanceWidth = prop.Query<t_real>("montecarlo/importance_width", 0.25);
+	// seed of the counter-based random numbers, 0: off
+	std::uint64_t iRngSeed = prop.Query<std::uint64_t>("montecarlo/seed", 0);
+	// generate and evaluate the neutrons in single precision
+	bool bSinglePrec = prop.Query<bool>("montecarlo/single_precision", 0);
+	// map one unit-sphere neutron bank onto all resolution ellipsoids
+	bool bUnitBank = prop.Query<bool>("montecarlo/unit_bank", 0);
 
 	if(g_iNumNeutrons > 0)
 		iNumNeutrons = g_iNumNeutrons;
 
+	// the frozen neutrons are drawn once with a fixed count directly on the ellipsoids
+	if(bFreezeMC && strConvoMethod == "mc")
+	{
+		const char* pcOpt = nullptr;
+		if(bImportance) pcOpt = "importance";
+		else if(dMCTargetErr > 0.) pcOpt = "target_error";
+		else if(bSinglePrec) pcOpt = "single_precision";
+		else if(bUnitBank) pcOpt = "unit_bank";
+
+		if(pcOpt)
+		{
+			tl::log_err("Option \"montecarlo/", pcOpt, "\" cannot be combined with \"montecarlo/freeze_neutrons\".");
+			return 0;
+		}
+	}
+
 	std::string strResAlgo = prop.Query<std::string>("resolution/algorithm", "pop");
 	bool bResFocMonoV = prop.Query<bool>("resolution/focus_mono_v", 0);
 	bool bResFocMonoH = prop.Query<bool>("resolution/focus_mono_h", 0);
 	bool bResFocAnaV = prop.Query<bool>("resolution/focus_ana_v", 0);
 	bool bResFocAnaH = prop.Query<bool>("resolution/focus_ana_h", 0);
+	bool bResCache = prop.Query<bool>("resolution/cache", 1);
 
 	std::string strMinimiser = prop.Query<std::string>("fitter/minimiser");
 	int iStrat = prop.Query<int>("fitter/strategy", 0);
 	t_real dSigma = prop.Query<t_real>("fitter/sigma", 1.);
+	bool bUseModelErr = prop.Query<bool>("fitter/use_model_errors", 0);
 
 	bool bDoFit = prop.Query<bool>("fitter/do_fit", 1);
 	if(g_bSkipFit) bDoFit = 0;
@@ -435,6 +476,38 @@ bool Convofit::run_job(const std::string& _strJob)
 			return 0;
 		}
 
+		if(strSampler == "pseudo")
+			reso.SetSampler(McSampler::PSEUDO);
+		else if(strSampler == "sobol")
+			reso.SetSampler(McSampler::SOBOL);
+		else if(strSampler == "stratified")
+			reso.SetSampler(McSampler::STRATIFIED);
+		else
+		{
+			tl::log_err("Invalid mc sampler selected: \"", strSampler, "\".");
+			return 0;
+		}
+
+		if(strConvoMethod == "mc")
+			reso.SetConvoMethod(ConvoMethod::MC);
+		else if(strConvoMethod == "cubature")
+			reso.SetConvoMethod(ConvoMethod::CUBATURE);
+		else if(strConvoMethod == "analytic")
+			reso.SetConvoMethod(ConvoMethod::ANALYTIC);
+		else
+		{
+			tl::log_err("Invalid convolution method selected: \"", strConvoMethod, "\".");
+			return 0;
+		}
+
+		std::vector<unsigned> vecCubOrder;
+		tl::get_tokens<unsigned, std::string>(strCubOrder, " \t\n,;", vecCubOrder);
+		reso.SetCubatureOrder(vecCubOrder);
+		reso.SetAnalyticMaxCurvature(dAnalyticMaxCurv);
+		reso.SetRngSeed(iRngSeed);
+		reso.SetSinglePrecision(bSinglePrec);
+		reso.SetUnitBank(bUnitBank);
+
 		if(bResFocMonoV || bResFocMonoH || bResFocAnaV || bResFocAnaH)
 		{
 			unsigned iFoc = 0;
@@ -447,6 +520,8 @@ bool Convofit::run_job(const std::string& _strJob)
 		}
 
 		reso.SetRandomSamplePos(iNumSample);
+		reso.SetAdaptiveMC(dMCTargetErr, iMaxNeutrons);
+		reso.SetImportanceSampling(bImportance, dImportanceMix, dImportanceWidth);
 		vecResos.emplace_back(std::move(reso));
 	}
 
@@ -476,14 +551,17 @@ bool Convofit::run_job(const std::string& _strJob)
 
 
 	std::vector<t_real> vecModTmpX, vecModTmpY;
+	// the scan points can be evaluated in parallel, see Chi2FunctionMC
+	std::mutex mtxModTmp;
 	// slots
 	mod.AddFuncResultSlot(
-	[this, &pltMeas, &vecModTmpX, &vecModTmpY, bPlotIntermediate](t_real h, t_real k, t_real l, t_real E, t_real S)
+	[this, &pltMeas, &vecModTmpX, &vecModTmpY, &mtxModTmp, bPlotIntermediate](t_real h, t_real k, t_real l, t_real E, t_real S)
 	{
 		tl::log_info("Q = (", h, ", ", k, ", ", l, ") rlu, E = ", E, " meV -> S = ", S);
 
 		if(bPlotIntermediate)
 		{
+			std::lock_guard<std::mutex> lock(mtxModTmp);
 			vecModTmpX.push_back(E);	// TODO: use scan direction
 			vecModTmpY.push_back(S);
 
@@ -497,7 +575,7 @@ bool Convofit::run_job(const std::string& _strJob)
 		}
 	});
 	mod.AddParamsChangedSlot(
-	[&vecModTmpX, &vecModTmpY, bPlotIntermediate, iSeed, bRecycleMC](const std::string& strDescr)
+	[&vecModTmpX, &vecModTmpY, bPlotIntermediate, iSeed, iRngSeed, bRecycleMC, bFreezeMC](const std::string& strDescr)
 	{
 		tl::log_info("Changed model parameters: ", strDescr);
 
@@ -508,7 +586,8 @@ bool Convofit::run_job(const std::string& _strJob)
 		}
 
 		// do we use the same MC neutrons again?
-		if(bRecycleMC)
+		// (counter-based random numbers are the same for each scan point anyway)
+		if(bRecycleMC && !bFreezeMC && !iRngSeed)
 		{
 			tl::init_rand_seed(iSeed);
 			tl::log_debug("Resetting random seed to ", iSeed, ".");
@@ -522,8 +601,15 @@ bool Convofit::run_job(const std::string& _strJob)
 
 	tl::log_info("Number of neutrons: ", iNumNeutrons, ".");
 	mod.SetNumNeutrons(iNumNeutrons);
-	// execution has to be in a determined order to recycle the same neutrons
-	mod.SetUseThreads(!bRecycleMC);
+	// execution has to be in a determined order to recycle the same neutrons,
+	// frozen neutrons are kept per scan point and don't depend on the order
+	// the cubature and counter-based random numbers are deterministic and can always run in parallel
+	const bool bCubature = (strConvoMethod == "cubature");
+	mod.SetFreezeNeutrons(bFreezeMC && !bCubature, iFreezeMem << 20);
+	mod.SetUseThreads(bFreezeMC || !bRecycleMC || bCubature || iRngSeed);
+	// re-use the resolution ellipsoids at each scan point for all fit iterations
+	// (this also fixes the random sample positions)
+	mod.SetUseResoCache(bResCache);
 
 	if(bTempOverride)
 	{
@@ -549,6 +635,21 @@ bool Convofit::run_job(const std::string& _strJob)
 	tl::log_info("Model temperature variable: \"", strTempVar, "\", value: ", vecSc[0].dTemp);
 	tl::log_info("Model field variable: \"", strFieldVar, "\", value: ", vecSc[0].dField);
 
+	// calculate the resolution at all points of all scans in one go,
+	// the fit iterations then find them in the resolution cache
+	if(bResCache)
+	{
+		for(std::size_t iSet=0; iSet<mod.GetParamSetCount(); ++iSet)
+		{
+			mod.SetParamSet(iSet);
+			if(mod.GetExpLen())
+				mod.PrecalcScan(mod.GetExpX(), mod.GetExpLen());
+			else
+				mod.PrecalcScan(vecSc[0].vecX.data(), vecSc[0].vecX.size());
+		}
+		mod.SetParamSet(0);
+	}
+
 
 	// set given individual model parameters
 	if(strSetParams != "")
@@ -596,6 +697,15 @@ bool Convofit::run_job(const std::string& _strJob)
 	chi2fkt.SetDebug(1);
 	chi2fkt.SetSigma(dSigma);
 
+	// optionally also weight with the statistical errors of the convolution
+	Chi2FunctionMC chi2fktMC(&mod, vecSc[0].vecX.size(), vecSc[0].vecX.data(), vecSc[0].vecCts.data(), vecSc[0].vecCtsErr.data());
+	chi2fktMC.SetDebug(1);
+	chi2fktMC.SetSigma(dSigma);
+
+	const minuit::FCNBase& chi2 = bUseModelErr
+		? static_cast<const minuit::FCNBase&>(chi2fktMC)
+		: static_cast<const minuit::FCNBase&>(chi2fkt);
+
 
 	minuit::MnUserParameters params = mod.GetMinuitParams();
 	for(std::size_t iParam=0; iParam<vecFitParams.size(); ++iParam)
@@ -622,9 +732,9 @@ bool Convofit::run_job(const std::string& _strJob)
 
 	std::unique_ptr<minuit::MnApplication> pmini;
 	if(strMinimiser == "simplex")
-		pmini.reset(new minuit::MnSimplex(chi2fkt, params, strat));
+		pmini.reset(new minuit::MnSimplex(chi2, params, strat));
 	else if(strMinimiser == "migrad")
-		pmini.reset(new minuit::MnMigrad(chi2fkt, params, strat));
+		pmini.reset(new minuit::MnMigrad(chi2, params, strat));
 	else
 	{
 		tl::log_err("Invalid minimiser selected: \"", strMinimiser, "\".");
@@ -69,6 +69,32 @@ std::string convert_monteconvo(
 		propMC.Query<std::string>("taz/monteconvo/sample_step_count", "1");
 	mapJob["montecarlo/recycle_neutrons"] =
 		propMC.Query<std::string>("taz/convofit/recycle_neutrons", "1");
+	switch(propMC.Query<int>("taz/monteconvo/sampler", 0))
+	{
+		case 1: mapJob["montecarlo/sampler"] = "sobol"; break;
+		case 2: mapJob["montecarlo/sampler"] = "stratified"; break;
+		default: mapJob["montecarlo/sampler"] = "pseudo"; break;
+	}
+	mapJob["montecarlo/importance"] =
+		propMC.Query<std::string>("taz/monteconvo/importance", "0");
+	switch(propMC.Query<int>("taz/monteconvo/method", 0))
+	{
+		case 1: mapJob["montecarlo/method"] = "cubature"; break;
+		case 2: mapJob["montecarlo/method"] = "analytic"; break;
+		default: mapJob["montecarlo/method"] = "mc"; break;
+	}
+	mapJob["montecarlo/cubature_order"] =
+		propMC.Query<std::string>("taz/monteconvo/cubature_order", "5");
+	mapJob["montecarlo/seed"] =
+		propMC.Query<std::string>("taz/monteconvo/seed", "0");
+	mapJob["montecarlo/single_precision"] =
+		propMC.Query<std::string>("taz/monteconvo/single_precision", "0");
+	mapJob["montecarlo/unit_bank"] =
+		propMC.Query<std::string>("taz/monteconvo/unit_bank", "0");
+	mapJob["montecarlo/target_error"] = tl::var_to_str(
+		propMC.Query<double>("taz/monteconvo/target_error", 0.) / 100.);
+	mapJob["montecarlo/max_neutrons"] =
+		propMC.Query<std::string>("taz/monteconvo/max_neutrons", "0");
 
 
 	// fitting
@@ -13,7 +13,8 @@
 #include "convofit.h"
 #include "libs/version.h"
 #include "tlibs/time/stopwatch.h"
-#include "tlibs/helper/thread.h"
+#include "libs/workers.h"
+#include "../monteconvo/sqwfactory.h"
 
 namespace asio = boost::asio;
 namespace sys = boost::system;
@@ -80,6 +81,9 @@ int main(int argc, char** argv)
 		// --------------------------------------------------------------------
 		// get job files and program options
 		std::vector<std::string> vecJobs;
+		unsigned int iMaxThreads = 0;
+		bool bPinThreads = 0;
+		unsigned int iSqwProcs = 1;
 
 		// normal args
 		opts::options_description args("convofit options (overriding job file settings)");
@@ -103,6 +107,18 @@ int main(int argc, char** argv)
 			new opts::option_description("model-params",
 			opts::value<decltype(g_strSetParams)>(&g_strSetParams),
 			"set S(q,w) model parameters")));
+		args.add(boost::shared_ptr<opts::option_description>(
+			new opts::option_description("max-threads",
+			opts::value<decltype(iMaxThreads)>(&iMaxThreads),
+			"maximum number of worker threads (0: all cores)")));
+		args.add(boost::shared_ptr<opts::option_description>(
+			new opts::option_description("pin-threads",
+			opts::bool_switch(&bPinThreads),
+			"pin the worker threads to the cores (numa-local neutron banks)")));
+		args.add(boost::shared_ptr<opts::option_description>(
+			new opts::option_description("sqw-procs",
+			opts::value<decltype(iSqwProcs)>(&iSqwProcs),
+			"number of child processes for python and julia S(q,w) models (0: one per worker thread)")));
 		args.add(boost::shared_ptr<opts::option_description>(
 			new opts::option_description("outfile-suffix",
 			opts::value<decltype(g_strOutFileSuffix)>(&g_strOutFileSuffix),
@@ -148,27 +164,31 @@ int main(int argc, char** argv)
 		// --------------------------------------------------------------------
 
 
-		unsigned int iNumThreads = std::thread::hardware_concurrency();
-		tl::ThreadPool<bool()> tp(iNumThreads);
+		// jobs and their mc neutron generation share the same worker pool
+		set_max_threads(iMaxThreads);
+		set_pin_threads(bPinThreads);
+		set_sqw_procs(iSqwProcs);
+		WorkerPool& workers = get_worker_pool();
+		tl::log_debug("Using ", workers.GetNumThreads(), " worker threads",
+			workers.IsPinned() ? " pinned to the cores." : ".");
 
+		tl::Stopwatch<t_real> watch;
+		watch.start();
+
+		std::vector<std::future<bool>> lstFut;
 		for(std::size_t iJob=0; iJob<vecJobs.size(); ++iJob)
 		{
 			const std::string& strJob = vecJobs[iJob];
-			tp.AddTask([iJob, strJob]() -> bool
+			lstFut.emplace_back(workers.Submit([iJob, strJob]() -> bool
 			{
 				tl::log_info("Executing job file ", iJob+1, ": \"", strJob, "\".");
 
 				Convofit convo;
 				return convo.run_job(strJob);
 				//if(argc > 2) tl::log_info("================================================================================");
-			});
+			}));
 		}
 
-		tl::Stopwatch<t_real> watch;
-		watch.start();
-		tp.StartTasks();
-
-		auto& lstFut = tp.GetFutures();
 		std::size_t iTask = 0;
 		for(auto& fut : lstFut)
 		{
@@ -6,6 +6,9 @@
  */
 
 #include <fstream>
+#include <mutex>
+#include <limits>
+#include <array>
 
 #include "model.h"
 #include "tlibs/math/math.h"
@@ -13,6 +16,7 @@
 #include "tlibs/log/log.h"
 #include "tlibs/string/string.h"
 #include "tlibs/helper/array.h"
+#include "libs/workers.h"
 #include "../res/defs.h"
 #include "../res/helper.h"
 #include "convofit.h"
@@ -22,36 +26,83 @@ using t_real = t_real_mod;
 
 
 SqwFuncModel::SqwFuncModel(std::shared_ptr<SqwBase> pSqw, const TASReso& reso)
-	: m_pSqw(pSqw)/*, m_reso(reso)*/, m_vecResos({reso})
+	: m_pSqw(pSqw)/*, m_reso(reso)*/, m_vecResos({reso}),
+		m_pResoCache(std::make_shared<ResoCache>())
 {}
 
 SqwFuncModel::SqwFuncModel(std::shared_ptr<SqwBase> pSqw, const std::vector<TASReso>& vecResos)
-	: m_pSqw(pSqw), m_vecResos(vecResos)
+	: m_pSqw(pSqw), m_vecResos(vecResos),
+		m_pResoCache(std::make_shared<ResoCache>())
 {}
 
+void SqwFuncModel::SetUseResoCache(bool b)
+{
+	if(b && !m_pResoCache)
+		m_pResoCache = std::make_shared<ResoCache>();
+	else if(!b)
+		m_pResoCache.reset();
+}
 
-TASReso* SqwFuncModel::GetTASReso()
+/**
+ * generate the neutrons at each scan position only once,
+ * the least recently used banks are dropped if they exceed iMaxBytes
+ */
+void SqwFuncModel::SetFreezeNeutrons(bool b, std::size_t iMaxBytes)
 {
-	//TASReso reso = m_reso;
-	TASReso *pReso = nullptr;
-	// multi-fits
-	if(m_pScans && m_vecResos.size() > 1)
-		pReso = &m_vecResos[m_iCurParamSet];
+	if(b && !m_pBankCache)
+		m_pBankCache = std::make_shared<NeutronBankCache>(iMaxBytes);
+	else if(b)
+		m_pBankCache->SetMaxCost(iMaxBytes);
 	else
-		pReso = &m_vecResos[0];
-	return pReso;
+		m_pBankCache.reset();
 }
 
-const TASReso* SqwFuncModel::GetTASReso() const
+ResoCache::t_key SqwFuncModel::GetPosKey(const TASReso& reso,
+	const ublas::vector<t_real>& vecScanPos) const
+{
+	ResoCache::t_key key = reso.GetConfigKey();
+	key.insert(key.end(), vecScanPos.begin(), vecScanPos.end());
+	return key;
+}
+
+
+/**
+ * resolution object of the current scan
+ */
+std::size_t SqwFuncModel::GetTASResoIdx() const
 {
-	return const_cast<SqwFuncModel*>(this)->GetTASReso();
+	// multi-fits
+	if(m_pScans && m_vecResos.size() > 1)
+		return m_iCurParamSet;
+	return 0;
 }
 
 bool SqwFuncModel::SetTASPos(t_real dX, TASReso& reso) const
+{
+	TASResoPos pos;
+	bool bOk = GetTASPos(dX, reso, pos);
+	reso.SetPos(pos);
+	return bOk;
+}
+
+/**
+ * resolution at scan position dX without changing or copying the TASReso object
+ */
+bool SqwFuncModel::GetTASPos(t_real dX, const TASReso& reso, TASResoPos& pos) const
 {
 	const ublas::vector<t_real> vecScanPos = m_vecScanOrigin + dX*m_vecScanDir;
 
-	if(!reso.SetHKLE(vecScanPos[0],vecScanPos[1],vecScanPos[2],vecScanPos[3]))
+	// only the S(q,w) parameters change during a fit, so look for
+	// an already calculated resolution at this position
+	ResoCache::t_key key;
+	if(m_pResoCache)
+	{
+		key = GetPosKey(reso, vecScanPos);
+		if(m_pResoCache->Get(key, pos))
+			return pos.bOk;
+	}
+
+	if(!reso.CalcHKLE(vecScanPos[0], vecScanPos[1], vecScanPos[2], vecScanPos[3], pos))
 	{
 		std::ostringstream ostrErr;
 		ostrErr << "Invalid crystal position: ("
@@ -60,49 +111,198 @@ bool SqwFuncModel::SetTASPos(t_real dX, TASReso& reso) const
 		tl::log_err(ostrErr.str());
 		return false;
 	}
+
+	if(m_pResoCache)
+		m_pResoCache->Put(key, TASResoPos(pos));
 	return true;
 }
 
+/**
+ * calculates the resolution at all not yet cached scan positions in one go
+ */
+void SqwFuncModel::PrecalcScan(const t_real* pX, std::size_t iLen) const
+{
+	if(!m_pResoCache || !pX)
+		return;
+
+	const TASReso& reso = *GetTASReso();
+
+	std::vector<ResoCache::t_key> vecKeys;
+	std::vector<std::array<t_real_reso, 4>> vecHKLE;
+	for(std::size_t iPt=0; iPt<iLen; ++iPt)
+	{
+		const ublas::vector<t_real> vecScanPos = m_vecScanOrigin + pX[iPt]*m_vecScanDir;
+		ResoCache::t_key key = GetPosKey(reso, vecScanPos);
+		if(m_pResoCache->Has(key))
+			continue;
+
+		vecKeys.emplace_back(std::move(key));
+		vecHKLE.push_back({{ t_real_reso(vecScanPos[0]), t_real_reso(vecScanPos[1]),
+			t_real_reso(vecScanPos[2]), t_real_reso(vecScanPos[3]) }});
+	}
+
+	if(vecHKLE.size() == 0)
+		return;
+
+	std::vector<TASResoPos> vecPos;
+	reso.CalcHKLEScan(vecHKLE, vecPos, m_bUseThreads);
+
+	for(std::size_t iPt=0; iPt<vecPos.size(); ++iPt)
+	{
+		// invalid positions are reported when they are evaluated
+		if(vecPos[iPt].bOk)
+			m_pResoCache->Put(vecKeys[iPt], std::move(vecPos[iPt]));
+	}
+}
+
 tl::t_real_min SqwFuncModel::operator()(tl::t_real_min x) const
 {
-	TASReso/*&*/ reso = *GetTASReso();
-	if(!SetTASPos(t_real_mod(x), reso))
+	return tl::t_real_min(Eval(t_real(x)));
+}
+
+/**
+ * convoluted model at scan position x, optionally also returns
+ * the statistical error of the mc integration
+ */
+t_real_mod SqwFuncModel::Eval(t_real_mod x, t_real_mod* pErr) const
+{
+	const TASReso& reso = *GetTASReso();
+	TASResoPos pos;
+	if(!GetTASPos(x, reso, pos))
+	{
+		if(pErr) *pErr = 0.;
 		return 0.;
+	}
 
-	const ublas::vector<t_real> vecScanPos = m_vecScanOrigin + t_real(x)*m_vecScanDir;
-	std::vector<ublas::vector<t_real_reso>> vecNeutrons;
-	Ellipsoid4d<t_real_reso> elli;
-	if(m_bUseThreads)
-		elli = reso.GenerateMC(m_iNumNeutrons, vecNeutrons);
-	else
-		elli = reso.GenerateMC_deferred(m_iNumNeutrons, vecNeutrons);
+	const ublas::vector<t_real> vecScanPos = m_vecScanOrigin + x*m_vecScanDir;
 
-	t_real dS = 0.;
-	t_real dhklE_mean[4] = {0., 0., 0., 0.};
+	// mean S(q,w) and its error
+	t_real dS = 0., dSErr = 0.;
 
-	for(const ublas::vector<t_real_reso>& vecHKLE : vecNeutrons)
+	if(m_pBankCache && reso.GetConvoMethod() == ConvoMethod::MC)
 	{
-		dS += t_real((*m_pSqw)(vecHKLE[0], vecHKLE[1], vecHKLE[2], vecHKLE[3]));
+		// frozen neutrons: generate them only at the first visit of this position
+		NeutronBankCache::t_key key = GetPosKey(reso, vecScanPos);
+		key.push_back(t_real(m_iNumNeutrons));
 
-		for(int i=0; i<4; ++i)
-			dhklE_mean[i] += t_real(vecHKLE[i]);
+		std::shared_ptr<const McNeutrons<t_real_reso>> pFrozen;
+		if(!m_pBankCache->Get(key, pFrozen))
+		{
+			auto pNew = std::make_shared<McNeutrons<t_real_reso>>();
+			reso.GenerateMC(pos, m_iNumNeutrons, *pNew, m_bUseThreads);
+			pFrozen = pNew;
+
+			// use the bank already stored if another thread was faster
+			m_pBankCache->Put(key, std::shared_ptr<const McNeutrons<t_real_reso>>(pNew),
+				NeutronBankCache::GetBytes(*pNew));
+			m_pBankCache->Get(key, pFrozen);
+		}
+
+		const McNeutrons<t_real_reso>& bank = *pFrozen;
+
+		// partial sums over fixed blocks, added up in order afterwards,
+		// so that the result does not depend on the number of threads
+		const std::size_t iNumBlocks = (bank.size() + MC_REDUCE_BLOCK-1) / MC_REDUCE_BLOCK;
+		std::vector<t_real> vecPart(2*iNumBlocks, t_real(0));
+		auto fktSum = [this, &bank, &vecPart](std::size_t iBeginBlock, std::size_t iEndBlock)
+		{
+			for(std::size_t iBlock=iBeginBlock; iBlock<iEndBlock; ++iBlock)
+			{
+				const std::size_t iEnd = std::min((iBlock+1)*MC_REDUCE_BLOCK, bank.size());
+				const std::size_t iBegin = iBlock*MC_REDUCE_BLOCK;
+				t_real_reso dBlockS[MC_REDUCE_BLOCK];
+				m_pSqw->EvalBlock(bank.h.data()+iBegin, bank.k.data()+iBegin,
+					bank.l.data()+iBegin, bank.E.data()+iBegin, iEnd-iBegin, dBlockS);
+
+				t_real dPartSum = 0., dPartSum2 = 0.;
+				for(std::size_t iNeutr=0; iNeutr<iEnd-iBegin; ++iNeutr)
+				{
+					t_real dCurS = t_real(dBlockS[iNeutr]);
+					dPartSum += dCurS;
+					dPartSum2 += dCurS*dCurS;
+				}
+
+				vecPart[2*iBlock] = dPartSum;
+				vecPart[2*iBlock+1] = dPartSum2;
+			}
+		};
+
+		if(m_bUseThreads)
+			get_worker_pool().ParallelFor(iNumBlocks, 0, fktSum);
+		else
+			fktSum(0, iNumBlocks);
+
+		t_real dSum = 0., dSum2 = 0.;
+		for(std::size_t iBlock=0; iBlock<iNumBlocks; ++iBlock)
+		{
+			dSum += vecPart[2*iBlock];
+			dSum2 += vecPart[2*iBlock+1];
+		}
+
+		const t_real dN = t_real(bank.size());
+		if(bank.size())
+		{
+			dS = dSum / dN;
+			dSErr = std::sqrt(std::max(dSum2/dN - dS*dS, t_real(0)) / dN);
+		}
+	}
+	else
+	{
+		// fused generation and evaluation of the neutrons
+		auto fktBlockEval = [this](const McNeutrons<t_real_reso>& block, std::size_t iNum, t_real_reso *pS)
+		{
+			m_pSqw->EvalBlock(block.h.data(), block.k.data(), block.l.data(), block.E.data(), iNum, pS);
+		};
+
+		auto fktBlockEvalFast = [this](const McNeutrons<t_real_fast>& block, std::size_t iNum, t_real_fast *pS)
+		{
+			m_pSqw->EvalFast(block.h.data(), block.k.data(), block.l.data(), block.E.data(), iNum, pS);
+		};
+
+		// dispersion branches for importance sampling
+		auto fktDisp = [this](t_real_reso h, t_real_reso k, t_real_reso l)
+		{
+			return m_pSqw->disp(h, k, l);
+		};
+
+		TASReso::ConvoCallbacks fkts;
+		fkts.fktEval = fktBlockEval;
+		fkts.fktEvalFast = fktBlockEvalFast;
+		fkts.fktLines = m_pSqw->GetLinesFunc();
+		TASReso::ConvoOpts convo;
+		convo.fktDisp = fktDisp;
+		convo.bThreads = m_bUseThreads;
+
+		McConvoResult res;
+		reso.ConvoMC(pos, m_iNumNeutrons, fkts, res, convo);
+		dS = t_real(res.dS);
+		dSErr = t_real(res.dSErr);
 	}
 
-	dS /= t_real(m_iNumNeutrons);
-	for(int i=0; i<4; ++i)
-		dhklE_mean[i] /= t_real(m_iNumNeutrons);
+	// same normalisation as before: per neutron of one sample position
+	const t_real dNorm = t_real(pos.res.size());
+	dS *= dNorm;
+	dSErr *= dNorm;
 
-	if(reso.GetResoParams().flags & CALC_RESVOL)
-		dS *= reso.GetResoResults().dResVol;
-	if(reso.GetResoParams().flags & CALC_R0)
-		dS *= reso.GetResoResults().dR0;
+	if(pos.iFlags & CALC_RESVOL)
+	{
+		dS *= pos.res[0].dResVol;
+		dSErr *= pos.res[0].dResVol;
+	}
+	if(pos.iFlags & CALC_R0)
+	{
+		dS *= pos.res[0].dR0;
+		dSErr *= pos.res[0].dR0;
+	}
 
 	if(m_psigFuncResult)
 	{
 		(*m_psigFuncResult)(vecScanPos[0], vecScanPos[1], vecScanPos[2], vecScanPos[3],
 			dS*m_dScale + m_dOffs);
 	}
-	return tl::t_real_min(dS*m_dScale + m_dOffs);
+
+	if(pErr) *pErr = std::abs(dSErr*m_dScale);
+	return dS*m_dScale + m_dOffs;
 }
 
 SqwFuncModel* SqwFuncModel::copy() const
@@ -114,6 +314,8 @@ SqwFuncModel* SqwFuncModel::copy() const
 	pMod->m_vecScanDir = this->m_vecScanDir;
 	pMod->m_iNumNeutrons = this->m_iNumNeutrons;
 	pMod->m_bUseThreads = this->m_bUseThreads;
+	pMod->m_pResoCache = this->m_pResoCache;
+	pMod->m_pBankCache = this->m_pBankCache;
 	pMod->m_dScale = this->m_dScale;
 	pMod->m_dOffs = this->m_dOffs;
 	pMod->m_dScaleErr = this->m_dScaleErr;
@@ -437,3 +639,64 @@ const t_real_mod* SqwFuncModel::GetExpDY() const
 	return nullptr;
 }
 // -----------------------------------------------------------------------------
+
+
+// -----------------------------------------------------------------------------
+double Chi2FunctionMC::operator()(const std::vector<double>& vecParams) const
+{
+	const std::vector<tl::t_real_min> vecModParams(vecParams.begin(), vecParams.end());
+
+	t_real dChi2 = 0.;
+	// the scan groups are run one after the other, as switching between them
+	// changes the temperature and field variables of the (shared) S(q,w) model
+	for(std::size_t iSet=0; iSet<m_pMod->GetParamSetCount(); ++iSet)
+	{
+		m_pMod->SetParamSet(iSet);
+		m_pMod->SetParams(vecModParams);
+
+		std::size_t iLen = m_iLen;
+		const t_real *pX = m_pX, *pY = m_pY, *pDY = m_pDY;
+		if(m_pMod->GetExpLen())
+		{
+			iLen = m_pMod->GetExpLen();
+			pX = m_pMod->GetExpX();
+			pY = m_pMod->GetExpY();
+			pDY = m_pMod->GetExpDY();
+		}
+
+		// resolution at all points of this scan
+		m_pMod->PrecalcScan(pX, iLen);
+
+		// the points of the scan are evaluated in parallel,
+		// their contributions are added up in order afterwards
+		std::vector<t_real> vecChi2(iLen, t_real(0));
+		auto fktPoints = [this, pX, pY, pDY, &vecChi2](std::size_t iBegin, std::size_t iEnd)
+		{
+			for(std::size_t iPt=iBegin; iPt<iEnd; ++iPt)
+			{
+				t_real dModErr = 0.;
+				t_real dMod = m_pMod->Eval(pX[iPt], &dModErr);
+
+				t_real dErr2 = dModErr*dModErr;
+				if(pDY) dErr2 += pDY[iPt]*pDY[iPt];
+				if(dErr2 < std::numeric_limits<t_real>::epsilon())
+					dErr2 = std::numeric_limits<t_real>::epsilon();
+
+				vecChi2[iPt] = (dMod-pY[iPt])*(dMod-pY[iPt]) / dErr2;
+			}
+		};
+
+		if(m_pMod->GetUseThreads())
+			get_worker_pool().ParallelFor(iLen, iLen, fktPoints);
+		else
+			fktPoints(0, iLen);
+
+		for(t_real dPtChi2 : vecChi2)
+			dChi2 += dPtChi2;
+	}
+
+	if(m_bDebug)
+		tl::log_debug("chi^2 (including mc errors) = ", dChi2);
+	return double(dChi2);
+}
+// -----------------------------------------------------------------------------
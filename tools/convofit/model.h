@@ -11,12 +11,16 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <map>
+#include <list>
+#include <mutex>
 
 #include "tlibs/fit/minuit.h"
 #include <Minuit2/FunctionMinimum.h>
 #include <Minuit2/MnMigrad.h>
 #include <Minuit2/MnSimplex.h>
 #include <Minuit2/MnPrint.h>
+#include <Minuit2/FCNBase.h>
 
 #include <boost/signals2.hpp>
 
@@ -32,6 +36,119 @@ namespace sig = boost::signals2;
 using t_real_mod = t_real_reso;
 
 
+/**
+ * thread-safe map which evicts the least recently used entries
+ * once the total cost of its entries exceeds a budget
+ */
+template<class t_val>
+class LruCache
+{
+public:
+	using t_key = std::vector<t_real_reso>;
+
+protected:
+	struct Entry
+	{
+		t_val val;
+		std::size_t iCost;
+		typename std::list<t_key>::iterator iterUse;
+	};
+
+	std::mutex m_mtx;
+	std::map<t_key, Entry> m_map;
+	std::list<t_key> m_lstUse;		// most recently used first
+	std::size_t m_iCost = 0, m_iMaxCost;
+
+	void Evict()
+	{
+		while(m_iCost > m_iMaxCost && m_lstUse.size())
+		{
+			auto iter = m_map.find(m_lstUse.back());
+			m_iCost -= iter->second.iCost;
+			m_map.erase(iter);
+			m_lstUse.pop_back();
+		}
+	}
+
+public:
+	LruCache(std::size_t iMaxCost) : m_iMaxCost(iMaxCost) {}
+
+	bool Get(const t_key& key, t_val& val)
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		auto iter = m_map.find(key);
+		if(iter == m_map.end())
+			return false;
+
+		m_lstUse.splice(m_lstUse.begin(), m_lstUse, iter->second.iterUse);
+		val = iter->second.val;
+		return true;
+	}
+
+	bool Has(const t_key& key)
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		return m_map.find(key) != m_map.end();
+	}
+
+	// an already stored entry is kept, an entry exceeding the whole budget is not stored
+	void Put(const t_key& key, t_val&& val, std::size_t iCost = 1)
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		if(iCost > m_iMaxCost || m_map.find(key) != m_map.end())
+			return;
+
+		m_lstUse.push_front(key);
+		m_map.emplace(key, Entry{std::move(val), iCost, m_lstUse.begin()});
+		m_iCost += iCost;
+		Evict();
+	}
+
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_map.clear();
+		m_lstUse.clear();
+		m_iCost = 0;
+	}
+
+	void SetMaxCost(std::size_t iMaxCost)
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_iMaxCost = iMaxCost;
+		Evict();
+	}
+};
+
+
+/**
+ * resolution results at already visited scan positions;
+ * the key consists of the instrument configuration and the (hkl, E) position
+ */
+class ResoCache : public LruCache<TASResoPos>
+{
+public:
+	ResoCache() : LruCache<TASResoPos>(1<<14) {}
+};
+
+
+/**
+ * mc neutrons generated once per scan position and re-used for all fit iterations,
+ * the budget is given in bytes
+ */
+class NeutronBankCache : public LruCache<std::shared_ptr<const McNeutrons<t_real_reso>>>
+{
+public:
+	using t_bank = McNeutrons<t_real_reso>;
+
+	NeutronBankCache(std::size_t iMaxBytes)
+		: LruCache<std::shared_ptr<const t_bank>>(iMaxBytes) {}
+
+	static std::size_t GetBytes(const t_bank& bank)
+	{ return 4 * bank.h.capacity() * sizeof(t_real_reso); }
+};
+
+
 class SqwFuncModel : public tl::MinuitMultiFuncModel<t_real_mod>
 {
 protected:
@@ -41,6 +158,10 @@ protected:
 	unsigned int m_iNumNeutrons = 1000;
 	bool m_bUseThreads = 1;
 
+	// shared between all copies of the model
+	std::shared_ptr<ResoCache> m_pResoCache;
+	std::shared_ptr<NeutronBankCache> m_pBankCache;
+
 	ublas::vector<t_real_mod> m_vecScanOrigin;	// hklE
 	ublas::vector<t_real_mod> m_vecScanDir;		// hklE
 
@@ -85,8 +206,11 @@ protected:
 	void SetModelParams();
 
 	bool SetTASPos(t_real_mod dX, TASReso& reso) const;
-	TASReso* GetTASReso();
-	const TASReso* GetTASReso() const;
+	bool GetTASPos(t_real_mod dX, const TASReso& reso, TASResoPos& pos) const;
+	ResoCache::t_key GetPosKey(const TASReso& reso, const ublas::vector<t_real_mod>& vecScanPos) const;
+	std::size_t GetTASResoIdx() const;
+	TASReso* GetTASReso() { return &m_vecResos[GetTASResoIdx()]; }
+	const TASReso* GetTASReso() const { return &m_vecResos[GetTASResoIdx()]; }
 
 public:
 	SqwFuncModel(std::shared_ptr<SqwBase> pSqw, const TASReso& reso);
@@ -97,6 +221,8 @@ public:
 	virtual bool SetParams(const std::vector<tl::t_real_min>& vecParams) override;
 	virtual bool SetErrs(const std::vector<tl::t_real_min>& vecErrs);
 	virtual tl::t_real_min operator()(tl::t_real_min x) const override;
+	t_real_mod Eval(t_real_mod x, t_real_mod* pErr = nullptr) const;
+	void PrecalcScan(const t_real_mod* pX, std::size_t iLen) const;
 
 	virtual SqwFuncModel* copy() const override;
 
@@ -121,10 +247,18 @@ public:
 	void SetOtherParamNames(std::string strTemp, std::string strField);
 	void SetOtherParams(t_real_mod dTemperature, t_real_mod dField);
 
-	void SetReso(const TASReso& reso) { /*m_reso = reso;*/ m_vecResos = {reso}; }
-	void SetResos(const std::vector<TASReso>& vecResos) { m_vecResos = vecResos; }
+	void SetReso(const TASReso& reso) { /*m_reso = reso;*/ m_vecResos = {reso}; ClearResoCache(); }
+	void SetResos(const std::vector<TASReso>& vecResos) { m_vecResos = vecResos; ClearResoCache(); }
+	void SetUseResoCache(bool b);
+	void SetFreezeNeutrons(bool b, std::size_t iMaxBytes = std::size_t(1) << 30);
+	void ClearResoCache()
+	{
+		if(m_pResoCache) m_pResoCache->Clear();
+		if(m_pBankCache) m_pBankCache->Clear();
+	}
 	void SetNumNeutrons(unsigned int iNum) { m_iNumNeutrons = iNum; }
 	void SetUseThreads(bool b) { m_bUseThreads = b; }
+	bool GetUseThreads() const { return m_bUseThreads; }
 
 	void SetScanOrigin(t_real_mod h, t_real_mod k, t_real_mod l, t_real_mod E)
 	{ m_vecScanOrigin = tl::make_vec({h,k,l,E}); }
@@ -149,4 +283,37 @@ public:
 };
 
 
+
+/**
+ * chi^2 which also includes the statistical error of the mc convolution:
+ * sigma^2 = (error of data point)^2 + (error of model)^2
+ */
+class Chi2FunctionMC : public minuit::FCNBase
+{
+protected:
+	// one copy of the model for the whole fit, the parameters are set on every call
+	std::unique_ptr<SqwFuncModel> m_pMod;
+
+	// default data set, used if the model has no scan groups
+	std::size_t m_iLen = 0;
+	const t_real_mod *m_pX = nullptr, *m_pY = nullptr, *m_pDY = nullptr;
+
+	t_real_mod m_dSigma = 1.;
+	bool m_bDebug = 0;
+
+public:
+	Chi2FunctionMC(const SqwFuncModel* pMod, std::size_t iLen,
+		const t_real_mod* pX, const t_real_mod* pY, const t_real_mod* pDY)
+		: m_pMod(pMod->copy()), m_iLen(iLen), m_pX(pX), m_pY(pY), m_pDY(pDY)
+	{}
+	virtual ~Chi2FunctionMC() = default;
+
+	void SetSigma(t_real_mod dSig) { m_dSigma = dSig; }
+	void SetDebug(bool b) { m_bDebug = b; }
+
+	virtual double Up() const override { return double(m_dSigma*m_dSigma); }
+	virtual double operator()(const std::vector<double>& vecParams) const override;
+};
+
+
 #endif
@@ -42,7 +42,7 @@ ConvoDlg::ConvoDlg(QWidget* pParent, QSettings* pSett)
 	m_vecSpinBoxes = { spinStartH, spinStartK, spinStartL, spinStartE,
 		spinStopH, spinStopK, spinStopL, spinStopE,
 		spinStopH2, spinStopK2, spinStopL2, spinStopE2,
-		spinKfix,
+		spinKfix, spinTargetErr,
 		spinTolerance
 	};
 
@@ -50,21 +50,23 @@ ConvoDlg::ConvoDlg(QWidget* pParent, QSettings* pSett)
 		"monteconvo/h_from", "monteconvo/k_from", "monteconvo/l_from", "monteconvo/E_from",
 		"monteconvo/h_to", "monteconvo/k_to", "monteconvo/l_to", "monteconvo/E_to",
 		"monteconvo/h_to_2", "monteconvo/k_to_2", "monteconvo/l_to_2", "monteconvo/E_to_2",
-		"monteconvo/kfix",
+		"monteconvo/kfix", "monteconvo/target_error",
 		"convofit/tolerance"
 	};
 
-	m_vecIntSpinBoxes = { spinNeutrons, spinSampleSteps, spinStepCnt,
-		spinStrategy, spinMaxCalls };
-	m_vecIntSpinNames = { "monteconvo/neutron_count", "monteconvo/sample_step_count", "monteconvo/step_count",
-	"convofit/strategy", "convofit/max_calls"
+	m_vecIntSpinBoxes = { spinNeutrons, spinSampleSteps, spinMaxNeutrons, spinStepCnt,
+		spinSeed, spinStrategy, spinMaxCalls };
+	m_vecIntSpinNames = { "monteconvo/neutron_count", "monteconvo/sample_step_count",
+	"monteconvo/max_neutrons", "monteconvo/step_count",
+	"monteconvo/seed", "convofit/strategy", "convofit/max_calls"
 	};
 
 	m_vecEditBoxes = { editCrys, editRes, editSqw, editScan, editScale, editOffs,
-		editCounter, editMonitor, editTemp, editField
+		editCubOrder, editCounter, editMonitor, editTemp, editField
 	};
 	m_vecEditNames = { "monteconvo/crys", "monteconvo/instr", "monteconvo/sqw_conf",
 		"monteconvo/scanfile", "monteconvo/S_scale", "monteconvo/S_offs",
+		"monteconvo/cubature_order",
 		"convofit/counter", "convofit/monitor",
 		"convofit/temp_override", "convofit/field_override"
 	};
@@ -73,18 +75,19 @@ ConvoDlg::ConvoDlg(QWidget* pParent, QSettings* pSett)
 	m_vecTextNames = { "convofit/sqw_params" };
 
 	m_vecComboBoxes = { comboAlgo, comboFixedK, comboFocMono, comboFocAna,
-		comboFitter
+		comboSampler, comboMethod, comboFitter
 	};
 	m_vecComboNames = { "monteconvo/algo", "monteconvo/fixedk", "monteconvo/mono_foc",
-		"monteconvo/ana_foc",
+		"monteconvo/ana_foc", "monteconvo/sampler", "monteconvo/method",
 		"convofit/minimiser"
 	};
 
-	m_vecCheckBoxes = { checkScan, check2dMap,
-		checkRnd, checkNorm, checkFlip
+	m_vecCheckBoxes = { checkScan, check2dMap, checkImportance, checkSinglePrec,
+		checkUnitBank, checkRnd, checkNorm, checkFlip
 	};
 	m_vecCheckNames = { "monteconvo/has_scanfile", "monteconvo/scan_2d",
-		"convofit/recycle_neutrons", "convofit/normalise", "convofit/flip_coords"
+		"monteconvo/importance", "monteconvo/single_precision",
+		"monteconvo/unit_bank", "convofit/recycle_neutrons", "convofit/normalise", "convofit/flip_coords"
 	};
 	// -------------------------------------------------------------------------
 
@@ -622,11 +625,14 @@ void ConvoDlg::scaleChanged()
 	t_real dOffs = tl::str_to_var<t_real>(editOffs->text().toStdString());
 
 	m_vecScaledS.resize(m_vecS.size());
+	m_vecScaledSErr.resize(m_vecSErr.size());
 	for(std::size_t i=0; i<m_vecS.size(); ++i)
 		m_vecScaledS[i] = dScale*m_vecS[i] + dOffs;
+	for(std::size_t i=0; i<m_vecSErr.size(); ++i)
+		m_vecScaledSErr[i] = std::abs(dScale*m_vecSErr[i]);
 
 	set_qwt_data<t_real_reso>()(*m_plotwrap, m_vecQ, m_vecScaledS, 0, false);
-	set_qwt_data<t_real_reso>()(*m_plotwrap, m_vecQ, m_vecScaledS, 1, false);
+	set_qwt_data<t_real_reso>()(*m_plotwrap, m_vecQ, m_vecScaledS, 1, false, &m_vecScaledSErr);
 
 	m_plotwrap->GetPlot()->replot();
 }
@@ -7,15 +7,21 @@
 
 #include "ConvoDlg.h"
 #include "tlibs/time/stopwatch.h"
-#include "tlibs/helper/thread.h"
+#include "libs/workers.h"
 #include "tlibs/math/stat.h"
 
+#include <tuple>
+#include <array>
+
 
 using t_real = t_real_reso;
 using t_stopwatch = tl::Stopwatch<t_real>;
 
 static constexpr const t_real g_dEpsRlu = 1e-3;
 
+// result of a convolution step: valid, S, error of S
+using t_stepres = std::tuple<bool, t_real, t_real>;
+
 
 /**
  * create 1d convolution
@@ -139,6 +145,19 @@ void ConvoDlg::Start1D()
 		}
 
 		reso.SetAlgo(ResoAlgo(comboAlgo->currentIndex()+1));
+		reso.SetSampler(McSampler(comboSampler->currentIndex()));
+		reso.SetAdaptiveMC(spinTargetErr->value()/100., spinMaxNeutrons->value());
+		reso.SetImportanceSampling(checkImportance->isChecked());
+		reso.SetRngSeed(std::uint64_t(spinSeed->value()));
+		reso.SetSinglePrecision(checkSinglePrec->isChecked());
+		reso.SetUnitBank(checkUnitBank->isChecked());
+		reso.SetConvoMethod(ConvoMethod(comboMethod->currentIndex()));
+		{
+			std::vector<unsigned> vecCubOrder;
+			tl::get_tokens<unsigned, std::string>(editCubOrder->text().toStdString(),
+				" \t,;", vecCubOrder);
+			reso.SetCubatureOrder(vecCubOrder);
+		}
 		reso.SetKiFix(comboFixedK->currentIndex()==0);
 		reso.SetKFix(spinKfix->value());
 		reso.SetOptimalFocus(GetFocus());
@@ -155,7 +174,7 @@ void ConvoDlg::Start1D()
 
 		std::ostringstream ostrOut;
 		ostrOut << "#\n";
-		ostrOut << "# Format: h k l E S\n";
+		ostrOut << "# Format: h k l E S S_err\n";
 		ostrOut << "# MC Neutrons: " << iNumNeutrons << "\n";
 		ostrOut << "# MC Sample Steps: " << iNumSampleSteps << "\n";
 		ostrOut << "#\n";
@@ -171,17 +190,41 @@ void ConvoDlg::Start1D()
 
 		m_vecQ.clear();
 		m_vecS.clear();
+		m_vecSErr.clear();
 		m_vecScaledS.clear();
+		m_vecScaledSErr.clear();
 
 		m_vecQ.reserve(iNumSteps);
 		m_vecS.reserve(iNumSteps);
+		m_vecSErr.reserve(iNumSteps);
 		m_vecScaledS.reserve(iNumSteps);
+		m_vecScaledSErr.reserve(iNumSteps);
 
-		unsigned int iNumThreads = bForceDeferred ? 0 : std::thread::hardware_concurrency();
+		// resolution at all scan points in one call
+		std::vector<TASResoPos> vecPos;
+		if(iNumNeutrons != 0)
+		{
+			std::vector<std::array<t_real, 4>> vecHKLE;
+			vecHKLE.reserve(vecH.size());
+			for(std::size_t iStep=0; iStep<vecH.size(); ++iStep)
+				vecHKLE.push_back({{ vecH[iStep], vecK[iStep], vecL[iStep], vecE[iStep] }});
 
-		void (*pThStartFunc)() = []{ tl::init_rand(); };
-		tl::ThreadPool<std::pair<bool, t_real>()> tp(iNumThreads, pThStartFunc);
-		auto& lstFuts = tp.GetFutures();
+			reso.SetRandomSamplePos(iNumSampleSteps);
+			try
+			{
+				reso.CalcHKLEScan(vecHKLE, vecPos, !bForceDeferred);
+			}
+			catch(const std::exception& ex)
+			{
+				tl::log_err(ex.what());
+				fktEnableButtons();
+				return;
+			}
+		}
+
+		// steps run on the shared worker pool, or in this thread if deferred
+		WorkerPool& workers = get_worker_pool();
+		std::vector<std::future<t_stepres>> lstFuts;
 
 		for(unsigned int iStep=0; iStep<iNumSteps; ++iStep)
 		{
@@ -190,14 +233,13 @@ void ConvoDlg::Start1D()
 			t_real dCurL = vecL[iStep];
 			t_real dCurE = vecE[iStep];
 
-			tp.AddTask(
-			[&reso, dCurH, dCurK, dCurL, dCurE, iNumNeutrons, iNumSampleSteps, this]()
-				-> std::pair<bool, t_real>
+			auto task =
+			[&reso, &vecPos, iStep, dCurH, dCurK, dCurL, dCurE, iNumNeutrons, this]()
+				-> t_stepres
 			{
-				if(m_atStop.load()) return std::pair<bool, t_real>(false, 0.);
+				if(m_atStop.load()) return t_stepres(false, 0., 0.);
 
-				t_real dS = 0.;
-				t_real dhklE_mean[4] = {0., 0., 0., 0.};
+				t_real dS = 0., dSErr = 0.;
 
 				if(iNumNeutrons == 0)
 				{	// if no neutrons are given, just plot the unconvoluted S(q,w)
@@ -205,75 +247,75 @@ void ConvoDlg::Start1D()
 				}
 				else
 				{	// convolution
-					TASReso localreso = reso;
-					localreso.SetRandomSamplePos(iNumSampleSteps);
-					std::vector<ublas::vector<t_real>> vecNeutrons;
-
-					try
+					const TASResoPos& pos = vecPos[iStep];
+					if(!pos.bOk)
 					{
-						if(!localreso.SetHKLE(dCurH, dCurK, dCurL, dCurE))
-						{
-							std::ostringstream ostrErr;
-							ostrErr << "Invalid crystal position: (" <<
-								dCurH << " " << dCurK << " " << dCurL << ") rlu, "
-								<< dCurE << " meV.";
-							throw tl::Err(ostrErr.str().c_str());
-						}
+						tl::log_err("Invalid crystal position: (",
+							dCurH, " ", dCurK, " ", dCurL, ") rlu, ", dCurE, " meV.");
+						return t_stepres(false, 0., 0.);
 					}
-					catch(const std::exception& ex)
+
+					// generate and evaluate the neutrons block-wise
+					auto fktBlockEval = [this](const McNeutrons<t_real>& block, std::size_t iNum, t_real *pS)
+					{
+						m_pSqw->EvalBlock(block.h.data(), block.k.data(), block.l.data(), block.E.data(), iNum, pS);
+					};
+					auto fktBlockEvalFast = [this](const McNeutrons<t_real_fast>& block, std::size_t iNum, t_real_fast *pS)
+					{
+						m_pSqw->EvalFast(block.h.data(), block.k.data(), block.l.data(), block.E.data(), iNum, pS);
+					};
+					auto fktDisp = [this](t_real h, t_real k, t_real l)
 					{
-						//QMessageBox::critical(this, "Error", ex.what());
-						tl::log_err(ex.what());
-						return std::pair<bool, t_real>(false, 0.);
+						return m_pSqw->disp(h, k, l);
+					};
+
+					TASReso::ConvoCallbacks fkts;
+					fkts.fktEval = fktBlockEval;
+					fkts.fktEvalFast = fktBlockEvalFast;
+					fkts.fktLines = m_pSqw->GetLinesFunc();
+					TASReso::ConvoOpts convo;
+					convo.fktDisp = fktDisp;
+					convo.pStop = &m_atStop;
+
+					McConvoResult res;
+					if(!reso.ConvoMC(pos, iNumNeutrons, fkts, res, convo))
+						return t_stepres(false, 0., 0.);
+					dS = res.dS;
+					dSErr = res.dSErr;
+
+					if(pos.iFlags & CALC_RESVOL)
+					{
+						dS *= pos.res[0].dResVol;
+						dSErr *= pos.res[0].dResVol;
 					}
-
-					Ellipsoid4d<t_real> elli =
-						localreso.GenerateMC(iNumNeutrons, vecNeutrons);
-
-					for(const ublas::vector<t_real>& vecHKLE : vecNeutrons)
+					if(pos.iFlags & CALC_R0)
 					{
-						if(m_atStop.load()) return std::pair<bool, t_real>(false, 0.);
-
-						dS += (*m_pSqw)(vecHKLE[0], vecHKLE[1], vecHKLE[2], vecHKLE[3]);
-
-						for(int i=0; i<4; ++i)
-							dhklE_mean[i] += vecHKLE[i];
+						dS *= pos.res[0].dR0;
+						dSErr *= pos.res[0].dR0;
 					}
-
-					dS /= t_real(iNumNeutrons*iNumSampleSteps);
-					for(int i=0; i<4; ++i)
-						dhklE_mean[i] /= t_real(iNumNeutrons*iNumSampleSteps);
-
-					if(localreso.GetResoParams().flags & CALC_RESVOL)
-						dS *= localreso.GetResoResults().dResVol;
-					if(localreso.GetResoParams().flags & CALC_R0)
-						dS *= localreso.GetResoResults().dR0;
 				}
-				return std::pair<bool, t_real>(true, dS);
-			});
-		}
+				return t_stepres(true, dS, dSErr);
+			};
 
-		tp.StartTasks();
+			if(bForceDeferred)
+				lstFuts.emplace_back(std::async(std::launch::deferred, task));
+			else
+				lstFuts.emplace_back(workers.Submit(task));
+		}
 
-		auto iterTask = tp.GetTasks().begin();
 		unsigned int iStep = 0;
 		for(auto &fut : lstFuts)
 		{
 			if(m_atStop.load()) break;
 
-			// deferred (in main thread), eval this task manually
-			if(iNumThreads == 0)
-			{
-				(*iterTask)();
-				++iterTask;
-			}
-
-			std::pair<bool, t_real> pairS = fut.get();
-			if(!pairS.first) break;
-			t_real dS = pairS.second;
+			// deferred futures are evaluated in this thread by get()
+			t_stepres resS = fut.get();
+			if(!std::get<0>(resS)) break;
+			t_real dS = std::get<1>(resS);
+			t_real dSErr = std::get<2>(resS);
 			if(tl::is_nan_or_inf(dS))
 			{
-				dS = t_real(0);
+				dS = dSErr = t_real(0);
 				tl::log_warn("S(q,w) is invalid.");
 			}
 
@@ -282,11 +324,14 @@ void ConvoDlg::Start1D()
 				<< std::left << std::setw(g_iPrec*2) << vecK[iStep] << " "
 				<< std::left << std::setw(g_iPrec*2) << vecL[iStep] << " "
 				<< std::left << std::setw(g_iPrec*2) << vecE[iStep] << " "
-				<< std::left << std::setw(g_iPrec*2) << dS << "\n";
+				<< std::left << std::setw(g_iPrec*2) << dS << " "
+				<< std::left << std::setw(g_iPrec*2) << dSErr << "\n";
 
 			m_vecQ.push_back((*pVecScanX)[iStep]);
 			m_vecS.push_back(dS);
+			m_vecSErr.push_back(dSErr);
 	 		m_vecScaledS.push_back(dS*dScale + dOffs);
+			m_vecScaledSErr.push_back(std::abs(dSErr*dScale));
 
 			static const std::vector<t_real> vecNull;
 			bool bIsLastStep = (iStep == lstFuts.size()-1);
@@ -294,7 +339,7 @@ void ConvoDlg::Start1D()
 			if(bLivePlots || bIsLastStep)
 			{
 				set_qwt_data<t_real>()(*m_plotwrap, m_vecQ, m_vecScaledS, 0, false);
-				set_qwt_data<t_real>()(*m_plotwrap, m_vecQ, m_vecScaledS, 1, false);
+				set_qwt_data<t_real>()(*m_plotwrap, m_vecQ, m_vecScaledS, 1, false, &m_vecScaledSErr);
 				if(bUseScan)
 					set_qwt_data<t_real>()(*m_plotwrap, m_scan.vecX, m_scan.vecCts, 2, false, &m_scan.vecCtsErr);
 				else
@@ -354,6 +399,13 @@ void ConvoDlg::Start1D()
 			++iStep;
 		}
 
+		// remaining tasks still reference the local resolution object
+		if(!bForceDeferred)
+		{
+			for(auto &fut : lstFuts)
+				if(fut.valid()) fut.wait();
+		}
+
 
 		// approximate chi^2
 		if(bUseScan && m_pSqw)
@@ -558,6 +610,19 @@ void ConvoDlg::Start2D()
 		}
 
 		reso.SetAlgo(ResoAlgo(comboAlgo->currentIndex()+1));
+		reso.SetSampler(McSampler(comboSampler->currentIndex()));
+		reso.SetAdaptiveMC(spinTargetErr->value()/100., spinMaxNeutrons->value());
+		reso.SetImportanceSampling(checkImportance->isChecked());
+		reso.SetRngSeed(std::uint64_t(spinSeed->value()));
+		reso.SetSinglePrecision(checkSinglePrec->isChecked());
+		reso.SetUnitBank(checkUnitBank->isChecked());
+		reso.SetConvoMethod(ConvoMethod(comboMethod->currentIndex()));
+		{
+			std::vector<unsigned> vecCubOrder;
+			tl::get_tokens<unsigned, std::string>(editCubOrder->text().toStdString(),
+				" \t,;", vecCubOrder);
+			reso.SetCubatureOrder(vecCubOrder);
+		}
 		reso.SetKiFix(comboFixedK->currentIndex()==0);
 		reso.SetKFix(spinKfix->value());
 		reso.SetOptimalFocus(GetFocus());
@@ -572,7 +637,7 @@ void ConvoDlg::Start2D()
 
 		std::ostringstream ostrOut;
 		ostrOut << "#\n";
-		ostrOut << "# Format: h k l E S\n";
+		ostrOut << "# Format: h k l E S S_err\n";
 		ostrOut << "# MC Neutrons: " << iNumNeutrons << "\n";
 		ostrOut << "# MC Sample Steps: " << iNumSampleSteps << "\n";
 		ostrOut << "#\n";
@@ -610,11 +675,31 @@ void ConvoDlg::Start2D()
 			}
 		}
 
-		unsigned int iNumThreads = bForceDeferred ? 0 : std::thread::hardware_concurrency();
+		// resolution at all scan points in one call
+		std::vector<TASResoPos> vecPos;
+		if(iNumNeutrons != 0)
+		{
+			std::vector<std::array<t_real, 4>> vecHKLE;
+			vecHKLE.reserve(vecH.size());
+			for(std::size_t iStep=0; iStep<vecH.size(); ++iStep)
+				vecHKLE.push_back({{ vecH[iStep], vecK[iStep], vecL[iStep], vecE[iStep] }});
+
+			reso.SetRandomSamplePos(iNumSampleSteps);
+			try
+			{
+				reso.CalcHKLEScan(vecHKLE, vecPos, !bForceDeferred);
+			}
+			catch(const std::exception& ex)
+			{
+				tl::log_err(ex.what());
+				fktEnableButtons();
+				return;
+			}
+		}
 
-		void (*pThStartFunc)() = []{ tl::init_rand(); };
-		tl::ThreadPool<std::pair<bool, t_real>()> tp(iNumThreads, pThStartFunc);
-		auto& lstFuts = tp.GetFutures();
+		// steps run on the shared worker pool, or in this thread if deferred
+		WorkerPool& workers = get_worker_pool();
+		std::vector<std::future<t_stepres>> lstFuts;
 
 		for(unsigned int iStep=0; iStep<iNumSteps*iNumSteps; ++iStep)
 		{
@@ -623,14 +708,13 @@ void ConvoDlg::Start2D()
 			t_real dCurL = vecL[iStep];
 			t_real dCurE = vecE[iStep];
 
-			tp.AddTask(
-			[&reso, dCurH, dCurK, dCurL, dCurE, iNumNeutrons, iNumSampleSteps, this]()
-				-> std::pair<bool, t_real>
+			auto task =
+			[&reso, &vecPos, iStep, dCurH, dCurK, dCurL, dCurE, iNumNeutrons, this]()
+				-> t_stepres
 			{
-				if(m_atStop.load()) return std::pair<bool, t_real>(false, 0.);
+				if(m_atStop.load()) return t_stepres(false, 0., 0.);
 
-				t_real dS = 0.;
-				t_real dhklE_mean[4] = {0., 0., 0., 0.};
+				t_real dS = 0., dSErr = 0.;
 
 				if(iNumNeutrons == 0)
 				{	// if no neutrons are given, just plot the unconvoluted S(q,w)
@@ -638,75 +722,75 @@ void ConvoDlg::Start2D()
 				}
 				else
 				{	// convolution
-					TASReso localreso = reso;
-					localreso.SetRandomSamplePos(iNumSampleSteps);
-					std::vector<ublas::vector<t_real>> vecNeutrons;
-
-					try
+					const TASResoPos& pos = vecPos[iStep];
+					if(!pos.bOk)
 					{
-						if(!localreso.SetHKLE(dCurH, dCurK, dCurL, dCurE))
-						{
-							std::ostringstream ostrErr;
-							ostrErr << "Invalid crystal position: (" <<
-								dCurH << " " << dCurK << " " << dCurL << ") rlu, "
-								<< dCurE << " meV.";
-							throw tl::Err(ostrErr.str().c_str());
-						}
+						tl::log_err("Invalid crystal position: (",
+							dCurH, " ", dCurK, " ", dCurL, ") rlu, ", dCurE, " meV.");
+						return t_stepres(false, 0., 0.);
 					}
-					catch(const std::exception& ex)
+
+					// generate and evaluate the neutrons block-wise
+					auto fktBlockEval = [this](const McNeutrons<t_real>& block, std::size_t iNum, t_real *pS)
+					{
+						m_pSqw->EvalBlock(block.h.data(), block.k.data(), block.l.data(), block.E.data(), iNum, pS);
+					};
+					auto fktBlockEvalFast = [this](const McNeutrons<t_real_fast>& block, std::size_t iNum, t_real_fast *pS)
+					{
+						m_pSqw->EvalFast(block.h.data(), block.k.data(), block.l.data(), block.E.data(), iNum, pS);
+					};
+					auto fktDisp = [this](t_real h, t_real k, t_real l)
 					{
-						//QMessageBox::critical(this, "Error", ex.what());
-						tl::log_err(ex.what());
-						return std::pair<bool, t_real>(false, 0.);
+						return m_pSqw->disp(h, k, l);
+					};
+
+					TASReso::ConvoCallbacks fkts;
+					fkts.fktEval = fktBlockEval;
+					fkts.fktEvalFast = fktBlockEvalFast;
+					fkts.fktLines = m_pSqw->GetLinesFunc();
+					TASReso::ConvoOpts convo;
+					convo.fktDisp = fktDisp;
+					convo.pStop = &m_atStop;
+
+					McConvoResult res;
+					if(!reso.ConvoMC(pos, iNumNeutrons, fkts, res, convo))
+						return t_stepres(false, 0., 0.);
+					dS = res.dS;
+					dSErr = res.dSErr;
+
+					if(pos.iFlags & CALC_RESVOL)
+					{
+						dS *= pos.res[0].dResVol;
+						dSErr *= pos.res[0].dResVol;
 					}
-
-					Ellipsoid4d<t_real> elli =
-						localreso.GenerateMC(iNumNeutrons, vecNeutrons);
-
-					for(const ublas::vector<t_real>& vecHKLE : vecNeutrons)
+					if(pos.iFlags & CALC_R0)
 					{
-						if(m_atStop.load()) return std::pair<bool, t_real>(false, 0.);
-
-						dS += (*m_pSqw)(vecHKLE[0], vecHKLE[1], vecHKLE[2], vecHKLE[3]);
-
-						for(int i=0; i<4; ++i)
-							dhklE_mean[i] += vecHKLE[i];
+						dS *= pos.res[0].dR0;
+						dSErr *= pos.res[0].dR0;
 					}
-
-					dS /= t_real(iNumNeutrons*iNumSampleSteps);
-					for(int i=0; i<4; ++i)
-						dhklE_mean[i] /= t_real(iNumNeutrons*iNumSampleSteps);
-
-					if(localreso.GetResoParams().flags & CALC_RESVOL)
-						dS *= localreso.GetResoResults().dResVol;
-					if(localreso.GetResoParams().flags & CALC_R0)
-						dS *= localreso.GetResoResults().dR0;
 				}
-				return std::pair<bool, t_real>(true, dS);
-			});
-		}
+				return t_stepres(true, dS, dSErr);
+			};
 
-		tp.StartTasks();
+			if(bForceDeferred)
+				lstFuts.emplace_back(std::async(std::launch::deferred, task));
+			else
+				lstFuts.emplace_back(workers.Submit(task));
+		}
 
-		auto iterTask = tp.GetTasks().begin();
 		unsigned int iStep = 0;
 		for(auto &fut : lstFuts)
 		{
 			if(m_atStop.load()) break;
 
-			// deferred (in main thread), eval this task manually
-			if(iNumThreads == 0)
-			{
-				(*iterTask)();
-				++iterTask;
-			}
-
-			std::pair<bool, t_real> pairS = fut.get();
-			if(!pairS.first) break;
-			t_real dS = pairS.second;
+			// deferred futures are evaluated in this thread by get()
+			t_stepres resS = fut.get();
+			if(!std::get<0>(resS)) break;
+			t_real dS = std::get<1>(resS);
+			t_real dSErr = std::get<2>(resS);
 			if(tl::is_nan_or_inf(dS))
 			{
-				dS = t_real(0);
+				dS = dSErr = t_real(0);
 				tl::log_warn("S(q,w) is invalid.");
 			}
 
@@ -715,7 +799,8 @@ void ConvoDlg::Start2D()
 				<< std::left << std::setw(g_iPrec*2) << vecK[iStep] << " "
 				<< std::left << std::setw(g_iPrec*2) << vecL[iStep] << " "
 				<< std::left << std::setw(g_iPrec*2) << vecE[iStep] << " "
-				<< std::left << std::setw(g_iPrec*2) << dS << "\n";
+				<< std::left << std::setw(g_iPrec*2) << dS << " "
+				<< std::left << std::setw(g_iPrec*2) << dSErr << "\n";
 
 			m_plotwrap2d->GetRaster()->SetPixel(iStep%iNumSteps, iStep/iNumSteps, t_real_qwt(dS));
 
@@ -744,6 +829,13 @@ void ConvoDlg::Start2D()
 			++iStep;
 		}
 
+		// remaining tasks still reference the local resolution object
+		if(!bForceDeferred)
+		{
+			for(auto &fut : lstFuts)
+				if(fut.valid()) fut.wait();
+		}
+
 		// output elapsed time
 		watch.stop();
 		QMetaObject::invokeMethod(editStopTime2d, "setText",
@@ -869,11 +961,8 @@ void ConvoDlg::StartDisp()
 		m_vecvecE.clear();
 		m_vecvecW.clear();
 
-		unsigned int iNumThreads = bForceDeferred ? 0 : std::thread::hardware_concurrency();
-
-		tl::ThreadPool<std::tuple<bool, std::vector<t_real>, std::vector<t_real>>()>
-			tp(iNumThreads);
-		auto& lstFuts = tp.GetFutures();
+		WorkerPool& workers = get_worker_pool();
+		std::vector<std::future<std::tuple<bool, std::vector<t_real>, std::vector<t_real>>>> lstFuts;
 
 		for(unsigned int iStep=0; iStep<iNumSteps; ++iStep)
 		{
@@ -881,7 +970,7 @@ void ConvoDlg::StartDisp()
 			t_real dCurK = vecK[iStep];
 			t_real dCurL = vecL[iStep];
 
-			tp.AddTask([dCurH, dCurK, dCurL, this]() ->
+			auto task = [dCurH, dCurK, dCurL, this]() ->
 			std::tuple<bool, std::vector<t_real>, std::vector<t_real>>
 			{
 				if(m_atStop.load())
@@ -891,24 +980,20 @@ void ConvoDlg::StartDisp()
 				std::tie(vecE, vecW) = m_pSqw->disp(dCurH, dCurK, dCurL);
 				return std::tuple<bool, std::vector<t_real>, std::vector<t_real>>
 					(true, vecE, vecW);
-			});
-		}
+			};
 
-		tp.StartTasks();
+			if(bForceDeferred)
+				lstFuts.emplace_back(std::async(std::launch::deferred, task));
+			else
+				lstFuts.emplace_back(workers.Submit(task));
+		}
 
-		auto iterTask = tp.GetTasks().begin();
 		unsigned int iStep = 0;
 		for(auto &fut : lstFuts)
 		{
 			if(m_atStop.load()) break;
 
-			// deferred (in main thread), eval this task manually
-			if(iNumThreads == 0)
-			{
-				(*iterTask)();
-				++iterTask;
-			}
-
+			// deferred futures are evaluated in this thread by get()
 			auto tupEW = fut.get();
 			if(!std::get<0>(tupEW)) break;
 
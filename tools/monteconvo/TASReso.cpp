@@ -10,9 +10,12 @@
 #include "tlibs/math/rand.h"
 #include "tlibs/file/prop.h"
 #include "tlibs/log/log.h"
-#include "tlibs/helper/thread.h"
+#include "libs/workers.h"
 
 #include <boost/units/io.hpp>
+#include <limits>
+#include <atomic>
+#include <mutex>
 
 
 typedef t_real_reso t_real;
@@ -33,6 +36,8 @@ using wavenumber = tl::t_wavenumber_si<t_real>;
 TASReso::TASReso()
 {
 	m_res.resize(1);
+	m_ell4d.resize(1);
+	NewResoId();
 
 	m_opts.bCenter = 0;
 	m_opts.coords = McNeutronCoords::RLU;
@@ -51,13 +56,80 @@ const TASReso& TASReso::operator=(const TASReso& res)
 	this->m_reso = res.m_reso;
 	this->m_tofreso = res.m_tofreso;
 	this->m_res = res.m_res;
+	this->m_ell4d = res.m_ell4d;
+	this->m_iResoId = res.m_iResoId;
 	this->m_bKiFix = res.m_bKiFix;
 	this->m_dKFix = res.m_dKFix;
+	this->m_dMCRelErr = res.m_dMCRelErr;
+	this->m_iMCMaxNeutrons = res.m_iMCMaxNeutrons;
+	this->m_bImportance = res.m_bImportance;
+	this->m_dImportanceMix = res.m_dImportanceMix;
+	this->m_dImportanceWidth = res.m_dImportanceWidth;
+	this->m_iRngSeed = res.m_iRngSeed;
+	this->m_iRngPoint = res.m_iRngPoint;
+	this->m_method = res.m_method;
+	for(int iAxis=0; iAxis<4; ++iAxis)
+		this->m_iCubatureOrder[iAxis] = res.m_iCubatureOrder[iAxis];
+	this->m_dAnalyticMaxCurv = res.m_dAnalyticMaxCurv;
+	this->m_bSinglePrec = res.m_bSinglePrec;
+	this->m_bUnitBank = res.m_bUnitBank;
+	this->m_pUnitBank = res.m_pUnitBank;
 
 	return *this;
 }
 
 
+void TASReso::NewResoId()
+{
+	static std::atomic<std::size_t> s_iNextId(1);
+	m_iResoId = s_iNextId++;
+}
+
+
+/**
+ * counter-based random numbers of a sample position at a scan point
+ */
+McRngStream TASReso::GetRngStream(std::uint32_t iPoint, std::size_t iPos) const
+{
+	McRngStream rng;
+	rng.iSeed = m_iRngSeed;
+	rng.iPoint = iPoint;
+	rng.iPos = std::uint32_t(iPos);
+	return rng;
+}
+
+/**
+ * streams for all sample positions, empty if no seed is set
+ */
+std::vector<McRngStream> TASReso::GetRngStreams(std::uint32_t iPoint, std::size_t iNumPos) const
+{
+	std::vector<McRngStream> vecRng;
+	if(m_iRngSeed)
+	{
+		for(std::size_t iPos=0; iPos<iNumPos; ++iPos)
+			vecRng.push_back(GetRngStream(iPoint, iPos));
+	}
+	return vecRng;
+}
+
+
+/**
+ * points per principal axis of the ellipsoid for the cubature,
+ * a single value is used for all axes
+ */
+void TASReso::SetCubatureOrder(const std::vector<unsigned>& vecOrder)
+{
+	if(vecOrder.size() == 0)
+		return;
+
+	for(std::size_t iAxis=0; iAxis<4; ++iAxis)
+	{
+		unsigned iOrder = vecOrder[std::min(iAxis, vecOrder.size()-1)];
+		m_iCubatureOrder[iAxis] = std::max(iOrder, 1u);
+	}
+}
+
+
 bool TASReso::LoadLattice(const char* pcXmlFile)
 {
 	const std::string strXmlRoot("taz/");
@@ -95,6 +167,7 @@ bool TASReso::LoadLattice(const char* pcXmlFile)
 bool TASReso::LoadRes(const char* pcXmlFile)
 {
 	const std::string strXmlRoot("taz/");
+	NewResoId();
 
 	tl::Prop<std::string> xml;
 	if(!xml.Load(pcXmlFile, tl::PropType::XML))
@@ -300,10 +373,89 @@ bool TASReso::SetLattice(t_real a, t_real b, t_real c,
 }
 
 bool TASReso::SetHKLE(t_real h, t_real k, t_real l, t_real E)
+{
+	TASResoPos pos;
+	pos.dAngleQVec0 = m_opts.dAngleQVec0;
+	pos.iScramble = m_opts.iScramble;
+	pos.iRngPoint = m_iRngPoint;
+
+	// also keep the parameters of this position, e.g. for GetResoParams()
+	EckParams reso = m_reso;
+	ViolParams tofreso = m_tofreso;
+	bool bOk = CalcHKLE(h, k, l, E, pos, reso, tofreso, true);
+
+	m_reso = reso;
+	m_tofreso = tofreso;
+	SetPos(pos);
+	return bOk;
+}
+
+
+/**
+ * calculates the resolution at (hkl) and E without changing this object
+ */
+bool TASReso::CalcHKLE(t_real h, t_real k, t_real l, t_real E,
+	TASResoPos& pos, bool bThreads) const
+{
+	EckParams reso = m_reso;
+	ViolParams tofreso = m_tofreso;
+	return CalcHKLE(h, k, l, E, pos, reso, tofreso, bThreads);
+}
+
+
+/**
+ * calculates the resolution at all points of a scan, the points are
+ * computed in parallel and share the lattice and instrument setup
+ */
+bool TASReso::CalcHKLEScan(const std::vector<std::array<t_real, 4>>& vecHKLE,
+	std::vector<TASResoPos>& vecPos, bool bThreads) const
+{
+	vecPos.resize(vecHKLE.size());
+
+	auto fktPoints = [this, &vecHKLE, &vecPos, bThreads](std::size_t iBegin, std::size_t iEnd) -> void
+	{
+		// parameters only copied once per chunk
+		EckParams reso = m_reso;
+		ViolParams tofreso = m_tofreso;
+
+		// instrument terms, kept for the following points of the chunk
+		TASResoPrecalc pre;
+
+		for(std::size_t iPt=iBegin; iPt<iEnd; ++iPt)
+		{
+			const std::array<t_real, 4>& hklE = vecHKLE[iPt];
+			CalcHKLE(hklE[0], hklE[1], hklE[2], hklE[3], vecPos[iPt], reso, tofreso, bThreads, &pre);
+		}
+	};
+
+	if(bThreads)
+		get_worker_pool().ParallelFor(vecHKLE.size(), 0, fktPoints);
+	else
+		fktPoints(0, vecHKLE.size());
+
+	bool bOk = true;
+	for(const TASResoPos& pos : vecPos)
+		bOk = bOk && pos.bOk;
+	return bOk;
+}
+
+
+/**
+ * calculates the resolution at (hkl) and E for all sample positions,
+ * reso and tofreso are set to the instrument parameters at this position.
+ * pPre holds the terms of the previous point of a scan which may be reused.
+ */
+bool TASReso::CalcHKLE(t_real h, t_real k, t_real l, t_real E, TASResoPos& pos,
+	EckParams& reso, ViolParams& tofreso, bool bThreads, TASResoPrecalc* pPre) const
 {
 	static const t_real s_dPlaneDistTolerance = std::cbrt(tl::get_epsilon<t_real>());
 
-	ResoResults& resores = m_res[0];
+	const std::size_t iNumPos = m_res.size();
+	pos.bOk = false;
+	pos.iFlags = reso.flags;
+	pos.res.resize(iNumPos);
+	pos.ell4d.resize(iNumPos);
+	ResoResults& resores = pos.res[0];
 
 	//std::cout << "UB = " << m_opts.matUB << std::endl;
 	//std::cout << h << " " << k << " " << l << ", " << E << std::endl;
@@ -326,89 +478,89 @@ bool TASReso::SetHKLE(t_real h, t_real k, t_real l, t_real E)
 	if(vecQ.size() > 3)
 		vecQ.resize(3, true);
 
-	m_tofreso.Q = m_reso.Q = ublas::norm_2(vecQ) / angs;
-	m_tofreso.E = m_reso.E = E * meV;
+	tofreso.Q = reso.Q = ublas::norm_2(vecQ) / angs;
+	tofreso.E = reso.E = E * meV;
 
 	//tl::log_info("kfix = ", m_dKFix);
-	wavenumber kother = tl::get_other_k(m_reso.E, m_dKFix/angs, m_bKiFix);
+	wavenumber kother = tl::get_other_k(reso.E, m_dKFix/angs, m_bKiFix);
 	if(m_bKiFix)
 	{
-		m_tofreso.ki = m_reso.ki = m_dKFix / angs;
-		m_tofreso.kf = m_reso.kf = kother;
+		tofreso.ki = reso.ki = m_dKFix / angs;
+		tofreso.kf = reso.kf = kother;
 	}
 	else
 	{
-		m_tofreso.ki = m_reso.ki = kother;
-		m_tofreso.kf = m_reso.kf = m_dKFix / angs;
+		tofreso.ki = reso.ki = kother;
+		tofreso.kf = reso.kf = m_dKFix / angs;
 	}
 
-	//tl::log_info("ki = ", m_reso.ki, ", kf = ", m_reso.kf);
-	//tl::log_info("Q = ", m_reso.Q, ", E = ", m_reso.E/meV, " meV");
+	//tl::log_info("ki = ", reso.ki, ", kf = ", reso.kf);
+	//tl::log_info("Q = ", reso.Q, ", E = ", reso.E/meV, " meV");
 
-	m_reso.thetam = units::abs(tl::get_mono_twotheta(m_reso.ki, m_reso.mono_d, /*m_reso.dmono_sense>=0.*/1)*t_real(0.5));
-	m_reso.thetaa = units::abs(tl::get_mono_twotheta(m_reso.kf, m_reso.ana_d, /*m_reso.dana_sense>=0.*/1)*t_real(0.5));
-	m_tofreso.twotheta = m_reso.twotheta = units::abs(tl::get_sample_twotheta(m_reso.ki, m_reso.kf, m_reso.Q, 1));
+	reso.thetam = units::abs(tl::get_mono_twotheta(reso.ki, reso.mono_d, /*reso.dmono_sense>=0.*/1)*t_real(0.5));
+	reso.thetaa = units::abs(tl::get_mono_twotheta(reso.kf, reso.ana_d, /*reso.dana_sense>=0.*/1)*t_real(0.5));
+	tofreso.twotheta = reso.twotheta = units::abs(tl::get_sample_twotheta(reso.ki, reso.kf, reso.Q, 1));
 
-	//tl::log_info("thetam = ", tl::r2d(m_reso.thetam/rads));
-	//tl::log_info("thetaa = ", tl::r2d(m_reso.thetaa/rads));
-	//tl::log_info("twothetas = ", tl::r2d(m_reso.twotheta/rads));
+	//tl::log_info("thetam = ", tl::r2d(reso.thetam/rads));
+	//tl::log_info("thetaa = ", tl::r2d(reso.thetaa/rads));
+	//tl::log_info("twothetas = ", tl::r2d(reso.twotheta/rads));
 
-	m_tofreso.angle_ki_Q = m_reso.angle_ki_Q = tl::get_angle_ki_Q(m_reso.ki, m_reso.kf, m_reso.Q, /*m_reso.dsample_sense>=0.*/1);
-	m_tofreso.angle_kf_Q = m_reso.angle_kf_Q = tl::get_angle_kf_Q(m_reso.ki, m_reso.kf, m_reso.Q, /*m_reso.dsample_sense>=0.*/1);
+	tofreso.angle_ki_Q = reso.angle_ki_Q = tl::get_angle_ki_Q(reso.ki, reso.kf, reso.Q, /*reso.dsample_sense>=0.*/1);
+	tofreso.angle_kf_Q = reso.angle_kf_Q = tl::get_angle_kf_Q(reso.ki, reso.kf, reso.Q, /*reso.dsample_sense>=0.*/1);
 
-	//tl::log_info("kiQ = ", tl::r2d(m_reso.angle_ki_Q/rads));
-	//m_reso.angle_ki_Q = units::abs(m_reso.angle_ki_Q);
-	//m_reso.angle_kf_Q = units::abs(m_reso.angle_kf_Q);
+	//tl::log_info("kiQ = ", tl::r2d(reso.angle_ki_Q/rads));
+	//reso.angle_ki_Q = units::abs(reso.angle_ki_Q);
+	//reso.angle_kf_Q = units::abs(reso.angle_kf_Q);
 
 
 	if(m_foc == ResoFocus::FOC_NONE)
 	{
-		m_reso.bMonoIsCurvedH = m_reso.bMonoIsCurvedV = 0;
-		m_reso.bAnaIsCurvedH = m_reso.bAnaIsCurvedV = 0;
+		reso.bMonoIsCurvedH = reso.bMonoIsCurvedV = 0;
+		reso.bAnaIsCurvedH = reso.bAnaIsCurvedV = 0;
 
 		//tl::log_info("No focus.");
 	}
 	else
 	{
-		m_reso.bMonoIsCurvedH = m_reso.bMonoIsOptimallyCurvedH =
+		reso.bMonoIsCurvedH = reso.bMonoIsOptimallyCurvedH =
 			(unsigned(m_foc) & unsigned(ResoFocus::FOC_MONO_H));
-		m_reso.bMonoIsCurvedV = m_reso.bMonoIsOptimallyCurvedV =
+		reso.bMonoIsCurvedV = reso.bMonoIsOptimallyCurvedV =
 			(unsigned(m_foc) & unsigned(ResoFocus::FOC_MONO_V));
-		m_reso.bAnaIsCurvedH = m_reso.bAnaIsOptimallyCurvedH =
+		reso.bAnaIsCurvedH = reso.bAnaIsOptimallyCurvedH =
 			(unsigned(m_foc) & unsigned(ResoFocus::FOC_ANA_H));
-		m_reso.bAnaIsCurvedV = m_reso.bAnaIsOptimallyCurvedV =
+		reso.bAnaIsCurvedV = reso.bAnaIsOptimallyCurvedV =
 			(unsigned(m_foc) & unsigned(ResoFocus::FOC_ANA_V));
 
-		//tl::log_info("Mono focus (h,v): ", m_reso.bMonoIsOptimallyCurvedH, ", ", m_reso.bMonoIsOptimallyCurvedV);
-		//tl::log_info("Ana focus (h,v): ", m_reso.bAnaIsOptimallyCurvedH, ", ", m_reso.bAnaIsOptimallyCurvedV);
+		//tl::log_info("Mono focus (h,v): ", reso.bMonoIsOptimallyCurvedH, ", ", reso.bMonoIsOptimallyCurvedV);
+		//tl::log_info("Ana focus (h,v): ", reso.bAnaIsOptimallyCurvedH, ", ", reso.bAnaIsOptimallyCurvedV);
 
 		// remove collimators
-		/*if(m_reso.bMonoIsCurvedH)
+		/*if(reso.bMonoIsCurvedH)
 		{
-			m_reso.coll_h_pre_mono = 99999. * rads;
-			m_reso.coll_h_pre_sample = 99999. * rads;
+			reso.coll_h_pre_mono = 99999. * rads;
+			reso.coll_h_pre_sample = 99999. * rads;
 		}
-		if(m_reso.bMonoIsCurvedV)
+		if(reso.bMonoIsCurvedV)
 		{
-			m_reso.coll_v_pre_mono = 99999. * rads;
-			m_reso.coll_v_pre_sample = 99999. * rads;
+			reso.coll_v_pre_mono = 99999. * rads;
+			reso.coll_v_pre_sample = 99999. * rads;
 		}
-		if(m_reso.bAnaIsCurvedH)
+		if(reso.bAnaIsCurvedH)
 		{
-			m_reso.coll_h_post_sample = 99999. * rads;
-			m_reso.coll_h_post_ana = 99999. * rads;
+			reso.coll_h_post_sample = 99999. * rads;
+			reso.coll_h_post_ana = 99999. * rads;
 		}
-		if(m_reso.bAnaIsCurvedV)
+		if(reso.bAnaIsCurvedV)
 		{
-			m_reso.coll_v_post_sample = 99999. * rads;
-			m_reso.coll_v_post_ana = 99999. * rads;
+			reso.coll_v_post_sample = 99999. * rads;
+			reso.coll_v_post_ana = 99999. * rads;
 		}*/
 	}
 
 
-	/*tl::log_info("thetam = ", m_reso.thetam);
-	tl::log_info("thetaa = ", m_reso.thetaa);
-	tl::log_info("2theta = ", m_reso.twotheta);*/
+	/*tl::log_info("thetam = ", reso.thetam);
+	tl::log_info("thetaa = ", reso.thetaa);
+	tl::log_info("2theta = ", reso.twotheta);*/
 
 	if(std::fabs(vecQ[2]) > s_dPlaneDistTolerance)
 	{
@@ -421,137 +573,899 @@ bool TASReso::SetHKLE(t_real h, t_real k, t_real l, t_real E)
 	}
 
 	vecQ.resize(2, true);
-	m_opts.dAngleQVec0 = -tl::vec_angle(vecQ);
-	//tl::log_info("angle Q vec0 = ", m_opts.dAngleQVec0);
-	//tl::log_info("calc r0: ", m_reso.bCalcR0);
+	pos.dAngleQVec0 = -tl::vec_angle(vecQ);
+	//tl::log_info("angle Q vec0 = ", pos.dAngleQVec0);
+
+	pos.iRngPoint = McRngStream::HashPoint<t_real>(h, k, l, E);
 
-	for(ResoResults& resores_cur : m_res)
+	// new random shift of the quasi-mc sequence for every position,
+	// the unit bank keeps one shift for all positions, see GetUnitNeutrons
+	if(m_opts.sampler == McSampler::SOBOL && m_bUnitBank)
 	{
-		// if only one sample position is requested, don't randomise
-		if(m_res.size() > 1)
+		pos.iScramble = m_opts.iScramble;
+		if(m_iRngSeed)
 		{
-			/*m_reso.pos_x = tl::rand_real(-t_real(m_reso.sample_w_q*0.5/cm),
-				t_real(m_reso.sample_w_q*0.5/cm)) * cm;
-			m_reso.pos_y = tl::rand_real(-t_real(m_reso.sample_w_perpq*0.5/cm),
-				t_real(m_reso.sample_w_perpq*0.5/cm)) * cm;
-			m_reso.pos_z = tl::rand_real(-t_real(m_reso.sample_h*0.5/cm),
-				t_real(m_reso.sample_h*0.5/cm)) * cm;*/
-
-			m_reso.pos_x = tl::rand_norm(t_real(0),
-				t_real(tl::get_FWHM2SIGMA<t_real>()*m_reso.sample_w_q/cm)) * cm;
-			m_reso.pos_y = tl::rand_norm(t_real(0),
-				t_real(tl::get_FWHM2SIGMA<t_real>()*m_reso.sample_w_perpq/cm)) * cm;
-			m_reso.pos_z = tl::rand_norm(t_real(0),
-				t_real(tl::get_FWHM2SIGMA<t_real>()*m_reso.sample_h/cm)) * cm;
+			std::uint32_t iRnd[4];
+			GetRngStream(0, 0).Raw(0, McRngSub::SCRAMBLE, iRnd);
+			pos.iScramble = iRnd[0] | 1;
 		}
+	}
+	else if(m_opts.sampler == McSampler::SOBOL)
+	{
+		if(m_iRngSeed)
+		{
+			std::uint32_t iRnd[4];
+			GetRngStream(pos.iRngPoint, 0).Raw(0, McRngSub::SCRAMBLE, iRnd);
+			pos.iScramble = iRnd[0] | 1;
+		}
+		else
+		{
+			pos.iScramble = std::uint32_t(tl::rand_real<t_real>(t_real(1),
+				t_real(std::numeric_limits<std::uint32_t>::max())));
+		}
+	}
+	//tl::log_info("calc r0: ", reso.bCalcR0);
 
-		// calculate resolution at (hkl) and E
-		if(m_algo == ResoAlgo::CN)
+	if(m_algo != ResoAlgo::CN && m_algo != ResoAlgo::POP &&
+		m_algo != ResoAlgo::ECK && m_algo != ResoAlgo::VIOL)
+	{
+		const char* pcErr = "Unknown algorithm selected.";
+		tl::log_err(pcErr);
+		resores.strErr = pcErr;
+		resores.bOk = false;
+		return false;
+	}
+	if(m_algo == ResoAlgo::VIOL)
+		reso.flags &= ~CALC_R0;
+	pos.iFlags = reso.flags;
+
+	// draw all random sample positions first and in the same order as in a serial loop,
+	// so the results only depend on the random seed and not on the number of threads
+	std::vector<EckParams> vecParams(iNumPos, reso);
+
+	// if only one sample position is requested, don't randomise
+	if(iNumPos > 1 && m_iRngSeed)
+	{
+		// counter-based: each position has its own stream
+		for(std::size_t iPos=0; iPos<iNumPos; ++iPos)
 		{
-			//tl::log_info("Algorithm: Cooper-Nathans (TAS)");
-			resores_cur = calc_cn(m_reso);
+			t_real dNorm[4];
+			GetRngStream(pos.iRngPoint, iPos).Normal<t_real>(0, McRngSub::SAMPLE_POS, dNorm);
+
+			vecParams[iPos].pos_x = dNorm[0] * t_real(tl::get_FWHM2SIGMA<t_real>()*reso.sample_w_q/cm) * cm;
+			vecParams[iPos].pos_y = dNorm[1] * t_real(tl::get_FWHM2SIGMA<t_real>()*reso.sample_w_perpq/cm) * cm;
+			vecParams[iPos].pos_z = dNorm[2] * t_real(tl::get_FWHM2SIGMA<t_real>()*reso.sample_h/cm) * cm;
 		}
-		else if(m_algo == ResoAlgo::POP)
+	}
+	else if(iNumPos > 1)
+	{
+		for(EckParams& params : vecParams)
 		{
-			//tl::log_info("Algorithm: Popovici (TAS)");
-			resores_cur = calc_pop(m_reso);
+			/*params.pos_x = tl::rand_real(-t_real(reso.sample_w_q*0.5/cm),
+				t_real(reso.sample_w_q*0.5/cm)) * cm;
+			params.pos_y = tl::rand_real(-t_real(reso.sample_w_perpq*0.5/cm),
+				t_real(reso.sample_w_perpq*0.5/cm)) * cm;
+			params.pos_z = tl::rand_real(-t_real(reso.sample_h*0.5/cm),
+				t_real(reso.sample_h*0.5/cm)) * cm;*/
+
+			params.pos_x = tl::rand_norm(t_real(0),
+				t_real(tl::get_FWHM2SIGMA<t_real>()*reso.sample_w_q/cm)) * cm;
+			params.pos_y = tl::rand_norm(t_real(0),
+				t_real(tl::get_FWHM2SIGMA<t_real>()*reso.sample_w_perpq/cm)) * cm;
+			params.pos_z = tl::rand_norm(t_real(0),
+				t_real(tl::get_FWHM2SIGMA<t_real>()*reso.sample_h/cm)) * cm;
 		}
-		else if(m_algo == ResoAlgo::ECK)
+
+	}
+	if(iNumPos > 1)
+	{
+		reso.pos_x = vecParams.back().pos_x;
+		reso.pos_y = vecParams.back().pos_y;
+		reso.pos_z = vecParams.back().pos_z;
+	}
+
+	// terms which don't depend on the sample position, only the ones
+	// which differ from the previous point are calculated
+	TASResoPrecalc preCur;
+	TASResoPrecalc& pre = pPre ? *pPre : preCur;
+	if(m_algo == ResoAlgo::CN)
+		calc_cn_precalc(reso, pre.cn);
+	else if(m_algo == ResoAlgo::POP)
+		calc_pop_precalc(reso, pre.pop);
+	else if(m_algo == ResoAlgo::ECK)
+		calc_eck_precalc(reso, pre.eck);
+
+	// calculate the resolution at (hkl) and E for all sample positions in parallel
+	auto fktPos = [this, &vecParams, &tofreso, &pos, &pre](std::size_t iBegin, std::size_t iEnd) -> void
+	{
+		for(std::size_t iPos=iBegin; iPos<iEnd; ++iPos)
 		{
-			//tl::log_info("Algorithm: Eckold-Sobolev (TAS)");
-			resores_cur = calc_eck(m_reso);
+			ResoResults& resores_cur = pos.res[iPos];
+
+			if(m_algo == ResoAlgo::CN)
+				resores_cur = calc_cn(vecParams[iPos], &pre.cn);
+			else if(m_algo == ResoAlgo::POP)
+				resores_cur = calc_pop(vecParams[iPos], &pre.pop);
+			else if(m_algo == ResoAlgo::ECK)
+				resores_cur = calc_eck(vecParams[iPos], &pre.eck);
+			else if(m_algo == ResoAlgo::VIOL)
+				resores_cur = calc_viol(tofreso);
+
+			if(!resores_cur.bOk)
+			{
+				tl::log_err("Error calculating resolution: ", resores_cur.strErr);
+				tl::log_debug("R0: ", resores_cur.dR0);
+				tl::log_debug("res: ", resores_cur.reso);
+			}
+
+			pos.ell4d[iPos] = calc_res_ellipsoid4d<t_real>(
+				resores_cur.reso, resores_cur.reso_v, resores_cur.reso_s, resores_cur.Q_avg);
 		}
-		else if(m_algo == ResoAlgo::VIOL)
+	};
+
+	if(bThreads)
+		get_worker_pool().ParallelFor(iNumPos, 0, fktPos);
+	else
+		fktPos(0, iNumPos);
+
+	pos.bOk = resores.bOk;
+	return pos.bOk;
+}
+
+
+/**
+ * gets the state calculated by SetHKLE
+ */
+TASResoPos TASReso::GetPos() const
+{
+	TASResoPos pos;
+	pos.bOk = m_res[0].bOk;
+	pos.res = m_res;
+	pos.ell4d = m_ell4d;
+	pos.dAngleQVec0 = m_opts.dAngleQVec0;
+	pos.iScramble = m_opts.iScramble;
+	pos.iRngPoint = m_iRngPoint;
+	pos.iFlags = m_reso.flags;
+	return pos;
+}
+
+/**
+ * restores a state previously calculated by SetHKLE
+ * (only valid for the same configuration, see GetConfigKey)
+ */
+void TASReso::SetPos(const TASResoPos& pos)
+{
+	m_res = pos.res;
+	m_ell4d = pos.ell4d;
+	m_opts.dAngleQVec0 = pos.dAngleQVec0;
+	m_opts.iScramble = pos.iScramble;
+	m_iRngPoint = pos.iRngPoint;
+	m_reso.flags = pos.iFlags;
+}
+
+/**
+ * all settings which affect the results of SetHKLE
+ */
+std::vector<t_real> TASReso::GetConfigKey() const
+{
+	std::vector<t_real> vecKey
+	{
+		t_real(m_iResoId), t_real(m_algo), t_real(m_foc),
+		t_real(m_opts.sampler), t_real(m_res.size()), t_real(m_bUnitBank),
+		t_real(m_bKiFix), m_dKFix,
+		t_real(m_iRngSeed & 0xffffffff), t_real(m_iRngSeed >> 32)
+	};
+
+	for(std::size_t i=0; i<m_opts.matUB.size1(); ++i)
+		for(std::size_t j=0; j<m_opts.matUB.size2(); ++j)
+			vecKey.push_back(m_opts.matUB(i,j));
+
+	return vecKey;
+}
+
+/**
+ * copies the neutrons from a bank into a vector of vectors
+ */
+static void bank_to_vecs(const McNeutrons<t_real>& neutrons, std::vector<t_vec>& vecNeutrons)
+{
+	if(vecNeutrons.size() != neutrons.size())
+		vecNeutrons.resize(neutrons.size());
+
+	for(std::size_t iNeutr=0; iNeutr<neutrons.size(); ++iNeutr)
+	{
+		vecNeutrons[iNeutr] = tl::make_vec<t_vec>({ neutrons.h[iNeutr],
+			neutrons.k[iNeutr], neutrons.l[iNeutr], neutrons.E[iNeutr] });
+	}
+}
+
+Ellipsoid4d<t_real> TASReso::GenerateMC(std::size_t iNum, std::vector<t_vec>& vecNeutrons) const
+{
+	McNeutrons<t_real> neutrons;
+	Ellipsoid4d<t_real> ell4d = GenerateMC(iNum, neutrons);
+	bank_to_vecs(neutrons, vecNeutrons);
+	return ell4d;
+}
+
+Ellipsoid4d<t_real> TASReso::GenerateMC_deferred(std::size_t iNum, std::vector<t_vec>& vecNeutrons) const
+{
+	McNeutrons<t_real> neutrons;
+	Ellipsoid4d<t_real> ell4d = GenerateMC_deferred(iNum, neutrons);
+	bank_to_vecs(neutrons, vecNeutrons);
+	return ell4d;
+}
+
+
+/**
+ * generates mc neutrons into a structure-of-arrays bank
+ * which is only reallocated if the requested size changes
+ */
+Ellipsoid4d<t_real> TASReso::GenerateMC(std::size_t iNum, McNeutrons<t_real>& neutrons) const
+{
+	return GenerateMC(m_ell4d, m_opts, m_iRngPoint, iNum, neutrons, true);
+}
+
+Ellipsoid4d<t_real> TASReso::GenerateMC_deferred(std::size_t iNum, McNeutrons<t_real>& neutrons) const
+{
+	return GenerateMC(m_ell4d, m_opts, m_iRngPoint, iNum, neutrons, false);
+}
+
+/**
+ * generates mc neutrons at a position calculated by CalcHKLE or CalcHKLEScan
+ */
+Ellipsoid4d<t_real> TASReso::GenerateMC(const TASResoPos& pos, std::size_t iNum,
+	McNeutrons<t_real>& neutrons, bool bThreads) const
+{
+	return GenerateMC(pos.ell4d, GetPosOpts(pos), pos.iRngPoint, iNum, neutrons, bThreads);
+}
+
+Ellipsoid4d<t_real> TASReso::GenerateMC(const std::vector<Ellipsoid4d<t_real>>& vecEll,
+	const McNeutronOpts<t_mat>& opts, std::uint32_t iRngPoint,
+	std::size_t iNum, McNeutrons<t_real>& neutrons, bool bThreads) const
+{
+	// number of iterations over random sample positions
+	std::size_t iIter = vecEll.size();
+	neutrons.resize(iNum*iIter);
+	if(iNum == 0 || iIter == 0)
+		return iIter ? vecEll[0] : Ellipsoid4d<t_real>();
+
+	const std::vector<McRngStream> vecRng = GetRngStreams(iRngPoint, iIter);
+	const std::shared_ptr<const McUnitBank> pUnit = GetUnitNeutrons(iNum, iIter, opts);
+
+	// all sample positions in one parallel loop on the shared worker pool,
+	// also when called from one of its workers. a chunk of the loop can
+	// span several sample positions.
+	auto fktRange = [&vecEll, &opts, &neutrons, &vecRng, &pUnit, iNum](std::size_t iBegin, std::size_t iEnd)
+	{
+		for(std::size_t iCur=iBegin; iCur<iEnd;)
 		{
-			//tl::log_info("Algorithm: Violini (TOF)");
-			m_reso.flags &= ~CALC_R0;
-			resores_cur = calc_viol(m_tofreso);
+			const std::size_t iCurIter = iCur / iNum;
+			const std::size_t iPosOffs = iCur % iNum;
+			const std::size_t iLen = std::min(iEnd-iCur, iNum-iPosOffs);
+
+			mc_neutrons_pos<t_real>(vecEll[iCurIter], opts, pUnit.get(), iCurIter, iPosOffs, iLen,
+				neutrons, iCur, vecRng.size() ? &vecRng[iCurIter] : nullptr);
+			iCur += iLen;
 		}
-		else
+	};
+
+	if(bThreads)
+		get_worker_pool().ParallelFor(iNum*iIter, 0, fktRange);
+	else
+		fktRange(0, iNum*iIter);
+
+	return vecEll[0];
+}
+
+/**
+ * mc options with the scattering plane orientation and the quasi-mc shift of a position
+ */
+McNeutronOpts<t_mat> TASReso::GetPosOpts(const TASResoPos& pos) const
+{
+	McNeutronOpts<t_mat> opts = m_opts;
+	opts.dAngleQVec0 = pos.dAngleQVec0;
+	opts.iScramble = pos.iScramble;
+	return opts;
+}
+
+
+void TASReso::SetUnitBank(bool bUnitBank)
+{
+	m_bUnitBank = bUnitBank;
+
+	if(!m_bUnitBank)
+		m_pUnitBank.reset();
+	else if(!m_pUnitBank)
+		m_pUnitBank = std::make_shared<std::shared_ptr<const McUnitBank>>();
+}
+
+
+/**
+ * unit-sphere bank with iNumPerPos neutrons for each of the iNumPos sample positions,
+ * drawn with the sampler settings of the position given in opts.
+ * it is drawn only once and then reused for all scan points (and fits) and all copies of this object.
+ * returns nullptr if the bank is not used.
+ */
+std::shared_ptr<const McUnitBank> TASReso::GetUnitNeutrons(std::size_t iNumPerPos, std::size_t iNumPos,
+	const McNeutronOpts<t_mat>& opts) const
+{
+	if(!m_bUnitBank || !m_pUnitBank || iNumPerPos == 0 || iNumPos == 0)
+		return nullptr;
+
+	auto fktMatches = [this, &opts, iNumPerPos, iNumPos](const std::shared_ptr<const McUnitBank>& pBank) -> bool
+	{
+		return pBank && pBank->iNumPerPos == iNumPerPos && pBank->iNumPos == iNumPos &&
+			pBank->sampler == opts.sampler && pBank->iScramble == opts.iScramble &&
+			pBank->iSeed == m_iRngSeed;
+	};
+
+	std::shared_ptr<const McUnitBank>& pShared = *m_pUnitBank;
+	std::shared_ptr<const McUnitBank> pBank = std::atomic_load(&pShared);
+	if(fktMatches(pBank))
+		return pBank;
+
+	static std::mutex s_mtx;
+	std::lock_guard<std::mutex> lock(s_mtx);
+
+	// another thread or copy may have drawn it in the meantime
+	pBank = std::atomic_load(&pShared);
+	if(fktMatches(pBank))
+		return pBank;
+
+	std::shared_ptr<McUnitBank> pNewBank = std::make_shared<McUnitBank>();
+	pNewBank->iNumPerPos = iNumPerPos;
+	pNewBank->iNumPos = iNumPos;
+	pNewBank->sampler = opts.sampler;
+	pNewBank->iScramble = opts.iScramble;
+	pNewBank->iSeed = m_iRngSeed;
+	pNewBank->neutrons.resize(iNumPerPos*iNumPos);
+
+	// the streams of point 0 are used for all points
+	const std::vector<McRngStream> vecRng = GetRngStreams(0, iNumPos);
+	get_worker_pool().ParallelFor(iNumPos, 0,
+		[&opts, &pNewBank, &vecRng, iNumPerPos](std::size_t iBegin, std::size_t iEnd)
+	{
+		for(std::size_t iPos=iBegin; iPos<iEnd; ++iPos)
 		{
-			const char* pcErr = "Unknown algorithm selected.";
-			tl::log_err(pcErr);
-			resores_cur.strErr = pcErr;
-			resores_cur.bOk = false;
-			return false;
+			mc_unit_neutrons<t_mat>(iNumPerPos, opts, pNewBank->neutrons, iPos*iNumPerPos,
+				0, vecRng.size() ? &vecRng[iPos] : nullptr);
 		}
+	});
+
+	pBank = pNewBank;
+	std::atomic_store(&pShared, pBank);
+	return pBank;
+}
+
+
+/**
+ * iNum neutrons [iSeqOffs, iSeqOffs+iNum) of a sample position, written to the bank at iOffs;
+ * the ones covered by the unit bank are mapped from it, the others are drawn
+ */
+template<class t_real_bank>
+static void mc_neutrons_pos(const Ellipsoid4d<t_real>& ell4d, const McNeutronOpts<t_mat>& opts,
+	const McUnitBank* pUnit, std::size_t iPos, std::size_t iSeqOffs, std::size_t iNum,
+	McNeutrons<t_real_bank>& neutrons, std::size_t iOffs, const McRngStream* pRng)
+{
+	std::size_t iNumUnit = 0;
+	if(pUnit && iPos < pUnit->iNumPos && iSeqOffs < pUnit->iNumPerPos)
+		iNumUnit = std::min(iNum, pUnit->iNumPerPos - iSeqOffs);
+
+	if(iNumUnit)
+	{
+		mc_neutrons_warp<t_vec, t_mat>(ell4d, iNumUnit, opts, pUnit->neutrons,
+			iPos*pUnit->iNumPerPos + iSeqOffs, neutrons, iOffs);
+	}
+
+	if(iNumUnit < iNum)
+	{
+		mc_neutrons<t_vec>(ell4d, iNum-iNumUnit, opts, neutrons,
+			iOffs+iNumUnit, iSeqOffs+iNumUnit, pRng);
+	}
+}
 
-		if(!resores_cur.bOk)
+
+/**
+ * fused mc convolution: the neutrons are generated in small blocks which are
+ * evaluated right away, so the memory does not grow with the number of neutrons.
+ *
+ * in adaptive mode, further neutrons are generated until the statistical
+ * error of the mean reaches the target relative error or the upper limit
+ */
+bool TASReso::ConvoMC(std::size_t iNum, const ConvoCallbacks& fkts, McConvoResult& res,
+	const ConvoOpts& convo) const
+{
+	return ConvoMC(m_ell4d, m_opts, m_iRngPoint, iNum, fkts, res, convo);
+}
+
+/**
+ * convolution at a position calculated by CalcHKLE or CalcHKLEScan.
+ *
+ * if importance sampling is enabled, the neutron energies are moved
+ * towards the dispersion branches given by convo.fktDisp.
+ * with the cubature method selected, ConvoCubature is used instead,
+ * with the analytic method ConvoAnalytic, if the model gives its lines in fkts.fktLines.
+ *
+ * the partial sums are formed over fixed blocks of MC_REDUCE_BLOCK neutrons and
+ * added up in order, so with counter-based random numbers (see SetRngSeed)
+ * the result does not depend on the number of threads.
+ */
+bool TASReso::ConvoMC(const TASResoPos& pos, std::size_t iNum, const ConvoCallbacks& fkts,
+	McConvoResult& res, const ConvoOpts& convo) const
+{
+	if(!pos.bOk)
+		return false;
+	return ConvoMC(pos.ell4d, GetPosOpts(pos), pos.iRngPoint, iNum, fkts, res, convo);
+}
+
+
+/**
+ * generates, weights and evaluates iBlockLen neutrons in the precision of the bank
+ * and adds them to the partial sums of the iNumRed reduction blocks at pPart;
+ * the sums are always formed in double precision.
+ * the same neutrons are passed to all iNumEval models, the partial sums
+ * of model i start at pPart + i*iEvalStride.
+ */
+template<class t_real_bank, class t_fkt>
+static void convo_block(const Ellipsoid4d<t_real>& ell4d, const McNeutronOpts<t_mat>& opts,
+	const McImportance<t_real>* pImp, const McRngStream* pRng,
+	const McUnitBank* pUnit, std::size_t iPos, std::size_t iSeqOffs,
+	std::size_t iBlockLen, std::size_t iNumRed,
+	const t_fkt* pEval, std::size_t iNumEval, std::size_t iEvalStride, t_real* pPart)
+{
+	// block of the current thread, reused for all convolutions
+	thread_local McNeutrons<t_real_bank> block;
+	thread_local std::vector<t_real_bank> vecS, vecW;
+	block.resize(MC_CONVO_BLOCK);
+	vecS.resize(MC_CONVO_BLOCK);
+	if(pImp)
+		vecW.resize(MC_CONVO_BLOCK);
+
+	mc_neutrons_pos<t_real_bank>(ell4d, opts, pUnit, iPos, iSeqOffs, iBlockLen, block, 0, pRng);
+	if(pImp)
+		mc_importance_block<t_real>(*pImp, block, iBlockLen, vecW.data(), pRng, iSeqOffs);
+
+	for(std::size_t iEval=0; iEval<iNumEval; ++iEval)
+	{
+		pEval[iEval](block, iBlockLen, vecS.data());
+
+		t_real *pPartEval = pPart + iEval*iEvalStride;
+		for(std::size_t iSub=0; iSub<iNumRed; ++iSub, pPartEval+=6)
 		{
-			tl::log_err("Error calculating resolution: ", resores_cur.strErr);
-			tl::log_debug("R0: ", resores_cur.dR0);
-			tl::log_debug("res: ", resores_cur.reso);
+			const std::size_t iSubBegin = iSub*MC_REDUCE_BLOCK;
+			const std::size_t iSubEnd = std::min(iSubBegin+MC_REDUCE_BLOCK, iBlockLen);
+
+			for(std::size_t iNeutr=iSubBegin; iNeutr<iSubEnd; ++iNeutr)
+			{
+				const t_real dW = pImp ? t_real(vecW[iNeutr]) : t_real(1);
+				const t_real dS = dW * t_real(vecS[iNeutr]);
+
+				pPartEval[0] += dS;
+				pPartEval[1] += dS*dS;
+				pPartEval[2] += dW*t_real(block.h[iNeutr]);
+				pPartEval[3] += dW*t_real(block.k[iNeutr]);
+				pPartEval[4] += dW*t_real(block.l[iNeutr]);
+				pPartEval[5] += dW*t_real(block.E[iNeutr]);
+			}
 		}
 	}
-	return resores.bOk;
 }
 
-Ellipsoid4d<t_real> TASReso::GenerateMC(std::size_t iNum, std::vector<t_vec>& vecNeutrons) const
+bool TASReso::ConvoMC(const std::vector<Ellipsoid4d<t_real>>& vecEll,
+	const McNeutronOpts<t_mat>& opts, std::uint32_t iRngPoint, std::size_t iNum,
+	const ConvoCallbacks& fkts, McConvoResult& res, const ConvoOpts& convo) const
 {
-	// number of iterations over random sample positions
-	std::size_t iIter = m_res.size();
-	if(vecNeutrons.size() != iNum*iIter)
-		vecNeutrons.resize(iNum*iIter);
+	if(m_method == ConvoMethod::CUBATURE)
+		return ConvoCubature(vecEll, opts, fkts.fktEval, res, convo);
+	if(m_method == ConvoMethod::ANALYTIC && ConvoAnalytic(vecEll, opts, fkts.fktLines, res))
+		return true;
+
+	std::vector<McConvoResult> vecRes;
+	bool bOk = ConvoMCMulti(vecEll, opts, iRngPoint, iNum, { fkts }, vecRes, convo);
+	res = vecRes[0];
+	return bOk;
+}
+
+
+/**
+ * multi-model convolution at a position calculated by CalcHKLE or CalcHKLEScan:
+ * the neutrons are generated only once and passed to all models in vecFkts,
+ * vecRes gets one result per model.
+ * the importance sampling (if enabled) uses the dispersion convo.fktDisp, e.g. that of
+ * the first model; the estimates of the other models stay unbiased.
+ * the single-precision path is only used if all models have a fktEvalFast.
+ * with the analytic method, the models with a fktLines are convoluted analytically,
+ * only the others share the mc neutrons.
+ */
+bool TASReso::ConvoMCMulti(const TASResoPos& pos, std::size_t iNum, const std::vector<ConvoCallbacks>& vecFkts,
+	std::vector<McConvoResult>& vecRes, const ConvoOpts& convo) const
+{
+	vecRes.assign(vecFkts.size(), McConvoResult());
+	if(!pos.bOk)
+		return false;
+
+	const McNeutronOpts<t_mat> opts = GetPosOpts(pos);
+
+	// the cubature nodes are cheap, so they are simply recalculated for each model
+	if(m_method == ConvoMethod::CUBATURE)
+	{
+		for(std::size_t iEval=0; iEval<vecFkts.size(); ++iEval)
+			if(!ConvoCubature(pos.ell4d, opts, vecFkts[iEval].fktEval, vecRes[iEval], convo))
+				return false;
+		return true;
+	}
+
+	if(m_method == ConvoMethod::ANALYTIC)
+	{
+		// remaining models for the mc convolution
+		std::vector<std::size_t> vecMCIdx;
+		std::vector<ConvoCallbacks> vecMCFkts;
+
+		for(std::size_t iEval=0; iEval<vecFkts.size(); ++iEval)
+		{
+			if(ConvoAnalytic(pos.ell4d, opts, vecFkts[iEval].fktLines, vecRes[iEval]))
+				continue;
 
-	Ellipsoid4d<t_real> ell4dret;
-	for(std::size_t iCurIter = 0; iCurIter<iIter; ++iCurIter)
+			vecMCIdx.push_back(iEval);
+			vecMCFkts.push_back(vecFkts[iEval]);
+		}
+
+		if(vecMCIdx.size() == 0)
+			return true;
+
+		std::vector<McConvoResult> vecMCRes;
+		bool bOk = ConvoMCMulti(pos.ell4d, opts, pos.iRngPoint, iNum, vecMCFkts, vecMCRes, convo);
+		for(std::size_t iMC=0; iMC<vecMCIdx.size(); ++iMC)
+			vecRes[vecMCIdx[iMC]] = vecMCRes[iMC];
+		return bOk;
+	}
+
+	return ConvoMCMulti(pos.ell4d, opts, pos.iRngPoint, iNum, vecFkts, vecRes, convo);
+}
+
+bool TASReso::ConvoMCMulti(const std::vector<Ellipsoid4d<t_real>>& vecEll,
+	const McNeutronOpts<t_mat>& opts, std::uint32_t iRngPoint, std::size_t iNum,
+	const std::vector<ConvoCallbacks>& vecFkts, std::vector<McConvoResult>& vecRes,
+	const ConvoOpts& convo) const
+{
+	const std::size_t iNumEval = vecFkts.size();
+	vecRes.assign(iNumEval, McConvoResult());
+	if(iNum == 0 || iNumEval == 0)
+		return true;
+
+	const t_fktDisp& fktDisp = convo.fktDisp;
+	const std::atomic<bool>* pStop = convo.pStop;
+
+	// only use single precision if all models support it
+	bool bFast = m_bSinglePrec;
+	std::vector<t_fktBlockEval> vecEval;
+	std::vector<t_fktBlockEvalFast> vecEvalFast;
+	for(const ConvoCallbacks& fkts : vecFkts)
+	{
+		vecEval.push_back(fkts.fktEval);
+		vecEvalFast.push_back(fkts.fktEvalFast);
+		if(!fkts.fktEvalFast)
+			bFast = false;
+	}
+
+	const std::size_t iNumPos = vecEll.size();
+	const std::vector<McRngStream> vecRng = GetRngStreams(iRngPoint, iNumPos);
+	const std::shared_ptr<const McUnitBank> pUnit = GetUnitNeutrons(iNum, iNumPos, opts);
+
+	// importance sampling for each sample position, the dispersion is only
+	// evaluated here and not in the (possibly threaded) neutron loop
+	std::vector<McImportance<t_real>> vecImp;
+	if(m_bImportance && fktDisp && opts.coords == McNeutronCoords::RLU && !opts.bCenter)
 	{
-		const ResoResults& resores = m_res[iCurIter];
+		vecImp.resize(iNumPos);
+		for(std::size_t iCurIter = 0; iCurIter<iNumPos; ++iCurIter)
+		{
+			t_real dMat[4][4], dTrans[4];
+			mc_neutron_trafo<t_mat>(vecEll[iCurIter], opts, dMat, dTrans);
+			mc_importance_init<t_real>(dMat, dTrans, fktDisp,
+				m_dImportanceMix, m_dImportanceWidth, vecImp[iCurIter]);
+		}
+	}
+
+	const bool bAdaptive = (m_dMCRelErr > t_real(0));
+	const std::size_t iMaxNum = bAdaptive ? std::max(iNum, m_iMCMaxNeutrons) : iNum;
 
-		Ellipsoid4d<t_real> ell4d = calc_res_ellipsoid4d<t_real>(
-			resores.reso, resores.reso_v, resores.reso_s, resores.Q_avg);
+	std::atomic<bool> bStopped(false);
+	std::vector<t_real> vecSum(iNumEval, 0.), vecSum2(iNumEval, 0.);
+	t_real dSumPos[4] = {0., 0., 0., 0.};
 
-		unsigned int iNumThreads = std::thread::hardware_concurrency();
-		std::size_t iNumPerThread = iNum / iNumThreads;
-		std::size_t iRemaining = iNum % iNumThreads;
+	// neutrons per sample position: already done and in the current round
+	std::size_t iDone = 0;
+	std::size_t iRound = iNum;
 
-		tl::ThreadPool<void()> tp(iNumThreads);
-		for(unsigned iThread=0; iThread<iNumThreads; ++iThread)
+	// partial sums of S, S^2 and the neutron positions per model and reduction block
+	std::vector<t_real> vecPart;
+
+	while(iRound > 0)
+	{
+		const std::size_t iRedPerPos = (iRound + MC_REDUCE_BLOCK-1) / MC_REDUCE_BLOCK;
+		const std::size_t iNumRed = iRedPerPos * iNumPos;
+		vecPart.assign(iNumEval*iNumRed*6, t_real(0));
+
+		// generates and evaluates the neutrons of the reduction blocks [iBegin, iEnd)
+		// of this round, the blocks of all sample positions are handled in one parallel loop
+		auto fktRange = [&vecEll, &opts, &vecImp, &vecRng, &pUnit, &vecPart, &vecEval, &vecEvalFast,
+			&bStopped, pStop, bFast, iDone, iRound, iRedPerPos, iNumRed, iNumEval]
+			(std::size_t iBegin, std::size_t iEnd) -> void
 		{
-			std::vector<t_vec>::iterator iterBegin = vecNeutrons.begin() + iNumPerThread*iThread + iCurIter*iNum;
-			std::size_t iNumNeutr = iNumPerThread;
-			if(iThread == iNumThreads-1)
-				iNumNeutr = iNumPerThread + iRemaining;
+			for(std::size_t iRed=iBegin; iRed<iEnd;)
+			{
+				if(bStopped.load() || (pStop && pStop->load()))
+				{
+					bStopped.store(true);
+					return;
+				}
+
+				// sample position and reduction blocks of this position which fit into a block
+				const std::size_t iCurIter = iRed / iRedPerPos;
+				const std::size_t iRedInPos = iRed % iRedPerPos;
+				const std::size_t iNumRedCur = std::min<std::size_t>(MC_CONVO_BLOCK/MC_REDUCE_BLOCK,
+					std::min(iEnd-iRed, iRedPerPos-iRedInPos));
+
+				// index of the block's first neutron in this round
+				const std::size_t iBlock = iRedInPos * MC_REDUCE_BLOCK;
+				const std::size_t iBlockLen = std::min(iNumRedCur*MC_REDUCE_BLOCK, iRound-iBlock);
+
+				const McRngStream* pRng = vecRng.size() ? &vecRng[iCurIter] : nullptr;
+				const McImportance<t_real>* pImp = vecImp.size() ? &vecImp[iCurIter] : nullptr;
+				if(pImp && !pImp->bOk)
+					pImp = nullptr;
+
+				t_real *pPart = vecPart.data() + 6*iRed;
+				if(bFast)
+				{
+					convo_block<t_real_fast>(vecEll[iCurIter], opts, pImp, pRng,
+						pUnit.get(), iCurIter, iDone+iBlock, iBlockLen, iNumRedCur,
+						vecEvalFast.data(), iNumEval, 6*iNumRed, pPart);
+				}
+				else
+				{
+					convo_block<t_real>(vecEll[iCurIter], opts, pImp, pRng,
+						pUnit.get(), iCurIter, iDone+iBlock, iBlockLen, iNumRedCur,
+						vecEval.data(), iNumEval, 6*iNumRed, pPart);
+				}
+
+				iRed += iNumRedCur;
+			}
+		};
+
+		if(convo.bThreads)
+			get_worker_pool().ParallelFor(iNumRed, 0, fktRange);
+		else
+			fktRange(0, iNumRed);
+
+		if(bStopped.load())
+			return false;
 
-			tp.AddTask([iterBegin, iNumNeutr, this, &ell4d]()
-				{ mc_neutrons<t_vec>(ell4d, iNumNeutr, this->m_opts, iterBegin); });
+		for(std::size_t iEval=0; iEval<iNumEval; ++iEval)
+		{
+			for(std::size_t iRed=0; iRed<iNumRed; ++iRed)
+			{
+				const t_real *pPart = vecPart.data() + 6*(iEval*iNumRed + iRed);
+				vecSum[iEval] += pPart[0];
+				vecSum2[iEval] += pPart[1];
+
+				// the neutron positions are the same for all models
+				if(iEval == 0)
+				{
+					for(int iComp=0; iComp<4; ++iComp)
+						dSumPos[iComp] += pPart[2+iComp];
+				}
+			}
 		}
 
-		tp.StartTasks();
+		iDone += iRound;
 
-		auto& lstFut = tp.GetFutures();
-		for(auto& fut : lstFut)
-			fut.get();
+		// running means and their standard errors
+		const t_real dN = t_real(iDone * iNumPos);
+		bool bConverged = true;
+		t_real dMaxFact = 0.;
+		for(std::size_t iEval=0; iEval<iNumEval; ++iEval)
+		{
+			McConvoResult& res = vecRes[iEval];
+			res.dS = vecSum[iEval] / dN;
+			t_real dVar = (vecSum2[iEval]/dN - res.dS*res.dS) * (dN > 1. ? dN/(dN-1.) : 1.);
+			res.dSErr = std::sqrt(std::max(dVar, t_real(0)) / dN);
+
+			if(bAdaptive && res.dSErr > m_dMCRelErr*std::abs(res.dS))
+			{
+				bConverged = false;
+				if(res.dS != t_real(0))
+					dMaxFact = std::max(dMaxFact, res.dSErr / (m_dMCRelErr*std::abs(res.dS)));
+				else
+					dMaxFact = std::numeric_limits<t_real>::max();
+			}
+		}
+
+		// in adaptive mode, all models have to reach the target error
+		if(!bAdaptive || iDone >= iMaxNum)
+			break;
+		if(bConverged)
+			break;
+
+		// estimate the remaining neutrons needed, err ~ 1/sqrt(N)
+		std::size_t iNext = iMaxNum - iDone;
+		t_real dNeeded = t_real(iDone) * dMaxFact*dMaxFact * t_real(1.1);
+		if(dNeeded < t_real(iMaxNum))
+			iNext = std::max<std::size_t>(std::size_t(dNeeded), iDone+iNum/4) - iDone;
+		iRound = std::min(iNext, iMaxNum - iDone);
+	}
 
-		if(iCurIter == 0)
-			ell4dret = ell4d;
+	for(McConvoResult& res : vecRes)
+	{
+		res.iNumNeutrons = iDone * iNumPos;
+		for(int iComp=0; iComp<4; ++iComp)
+			res.dhklE_mean[iComp] = dSumPos[iComp] / t_real(res.iNumNeutrons);
 	}
 
-	//mc_neutrons<t_vec>(ell4d, iNum, m_opts, vecNeutrons.begin());
-	return ell4dret;
+	return true;
 }
 
-Ellipsoid4d<t_real> TASReso::GenerateMC_deferred(std::size_t iNum, std::vector<t_vec>& vecNeutrons) const
+
+/**
+ * deterministic convolution: gauss-hermite cubature over the principal axes
+ * of the resolution ellipsoid, the nodes are evaluated block-wise like mc neutrons.
+ * the result has no statistical error (apart from the random sample positions).
+ */
+bool TASReso::ConvoCubature(const t_fktBlockEval& fktEval, McConvoResult& res,
+	const ConvoOpts& convo) const
 {
-	// number of iterations over random sample positions
-	std::size_t iIter = m_res.size();
-	if(vecNeutrons.size() != iNum*iIter)
-		vecNeutrons.resize(iNum*iIter);
+	return ConvoCubature(m_ell4d, m_opts, fktEval, res, convo);
+}
+
+bool TASReso::ConvoCubature(const std::vector<Ellipsoid4d<t_real>>& vecEll,
+	const McNeutronOpts<t_mat>& opts, const t_fktBlockEval& fktEval, McConvoResult& res,
+	const ConvoOpts& convo) const
+{
+	const std::atomic<bool>* pStop = convo.pStop;
+
+	res = McConvoResult();
+
+	const std::size_t iNumPos = vecEll.size();
+	std::atomic<bool> bStopped(false);
 
-	Ellipsoid4d<t_real> ell4dret;
-	for(std::size_t iCurIter = 0; iCurIter<iIter; ++iCurIter)
+	// nodes of all sample positions, the weights are the same for all of them
+	std::vector<McNeutrons<t_real>> vecNodes(iNumPos);
+	std::vector<t_real> vecWeights;
+	std::size_t iNumNodes = 0;
+	for(std::size_t iCurIter = 0; iCurIter<iNumPos; ++iCurIter)
 	{
-		const ResoResults& resores = m_res[iCurIter];
+		iNumNodes = cubature_neutrons<t_vec, t_mat>(vecEll[iCurIter],
+			m_iCubatureOrder, opts, vecNodes[iCurIter], vecWeights);
+	}
+
+	// partial sums of S and the node positions per reduction block
+	const std::size_t iRedPerPos = (iNumNodes + MC_REDUCE_BLOCK-1) / MC_REDUCE_BLOCK;
+	const std::size_t iNumRed = iRedPerPos * iNumPos;
+	std::vector<t_real> vecPart(iNumRed*5, t_real(0));
+
+	// evaluates the nodes of the reduction blocks [iBegin, iEnd) of all sample positions
+	auto fktRange = [&vecNodes, &vecWeights, &vecPart, iNumNodes, iRedPerPos,
+		&fktEval, &bStopped, pStop](std::size_t iBegin, std::size_t iEnd) -> void
+	{
+		thread_local McNeutrons<t_real> block;
+		thread_local std::vector<t_real> vecS;
+		block.resize(MC_CONVO_BLOCK);
+		vecS.resize(MC_CONVO_BLOCK);
+
+		for(std::size_t iRed=iBegin; iRed<iEnd;)
+		{
+			if(bStopped.load() || (pStop && pStop->load()))
+			{
+				bStopped.store(true);
+				return;
+			}
+
+			const std::size_t iCurIter = iRed / iRedPerPos;
+			const std::size_t iRedInPos = iRed % iRedPerPos;
+			const std::size_t iNumRedCur = std::min<std::size_t>(MC_CONVO_BLOCK/MC_REDUCE_BLOCK,
+				std::min(iEnd-iRed, iRedPerPos-iRedInPos));
+
+			const McNeutrons<t_real>& nodes = vecNodes[iCurIter];
+			const std::size_t iBlock = iRedInPos * MC_REDUCE_BLOCK;
+			const std::size_t iBlockLen = std::min(iNumRedCur*MC_REDUCE_BLOCK, iNumNodes-iBlock);
+
+			for(int iComp=0; iComp<4; ++iComp)
+			{
+				const t_real *pNodes = nodes.data(iComp) + iBlock;
+				std::copy(pNodes, pNodes+iBlockLen, block.data(iComp));
+			}
+
+			fktEval(block, iBlockLen, vecS.data());
+
+			const t_real *pW = vecWeights.data() + iBlock;
+			for(std::size_t iSub=0; iSub<iNumRedCur; ++iSub)
+			{
+				t_real *pPart = vecPart.data() + 5*(iRed + iSub);
+				const std::size_t iSubBegin = iSub*MC_REDUCE_BLOCK;
+				const std::size_t iSubEnd = std::min(iSubBegin+MC_REDUCE_BLOCK, iBlockLen);
+
+				for(std::size_t iNode=iSubBegin; iNode<iSubEnd; ++iNode)
+				{
+					pPart[0] += pW[iNode]*vecS[iNode];
+					pPart[1] += pW[iNode]*block.h[iNode];
+					pPart[2] += pW[iNode]*block.k[iNode];
+					pPart[3] += pW[iNode]*block.l[iNode];
+					pPart[4] += pW[iNode]*block.E[iNode];
+				}
+			}
+
+			iRed += iNumRedCur;
+		}
+	};
 
-		Ellipsoid4d<t_real> ell4d = calc_res_ellipsoid4d<t_real>(
-			resores.reso, resores.reso_v, resores.reso_s, resores.Q_avg);
+	if(convo.bThreads)
+		get_worker_pool().ParallelFor(iNumRed, 0, fktRange);
+	else
+		fktRange(0, iNumRed);
 
-		std::vector<t_vec>::iterator iterBegin = vecNeutrons.begin() + iCurIter*iNum;
-		mc_neutrons<t_vec>(ell4d, iNum, m_opts, iterBegin);
+	if(bStopped.load())
+		return false;
 
-		if(iCurIter == 0)
-			ell4dret = ell4d;
+	t_real dSum = 0.;
+	t_real dSumPos[4] = {0., 0., 0., 0.};
+	for(std::size_t iRed=0; iRed<iNumRed; ++iRed)
+	{
+		const t_real *pPart = vecPart.data() + 5*iRed;
+		dSum += pPart[0];
+		for(int iComp=0; iComp<4; ++iComp)
+			dSumPos[iComp] += pPart[1+iComp];
 	}
 
-	return ell4dret;
+	res.iNumNeutrons = iNumNodes*iNumPos;
+
+	// the weights of each sample position sum to one
+	res.dS = dSum / t_real(iNumPos);
+	res.dSErr = 0.;
+	for(int iComp=0; iComp<4; ++iComp)
+		res.dhklE_mean[iComp] = dSumPos[iComp] / t_real(iNumPos);
+
+	return true;
+}
+
+
+/**
+ * analytic convolution for models which are a sum of lines along their dispersion
+ * branches, see analytic_convo. returns false, if the model has no lines or if its
+ * branches are too strongly curved over one of the ellipsoids, the caller then
+ * has to use mc instead.
+ */
+bool TASReso::ConvoAnalytic(const TASResoPos& pos, const t_fktLines& fktLines, McConvoResult& res) const
+{
+	if(!pos.bOk)
+		return false;
+	return ConvoAnalytic(pos.ell4d, GetPosOpts(pos), fktLines, res);
+}
+
+bool TASReso::ConvoAnalytic(const std::vector<Ellipsoid4d<t_real>>& vecEll,
+	const McNeutronOpts<t_mat>& opts, const t_fktLines& fktLines, McConvoResult& res) const
+{
+	res = McConvoResult();
+	if(!fktLines || vecEll.size() == 0)
+		return false;
+
+	t_real dSum = 0.;
+	t_real dSumPos[4] = {0., 0., 0., 0.};
+	for(const Ellipsoid4d<t_real>& ell : vecEll)
+	{
+		t_real dS = 0., dPos[4];
+		if(!analytic_convo<t_mat>(ell, opts, fktLines, m_dAnalyticMaxCurv, dS, dPos))
+			return false;
+
+		dSum += dS;
+		for(int iComp=0; iComp<4; ++iComp)
+			dSumPos[iComp] += dPos[iComp];
+	}
+
+	// no neutrons and no statistical error
+	const t_real dNumPos = t_real(vecEll.size());
+	res.dS = dSum / dNumPos;
+	for(int iComp=0; iComp<4; ++iComp)
+		res.dhklE_mean[iComp] = dSumPos[iComp] / dNumPos;
+
+	return true;
 }
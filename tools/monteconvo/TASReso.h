@@ -12,8 +12,16 @@
 #include "../res/viol.h"
 #include "../res/ellipse.h"
 #include "../res/mc.h"
+#include "../res/cubature.h"
+#include "../res/analytic.h"
 
 #include<vector>
+#include<array>
+#include<cstdint>
+#include<atomic>
+#include<functional>
+#include<tuple>
+#include<memory>
 
 
 enum class ResoFocus : unsigned
@@ -28,6 +36,72 @@ enum class ResoFocus : unsigned
 };
 
 
+enum class ConvoMethod : unsigned
+{
+	MC = 0,		// monte carlo neutrons
+	CUBATURE = 1,	// gauss-hermite cubature over the principal axes
+	ANALYTIC = 2	// linearised dispersion lines, falls back to mc
+};
+
+
+/**
+ * resolution state at one (hkl, E) position as calculated by
+ * TASReso::SetHKLE, TASReso::CalcHKLE or TASReso::CalcHKLEScan
+ */
+struct TASResoPos
+{
+	bool bOk = false;
+	std::vector<ResoResults> res;
+	std::vector<Ellipsoid4d<t_real_reso>> ell4d;	// one per sample position
+	t_real_reso dAngleQVec0 = 0;
+	std::uint32_t iScramble = 0;
+	std::uint32_t iRngPoint = 0;
+	std::size_t iFlags = 0;		// calculation flags used, e.g. CALC_R0
+};
+
+
+/**
+ * terms of the resolution algorithms which don't depend on the sample position,
+ * see calc_*_precalc; they are shared by all sample positions of a point and
+ * partly reused for the following points of a scan, e.g. the arm with fixed k
+ */
+struct TASResoPrecalc
+{
+	CNPrecalc cn;
+	PopPrecalc pop;
+	EckPrecalc eck;
+};
+
+
+/**
+ * standard normal variates which are mapped onto the resolution ellipsoids
+ * of all scan points, see TASReso::SetUnitBank
+ */
+struct McUnitBank
+{
+	McNeutrons<t_real_reso> neutrons;	// [sample position][neutron]
+	std::size_t iNumPerPos = 0;
+	std::size_t iNumPos = 0;
+
+	// sampler settings the bank was drawn with
+	McSampler sampler = McSampler::PSEUDO;
+	std::uint32_t iScramble = 0;
+	std::uint64_t iSeed = 0;
+};
+
+
+/**
+ * result of a fused mc convolution, see TASReso::ConvoMC
+ */
+struct McConvoResult
+{
+	t_real_reso dS = 0;				// mean S(q,w)
+	t_real_reso dSErr = 0;				// statistical error of the mean
+	t_real_reso dhklE_mean[4] = {0, 0, 0, 0};	// mean neutron position
+	std::size_t iNumNeutrons = 0;			// total, for all sample positions
+};
+
+
 class TASReso
 {
 protected:
@@ -40,10 +114,43 @@ protected:
 
 	// randomly smear out sample position if vector size >= 1
 	std::vector<ResoResults> m_res;
+	std::vector<Ellipsoid4d<t_real_reso>> m_ell4d;
+
+	// changes whenever the instrument parameters have changed, see Invalidate
+	std::size_t m_iResoId = 0;
 
 	bool m_bKiFix = 0;
 	t_real_reso m_dKFix = 1.4;
 
+	// adaptive neutron count: target relative error (0: off) and upper limit
+	t_real_reso m_dMCRelErr = 0;
+	std::size_t m_iMCMaxNeutrons = 0;
+
+	// importance sampling towards the dispersion branches
+	bool m_bImportance = 0;
+	t_real_reso m_dImportanceMix = 0.5;
+	t_real_reso m_dImportanceWidth = 0.25;
+
+	// seed of the counter-based random numbers (0: use the threads' engines)
+	// and identifier of the current scan point
+	std::uint64_t m_iRngSeed = 0;
+	std::uint32_t m_iRngPoint = 0;
+
+	// convolution method and points per principal axis for the cubature
+	ConvoMethod m_method = ConvoMethod::MC;
+	unsigned m_iCubatureOrder[4] = { 5, 5, 5, 5 };
+	// maximum curvature of the dispersion branches for the analytic method, relative to the line width
+	t_real_reso m_dAnalyticMaxCurv = 0.1;
+
+	// generate and evaluate the mc neutrons in single precision
+	bool m_bSinglePrec = 0;
+
+	// map one unit-sphere neutron bank onto the ellipsoids instead of drawing new neutrons;
+	// the holder is created by SetUnitBank and shared by the copies of this object,
+	// the bank in it is only replaced if its size or sampler settings change
+	bool m_bUnitBank = 0;
+	std::shared_ptr<std::shared_ptr<const McUnitBank>> m_pUnitBank;
+
 public:
 	TASReso();
 	TASReso(const TASReso& res);
@@ -58,24 +165,132 @@ public:
 		t_real_reso alpha, t_real_reso beta, t_real_reso gamma,
 		const ublas::vector<t_real_reso>& vec1, const ublas::vector<t_real_reso>& vec2);
 	bool SetHKLE(t_real_reso h, t_real_reso k, t_real_reso l, t_real_reso E);
+
+	// resolution at one or all (h, k, l, E) points of a scan without changing this object
+	bool CalcHKLE(t_real_reso h, t_real_reso k, t_real_reso l, t_real_reso E,
+		TASResoPos& pos, bool bThreads = true) const;
+	bool CalcHKLEScan(const std::vector<std::array<t_real_reso, 4>>& vecHKLE,
+		std::vector<TASResoPos>& vecPos, bool bThreads = true) const;
+
 	Ellipsoid4d<t_real_reso> GenerateMC(std::size_t iNum, std::vector<ublas::vector<t_real_reso>>&) const;
 	Ellipsoid4d<t_real_reso> GenerateMC_deferred(std::size_t iNum, std::vector<ublas::vector<t_real_reso>>&) const;
+	Ellipsoid4d<t_real_reso> GenerateMC(std::size_t iNum, McNeutrons<t_real_reso>&) const;
+	Ellipsoid4d<t_real_reso> GenerateMC_deferred(std::size_t iNum, McNeutrons<t_real_reso>&) const;
+	Ellipsoid4d<t_real_reso> GenerateMC(const TASResoPos& pos, std::size_t iNum,
+		McNeutrons<t_real_reso>&, bool bThreads = true) const;
+
+	// writes S(q,w) of the first iNum neutrons of a block to pS
+	using t_fktBlockEval = std::function<void(const McNeutrons<t_real_reso>&, std::size_t iNum, t_real_reso* pS)>;
+	// same in single precision, see SetSinglePrecision
+	using t_fktBlockEvalFast = std::function<void(const McNeutrons<t_real_fast>&, std::size_t iNum, t_real_fast* pS)>;
+
+	// dispersion branches E(Q) and weights for importance sampling, see SqwBase::disp
+	using t_fktDisp = std::function<std::tuple<std::vector<t_real_reso>, std::vector<t_real_reso>>
+		(t_real_reso h, t_real_reso k, t_real_reso l)>;
+
+	// branches, weights and line shape of a model for the analytic convolution,
+	// false if it is not a sum of lines along its branches, see SqwBase::lineshape
+	using t_fktLines = std::function<bool(t_real_reso h, t_real_reso k, t_real_reso l,
+		std::vector<t_real_reso>& vecE, std::vector<t_real_reso>& vecW,
+		t_real_reso& dSigma, t_real_reso& dHWHM)>;
+
+	// one S(q,w) model to convolve, only fktEval is required
+	struct ConvoCallbacks
+	{
+		t_fktBlockEval fktEval;
+		t_fktBlockEvalFast fktEvalFast;
+		t_fktLines fktLines;
+	};
+
+	// settings of a convolution which are not part of the resolution object
+	struct ConvoOpts
+	{
+		t_fktDisp fktDisp;			// for importance sampling
+		bool bThreads;
+		const std::atomic<bool>* pStop;		// cancels the calculation
+
+		// not with default member initialisers, these can't be used in the default arguments below
+		ConvoOpts() : bThreads(true), pStop(nullptr) {}
+	};
+
+	bool ConvoMC(std::size_t iNum, const ConvoCallbacks& fkts, McConvoResult& res,
+		const ConvoOpts& convo = ConvoOpts()) const;
+	bool ConvoMC(const TASResoPos& pos, std::size_t iNum, const ConvoCallbacks& fkts,
+		McConvoResult& res, const ConvoOpts& convo = ConvoOpts()) const;
+	// one pass over the neutrons for several S(q,w) models, one result per model
+	bool ConvoMCMulti(const TASResoPos& pos, std::size_t iNum, const std::vector<ConvoCallbacks>& vecFkts,
+		std::vector<McConvoResult>& vecRes, const ConvoOpts& convo = ConvoOpts()) const;
+	bool ConvoCubature(const t_fktBlockEval& fktEval, McConvoResult& res,
+		const ConvoOpts& convo = ConvoOpts()) const;
+	bool ConvoAnalytic(const TASResoPos& pos, const t_fktLines& fktLines, McConvoResult& res) const;
+
+	TASResoPos GetPos() const;
+	void SetPos(const TASResoPos& pos);
+	std::vector<t_real_reso> GetConfigKey() const;
 
 	void SetKiFix(bool bKiFix) { m_bKiFix = bKiFix; }
 	void SetKFix(t_real_reso dKFix) { m_dKFix = dKFix; }
 
 	void SetAlgo(ResoAlgo algo) { m_algo = algo; }
 	void SetOptimalFocus(ResoFocus foc) { m_foc = foc; }
+	void SetSampler(McSampler sampler) { m_opts.sampler = sampler; }
+	void SetAdaptiveMC(t_real_reso dRelErr, std::size_t iMaxNeutrons)
+	{ m_dMCRelErr = dRelErr; m_iMCMaxNeutrons = iMaxNeutrons; }
+	void SetImportanceSampling(bool bImportance, t_real_reso dMix = 0.5, t_real_reso dWidth = 0.25)
+	{ m_bImportance = bImportance; m_dImportanceMix = dMix; m_dImportanceWidth = dWidth; }
+	void SetRngSeed(std::uint64_t iSeed) { m_iRngSeed = iSeed; }
+	std::uint64_t GetRngSeed() const { return m_iRngSeed; }
+	void SetConvoMethod(ConvoMethod method) { m_method = method; }
+	ConvoMethod GetConvoMethod() const { return m_method; }
+	void SetCubatureOrder(const std::vector<unsigned>& vecOrder);
+	void SetAnalyticMaxCurvature(t_real_reso dMaxCurv) { m_dAnalyticMaxCurv = dMaxCurv; }
+	void SetSinglePrecision(bool bSinglePrec) { m_bSinglePrec = bSinglePrec; }
+	bool GetSinglePrecision() const { return m_bSinglePrec; }
+	void SetUnitBank(bool bUnitBank);
+	bool GetUnitBank() const { return m_bUnitBank; }
 
 	const EckParams& GetResoParams() const { return m_reso; }
 	const ViolParams& GetTofResoParams() const { return m_tofreso; }
 	const McNeutronOpts<ublas::matrix<t_real_reso>>& GetMCOpts() const { return m_opts; }
-	EckParams& GetResoParams() { return m_reso; }
-	ViolParams& GetTofResoParams() { return m_tofreso; }
+	// the parameters can be changed through these, so cached resolutions are invalidated
+	EckParams& GetResoParams() { NewResoId(); return m_reso; }
+	ViolParams& GetTofResoParams() { NewResoId(); return m_tofreso; }
+	// marks the instrument parameters as changed, so that cached resolutions are not reused
+	void Invalidate() { NewResoId(); }
 
 	const ResoResults& GetResoResults() const { return m_res[0]; }
+	std::size_t GetRandomSamplePos() const { return m_res.size(); }
+
+	void SetRandomSamplePos(std::size_t iNum) { m_res.resize(iNum); m_ell4d.resize(iNum); }
+
+protected:
+	void NewResoId();
+	McRngStream GetRngStream(std::uint32_t iPoint, std::size_t iPos) const;
+	std::vector<McRngStream> GetRngStreams(std::uint32_t iPoint, std::size_t iNumPos) const;
+	McNeutronOpts<ublas::matrix<t_real_reso>> GetPosOpts(const TASResoPos& pos) const;
+	std::shared_ptr<const McUnitBank> GetUnitNeutrons(std::size_t iNumPerPos, std::size_t iNumPos,
+		const McNeutronOpts<ublas::matrix<t_real_reso>>& opts) const;
+
+	bool CalcHKLE(t_real_reso h, t_real_reso k, t_real_reso l, t_real_reso E, TASResoPos& pos,
+		EckParams& reso, ViolParams& tofreso, bool bThreads, TASResoPrecalc* pPre = nullptr) const;
 
-	void SetRandomSamplePos(std::size_t iNum) { m_res.resize(iNum); }
+	// work on the ellipsoids and options of a given position
+	Ellipsoid4d<t_real_reso> GenerateMC(const std::vector<Ellipsoid4d<t_real_reso>>& vecEll,
+		const McNeutronOpts<ublas::matrix<t_real_reso>>& opts, std::uint32_t iRngPoint,
+		std::size_t iNum, McNeutrons<t_real_reso>& neutrons, bool bThreads) const;
+	bool ConvoMC(const std::vector<Ellipsoid4d<t_real_reso>>& vecEll,
+		const McNeutronOpts<ublas::matrix<t_real_reso>>& opts, std::uint32_t iRngPoint, std::size_t iNum,
+		const ConvoCallbacks& fkts, McConvoResult& res, const ConvoOpts& convo) const;
+	bool ConvoMCMulti(const std::vector<Ellipsoid4d<t_real_reso>>& vecEll,
+		const McNeutronOpts<ublas::matrix<t_real_reso>>& opts, std::uint32_t iRngPoint, std::size_t iNum,
+		const std::vector<ConvoCallbacks>& vecFkts, std::vector<McConvoResult>& vecRes,
+		const ConvoOpts& convo) const;
+	bool ConvoCubature(const std::vector<Ellipsoid4d<t_real_reso>>& vecEll,
+		const McNeutronOpts<ublas::matrix<t_real_reso>>& opts, const t_fktBlockEval& fktEval,
+		McConvoResult& res, const ConvoOpts& convo) const;
+	bool ConvoAnalytic(const std::vector<Ellipsoid4d<t_real_reso>>& vecEll,
+		const McNeutronOpts<ublas::matrix<t_real_reso>>& opts, const t_fktLines& fktLines,
+		McConvoResult& res) const;
 };
 
 #endif
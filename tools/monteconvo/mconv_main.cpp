@@ -11,6 +11,9 @@
 #include <fstream>
 #include <memory>
 #include <unordered_map>
+#include <array>
+#include <vector>
+#include <string>
 
 #include "tlibs/string/string.h"
 #include "tlibs/log/log.h"
@@ -18,6 +21,7 @@
 #include "TASReso.h"
 #include "sqw.h"
 #include "../res/defs.h"
+#include "libs/workers.h"
 
 using t_real = t_real_reso;
 
@@ -28,7 +32,11 @@ static inline void usage(const char* pcProg)
 	ostr << "Usage: "
 		<< "\n\t(1), single point: " << pcProg << " <mc neutron file> <S(Q,w) file>"
 		<< "\n\t(2), phonon model: " << pcProg << " <resolution file> <crystal file> <steps file> <out file>"
-		<< "\n\t(3), S(q,w) file:  " << pcProg << " <resolution file> <crystal file> <S(Q,w) file> <steps file> <out file>";
+		<< "\n\t(3), S(q,w) file:  " << pcProg << " <resolution file> <crystal file> <S(Q,w) file> <steps file> <out file>"
+		<< "\n\t(4), S(q,w) files: " << pcProg << " <resolution file> <crystal file> <S(Q,w) file 1> ... <S(Q,w) file n> <steps file> <out file>"
+		<< "\nOptions:"
+		<< "\n\t--max-threads=<n>   maximum number of worker threads (0: all cores)"
+		<< "\n\t--pin-threads       pin the worker threads to the cores";
 
 	tl::log_err("Wrong arguments.\n", ostr.str());
 }
@@ -106,8 +114,12 @@ static inline int monteconvo_simple(const char* pcNeutrons, const char* pcSqw)
 }
 
 
+/**
+ * convolution of one or several S(q,w) models (phonon model if vecSqw is empty),
+ * all models are evaluated with the same neutrons
+ */
 static inline int monteconvo(const char* pcRes, const char* pcCrys,
-	const char* pcSqw, const char* pcSteps, const char* pcOut)
+	const std::vector<const char*>& vecSqw, const char* pcSteps, const char* pcOut)
 {
 	TASReso reso;
 	tl::log_info("Loading resolution file \"", pcRes, "\".");
@@ -148,6 +160,72 @@ static inline int monteconvo(const char* pcRes, const char* pcCrys,
 
 		reso.SetKiFix(bFixedKi);
 		reso.SetKFix(dKFix);
+
+		// optional: "pseudo", "sobol" or "stratified"
+		auto iterSampler = steps.GetHeader().find("sampler");
+		if(iterSampler != steps.GetHeader().end())
+		{
+			std::string strSampler = tl::trimmed(iterSampler->second);
+			if(strSampler == "sobol")
+				reso.SetSampler(McSampler::SOBOL);
+			else if(strSampler == "stratified")
+				reso.SetSampler(McSampler::STRATIFIED);
+			else if(strSampler != "pseudo")
+				tl::log_warn("Unknown sampler \"", strSampler, "\", using pseudo-random numbers.");
+		}
+
+		// optional: adaptive neutron count
+		auto iterErr = steps.GetHeader().find("target_error");
+		if(iterErr != steps.GetHeader().end())
+		{
+			t_real dTargetErr = tl::str_to_var<t_real>(iterErr->second);
+			unsigned int iMaxNeutrons = 0;
+			auto iterMax = steps.GetHeader().find("max_neutrons");
+			if(iterMax != steps.GetHeader().end())
+				iMaxNeutrons = tl::str_to_var<unsigned int>(iterMax->second);
+
+			reso.SetAdaptiveMC(dTargetErr, iMaxNeutrons);
+		}
+
+		// optional: importance sampling towards the dispersion branches
+		auto iterImp = steps.GetHeader().find("importance");
+		if(iterImp != steps.GetHeader().end())
+			reso.SetImportanceSampling(tl::str_to_var<bool>(iterImp->second));
+
+		// optional: seed of the counter-based random numbers for reproducible runs
+		auto iterSeed = steps.GetHeader().find("seed");
+		if(iterSeed != steps.GetHeader().end())
+			reso.SetRngSeed(tl::str_to_var<std::uint64_t>(iterSeed->second));
+
+		// optional: generate and evaluate the neutrons in single precision
+		auto iterSinglePrec = steps.GetHeader().find("single_precision");
+		if(iterSinglePrec != steps.GetHeader().end())
+			reso.SetSinglePrecision(tl::str_to_var<bool>(iterSinglePrec->second));
+
+		// optional: map one unit-sphere neutron bank onto the ellipsoids of all points
+		auto iterUnitBank = steps.GetHeader().find("unit_bank");
+		if(iterUnitBank != steps.GetHeader().end())
+			reso.SetUnitBank(tl::str_to_var<bool>(iterUnitBank->second));
+
+		// optional: "mc", "cubature" or "analytic" and the cubature points per principal axis
+		auto iterMethod = steps.GetHeader().find("method");
+		if(iterMethod != steps.GetHeader().end())
+		{
+			std::string strMethod = tl::trimmed(iterMethod->second);
+			if(strMethod == "cubature")
+				reso.SetConvoMethod(ConvoMethod::CUBATURE);
+			else if(strMethod == "analytic")
+				reso.SetConvoMethod(ConvoMethod::ANALYTIC);
+			else if(strMethod != "mc")
+				tl::log_warn("Unknown convolution method \"", strMethod, "\", using monte carlo.");
+		}
+		auto iterCubOrder = steps.GetHeader().find("cubature_order");
+		if(iterCubOrder != steps.GetHeader().end())
+		{
+			std::vector<unsigned> vecCubOrder;
+			tl::get_tokens<unsigned, std::string>(iterCubOrder->second, " \t,;", vecCubOrder);
+			reso.SetCubatureOrder(vecCubOrder);
+		}
 	}
 	catch(const std::out_of_range& ex)
 	{
@@ -159,18 +237,18 @@ static inline int monteconvo(const char* pcRes, const char* pcCrys,
 	tl::log_info("Number of neutrons: ", iNumNeutrons);
 
 
-	std::shared_ptr<SqwBase> ptrSqw;
-	//std::shared_ptr<SqwBase> ptrSqw(new SqwElast());
+	std::vector<std::shared_ptr<SqwBase>> vecSqwModels;
+	//vecSqwModels.emplace_back(new SqwElast());
 
-	if(pcSqw)
+	for(const char* pcSqw : vecSqw)
 	{
 		tl::log_info("Loading S(Q,w) file \"", pcSqw, "\".");
-		ptrSqw.reset(new SqwKdTree(pcSqw));
+		vecSqwModels.emplace_back(new SqwKdTree(pcSqw));
 	}
-	else
+	if(vecSqwModels.empty())
 	{
 		tl::log_info("Using phonon model.");
-		ptrSqw.reset(new SqwPhonon(tl::make_vec({4.,4.,0}),
+		vecSqwModels.emplace_back(new SqwPhonon(tl::make_vec({4.,4.,0}),
 				tl::make_vec({0.,0.,1.}), tl::make_vec({1.,-1.,0.}),
 				40., M_PI/2., 0.5, 0.5, 1.,
 				12., M_PI/2., 0.5, 0.5, 1.,
@@ -178,22 +256,63 @@ static inline int monteconvo(const char* pcRes, const char* pcCrys,
 				100.));
 	}
 
-
-	SqwBase *psqw = ptrSqw.get();
-
-	if(!psqw->IsOk())
+	for(const std::shared_ptr<SqwBase>& ptrSqw : vecSqwModels)
 	{
-		tl::log_err("Cannot init Sqw.");
-		return -4;
+		if(!ptrSqw->IsOk())
+		{
+			tl::log_err("Cannot init Sqw.");
+			return -4;
+		}
 	}
+	const std::size_t iNumModels = vecSqwModels.size();
 
 
 	std::ofstream ofstrOut(pcOut);
 	ofstrOut << "#\n";
-	ofstrOut << "# Format: h k l E S\n";
+	if(iNumModels == 1)
+		ofstrOut << "# Format: h k l E S S_err\n";
+	else
+		ofstrOut << "# Format: h k l E S_1 S_err_1 ... S_" << iNumModels << " S_err_" << iNumModels << "\n";
+	for(std::size_t iModel=0; iModel<vecSqw.size() && iNumModels>1; ++iModel)
+		ofstrOut << "# Model " << iModel+1 << ": " << vecSqw[iModel] << "\n";
 	ofstrOut << "#\n";
 
-	std::vector<ublas::vector<t_real>> vecNeutrons;
+	// evaluate S(q,w) for the first iNum neutrons of a block, one set of functions per model
+	std::vector<TASReso::ConvoCallbacks> vecFkts;
+	for(const std::shared_ptr<SqwBase>& ptrSqw : vecSqwModels)
+	{
+		SqwBase *psqw = ptrSqw.get();
+
+		TASReso::ConvoCallbacks fkts;
+		fkts.fktEval = [psqw](const McNeutrons<t_real>& block, std::size_t iNum, t_real *pS)
+		{
+			psqw->EvalBlock(block.h.data(), block.k.data(), block.l.data(), block.E.data(), iNum, pS);
+		};
+		fkts.fktEvalFast = [psqw](const McNeutrons<t_real_fast>& block, std::size_t iNum, t_real_fast *pS)
+		{
+			psqw->EvalFast(block.h.data(), block.k.data(), block.l.data(), block.E.data(), iNum, pS);
+		};
+		fkts.fktLines = psqw->GetLinesFunc();
+		vecFkts.push_back(fkts);
+	}
+
+	// importance sampling follows the dispersion of the first model
+	SqwBase *psqwDisp = vecSqwModels[0].get();
+	TASReso::ConvoOpts convo;
+	convo.fktDisp = [psqwDisp](t_real h, t_real k, t_real l)
+	{
+		return psqwDisp->disp(h, k, l);
+	};
+
+	// resolution at all scan points
+	std::vector<std::array<t_real, 4>> vecHKLE;
+	vecHKLE.reserve(iNumSteps);
+	for(unsigned int iStep=0; iStep<iNumSteps; ++iStep)
+		vecHKLE.push_back({{ pH[iStep], pK[iStep], pL[iStep], pE[iStep] }});
+
+	std::vector<TASResoPos> vecPos;
+	reso.CalcHKLEScan(vecHKLE, vecPos);
+
 	for(unsigned int iStep=0; iStep<iNumSteps; ++iStep)
 	{
 		t_real dProgress = t_real(iStep)/t_real(iNumSteps)*100.;
@@ -201,46 +320,45 @@ static inline int monteconvo(const char* pcRes, const char* pcCrys,
 		tl::log_info("------------------------------------------------------------");
 		tl::log_info("Step ", iStep+1, " of ", iNumSteps, ".");
 		tl::log_info("Q = (", pH[iStep], " ", pK[iStep], " ", pL[iStep], "), E = ", pE[iStep], " meV.");
-		if(!reso.SetHKLE(pH[iStep], pK[iStep], pL[iStep], pE[iStep]))
+		if(!vecPos[iStep].bOk)
 		{
 			tl::log_err("Invalid position.");
 			break;
 		}
 
-		std::cout <<"\x1b]0;"
-			<< std::setprecision(3) << dProgress <<  "%"
-			<< " - generating MC neutrons"
-			<< "\x07" << std::flush;
-		Ellipsoid4d<t_real> elli = reso.GenerateMC(iNumNeutrons, vecNeutrons);
-
-		t_real dS = 0.;
-		t_real dhklE_mean[4] = {0., 0., 0., 0.};
-
 		std::cout <<"\x1b]0;"
 			<< std::setprecision(3) << dProgress <<  "%"
 			<< " - calculating S(q,w)"
 			<< "\x07" << std::flush;
-		for(const ublas::vector<t_real>& vecHKLE : vecNeutrons)
-		{
-			dS += (*psqw)(vecHKLE[0], vecHKLE[1], vecHKLE[2], vecHKLE[3]);
-
-			for(int i=0; i<4; ++i)
-				dhklE_mean[i] += vecHKLE[i];
-		}
 
-		dS /= t_real(iNumNeutrons);
-		for(int i=0; i<4; ++i)
-			dhklE_mean[i] /= t_real(iNumNeutrons);
+		// generates the neutrons block-wise and evaluates them right away for all models
+		std::vector<McConvoResult> vecRes;
+		reso.ConvoMCMulti(vecPos[iStep], iNumNeutrons, vecFkts, vecRes, convo);
 
 		ofstrOut.precision(16);
 		ofstrOut << std::left << std::setw(20) << pH[iStep] << " "
 			<< std::left << std::setw(20) << pK[iStep] << " "
 			<< std::left << std::setw(20) << pL[iStep] << " "
-			<< std::left << std::setw(20) << pE[iStep] << " "
-			<< std::left << std::setw(20) << dS << "\n";
+			<< std::left << std::setw(20) << pE[iStep] << " ";
 
+		const t_real *dhklE_mean = vecRes[0].dhklE_mean;
 		tl::log_info("Mean position: Q = (", dhklE_mean[0], " ", dhklE_mean[1], " ", dhklE_mean[2], "), E = ", dhklE_mean[3], " meV.");
-		tl::log_info("S(", pH[iStep], ", ", pK[iStep],  ", ", pL[iStep], ", ", pE[iStep], ") = ", dS);
+
+		for(std::size_t iModel=0; iModel<iNumModels; ++iModel)
+		{
+			const McConvoResult& res = vecRes[iModel];
+
+			// same normalisation as before: per neutron of one sample position
+			t_real dS = res.dS * t_real(reso.GetRandomSamplePos());
+			t_real dSErr = res.dSErr * t_real(reso.GetRandomSamplePos());
+
+			ofstrOut << std::left << std::setw(20) << dS << " "
+				<< std::left << std::setw(20) << dSErr << " ";
+
+			tl::log_info("Model ", iModel+1, ": S(", pH[iStep], ", ", pK[iStep],  ", ", pL[iStep], ", ", pE[iStep], ") = ", dS,
+				" +- ", dSErr, " (", res.iNumNeutrons, " neutrons).");
+		}
+		ofstrOut << "\n";
 	}
 	std::cout <<"\x1b]0;" << "100%" << "\x07" << std::flush;
 
@@ -261,26 +379,40 @@ int main(int argc, char** argv)
 	std::setlocale(LC_ALL, "C");
 	QLocale::setDefault(QLocale::English);
 
-	if(argc == 3)
+	// options of the worker pool
+	std::vector<const char*> vecArgs = { argv[0] };
+	for(int iArg=1; iArg<argc; ++iArg)
+	{
+		const std::string strArg = argv[iArg];
+		if(strArg == "--pin-threads")
+			set_pin_threads(1);
+		else if(strArg.compare(0, 14, "--max-threads=") == 0)
+			set_max_threads(tl::str_to_var<unsigned int>(strArg.substr(14)));
+		else
+			vecArgs.push_back(argv[iArg]);
+	}
+
+	if(vecArgs.size() == 3)
 	{
-		return monteconvo_simple(argv[1], argv[2]);
+		return monteconvo_simple(vecArgs[1], vecArgs[2]);
 	}
-	else if(argc==5)
+	else if(vecArgs.size() == 5)
 	{
-		const char *pcRes = argv[1];
-		const char *pcCrys = argv[2];
-		const char *pcSteps = argv[3];
-		const char *pcOut = argv[4];
-		return monteconvo(pcRes, pcCrys, 0, pcSteps, pcOut);
+		const char *pcRes = vecArgs[1];
+		const char *pcCrys = vecArgs[2];
+		const char *pcSteps = vecArgs[3];
+		const char *pcOut = vecArgs[4];
+		return monteconvo(pcRes, pcCrys, {}, pcSteps, pcOut);
 	}
-	else if(argc==6)
+	else if(vecArgs.size() >= 6)
 	{
-		const char *pcRes = argv[1];
-		const char *pcCrys = argv[2];
-		const char *pcSqw = argv[3];
-		const char *pcSteps = argv[4];
-		const char *pcOut = argv[5];
-		return monteconvo(pcRes, pcCrys, pcSqw, pcSteps, pcOut);
+		// one or several S(q,w) files between the crystal and the steps file
+		const char *pcRes = vecArgs[1];
+		const char *pcCrys = vecArgs[2];
+		std::vector<const char*> vecSqw(vecArgs.begin()+3, vecArgs.end()-2);
+		const char *pcSteps = vecArgs[vecArgs.size()-2];
+		const char *pcOut = vecArgs[vecArgs.size()-1];
+		return monteconvo(pcRes, pcCrys, vecSqw, pcSteps, pcOut);
 	}
 	else
 	{
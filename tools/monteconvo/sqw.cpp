@@ -13,6 +13,7 @@
 #include "tlibs/phys/neutrons.h"
 #include <fstream>
 #include <list>
+#include <algorithm>
 
 using t_real = t_real_reso;
 
@@ -89,6 +90,61 @@ t_real SqwElast::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 	}
 }
 
+/**
+ * S(Q,E) for a block of points in double or single precision
+ */
+template<class t_flt>
+void SqwElast::eval_block(const t_flt* pH, const t_flt* pK, const t_flt* pL,
+	const t_flt* pE, std::size_t iNum, t_flt* pS) const
+{
+	if(!m_bLoadedFromFile)	// use nearest integer bragg peak
+	{
+		const t_flt dSigmaQ = t_flt(0.02), dSigmaE = t_flt(0.02);
+
+		for(std::size_t i=0; i<iNum; ++i)
+		{
+			const t_flt dh = pH[i]-std::round(pH[i]);
+			const t_flt dk = pK[i]-std::round(pK[i]);
+			const t_flt dl = pL[i]-std::round(pL[i]);
+			const t_flt dDistQ = std::sqrt(dh*dh + dk*dk + dl*dl);
+
+			pS[i] = tl::gauss_model<t_flt>(dDistQ, t_flt(0), dSigmaQ, t_flt(1), t_flt(0)) *
+				tl::gauss_model<t_flt>(pE[i], t_flt(0), dSigmaE, t_flt(1), t_flt(0));
+		}
+	}
+	else	// use bragg peaks from config file
+	{
+		std::fill(pS, pS+iNum, t_flt(0));
+
+		for(const ElastPeak& pk : m_lstPeaks)
+		{
+			const t_flt h = t_flt(pk.h), k = t_flt(pk.k), l = t_flt(pk.l);
+			const t_flt dSigQ = t_flt(pk.dSigQ), dSigE = t_flt(pk.dSigE), dS = t_flt(pk.dS);
+
+			for(std::size_t i=0; i<iNum; ++i)
+			{
+				const t_flt dDistQ = std::sqrt((pH[i]-h)*(pH[i]-h) +
+					(pK[i]-k)*(pK[i]-k) + (pL[i]-l)*(pL[i]-l));
+
+				pS[i] += dS * tl::gauss_model<t_flt>(dDistQ, t_flt(0), dSigQ, t_flt(1), t_flt(0)) *
+					tl::gauss_model<t_flt>(pE[i], t_flt(0), dSigE, t_flt(1), t_flt(0));
+			}
+		}
+	}
+}
+
+void SqwElast::EvalBlock(const t_real* pH, const t_real* pK, const t_real* pL,
+	const t_real* pE, std::size_t iNum, t_real* pS) const
+{
+	eval_block<t_real>(pH, pK, pL, pE, iNum, pS);
+}
+
+void SqwElast::EvalFast(const t_real_fast* pH, const t_real_fast* pK, const t_real_fast* pL,
+	const t_real_fast* pE, std::size_t iNum, t_real_fast* pS) const
+{
+	eval_block<t_real_fast>(pH, pK, pL, pE, iNum, pS);
+}
+
 std::vector<SqwBase::t_var> SqwElast::GetVars() const
 {
 	std::vector<SqwBase::t_var> vecVars;
@@ -166,6 +222,25 @@ bool SqwKdTree::open(const char* pcFile)
 }
 
 
+/**
+ * S(Q,E) for a block of points, reusing the query point
+ */
+void SqwKdTree::EvalBlock(const t_real* pH, const t_real* pK, const t_real* pL,
+	const t_real* pE, std::size_t iNum, t_real* pS) const
+{
+	std::vector<t_real> vechklE(4);
+	for(std::size_t i=0; i<iNum; ++i)
+	{
+		vechklE[0] = pH[i]; vechklE[1] = pK[i];
+		vechklE[2] = pL[i]; vechklE[3] = pE[i];
+
+		if(!m_kd->IsPointInGrid(vechklE))
+			pS[i] = 0.;
+		else
+			pS[i] = m_kd->GetNearestNode(vechklE)[4];
+	}
+}
+
 t_real SqwKdTree::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 {
 	std::vector<t_real> vechklE = {dh, dk, dl, dE};
@@ -409,7 +484,27 @@ SqwPhonon::SqwPhonon(const char* pcFile)
 
 t_real SqwPhonon::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 {
-	std::vector<t_real> vechklE = {dh, dk, dl, dE};
+	return eval(std::vector<t_real>{dh, dk, dl, dE});
+}
+
+/**
+ * S(Q,E) for a block of points, reusing the query point
+ */
+void SqwPhonon::EvalBlock(const t_real* pH, const t_real* pK, const t_real* pL,
+	const t_real* pE, std::size_t iNum, t_real* pS) const
+{
+	std::vector<t_real> vechklE(4);
+	for(std::size_t i=0; i<iNum; ++i)
+	{
+		vechklE[0] = pH[i]; vechklE[1] = pK[i];
+		vechklE[2] = pL[i]; vechklE[3] = pE[i];
+		pS[i] = eval(vechklE);
+	}
+}
+
+t_real SqwPhonon::eval(const std::vector<t_real>& vechklE) const
+{
+	const t_real dE = vechklE[3];
 #ifdef USE_RTREE
 	if(!m_rt->IsPointInGrid(vechklE)) return 0.;
 	std::vector<t_real> vec = m_rt->GetNearestNode(vechklE);
@@ -650,6 +745,7 @@ SqwPhononSingleBranch::SqwPhononSingleBranch(const char* pcFile)
 			else if(vecToks[0] == "inc_sig") m_dIncSig = tl::str_to_var_parse<t_real>(vecToks[1]);
 
 			else if(vecToks[0] == "T") m_dT = tl::str_to_var_parse<t_real>(vecToks[1]);
+			else if(vecToks[0] == "line") m_iLine = tl::str_to_var<decltype(m_iLine)>(vecToks[1]);
 		}
 	}
 
@@ -661,7 +757,7 @@ SqwPhononSingleBranch::SqwPhononSingleBranch(const char* pcFile)
 }
 
 /**
- * dispersion E(Q)
+ * dispersion E(Q), with line shapes the weights include S0
  */
 std::tuple<std::vector<t_real>, std::vector<t_real>>
 SqwPhononSingleBranch::disp(t_real dh, t_real dk, t_real dl) const
@@ -672,25 +768,104 @@ SqwPhononSingleBranch::disp(t_real dh, t_real dk, t_real dl) const
 
 	t_real dq = std::sqrt(dh*dh + dk*dk + dl*dl);
 	t_real dE0 = phonon_disp(dq, m_damp, m_dfreq);
-	t_real dWeight = t_real(1);
+	t_real dWeight = m_iLine ? m_dS0 : t_real(1);
 
 	return std::make_tuple(std::vector<t_real>({dE0, -dE0}),
 		std::vector<t_real>({dWeight, dWeight}));
 }
 
+/**
+ * with gaussian or lorentzian lines (and without incoherent part),
+ * S(Q,E) is a sum of lines along the branches and can be convoluted analytically
+ */
+bool SqwPhononSingleBranch::lineshape(t_real& dSigma, t_real& dHWHM) const
+{
+	if(!tl::float_equal<t_real>(m_dIncAmp, 0.))
+		return false;
+
+	if(m_iLine == 1)
+	{
+		dSigma = m_dHWHM / tl::get_SIGMA2HWHM<t_real>();
+		dHWHM = 0.;
+		return true;
+	}
+	else if(m_iLine == 2)
+	{
+		dSigma = 0.;
+		dHWHM = m_dHWHM;
+		return true;
+	}
+
+	return false;
+}
+
 /**
  * dynamical structure factor S(Q,E)
  */
 t_real SqwPhononSingleBranch::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 {
-	std::vector<t_real> vecE0, vecW;
-	std::tie(vecE0, vecW) = disp(dh, dk, dl);
+	t_real dS = 0.;
+	eval_block<t_real>(&dh, &dk, &dl, &dE, 1, &dS);
+	return dS;
+}
 
-	t_real dInc = 0.;
-	if(!tl::float_equal<t_real>(m_dIncAmp, 0.))
-		dInc = tl::gauss_model<t_real>(dE, 0., m_dIncSig, m_dIncAmp, 0.);
+/**
+ * S(Q,E) for a block of points in double or single precision
+ */
+template<class t_flt>
+void SqwPhononSingleBranch::eval_block(const t_flt* pH, const t_flt* pK, const t_flt* pL,
+	const t_flt* pE, std::size_t iNum, t_flt* pS) const
+{
+	const t_flt G[3] = { t_flt(m_vecBragg[0]), t_flt(m_vecBragg[1]), t_flt(m_vecBragg[2]) };
+	const t_flt damp = t_flt(m_damp), dfreq = t_flt(m_dfreq);
+	const t_flt dHWHM = t_flt(m_dHWHM), dS0 = t_flt(m_dS0), dT = t_flt(m_dT);
+	const t_flt dIncAmp = t_flt(m_dIncAmp), dIncSig = t_flt(m_dIncSig);
+	const bool bInc = !tl::float_equal<t_real>(m_dIncAmp, 0.);
+
+	// area-normalised lines at +-E0
+	const t_flt dPi = tl::get_pi<t_flt>();
+	const t_flt dSig = dHWHM / tl::get_SIGMA2HWHM<t_flt>();
+	const t_flt dGaussNorm = dS0 / (std::sqrt(t_flt(2)*dPi) * dSig);
+	const t_flt dLorentzNorm = dS0 * dHWHM / dPi;
+
+	for(std::size_t i=0; i<iNum; ++i)
+	{
+		const t_flt dh = pH[i]-G[0], dk = pK[i]-G[1], dl = pL[i]-G[2];
+		const t_flt dq = std::sqrt(dh*dh + dk*dk + dl*dl);
+		const t_flt dE0 = std::abs(damp*std::sin(dq*dfreq));
+		const t_flt dxm = pE[i]-dE0, dxp = pE[i]+dE0;
+
+		t_flt dS;
+		if(m_iLine == 1)
+		{
+			dS = dGaussNorm * (std::exp(t_flt(-0.5)*dxm*dxm/(dSig*dSig)) +
+				std::exp(t_flt(-0.5)*dxp*dxp/(dSig*dSig)));
+		}
+		else if(m_iLine == 2)
+		{
+			dS = dLorentzNorm * (t_flt(1)/(dxm*dxm + dHWHM*dHWHM) +
+				t_flt(1)/(dxp*dxp + dHWHM*dHWHM));
+		}
+		else
+		{
+			dS = std::abs(tl::DHO_model<t_flt>(pE[i], dT, dE0, dHWHM, dS0, t_flt(0)));
+		}
+		if(bInc)
+			dS += tl::gauss_model<t_flt>(pE[i], t_flt(0), dIncSig, dIncAmp, t_flt(0));
+		pS[i] = dS;
+	}
+}
 
-	return std::abs(tl::DHO_model<t_real>(dE, m_dT, vecE0[0], m_dHWHM, m_dS0*vecW[0], 0.)) + dInc;
+void SqwPhononSingleBranch::EvalBlock(const t_real* pH, const t_real* pK, const t_real* pL,
+	const t_real* pE, std::size_t iNum, t_real* pS) const
+{
+	eval_block<t_real>(pH, pK, pL, pE, iNum, pS);
+}
+
+void SqwPhononSingleBranch::EvalFast(const t_real_fast* pH, const t_real_fast* pK, const t_real_fast* pL,
+	const t_real_fast* pE, std::size_t iNum, t_real_fast* pS) const
+{
+	eval_block<t_real_fast>(pH, pK, pL, pE, iNum, pS);
 }
 
 std::vector<SqwBase::t_var> SqwPhononSingleBranch::GetVars() const
@@ -708,6 +883,7 @@ std::vector<SqwBase::t_var> SqwPhononSingleBranch::GetVars() const
 	vecVars.push_back(SqwBase::t_var{"inc_sig", "real", tl::var_to_str(m_dIncSig)});
 
 	vecVars.push_back(SqwBase::t_var{"T", "real", tl::var_to_str(m_dT)});
+	vecVars.push_back(SqwBase::t_var{"line", "uint", tl::var_to_str(m_iLine)});
 
 	return vecVars;
 }
@@ -733,6 +909,7 @@ void SqwPhononSingleBranch::SetVars(const std::vector<SqwBase::t_var>& vecVars)
 		else if(strVar == "inc_sig") m_dIncSig = tl::str_to_var<decltype(m_dIncSig)>(strVal);
 
 		else if(strVar == "T") m_dT = tl::str_to_var<decltype(m_dT)>(strVal);
+		else if(strVar == "line") m_iLine = tl::str_to_var<decltype(m_iLine)>(strVal);
 	}
 }
 
@@ -752,6 +929,7 @@ SqwBase* SqwPhononSingleBranch::shallow_copy() const
 	pCpy->m_dIncSig = m_dIncSig;
 
 	pCpy->m_dT = m_dT;
+	pCpy->m_iLine = m_iLine;
 	return pCpy;
 }
 
@@ -860,6 +1038,52 @@ t_real SqwMagnon::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 	return dS + dInc;
 }
 
+/**
+ * S(Q,E) for a block of points in double or single precision
+ */
+template<class t_flt>
+void SqwMagnon::eval_block(const t_flt* pH, const t_flt* pK, const t_flt* pL,
+	const t_flt* pE, std::size_t iNum, t_flt* pS) const
+{
+	const t_flt G[3] = { t_flt(m_vecBragg[0]), t_flt(m_vecBragg[1]), t_flt(m_vecBragg[2]) };
+	const t_flt dD = t_flt(m_dD), dOffs = t_flt(m_dOffs);
+	const t_flt dHWHM = t_flt(m_dE_HWHM), dS0 = t_flt(m_dS0), dT = t_flt(m_dT);
+	const t_flt dIncAmp = t_flt(m_dIncAmp), dIncSig = t_flt(m_dIncSig);
+	const bool bInc = !tl::float_equal<t_real>(m_dIncAmp, 0.);
+	const bool bDisp = (m_iWhichDisp == 0 || m_iWhichDisp == 1);
+
+	for(std::size_t i=0; i<iNum; ++i)
+	{
+		t_flt dS = 0;
+
+		if(bDisp)
+		{
+			const t_flt dh = pH[i]-G[0], dk = pK[i]-G[1], dl = pL[i]-G[2];
+			const t_flt dq = std::sqrt(dh*dh + dk*dk + dl*dl);
+			const t_flt dE0 = (m_iWhichDisp == 0) ? dq*dq*dD + dOffs : dq*dD + dOffs;
+
+			dS = dS0 * (std::abs(tl::DHO_model<t_flt>(pE[i], dT, dE0, dHWHM, t_flt(1), t_flt(0))) +
+				std::abs(tl::DHO_model<t_flt>(pE[i], dT, -dE0, dHWHM, t_flt(1), t_flt(0))));
+		}
+
+		if(bInc)
+			dS += tl::gauss_model<t_flt>(pE[i], t_flt(0), dIncSig, dIncAmp, t_flt(0));
+		pS[i] = dS;
+	}
+}
+
+void SqwMagnon::EvalBlock(const t_real* pH, const t_real* pK, const t_real* pL,
+	const t_real* pE, std::size_t iNum, t_real* pS) const
+{
+	eval_block<t_real>(pH, pK, pL, pE, iNum, pS);
+}
+
+void SqwMagnon::EvalFast(const t_real_fast* pH, const t_real_fast* pK, const t_real_fast* pL,
+	const t_real_fast* pE, std::size_t iNum, t_real_fast* pS) const
+{
+	eval_block<t_real_fast>(pH, pK, pL, pE, iNum, pS);
+}
+
 std::vector<SqwBase::t_var> SqwMagnon::GetVars() const
 {
 	std::vector<SqwBase::t_var> vecVars;
@@ -48,10 +48,17 @@ protected:
 	bool m_bLoadedFromFile = false;
 	std::list<ElastPeak> m_lstPeaks;
 
+	template<class t_flt> void eval_block(const t_flt* pH, const t_flt* pK, const t_flt* pL,
+		const t_flt* pE, std::size_t iNum, t_flt* pS) const;
+
 public:
 	SqwElast() { SqwBase::m_bOk = true; }
 	SqwElast(const char* pcFile);
 	virtual t_real_reso operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void EvalBlock(const t_real_reso* pH, const t_real_reso* pK, const t_real_reso* pL,
+		const t_real_reso* pE, std::size_t iNum, t_real_reso* pS) const override;
+	virtual void EvalFast(const t_real_fast* pH, const t_real_fast* pK, const t_real_fast* pL,
+		const t_real_fast* pE, std::size_t iNum, t_real_fast* pS) const override;
 
 	void AddPeak(t_real_reso h, t_real_reso k, t_real_reso l, t_real_reso dSigQ, t_real_reso dSigE, t_real_reso dS);
 
@@ -80,6 +87,8 @@ public:
 
 	bool open(const char* pcFile);
 	virtual t_real_reso operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void EvalBlock(const t_real_reso* pH, const t_real_reso* pK, const t_real_reso* pL,
+		const t_real_reso* pE, std::size_t iNum, t_real_reso* pS) const override;
 
 	virtual std::vector<SqwBase::t_var> GetVars() const override;
 	virtual void SetVars(const std::vector<SqwBase::t_var>&) override;
@@ -104,6 +113,7 @@ protected:
 
 	void create();
 	void destroy();
+	t_real_reso eval(const std::vector<t_real_reso>& vechklE) const;
 
 protected:
 #ifdef USE_RTREE
@@ -141,6 +151,8 @@ public:
 	virtual ~SqwPhonon() = default;
 
 	virtual t_real_reso operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void EvalBlock(const t_real_reso* pH, const t_real_reso* pK, const t_real_reso* pL,
+		const t_real_reso* pE, std::size_t iNum, t_real_reso* pS) const override;
 
 
 	const ublas::vector<t_real_reso>& GetBragg() const { return m_vecBragg; }
@@ -165,6 +177,8 @@ private:
 
 protected:
 	static t_real_reso phonon_disp(t_real_reso dq, t_real_reso da, t_real_reso df);
+	template<class t_flt> void eval_block(const t_flt* pH, const t_flt* pK, const t_flt* pL,
+		const t_flt* pE, std::size_t iNum, t_flt* pS) const;
 
 protected:
 	ublas::vector<t_real_reso> m_vecBragg;
@@ -172,6 +186,7 @@ protected:
 	t_real_reso m_damp=20., m_dfreq=M_PI/2., m_dHWHM=0.1, m_dS0=1.;
 	t_real_reso m_dIncAmp=0., m_dIncSig=0.1;
 	t_real_reso m_dT = 100.;
+	unsigned short m_iLine = 0;		// 0: dho, 1: gaussian lines, 2: lorentzian lines
 
 public:
 	SqwPhononSingleBranch(const char* pcFile);
@@ -180,8 +195,13 @@ public:
 
 	virtual std::tuple<std::vector<t_real_reso>, std::vector<t_real_reso>>
 		disp(t_real_reso dh, t_real_reso dk, t_real_reso dl) const override;
+	virtual bool lineshape(t_real_reso& dSigma, t_real_reso& dHWHM) const override;
 	virtual t_real_reso
 		operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void EvalBlock(const t_real_reso* pH, const t_real_reso* pK, const t_real_reso* pL,
+		const t_real_reso* pE, std::size_t iNum, t_real_reso* pS) const override;
+	virtual void EvalFast(const t_real_fast* pH, const t_real_fast* pK, const t_real_fast* pL,
+		const t_real_fast* pE, std::size_t iNum, t_real_fast* pS) const override;
 
 	const ublas::vector<t_real_reso>& GetBragg() const { return m_vecBragg; }
 
@@ -206,6 +226,8 @@ private:
 protected:
 	static t_real_reso ferro_disp(t_real_reso dq, t_real_reso dD, t_real_reso doffs);
 	static t_real_reso antiferro_disp(t_real_reso dq, t_real_reso dD, t_real_reso doffs);
+	template<class t_flt> void eval_block(const t_flt* pH, const t_flt* pK, const t_flt* pL,
+		const t_flt* pE, std::size_t iNum, t_flt* pS) const;
 
 protected:
 	unsigned short m_iWhichDisp = 0;		// 0: ferro, 1: antiferro
@@ -225,6 +247,10 @@ public:
 	virtual std::tuple<std::vector<t_real_reso>, std::vector<t_real_reso>>
 		disp(t_real_reso dh, t_real_reso dk, t_real_reso dl) const override;
 	virtual t_real_reso operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void EvalBlock(const t_real_reso* pH, const t_real_reso* pK, const t_real_reso* pL,
+		const t_real_reso* pE, std::size_t iNum, t_real_reso* pS) const override;
+	virtual void EvalFast(const t_real_fast* pH, const t_real_fast* pK, const t_real_fast* pL,
+		const t_real_fast* pE, std::size_t iNum, t_real_fast* pS) const override;
 
 	const ublas::vector<t_real_reso>& GetBragg() const { return m_vecBragg; }
 
@@ -9,6 +9,8 @@
 #include "tlibs/string/string.h"
 #include "tlibs/log/log.h"
 #include "tlibs/file/file.h"
+
+#include <algorithm>
 #include "tlibs/ext/jl.h"
 
 using t_real = t_real_reso;
@@ -55,6 +57,8 @@ SqwJl::SqwJl(const char* pcFile) : m_pmtx(std::make_shared<std::mutex>())
 	m_pInit = jl_get_function(jl_main_module, "TakinInit");
 	m_pSqw = jl_get_function(jl_main_module, "TakinSqw");
 	m_pDisp = jl_get_function(jl_main_module, "TakinDisp");
+	// optional, [sigma, hwhm] of the lines along the TakinDisp branches
+	m_pLineShape = jl_get_function(jl_main_module, "TakinLineShape");
 
 	PrintExceptions();
 
@@ -149,7 +153,7 @@ std::tuple<std::vector<t_real>, std::vector<t_real>>
 		for(std::size_t iElem=0; iElem<std::min(iSizeE, iSizeW); ++iElem)
 		{
 			t_real dE = tl::jl_traits<t_real>::unbox(jl_arrayref(parrE, iElem));
-			t_real dW = tl::jl_traits<t_real>::unbox(jl_arrayref(parrE, iElem));
+			t_real dW = tl::jl_traits<t_real>::unbox(jl_arrayref(parrW, iElem));
 
 			vecE.push_back(dE);
 			vecW.push_back(dW);
@@ -161,6 +165,32 @@ std::tuple<std::vector<t_real>, std::vector<t_real>>
 }
 
 
+/**
+ * line shape along the dispersion branches
+ */
+bool SqwJl::lineshape(t_real& dSigma, t_real& dHWHM) const
+{
+	if(!m_bOk || !m_pLineShape)
+		return false;
+
+	std::lock_guard<std::mutex> lock(*m_pmtx);
+
+	jl_array_t *pLine = reinterpret_cast<jl_array_t*>(jl_call0((jl_function_t*)m_pLineShape));
+	if(!pLine || jl_array_len(pLine) != 2)
+	{
+		tl::log_err("TakinLineShape has to return [sigma, hwhm].");
+		PrintExceptions();
+		return false;
+	}
+
+	dSigma = tl::jl_traits<t_real>::unbox(jl_arrayref(pLine, 0));
+	dHWHM = tl::jl_traits<t_real>::unbox(jl_arrayref(pLine, 1));
+
+	PrintExceptions();
+	return true;
+}
+
+
 /**
  * S(Q,E)
  */
@@ -184,6 +214,34 @@ t_real SqwJl::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 }
 
 
+/**
+ * S(Q,E) for a block of points, the interpreter is only locked once
+ */
+void SqwJl::EvalBlock(const t_real* pH, const t_real* pK, const t_real* pL,
+	const t_real* pE, std::size_t iNum, t_real* pS) const
+{
+	if(!m_bOk)
+	{
+		tl::log_err("Julia interpreter has not initialised, cannot query S(q,w).");
+		std::fill(pS, pS+iNum, t_real(0));
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(*m_pmtx);
+
+	for(std::size_t i=0; i<iNum; ++i)
+	{
+		jl_value_t *phklE[4] =
+			{ tl::jl_traits<t_real>::box(pH[i]), tl::jl_traits<t_real>::box(pK[i]),
+			tl::jl_traits<t_real>::box(pL[i]), tl::jl_traits<t_real>::box(pE[i]) };
+		jl_value_t *pSqw = jl_call((jl_function_t*)m_pSqw, phklE, 4);
+		pS[i] = t_real(tl::jl_traits<t_real>::unbox(pSqw));
+	}
+
+	PrintExceptions();
+}
+
+
 std::vector<SqwBase::t_var> SqwJl::GetVars() const
 {
 	std::vector<SqwBase::t_var> vecVars;
@@ -294,6 +352,7 @@ SqwBase* SqwJl::shallow_copy() const
 	pSqw->m_pInit = this->m_pInit;
 	pSqw->m_pSqw = this->m_pSqw;
 	pSqw->m_pDisp = this->m_pDisp;
+	pSqw->m_pLineShape = this->m_pLineShape;
 	pSqw->m_pmtx = this->m_pmtx;
 
 	return pSqw;
@@ -22,6 +22,7 @@ protected:
 	/*jl_function_t*/ void *m_pInit = nullptr;
 	/*jl_function_t*/ void *m_pSqw = nullptr;
 	/*jl_function_t*/ void *m_pDisp = nullptr;
+	/*jl_function_t*/ void *m_pLineShape = nullptr;
 
 	// filter variables that don't start with the given prefix
 	std::string m_strVarPrefix = "g_";
@@ -36,8 +37,11 @@ public:
 
 	virtual std::tuple<std::vector<t_real_reso>, std::vector<t_real_reso>>
 		disp(t_real_reso dh, t_real_reso dk, t_real_reso dl) const override;
+	virtual bool lineshape(t_real_reso& dSigma, t_real_reso& dHWHM) const override;
 	virtual t_real_reso
 		operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void EvalBlock(const t_real_reso* pH, const t_real_reso* pK, const t_real_reso* pL,
+		const t_real_reso* pE, std::size_t iNum, t_real_reso* pS) const override;
 
 	virtual std::vector<SqwBase::t_var> GetVars() const override;
 	virtual void SetVars(const std::vector<SqwBase::t_var>&) override;
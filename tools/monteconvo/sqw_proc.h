@@ -11,41 +11,75 @@
 #include "sqw.h"
 #include <mutex>
 #include <memory>
+#include <atomic>
 #include <unistd.h>
 #include <boost/interprocess/ipc/message_queue.hpp>
 
 
+/**
+ * shared memory for blocks of neutrons, re-created by the parent when it is too small
+ */
+struct SqwProcBlockMem
+{
+	std::shared_ptr<boost::interprocess::managed_shared_memory> pMem;
+	t_real_reso *pBuf = nullptr;		// h, k, l, E and S arrays of iCapacity points
+	std::size_t iCapacity = 0;
+	bool bNew = false;			// the child has to re-open the memory
+};
+
+
+/**
+ * one child process with its message queues and shared memory,
+ * the process is ended when the last copy of the model releases it
+ */
+struct SqwProcChild
+{
+	std::mutex mtx;
+
+	std::string strProcName;
+	pid_t pidChild = 0;
+
+	std::shared_ptr<boost::interprocess::managed_shared_memory> pMem;
+	std::shared_ptr<boost::interprocess::message_queue> pmsgIn, pmsgOut;
+	void *pSharedPars = nullptr;
+	SqwProcBlockMem block;
+
+	~SqwProcChild();
+};
+
+
 template<class t_sqw>
 class SqwProc : public SqwBase
 {
-private:
-	std::size_t m_iRefCnt = 0;
-
 protected:
-	mutable std::shared_ptr<std::mutex> m_pmtx;
+	// pool of child processes, shared with the shallow copies
+	std::vector<std::shared_ptr<SqwProcChild>> m_vecChildren;
+	std::shared_ptr<std::atomic<std::size_t>> m_pNextChild;
 
-	std::string m_strProcName;
-	pid_t m_pidChild = 0;
-
-	std::shared_ptr<boost::interprocess::managed_shared_memory> m_pMem;
-	std::shared_ptr<boost::interprocess::message_queue> m_pmsgIn, m_pmsgOut;
-	void *m_pSharedPars = nullptr;
+	std::shared_ptr<SqwProcChild> create_child(const char* pcCfg, bool& bOk);
+	SqwProcChild* lock_child(std::unique_lock<std::mutex>& lock) const;
+	static bool reserve_block(SqwProcChild& child, std::size_t iNum);
 
 public:
-	SqwProc();
-	SqwProc(const char* pcCfg);
-	virtual ~SqwProc();
+	SqwProc() = default;
+	SqwProc(const char* pcCfg, unsigned int iNumProcs=1);
+	virtual ~SqwProc() = default;
 
 	virtual std::tuple<std::vector<t_real_reso>, std::vector<t_real_reso>>
 		disp(t_real_reso dh, t_real_reso dk, t_real_reso dl) const override;
+	virtual bool lineshape(t_real_reso& dSigma, t_real_reso& dHWHM) const override;
 	virtual t_real_reso
 		operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const override;
+	virtual void EvalBlock(const t_real_reso* pH, const t_real_reso* pK, const t_real_reso* pL,
+		const t_real_reso* pE, std::size_t iNum, t_real_reso* pS) const override;
 	virtual bool IsOk() const override;
 
 	virtual std::vector<SqwBase::t_var> GetVars() const override;
 	virtual void SetVars(const std::vector<SqwBase::t_var>&) override;
 
 	virtual SqwBase* shallow_copy() const override;
+
+	std::size_t GetNumProcs() const { return m_vecChildren.size(); }
 };
 
 #endif
@@ -17,8 +17,11 @@
 #include <boost/interprocess/allocators/allocator.hpp>
 #include <boost/interprocess/containers/string.hpp>
 
+#include <algorithm>
+
 #define MSG_QUEUE_SIZE 128
 #define PARAM_MEM 1024*1024
+#define BLOCK_MEM_OVERHEAD 64*1024
 
 
 namespace ipr = boost::interprocess;
@@ -185,7 +188,9 @@ enum class ProcMsgTypes
 	NOP,
 
 	DISP,
+	LINESHAPE,
 	SQW,
+	SQW_BLOCK,
 	GET_VARS,
 	SET_VARS,
 
@@ -200,6 +205,8 @@ struct ProcMsg
 	t_real dParam1, dParam2, dParam3, dParam4;
 	t_real dRet;
 	bool bRet;
+	std::size_t iNum = 0;
+	bool bReopen = false;		// SQW_BLOCK request: the block memory was re-created
 
 	t_sh_str *pPars = nullptr;
 };
@@ -245,10 +252,14 @@ static ProcMsg msg_recv(ipr::message_queue& msgqueue)
 
 template<class t_sqw>
 static void child_proc(ipr::message_queue& msgToParent, ipr::message_queue& msgFromParent,
-	const char* pcCfg)
+	const char* pcCfg, const std::string& strProcName)
 {
 	std::unique_ptr<t_sqw> pSqw(new t_sqw(pcCfg));
 
+	// neutron blocks, mapped on the first request and after the parent has re-created them
+	std::unique_ptr<ipr::managed_shared_memory> pBlockMem;
+	t_real *pBlock = nullptr;
+
 	// tell parent that pSqw is inited
 	ProcMsg msgReady;
 	msgReady.ty = ProcMsgTypes::READY;
@@ -270,6 +281,13 @@ static void child_proc(ipr::message_queue& msgToParent, ipr::message_queue& msgF
 				msg_send(msgToParent, msgRet);
 				break;
 			}
+			case ProcMsgTypes::LINESHAPE:	// line shape along the dispersion
+			{
+				msgRet.ty = msg.ty;
+				msgRet.bRet = pSqw->lineshape(msgRet.dParam1, msgRet.dParam2);
+				msg_send(msgToParent, msgRet);
+				break;
+			}
 			case ProcMsgTypes::SQW:		// structure factor
 			{
 				msgRet.ty = msg.ty;
@@ -277,6 +295,39 @@ static void child_proc(ipr::message_queue& msgToParent, ipr::message_queue& msgF
 				msg_send(msgToParent, msgRet);
 				break;
 			}
+			case ProcMsgTypes::SQW_BLOCK:	// structure factor for a block of neutrons
+			{
+				msgRet.ty = msg.ty;
+				msgRet.bRet = 0;
+
+				try
+				{
+					if(msg.bReopen || !pBlockMem)
+					{
+						pBlock = nullptr;
+						pBlockMem.reset(new ipr::managed_shared_memory(ipr::open_only,
+							("takin_sqw_proc_blk_" + strProcName).c_str()));
+						pBlock = pBlockMem->find<t_real>(
+							("takin_sqw_proc_block_" + strProcName).c_str()).first;
+					}
+
+					if(pBlock)
+					{
+						// layout: h, k, l, E and S arrays with a stride of msg.iNum
+						const std::size_t iNum = msg.iNum;
+						pSqw->EvalBlock(pBlock, pBlock + iNum, pBlock + 2*iNum,
+							pBlock + 3*iNum, iNum, pBlock + 4*iNum);
+						msgRet.bRet = 1;
+					}
+				}
+				catch(const std::exception& ex)
+				{
+					tl::log_err(ex.what());
+				}
+
+				msg_send(msgToParent, msgRet);
+				break;
+			}
 			case ProcMsgTypes::GET_VARS:	// get variables
 			{
 				msgRet.ty = msg.ty;
@@ -318,97 +369,155 @@ static void child_proc(ipr::message_queue& msgToParent, ipr::message_queue& msgF
 // ----------------------------------------------------------------------------
 // parent process
 
+/**
+ * clean up sub-process
+ */
+inline SqwProcChild::~SqwProcChild()
+{
+	try
+	{
+		if(pmsgOut)
+		{
+			ProcMsg msg;
+			msg.ty = ProcMsgTypes::QUIT;
+			msg_send(*pmsgOut, msg);
+		}
+
+		if(pMem)
+		{
+			tl::log_debug("Removing process memory \"", "takin_sqw_proc_*_", strProcName, "\".");
+
+			ipr::shared_memory_object::remove(("takin_sqw_proc_mem_" + strProcName).c_str());
+			if(block.pMem)
+				ipr::shared_memory_object::remove(("takin_sqw_proc_blk_" + strProcName).c_str());
+
+			ipr::message_queue::remove(("takin_sqw_proc_in_" + strProcName).c_str());
+			ipr::message_queue::remove(("takin_sqw_proc_out_" + strProcName).c_str());
+		}
+	}
+	catch(const std::exception&)
+	{}
+}
+
+
+/**
+ * create the pool of sub-processes
+ */
 template<class t_sqw>
-SqwProc<t_sqw>::SqwProc()
+SqwProc<t_sqw>::SqwProc(const char* pcCfg, unsigned int iNumProcs)
+	: m_pNextChild(std::make_shared<std::atomic<std::size_t>>(0))
 {
-	++m_iRefCnt;
+	m_bOk = 1;
+	if(iNumProcs == 0) iNumProcs = 1;
+
+	for(unsigned int iProc=0; iProc<iNumProcs; ++iProc)
+	{
+		bool bChildOk = 0;
+		std::shared_ptr<SqwProcChild> pChild = create_child(pcCfg, bChildOk);
+		if(!pChild || !bChildOk)
+		{
+			m_bOk = 0;
+			break;
+		}
+
+		m_vecChildren.emplace_back(std::move(pChild));
+	}
+
+	// a partial pool is not usable, end all processes
+	if(!m_bOk)
+		m_vecChildren.clear();
+
+	if(m_bOk && iNumProcs > 1)
+		tl::log_debug("Created ", iNumProcs, " client processes.");
 }
 
 
 /**
- * create sub-process
+ * create one sub-process, bOk tells if its model could be initialised
  */
 template<class t_sqw>
-SqwProc<t_sqw>::SqwProc(const char* pcCfg)
-	: m_pmtx(std::make_shared<std::mutex>()),
-	m_strProcName(tl::rand_name<std::string>(8))
+std::shared_ptr<SqwProcChild> SqwProc<t_sqw>::create_child(const char* pcCfg, bool& bOk)
 {
-	++m_iRefCnt;
+	bOk = 0;
+	std::shared_ptr<SqwProcChild> pChild = std::make_shared<SqwProcChild>();
+	SqwProcChild& child = *pChild;
+	child.strProcName = tl::rand_name<std::string>(8);
 
 	try
 	{
-		tl::log_debug("Creating process memory \"", "takin_sqw_proc_*_", m_strProcName, "\".");
+		tl::log_debug("Creating process memory \"", "takin_sqw_proc_*_", child.strProcName, "\".");
 
-		m_pMem = std::make_shared<ipr::managed_shared_memory>(ipr::create_only,
-			("takin_sqw_proc_mem_" + m_strProcName).c_str(), PARAM_MEM);
-		m_pSharedPars = static_cast<void*>(m_pMem->construct<t_sh_str>
-			(("takin_sqw_proc_params_" + m_strProcName).c_str())
-			(t_sh_str_alloc(m_pMem->get_segment_manager())));
+		child.pMem = std::make_shared<ipr::managed_shared_memory>(ipr::create_only,
+			("takin_sqw_proc_mem_" + child.strProcName).c_str(), PARAM_MEM);
+		child.pSharedPars = static_cast<void*>(child.pMem->construct<t_sh_str>
+			(("takin_sqw_proc_params_" + child.strProcName).c_str())
+			(t_sh_str_alloc(child.pMem->get_segment_manager())));
 
-		m_pmsgIn = std::make_shared<ipr::message_queue>(ipr::create_only,
-			("takin_sqw_proc_in_" + m_strProcName).c_str(), MSG_QUEUE_SIZE, sizeof(ProcMsg));
-		m_pmsgOut = std::make_shared<ipr::message_queue>(ipr::create_only,
-			("takin_sqw_proc_out_" + m_strProcName).c_str(), MSG_QUEUE_SIZE, sizeof(ProcMsg));
+		child.pmsgIn = std::make_shared<ipr::message_queue>(ipr::create_only,
+			("takin_sqw_proc_in_" + child.strProcName).c_str(), MSG_QUEUE_SIZE, sizeof(ProcMsg));
+		child.pmsgOut = std::make_shared<ipr::message_queue>(ipr::create_only,
+			("takin_sqw_proc_out_" + child.strProcName).c_str(), MSG_QUEUE_SIZE, sizeof(ProcMsg));
 
-		m_pidChild = fork();
-		if(m_pidChild < 0)
+		child.pidChild = fork();
+		if(child.pidChild < 0)
 		{
 			tl::log_err("Cannot fork process.");
-			return;
+			child.pmsgOut.reset();
+			return nullptr;
 		}
-		else if(m_pidChild == 0)
+		else if(child.pidChild == 0)
 		{
-			child_proc<t_sqw>(*m_pmsgIn, *m_pmsgOut, pcCfg);
+			child_proc<t_sqw>(*child.pmsgIn, *child.pmsgOut, pcCfg, child.strProcName);
 			exit(0);
 		}
 
 		tl::log_debug("Waiting for client to become ready...");
-		ProcMsg msgReady = msg_recv(*m_pmsgIn);
+		ProcMsg msgReady = msg_recv(*child.pmsgIn);
 		if(!msgReady.bRet)
 			tl::log_err("Client reports failure.");
 		else
 			tl::log_debug("Client is ready.");
 
-		m_bOk = msgReady.bRet;
+		bOk = msgReady.bRet;
 	}
 	catch(const std::exception& ex)
 	{
-		m_bOk = 0;
 		tl::log_err(ex.what());
+		return nullptr;
 	}
+
+	return pChild;
 }
 
 
 /**
- * clean up sub-process
+ * lock a free sub-process, starting the search at the next one in turn,
+ * if all of them are busy, wait for that one.
+ * returns nullptr if there are no usable sub-processes.
  */
 template<class t_sqw>
-SqwProc<t_sqw>::~SqwProc()
+SqwProcChild* SqwProc<t_sqw>::lock_child(std::unique_lock<std::mutex>& lock) const
 {
-	// is this instance the last?
-	if(m_pMem.use_count() > 1) return;
-
-	try
+	const std::size_t iNumChildren = m_vecChildren.size();
+	if(!m_bOk || iNumChildren == 0)
 	{
-		if(m_pmsgOut)
-		{
-			ProcMsg msg;
-			msg.ty = ProcMsgTypes::QUIT;
-			msg_send(*m_pmsgOut, msg);
-		}
-
-		if(--m_iRefCnt == 0)
-		{
-			tl::log_debug("Removing process memory \"", "takin_sqw_proc_*_", m_strProcName, "\".");
+		tl::log_err("No S(q,w) process available.");
+		return nullptr;
+	}
 
-			ipr::shared_memory_object::remove(("takin_sqw_proc_mem_" + m_strProcName).c_str());
+	const std::size_t iStart = (*m_pNextChild)++ % iNumChildren;
 
-			ipr::message_queue::remove(("takin_sqw_proc_in_" + m_strProcName).c_str());
-			ipr::message_queue::remove(("takin_sqw_proc_out_" + m_strProcName).c_str());
-		}
+	for(std::size_t iChild=0; iChild<iNumChildren; ++iChild)
+	{
+		SqwProcChild& child = *m_vecChildren[(iStart + iChild) % iNumChildren];
+		lock = std::unique_lock<std::mutex>(child.mtx, std::try_to_lock);
+		if(lock.owns_lock())
+			return &child;
 	}
-	catch(const std::exception&)
-	{}
+
+	SqwProcChild& child = *m_vecChildren[iStart];
+	lock = std::unique_lock<std::mutex>(child.mtx);
+	return &child;
 }
 
 
@@ -419,28 +528,62 @@ template<class t_sqw>
 std::tuple<std::vector<t_real>, std::vector<t_real>>
 SqwProc<t_sqw>::disp(t_real dh, t_real dk, t_real dl) const
 {
-	std::lock_guard<std::mutex> lock(*m_pmtx);
+	std::unique_lock<std::mutex> lock;
+	SqwProcChild* pChild = lock_child(lock);
+	if(!pChild)
+		return std::make_tuple(std::vector<t_real>(), std::vector<t_real>());
+	SqwProcChild& child = *pChild;
 
 	ProcMsg msg;
 	msg.ty = ProcMsgTypes::DISP;
 	msg.dParam1 = dh;
 	msg.dParam2 = dk;
 	msg.dParam3 = dl;
-	msg.pPars = static_cast<decltype(msg.pPars)>(m_pSharedPars);
-	msg_send(*m_pmsgOut, msg);
+	msg.pPars = static_cast<decltype(msg.pPars)>(child.pSharedPars);
+	msg_send(*child.pmsgOut, msg);
 
-	ProcMsg msgDisp = msg_recv(*m_pmsgIn);
+	ProcMsg msgDisp = msg_recv(*child.pmsgIn);
 	return str_to_disp(*msgDisp.pPars);
 }
 
 
+/**
+ * query line shape
+ */
+template<class t_sqw>
+bool SqwProc<t_sqw>::lineshape(t_real& dSigma, t_real& dHWHM) const
+{
+	std::unique_lock<std::mutex> lock;
+	SqwProcChild* pChild = lock_child(lock);
+	if(!pChild)
+		return false;
+	SqwProcChild& child = *pChild;
+
+	ProcMsg msg;
+	msg.ty = ProcMsgTypes::LINESHAPE;
+	msg_send(*child.pmsgOut, msg);
+
+	ProcMsg msgLine = msg_recv(*child.pmsgIn);
+	if(!msgLine.bRet)
+		return false;
+
+	dSigma = msgLine.dParam1;
+	dHWHM = msgLine.dParam2;
+	return true;
+}
+
+
 /**
  * query dynamical structure factor
  */
 template<class t_sqw>
 t_real SqwProc<t_sqw>::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 {
-	std::lock_guard<std::mutex> lock(*m_pmtx);
+	std::unique_lock<std::mutex> lock;
+	SqwProcChild* pChild = lock_child(lock);
+	if(!pChild)
+		return t_real(0);
+	SqwProcChild& child = *pChild;
 
 	ProcMsg msg;
 	msg.ty = ProcMsgTypes::SQW;
@@ -448,63 +591,191 @@ t_real SqwProc<t_sqw>::operator()(t_real dh, t_real dk, t_real dl, t_real dE) co
 	msg.dParam2 = dk;
 	msg.dParam3 = dl;
 	msg.dParam4 = dE;
-	msg_send(*m_pmsgOut, msg);
+	msg_send(*child.pmsgOut, msg);
 
-	ProcMsg msgS = msg_recv(*m_pmsgIn);
+	ProcMsg msgS = msg_recv(*child.pmsgIn);
 	return msgS.dRet;
 }
 
+
+/**
+ * makes sure the block memory of a sub-process can hold iNum neutrons,
+ * the managed segment cannot grow while the child has it mapped,
+ * so a larger one is created under the same name instead
+ */
+template<class t_sqw>
+bool SqwProc<t_sqw>::reserve_block(SqwProcChild& child, std::size_t iNum)
+{
+	SqwProcBlockMem& blk = child.block;
+	if(blk.pMem && iNum <= blk.iCapacity)
+		return true;
+
+	// start with the size of the parameter memory and at least double on growing
+	std::size_t iCap = std::max<std::size_t>(2*blk.iCapacity, PARAM_MEM / (5*sizeof(t_real)));
+	iCap = std::max(iCap, iNum);
+	const std::string strMem = "takin_sqw_proc_blk_" + child.strProcName;
+
+	try
+	{
+		blk.pBuf = nullptr;
+		blk.iCapacity = 0;
+		if(blk.pMem)
+		{
+			blk.pMem.reset();
+			ipr::shared_memory_object::remove(strMem.c_str());
+		}
+
+		tl::log_debug("Creating process block memory \"", strMem, "\" for ", iCap, " neutrons.");
+		blk.pMem = std::make_shared<ipr::managed_shared_memory>(ipr::create_only,
+			strMem.c_str(), 5*iCap*sizeof(t_real) + BLOCK_MEM_OVERHEAD);
+		blk.pBuf = blk.pMem->construct<t_real>(("takin_sqw_proc_block_" + child.strProcName).c_str())
+			[5*iCap](t_real(0));
+		blk.iCapacity = iCap;
+		blk.bNew = 1;
+	}
+	catch(const std::exception& ex)
+	{
+		tl::log_err(ex.what());
+		blk.pMem.reset();
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * query dynamical structure factor for a block of points,
+ * the block is passed through shared memory with only one message round trip
+ */
+template<class t_sqw>
+void SqwProc<t_sqw>::EvalBlock(const t_real* pH, const t_real* pK, const t_real* pL,
+	const t_real* pE, std::size_t iNum, t_real* pS) const
+{
+	if(!iNum) return;
+	std::unique_lock<std::mutex> lock;
+	SqwProcChild* pChild = lock_child(lock);
+	if(!pChild)
+	{
+		std::fill(pS, pS+iNum, t_real(0));
+		return;
+	}
+	SqwProcChild& child = *pChild;
+
+	if(!reserve_block(child, iNum))
+	{
+		tl::log_err("Cannot allocate process block memory.");
+		std::fill(pS, pS+iNum, t_real(0));
+		return;
+	}
+
+	SqwProcBlockMem& blk = child.block;
+	std::copy(pH, pH+iNum, blk.pBuf);
+	std::copy(pK, pK+iNum, blk.pBuf + iNum);
+	std::copy(pL, pL+iNum, blk.pBuf + 2*iNum);
+	std::copy(pE, pE+iNum, blk.pBuf + 3*iNum);
+
+	ProcMsg msg;
+	msg.ty = ProcMsgTypes::SQW_BLOCK;
+	msg.iNum = iNum;
+	msg.bReopen = blk.bNew;
+	msg_send(*child.pmsgOut, msg);
+	blk.bNew = 0;
+
+	ProcMsg msgS = msg_recv(*child.pmsgIn);
+	if(!msgS.bRet)
+	{
+		tl::log_err("Client could not evaluate neutron block.");
+		std::fill(pS, pS+iNum, t_real(0));
+		return;
+	}
+
+	std::copy(blk.pBuf + 4*iNum, blk.pBuf + 5*iNum, pS);
+}
+
+
+/**
+ * all sub-processes have to be ok
+ */
 template<class t_sqw>
 bool SqwProc<t_sqw>::IsOk() const
 {
 	if(!m_bOk) return false;
-	std::lock_guard<std::mutex> lock(*m_pmtx);
 
-	ProcMsg msg;
-	msg.ty = ProcMsgTypes::IS_OK;
-	msg_send(*m_pmsgOut, msg);
+	for(const std::shared_ptr<SqwProcChild>& pChild : m_vecChildren)
+	{
+		std::lock_guard<std::mutex> lock(pChild->mtx);
+
+		ProcMsg msg;
+		msg.ty = ProcMsgTypes::IS_OK;
+		msg_send(*pChild->pmsgOut, msg);
 
-	ProcMsg msgRet = msg_recv(*m_pmsgIn);
-	return msgRet.bRet;
+		ProcMsg msgRet = msg_recv(*pChild->pmsgIn);
+		if(!msgRet.bRet)
+			return false;
+	}
+
+	return true;
 }
 
 
 /**
- * query variables
+ * query variables, they are the same in all sub-processes
  */
 template<class t_sqw>
 std::vector<SqwBase::t_var> SqwProc<t_sqw>::GetVars() const
 {
-	std::lock_guard<std::mutex> lock(*m_pmtx);
+	std::unique_lock<std::mutex> lock;
+	SqwProcChild* pChild = lock_child(lock);
+	if(!pChild)
+		return std::vector<SqwBase::t_var>();
+	SqwProcChild& child = *pChild;
 
 	ProcMsg msg;
 	msg.ty = ProcMsgTypes::GET_VARS;
-	msg.pPars = static_cast<decltype(msg.pPars)>(m_pSharedPars);
-	msg_send(*m_pmsgOut, msg);
+	msg.pPars = static_cast<decltype(msg.pPars)>(child.pSharedPars);
+	msg_send(*child.pmsgOut, msg);
 
-	ProcMsg msgRet = msg_recv(*m_pmsgIn);
+	ProcMsg msgRet = msg_recv(*child.pmsgIn);
 	return str_to_pars(*msg.pPars);
 }
 
 
 /**
- * set variables
+ * set variables in all sub-processes
  */
 template<class t_sqw>
 void SqwProc<t_sqw>::SetVars(const std::vector<SqwBase::t_var>& vecVars)
 {
-	std::lock_guard<std::mutex> lock(*m_pmtx);
+	if(!m_bOk)
+	{
+		tl::log_err("No S(q,w) process available, cannot set variables.");
+		return;
+	}
 
-	ProcMsg msg;
-	msg.ty = ProcMsgTypes::SET_VARS;
-	msg.pPars = static_cast<decltype(msg.pPars)>(m_pSharedPars);
-	pars_to_str(*msg.pPars, vecVars);
-	//tl::log_debug("Message string: ", *msg.pPars);
-	msg_send(*m_pmsgOut, msg);
-
-	ProcMsg msgRet = msg_recv(*m_pmsgIn);
-	if(!msgRet.bRet)
-		tl::log_err("Could not set variables.");
+	// lock all children in the same order, so that no one sees a half-updated pool
+	std::vector<std::unique_lock<std::mutex>> vecLocks;
+	vecLocks.reserve(m_vecChildren.size());
+	for(const std::shared_ptr<SqwProcChild>& pChild : m_vecChildren)
+		vecLocks.emplace_back(pChild->mtx);
+
+	// send to all children first, so that they can update in parallel
+	for(const std::shared_ptr<SqwProcChild>& pChild : m_vecChildren)
+	{
+		ProcMsg msg;
+		msg.ty = ProcMsgTypes::SET_VARS;
+		msg.pPars = static_cast<decltype(msg.pPars)>(pChild->pSharedPars);
+		pars_to_str(*msg.pPars, vecVars);
+		//tl::log_debug("Message string: ", *msg.pPars);
+		msg_send(*pChild->pmsgOut, msg);
+	}
+
+	for(const std::shared_ptr<SqwProcChild>& pChild : m_vecChildren)
+	{
+		ProcMsg msgRet = msg_recv(*pChild->pmsgIn);
+		if(!msgRet.bRet)
+			tl::log_err("Could not set variables in process \"", pChild->strProcName, "\".");
+	}
 }
 
 
@@ -514,13 +785,8 @@ SqwBase* SqwProc<t_sqw>::shallow_copy() const
 	SqwProc* pSqw = new SqwProc();
 	*static_cast<SqwBase*>(pSqw) = *static_cast<const SqwBase*>(this);
 
-	pSqw->m_pmtx = this->m_pmtx;
-	pSqw->m_pMem = this->m_pMem;
-	pSqw->m_pmsgIn = this->m_pmsgIn;
-	pSqw->m_pmsgOut = this->m_pmsgOut;
-	pSqw->m_strProcName = this->m_strProcName;
-	pSqw->m_pidChild = this->m_pidChild;
-	pSqw->m_pSharedPars = this->m_pSharedPars;
+	pSqw->m_vecChildren = this->m_vecChildren;
+	pSqw->m_pNextChild = this->m_pNextChild;
 
 	return pSqw;
 }
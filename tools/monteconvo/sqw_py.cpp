@@ -11,6 +11,7 @@
 #include "tlibs/file/file.h"
 
 #include <boost/python/stl_iterator.hpp>
+#include <algorithm>
 
 using t_real = t_real_reso;
 
@@ -86,6 +87,10 @@ SqwPy::SqwPy(const char* pcFile) : m_pmtx(std::make_shared<std::mutex>())
 				m_disp = moddict["TakinDisp"];
 			else
 				tl::log_warn("Python script has no TakinDisp function.");
+
+			// (sigma, hwhm) of the lines along TakinDisp for the analytic convolution
+			if(moddict.has_key("TakinLineShape"))
+				m_lineshape = moddict["TakinLineShape"];
 		}
 		catch(const py::error_already_set& ex) {}
 	}
@@ -169,6 +174,33 @@ std::tuple<std::vector<t_real>, std::vector<t_real>>
 }
 
 
+/**
+ * line shape along the dispersion branches
+ */
+bool SqwPy::lineshape(t_real& dSigma, t_real& dHWHM) const
+{
+	if(!m_bOk || !m_lineshape)
+		return false;
+
+	std::lock_guard<std::mutex> lock(*m_pmtx);
+
+	try
+	{
+		py::object tup = m_lineshape();
+		dSigma = py::extract<t_real>(tup[0]);
+		dHWHM = py::extract<t_real>(tup[1]);
+		return true;
+	}
+	catch(const py::error_already_set& ex)
+	{
+		PyErr_Print();
+		PyErr_Clear();
+	}
+
+	return false;
+}
+
+
 /**
  * S(Q,E)
  */
@@ -196,6 +228,34 @@ t_real SqwPy::operator()(t_real dh, t_real dk, t_real dl, t_real dE) const
 }
 
 
+/**
+ * S(Q,E) for a block of points, the interpreter is only locked once
+ */
+void SqwPy::EvalBlock(const t_real* pH, const t_real* pK, const t_real* pL,
+	const t_real* pE, std::size_t iNum, t_real* pS) const
+{
+	std::fill(pS, pS+iNum, t_real(0));
+	if(!m_bOk)
+	{
+		tl::log_err("Interpreter has not initialised, cannot query S(q,w).");
+		return;
+	}
+
+
+	std::lock_guard<std::mutex> lock(*m_pmtx);
+	try
+	{
+		for(std::size_t i=0; i<iNum; ++i)
+			pS[i] = py::extract<t_real>(m_Sqw(pH[i], pK[i], pL[i], pE[i]));
+	}
+	catch(const py::error_already_set& ex)
+	{
+		PyErr_Print();
+		PyErr_Clear();
+	}
+}
+
+
 /**
  * Gets model variables.
  */
@@ -349,6 +409,7 @@ SqwBase* SqwPy::shallow_copy() const
 	pSqw->m_Sqw = this->m_Sqw;
 	pSqw->m_Init = this->m_Init;
 	pSqw->m_disp = this->m_disp;
+	pSqw->m_lineshape = this->m_lineshape;
 
 	return pSqw;
 }
@@ -6,6 +6,7 @@
  */
 
 #include "sqwbase.h"
+#include <algorithm>
 
 
 /**
@@ -30,6 +31,65 @@ bool SqwBase::SetVarIfAvail(const std::string& strKey, const std::string& strNew
 }
 
 
+/**
+ * evaluates S(Q,E) for iNum points at pH, pK, pL, pE and writes the results to pS;
+ * models which have to lock or call an interpreter or another process for each
+ * point should override this to do so only once per block
+ */
+void SqwBase::EvalBlock(const t_real_reso* pH, const t_real_reso* pK, const t_real_reso* pL,
+	const t_real_reso* pE, std::size_t iNum, t_real_reso* pS) const
+{
+	for(std::size_t i=0; i<iNum; ++i)
+		pS[i] = (*this)(pH[i], pK[i], pL[i], pE[i]);
+}
+
+/**
+ * evaluates S(Q,E) for iNum points;
+ * models without a native single-precision version are evaluated in double precision
+ */
+void SqwBase::EvalFast(const t_real_fast* pH, const t_real_fast* pK, const t_real_fast* pL,
+	const t_real_fast* pE, std::size_t iNum, t_real_fast* pS) const
+{
+	constexpr std::size_t CHUNK = 256;
+	t_real_reso dhklE[4][CHUNK], dS[CHUNK];
+
+	for(std::size_t iChunk=0; iChunk<iNum; iChunk+=CHUNK)
+	{
+		const std::size_t iChunkLen = std::min(CHUNK, iNum-iChunk);
+		for(std::size_t i=0; i<iChunkLen; ++i)
+		{
+			dhklE[0][i] = t_real_reso(pH[iChunk+i]);
+			dhklE[1][i] = t_real_reso(pK[iChunk+i]);
+			dhklE[2][i] = t_real_reso(pL[iChunk+i]);
+			dhklE[3][i] = t_real_reso(pE[iChunk+i]);
+		}
+
+		EvalBlock(dhklE[0], dhklE[1], dhklE[2], dhklE[3], iChunkLen, dS);
+
+		for(std::size_t i=0; i<iChunkLen; ++i)
+			pS[iChunk+i] = t_real_fast(dS[i]);
+	}
+}
+
+
+/**
+ * callback giving the branches of disp() with the line shape of lineshape(),
+ * it returns false for models which are not a sum of lines along their branches
+ */
+SqwBase::t_fktLines SqwBase::GetLinesFunc() const
+{
+	return [this](t_real_reso dh, t_real_reso dk, t_real_reso dl,
+		std::vector<t_real_reso>& vecE, std::vector<t_real_reso>& vecW,
+		t_real_reso& dSigma, t_real_reso& dHWHM) -> bool
+	{
+		if(!lineshape(dSigma, dHWHM))
+			return false;
+		std::tie(vecE, vecW) = disp(dh, dk, dl);
+		return true;
+	};
+}
+
+
 const SqwBase& SqwBase::operator=(const SqwBase& sqw)
 {
 	this->m_bOk = sqw.m_bOk;
@@ -12,6 +12,7 @@
 #include <tuple>
 #include <vector>
 #include <memory>
+#include <functional>
 
 #include "../res/defs.h"
 #include "tlibs/string/string.h"
@@ -29,6 +30,11 @@ public:
 	// extended fields: ident, error, is fit var?
 	using t_var_fit = std::tuple<std::string, std::string, bool>;
 
+	// branches, weights and line shape at a Q point, same as TASReso::t_fktLines
+	using t_fktLines = std::function<bool(t_real_reso dh, t_real_reso dk, t_real_reso dl,
+		std::vector<t_real_reso>& vecE, std::vector<t_real_reso>& vecW,
+		t_real_reso& dSigma, t_real_reso& dHWHM)>;
+
 
 protected:
 	bool m_bOk = false;
@@ -44,10 +50,29 @@ public:
 		disp(t_real_reso dh, t_real_reso dk, t_real_reso dl) const
 	{ return std::tuple<std::vector<t_real_reso>, std::vector<t_real_reso>>({}, {}); }
 
+	/**
+	 * line shape for the analytic convolution (optional):
+	 * if S(Q,E) = sum_i w_i V(E - E_i(Q)) with the energies and weights of disp()
+	 * and an area-normalised voigt profile V, return its gaussian sigma and lorentzian hwhm
+	 */
+	virtual bool lineshape(t_real_reso& dSigma, t_real_reso& dHWHM) const
+	{ return false; }
+
+	// lineshape() and disp() combined for the analytic convolution, the model has to outlive it
+	t_fktLines GetLinesFunc() const;
+
 	// S(Q,E) dynamical structure factor function
 	virtual t_real_reso operator()(t_real_reso dh, t_real_reso dk, t_real_reso dl, t_real_reso dE) const = 0;
 	virtual bool IsOk() const { return m_bOk; }
 
+	// S(Q,E) for a block of points, the default calls operator()
+	virtual void EvalBlock(const t_real_reso* pH, const t_real_reso* pK, const t_real_reso* pL,
+		const t_real_reso* pE, std::size_t iNum, t_real_reso* pS) const;
+
+	// S(Q,E) for a block of points in single precision, the default calls EvalBlock
+	virtual void EvalFast(const t_real_fast* pH, const t_real_fast* pK, const t_real_fast* pL,
+		const t_real_fast* pE, std::size_t iNum, t_real_fast* pS) const;
+
 	// return model variables
 	virtual std::vector<t_var> GetVars() const = 0;
 	virtual const std::vector<t_var_fit>& GetFitVars() const { return m_vecFit; }
@@ -23,12 +23,27 @@
 #include "tlibs/file/file.h"
 #include "libs/globals.h"
 #include "libs/version.h"
+#include "libs/workers.h"
 
 #include <algorithm>
 #include <functional>
 #include <unordered_map>
 
 
+// number of child processes for the python and julia models
+static unsigned int s_iNumSqwProcs = 1;
+
+void set_sqw_procs(unsigned int iNumProcs)
+{
+	s_iNumSqwProcs = iNumProcs;
+}
+
+unsigned int get_sqw_procs()
+{
+	return s_iNumSqwProcs ? s_iNumSqwProcs : get_max_threads();
+}
+
+
 // sqw info function: "takin_sqw_info"
 // returns: [takin ver, ident, long name]
 using t_pfkt_info = std::tuple<std::string, std::string, std::string>(*)();
@@ -63,14 +78,14 @@ static t_mapSqw g_mapSqw =
 	{ "py", t_mapSqw::mapped_type {
 		[](const std::string& strCfgFile) -> std::shared_ptr<SqwBase>
 		//{ return std::make_shared<SqwPy>(strCfgFile.c_str()); },
-		{ return std::make_shared<SqwProc<SqwPy>>(strCfgFile.c_str()); },
+		{ return std::make_shared<SqwProc<SqwPy>>(strCfgFile.c_str(), get_sqw_procs()); },
 		"Python Model" } },
 #endif
 #ifdef USE_JL
 	{ "jl", t_mapSqw::mapped_type {
 		[](const std::string& strCfgFile) -> std::shared_ptr<SqwBase>
 		//{ return std::make_shared<SqwJl>(strCfgFile.c_str()); },
-		{ return std::make_shared<SqwProc<SqwJl>>(strCfgFile.c_str()); },
+		{ return std::make_shared<SqwProc<SqwJl>>(strCfgFile.c_str(), get_sqw_procs()); },
 		"Julia Model" } },
 #endif
 	{ "elastic", t_mapSqw::mapped_type {
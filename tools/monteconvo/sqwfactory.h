@@ -27,6 +27,10 @@ extern std::vector<std::tuple<std::string, std::string>> get_sqw_names();
 extern void unload_sqw_plugins();
 extern void load_sqw_plugins();
 
+// number of child processes for the out-of-process models (0: one per worker thread)
+extern void set_sqw_procs(unsigned int iNumProcs);
+extern unsigned int get_sqw_procs();
+
 
 // ----------------------------------------------------------------------------
 // saving and loading of parameters
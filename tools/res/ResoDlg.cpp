@@ -968,7 +968,29 @@ void ResoDlg::MCGenerate()
 
 	opts.dAngleQVec0 = m_dAngleQVec0;
 	vecNeutrons.resize(iNeutrons);
-	mc_neutrons<t_vec>(m_ell4d, iNeutrons, opts, vecNeutrons.begin());
+	if(checkMCUnitBank->isChecked())
+	{
+		// only draw new unit neutrons if their number has changed
+		if(m_mcUnit.size() != std::size_t(iNeutrons))
+		{
+			m_mcUnit.resize(iNeutrons);
+			mc_unit_neutrons<t_mat>(iNeutrons, opts, m_mcUnit, 0);
+		}
+
+		McNeutrons<t_real_reso> neutrons;
+		neutrons.resize(iNeutrons);
+		mc_neutrons_warp<t_vec, t_mat>(m_ell4d, iNeutrons, opts, m_mcUnit, 0, neutrons, 0);
+
+		for(int iCur=0; iCur<iNeutrons; ++iCur)
+		{
+			vecNeutrons[iCur] = tl::make_vec<t_vec>({ neutrons.h[iCur], neutrons.k[iCur],
+				neutrons.l[iCur], neutrons.E[iCur] });
+		}
+	}
+	else
+	{
+		mc_neutrons<t_vec>(m_ell4d, iNeutrons, opts, vecNeutrons.begin());
+	}
 
 
 	ofstr.precision(g_iPrec);
@@ -29,6 +29,7 @@
 	#include "libs/plotgl.h"
 #endif
 #include "ellipse.h"
+#include "mc.h"
 #include "dialogs/RecipParamDlg.h"
 #include "dialogs/RealParamDlg.h"
 #include "dialogs/EllipseDlg.h"
@@ -101,6 +102,9 @@ protected:
 	std::vector<ublas::vector<t_real_reso>> m_vecMC_direct;
 	std::vector<ublas::vector<t_real_reso>> m_vecMC_HKL;
 
+	// unit-sphere neutrons for the external mc file, mapped onto the current ellipsoid
+	McNeutrons<t_real_reso> m_mcUnit;
+
 
 	bool m_bDontCalc;
 	bool m_bEll4dCurrent = 0;
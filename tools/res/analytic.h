@@ -0,0 +1,188 @@
+/**
+ * analytic convolution of dispersion lines with the resolution ellipsoid
+ * @author agent <agent@local>
+ * @date oct-2026
+ * @license GPLv2
+ *
+ * @desc for S(Q,E) = sum_i w_i V(E - E_i(Q)) and a branch E_i(Q) which is linear over
+ *       the ellipsoid, E - E_i(Q) is normally distributed under the gaussian resolution,
+ *       so the convolution of each line V is again a line with the resolution width
+ *       along the branch added to it (linearisation as in cooper-nathans and popovici).
+ */
+
+#ifndef __RESO_ANALYTIC_H__
+#define __RESO_ANALYTIC_H__
+
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <limits>
+
+#include "ellipse.h"
+#include "mc.h"
+
+
+/**
+ * coefficients of the rational approximation of the faddeeva function
+ * @see J. A. C. Weideman, SIAM J. Numer. Anal. 31(5), pp. 1497-1518 (1994), "cef"
+ */
+template<class t_real = double>
+std::vector<t_real> faddeeva_coeff(int N)
+{
+	const t_real dPi = tl::get_pi<t_real>();
+	const t_real dL = std::sqrt(t_real(N) / std::sqrt(t_real(2)));
+
+	// samples of exp(-t^2) (L^2 + t^2) at t = L tan(k pi / 4N)
+	std::vector<t_real> vecF(4*N, t_real(0));
+	for(int k=-2*N+1; k<2*N; ++k)
+	{
+		const t_real t = dL * std::tan(t_real(k)*dPi / t_real(4*N));
+		vecF[k + 2*N] = std::exp(-t*t) * (dL*dL + t*t);
+	}
+
+	// the fourier coefficients, f is even, so only the cosine terms remain
+	std::vector<t_real> vecA(N);
+	for(int n=1; n<=N; ++n)
+	{
+		t_real dSum = 0;
+		for(int k=-2*N+1; k<2*N; ++k)
+			dSum += vecF[k + 2*N] * std::cos(t_real(k*n)*dPi / t_real(2*N));
+		vecA[n-1] = dSum / t_real(4*N);
+	}
+
+	return vecA;
+}
+
+
+/**
+ * faddeeva function w(z) = exp(-z^2) erfc(-iz) in the upper half-plane, Im z >= 0
+ */
+template<class t_real = double>
+std::complex<t_real> faddeeva(const std::complex<t_real>& z)
+{
+	using t_cplx = std::complex<t_real>;
+
+	constexpr int N = 32;
+	static const t_real dL = std::sqrt(t_real(N) / std::sqrt(t_real(2)));
+	static const std::vector<t_real> vecA = faddeeva_coeff<t_real>(N);
+
+	const t_cplx i(0, 1);
+	const t_cplx zDen = dL - i*z;
+	const t_cplx Z = (dL + i*z) / zDen;
+
+	// horner scheme for sum_n a_n Z^(n-1)
+	t_cplx p = vecA.back();
+	for(std::size_t n=vecA.size()-1; n>0; --n)
+		p = p*Z + vecA[n-1];
+
+	return t_real(2)*p/(zDen*zDen) + t_real(1)/(std::sqrt(tl::get_pi<t_real>()) * zDen);
+}
+
+
+/**
+ * area-normalised voigt profile, i.e. a gaussian with dSigma convoluted
+ * with a lorentzian with dHWHM, either of which may be zero
+ */
+template<class t_real = double>
+t_real voigt_profile(t_real x, t_real dSigma, t_real dHWHM)
+{
+	const t_real dPi = tl::get_pi<t_real>();
+	dSigma = std::abs(dSigma);
+	dHWHM = std::abs(dHWHM);
+
+	if(dHWHM == t_real(0))
+	{
+		if(dSigma == t_real(0))
+			return x == t_real(0) ? std::numeric_limits<t_real>::infinity() : t_real(0);
+		return std::exp(-t_real(0.5)*x*x/(dSigma*dSigma)) / (std::sqrt(t_real(2)*dPi) * dSigma);
+	}
+	if(dSigma == t_real(0))
+		return dHWHM / (dPi * (x*x + dHWHM*dHWHM));
+
+	const t_real dScale = t_real(1) / (std::sqrt(t_real(2)) * dSigma);
+	const std::complex<t_real> z(x*dScale, dHWHM*dScale);
+	return faddeeva<t_real>(z).real() / (std::sqrt(t_real(2)*dPi) * dSigma);
+}
+
+
+/**
+ * analytic convolution of S(Q,E) = sum_i w_i V(E - E_i(Q)) with one resolution ellipsoid,
+ * V is the voigt profile with dSigma and dHWHM.
+ * fktLines(h, k, l, vecE, vecW, dSigma, dHWHM) gives the branches and weights at a Q point
+ * and the line shape, or false if the model cannot be written in this form.
+ *
+ * the branches are linearised around the centre of the ellipsoid using their central
+ * differences along its principal axes (one sigma), the second differences only correct
+ * the mean and the width of the lines. returns false (and the caller has to fall back
+ * to mc) if the linearisation is invalid, i.e. if the number of branches changes or if
+ * the curvature of a branch over the ellipsoid exceeds dMaxCurv times the width of its
+ * convoluted line.
+ */
+template<class t_mat = ublas::matrix<double>, class t_fkt>
+bool analytic_convo(const Ellipsoid4d<typename t_mat::value_type>& ell4d,
+	const McNeutronOpts<t_mat>& opts, const t_fkt& fktLines, typename t_mat::value_type dMaxCurv,
+	typename t_mat::value_type& dS, typename t_mat::value_type (&dhklE)[4])
+{
+	using t_real = typename t_mat::value_type;
+
+	t_real dMat[4][4], dTrans[4];
+	mc_neutron_trafo<t_mat>(ell4d, opts, dMat, dTrans);
+
+	for(int i=0; i<4; ++i)
+		dhklE[i] = dTrans[i];
+	dS = t_real(0);
+
+	t_real dSigma = 0, dHWHM = 0;
+	std::vector<t_real> vecE0, vecW0;
+	if(!fktLines(dTrans[0], dTrans[1], dTrans[2], vecE0, vecW0, dSigma, dHWHM))
+		return false;
+	const std::size_t iNumBranches = vecE0.size();
+	if(iNumBranches == 0 || vecW0.size() < iNumBranches)
+		return false;
+
+	// branch energies one sigma along the principal axes in both directions
+	std::vector<t_real> vecEPlus[4], vecEMinus[4], vecW;
+	for(int iAxis=0; iAxis<4; ++iAxis)
+	{
+		t_real dSig, dHW;
+		for(int iDir : { -1, 1 })
+		{
+			std::vector<t_real>& vecE = (iDir > 0 ? vecEPlus[iAxis] : vecEMinus[iAxis]);
+			if(!fktLines(dTrans[0] + t_real(iDir)*dMat[0][iAxis], dTrans[1] + t_real(iDir)*dMat[1][iAxis],
+				dTrans[2] + t_real(iDir)*dMat[2][iAxis], vecE, vecW, dSig, dHW))
+				return false;
+			if(vecE.size() != iNumBranches)
+				return false;
+		}
+	}
+
+	for(std::size_t iBranch=0; iBranch<iNumBranches; ++iBranch)
+	{
+		// variance of E - E_i(Q), the second differences give the mean shift
+		// of the branch over the ellipsoid and its contribution to the variance
+		t_real dVar = 0, dShift = 0, dCurv = 0;
+		for(int iAxis=0; iAxis<4; ++iAxis)
+		{
+			const t_real dEPlus = vecEPlus[iAxis][iBranch], dEMinus = vecEMinus[iAxis][iBranch];
+			const t_real dGrad = t_real(0.5) * (dEPlus - dEMinus);
+			const t_real dDiff2 = dEPlus + dEMinus - t_real(2)*vecE0[iBranch];
+			const t_real dDiff = dMat[3][iAxis] - dGrad;
+
+			dVar += dDiff*dDiff + t_real(0.5)*dDiff2*dDiff2;
+			dShift += t_real(0.5)*dDiff2;
+			dCurv += t_real(0.5)*std::abs(dDiff2);
+		}
+
+		const t_real dSigTot = std::sqrt(dVar + dSigma*dSigma);
+		const t_real dWidth = std::sqrt(dSigTot*dSigTot + dHWHM*dHWHM);
+		if(dCurv > dMaxCurv*dWidth)
+			return false;
+
+		dS += vecW0[iBranch] * voigt_profile<t_real>(dTrans[3] - vecE0[iBranch] - dShift, dSigTot, dHWHM);
+	}
+
+	return true;
+}
+
+
+#endif
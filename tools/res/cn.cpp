@@ -21,7 +21,6 @@
 #include "tlibs/log/log.h"
 
 #include <string>
-#include <future>
 #include <iostream>
 
 
@@ -114,15 +113,18 @@ t_real chess_R0(wavenumber ki, wavenumber kf,
  * e.g. E ~ ki^2 - kf^2
  * dE ~ 2ki*dki - 2kf*dkf
  */
-t_mat get_trafo_dkidkf_dQdE(const angle& ki_Q, const angle& kf_Q,
+t_matfix<t_real, 6> get_trafo_dkidkf_dQdE(const angle& ki_Q, const angle& kf_Q,
 	const wavenumber& ki, const wavenumber& kf)
 {
-	t_mat Ti = tl::rotation_matrix_2d(ki_Q/rads);
-	t_mat Tf = -tl::rotation_matrix_2d(kf_Q/rads);
-
-	t_mat U = ublas::zero_matrix<t_real>(6,6);
-	tl::submatrix_copy(U, Ti, 0, 0);
-	tl::submatrix_copy(U, Tf, 0, 3);
+	// Ti = rotation(ki_Q), Tf = -rotation(kf_Q)
+	const t_real dCi = units::cos(ki_Q), dSi = units::sin(ki_Q);
+	const t_real dCf = units::cos(kf_Q), dSf = units::sin(kf_Q);
+
+	t_matfix<t_real, 6> U = fix_zero<t_real, 6>();
+	U(0,0) = dCi; U(0,1) = -dSi;
+	U(1,0) = dSi; U(1,1) = dCi;
+	U(0,3) = -dCf; U(0,4) = dSf;
+	U(1,3) = -dSf; U(1,4) = -dCf;
 	U(2,2) = 1.; U(2,5) = -1.;
 	U(3,0) = +t_real(2)*ki * tl::get_KSQ2E<t_real>() * angs;
 	U(3,3) = -t_real(2)*kf * tl::get_KSQ2E<t_real>() * angs;
@@ -133,7 +135,80 @@ t_mat get_trafo_dkidkf_dQdE(const angle& ki_Q, const angle& kf_Q,
 }
 
 
-ResoResults calc_cn(const CNParams& cn)
+/**
+ * horizontal and vertical resolution of the mono or ana arm
+ */
+static CNArm calc_cn_arm(angle theta, wavenumber k,
+	angle mosaic, angle mosaic_v,
+	angle coll1, angle coll2,
+	angle coll1_v, angle coll2_v)
+{
+	CNArm arm;
+	arm.dK = k*angs;
+	arm.dTheta = theta/rads;
+
+	// horizontal part
+	const t_real dMos[2] = { units::tan(theta) / (k*angs * mosaic/rads), t_real(1) / (k*angs * mosaic/rads) };
+	const t_real dColl1[2] = { t_real(2)*units::tan(theta) / (k*angs * coll1/rads), t_real(1) / (k*angs * coll1/rads) };
+	const t_real dColl2[2] = { t_real(0), t_real(1) / (k*angs * coll2/rads) };
+
+	for(std::size_t i=0; i<2; ++i)
+		for(std::size_t j=0; j<2; ++j)
+			arm.matHori(i,j) = dMos[i]*dMos[j] + dColl1[i]*dColl1[j] + dColl2[i]*dColl2[j];
+
+	// vertical part, [mit84], equ. A.9 & A.13
+	arm.dVert = t_real(1)/(k*k * angs*angs) * rads*rads *
+	(
+		t_real(1) / (coll2_v * coll2_v) +
+		t_real(1) / ((t_real(2)*units::sin(theta) * mosaic_v) *
+			(t_real(2)*units::sin(theta) * mosaic_v) +
+			coll1_v * coll1_v)
+	);
+
+	arm.bOk = true;
+	return arm;
+}
+
+// use the same as the horizontal mosaics for the vertical ones for now
+static CNArm calc_cn_mono_arm(const CNParams& cn)
+{
+	return calc_cn_arm(cn.thetam * cn.dmono_sense, cn.ki,
+		cn.mono_mosaic, cn.mono_mosaic,
+		cn.coll_h_pre_mono, cn.coll_h_pre_sample,
+		cn.coll_v_pre_mono, cn.coll_v_pre_sample);
+}
+
+static CNArm calc_cn_ana_arm(const CNParams& cn)
+{
+	return calc_cn_arm(-cn.thetaa * cn.dana_sense, cn.kf,
+		cn.ana_mosaic, cn.ana_mosaic,
+		cn.coll_h_post_ana, cn.coll_h_post_sample,
+		cn.coll_v_post_ana, cn.coll_v_post_sample);
+}
+
+static bool arm_matches(const CNArm& arm, const wavenumber& k, const angle& theta)
+{
+	return arm.bOk && tl::float_equal<t_real>(arm.dK, k*angs)
+		&& tl::float_equal<t_real>(arm.dTheta, theta/rads);
+}
+
+
+/**
+ * (re-)calculates the arms which do not match the current k and angles
+ */
+void calc_cn_precalc(const CNParams& cn, CNPrecalc& pre)
+{
+	if(!arm_matches(pre.mono, cn.ki, cn.thetam * cn.dmono_sense))
+		pre.mono = calc_cn_mono_arm(cn);
+	if(!arm_matches(pre.ana, cn.kf, -cn.thetaa * cn.dana_sense))
+		pre.ana = calc_cn_ana_arm(cn);
+}
+
+
+/**
+ * the arms are taken from pPre if they match, see calc_cn_precalc
+ */
+ResoResults calc_cn(const CNParams& cn, const CNPrecalc* pPre)
 {
 	ResoResults res;
 
@@ -146,10 +221,6 @@ ResoResults calc_cn(const CNParams& cn)
 	angle coll_h_pre_mono = cn.coll_h_pre_mono;
 	angle coll_v_pre_mono = cn.coll_v_pre_mono;
 
-	// use the same as the horizontal mosaics for now
-	angle mono_mosaic_v = cn.mono_mosaic;
-	angle ana_mosaic_v = cn.ana_mosaic;
-
 	/*const length lam = tl::k2lam(cn.ki);
 	if(cn.bGuide)
 	{
@@ -165,11 +236,11 @@ ResoResults calc_cn(const CNParams& cn)
 	ki_Q *= cn.dsample_sense;
 	kf_Q *= cn.dsample_sense;
 
-	t_mat U = get_trafo_dkidkf_dQdE(ki_Q, kf_Q, cn.ki, cn.kf);
+	const t_matfix<t_real, 6> U = get_trafo_dkidkf_dQdE(ki_Q, kf_Q, cn.ki, cn.kf);
 
 	// V matrix -> [mit84], equ. A.16
-	t_mat V(6,6);
-	if(!tl::inverse(U, V))
+	t_matfix<t_real, 6> V;
+	if(!fix_inverse(U, V))
 	{
 		res.bOk = false;
 		res.strErr = "Transformation matrix cannot be inverted.";
@@ -187,95 +258,57 @@ ResoResults calc_cn(const CNParams& cn)
 
 	// -------------------------------------------------------------------------
 	// resolution matrix, [mit84], equ. A.5
-	t_mat M = ublas::zero_matrix<t_real>(6,6);
-
-	auto calc_mono_ana_res =
-		[](angle theta, wavenumber k,
-		angle mosaic, angle mosaic_v,
-		angle coll1, angle coll2,
-		angle coll1_v, angle coll2_v) -> std::pair<t_mat, t_real>
-	{
-		// horizontal part
-		t_vec vecMos(2);
-		vecMos[0] = units::tan(theta);
-		vecMos[1] = 1.;
-		vecMos /= k*angs * mosaic/rads;
-
-		t_vec vecColl1(2);
-		vecColl1[0] = 2.*units::tan(theta);
-		vecColl1[1] = 1.;
-		vecColl1 /= (k*angs * coll1/rads);
-
-		t_vec vecColl2(2);
-		vecColl2[0] = 0;
-		vecColl2[1] = 1.;
-		vecColl2 /= (k*angs * coll2/rads);
-
-		t_mat matHori = ublas::outer_prod(vecMos, vecMos) +
-			ublas::outer_prod(vecColl1, vecColl1) +
-			ublas::outer_prod(vecColl2, vecColl2);
-
-		// vertical part, [mit84], equ. A.9 & A.13
-		t_real dVert = t_real(1)/(k*k * angs*angs) * rads*rads *
-		(
-			t_real(1) / (coll2_v * coll2_v) +
-			t_real(1) / ((t_real(2)*units::sin(theta) * mosaic_v) *
-				(t_real(2)*units::sin(theta) * mosaic_v) +
-				coll1_v * coll1_v)
-		);
-
-		return std::pair<t_mat, t_real>(matHori, dVert);
-	};
-
-	std::launch lpol = /*std::launch::deferred |*/ std::launch::async;
-	std::future<std::pair<t_mat, t_real>> futMono
-		= std::async(lpol, calc_mono_ana_res,
-			thetam, cn.ki,
-			cn.mono_mosaic, mono_mosaic_v,
-			cn.coll_h_pre_mono, cn.coll_h_pre_sample,
-			cn.coll_v_pre_mono, cn.coll_v_pre_sample);
-	std::future<std::pair<t_mat, t_real>> futAna
-		= std::async(lpol, calc_mono_ana_res,
-			-thetaa, cn.kf,
-			cn.ana_mosaic, ana_mosaic_v,
-			cn.coll_h_post_ana, cn.coll_h_post_sample,
-			cn.coll_v_post_ana, cn.coll_v_post_sample);
-
-	t_mat matMonoH, matAnaH;
-	t_real dMonoV, dAnaV;
-	std::tie(matMonoH, dMonoV) = futMono.get();
-	std::tie(matAnaH, dAnaV) = futAna.get();
-
-	tl::submatrix_copy(M, matMonoH, 0, 0);
-	tl::submatrix_copy(M, matAnaH, 3, 3);
-	M(2,2) = dMonoV;
-	M(5,5) = dAnaV;
+	t_matfix<t_real, 6> M = fix_zero<t_real, 6>();
+
+	CNArm armMono, armAna;
+	const CNArm *pMono = nullptr, *pAna = nullptr;
+	if(pPre && arm_matches(pPre->mono, cn.ki, thetam))
+		pMono = &pPre->mono;
+	if(pPre && arm_matches(pPre->ana, cn.kf, -thetaa))
+		pAna = &pPre->ana;
+
+	// the arms are cheap, a thread per call would cost more than it saves
+	if(!pMono)
+		armMono = calc_cn_mono_arm(cn);
+	if(!pAna)
+		armAna = calc_cn_ana_arm(cn);
+
+	if(!pMono) pMono = &armMono;
+	if(!pAna) pAna = &armAna;
+
+	fix_submatrix_copy(M, pMono->matHori, 0, 0);
+	fix_submatrix_copy(M, pAna->matHori, 3, 3);
+	M(2,2) = pMono->dVert;
+	M(5,5) = pAna->dVert;
 	// -------------------------------------------------------------------------
 
 
-	t_mat N = tl::transform(M, V, 1);
+	const t_matfix<t_real, 4> N = fix_gauss_int(fix_gauss_int(fix_transform(M, V), 5), 4);
 
-	N = ellipsoid_gauss_int(N, 5);
-	N = ellipsoid_gauss_int(N, 4);
+	// sample mosaic
+	const t_real dMosQ = cn.sample_mosaic/rads * cn.Q*angs;
+	const t_real dMosDenom = t_real(1)/(dMosQ*dMosQ) + N(1,1);
 
-	t_vec vec1 = tl::get_column<t_vec>(N, 1);
-	res.reso = N - ublas::outer_prod(vec1,vec1)
-		/ (1./((cn.sample_mosaic/rads * cn.Q*angs)
-		* (cn.sample_mosaic/rads * cn.Q*angs)) + N(1,1));
-	res.reso(2,2) = N(2,2);
-	res.reso *= sig2fwhm*sig2fwhm;
-
-	res.reso_v = ublas::zero_vector<t_real>(4);
-	res.reso_s = 0.;
+	t_matfix<t_real, 4> reso;
+	for(std::size_t i=0; i<4; ++i)
+		for(std::size_t j=0; j<4; ++j)
+			reso(i,j) = (N(i,j) - N(i,1)*N(j,1) / dMosDenom) * sig2fwhm*sig2fwhm;
+	reso(2,2) = N(2,2) * sig2fwhm*sig2fwhm;
 
 	if(cn.dsample_sense < 0.)
 	{
 		// mirror Q_perp
-		t_mat matMirror = tl::mirror_matrix<t_mat>(res.reso.size1(), 1);
-		res.reso = tl::transform(res.reso, matMirror, true);
-		res.reso_v[1] = -res.reso_v[1];
+		for(std::size_t i=0; i<4; ++i)
+		{
+			if(i == 1) continue;
+			reso(1,i) = reso(i,1) = -reso(i,1);
+		}
 	}
 
+	res.reso = fix_to_dyn(reso);
+	res.reso_v = ublas::zero_vector<t_real>(4);
+	res.reso_s = 0.;
+
 	// -------------------------------------------------------------------------
 
 
@@ -16,6 +16,7 @@
 #define __TAKIN_CN_H__
 
 #include "defs.h"
+#include "fixmat.h"
 #include "tlibs/phys/neutrons.h"
 #include "tlibs/math/linalg.h"
 #include <tuple>
@@ -71,7 +72,26 @@ struct CNParams
 	std::size_t flags = CALC_R0 | CALC_RESVOL | CALC_KI3 | CALC_KF3 | CALC_KFKI;
 };
 
-extern ResoResults calc_cn(const CNParams& cn);
+/**
+ * terms of the mono or ana arm, which only depend on the instrument, on k and
+ * on the crystal angle; the arm with fixed k can be reused for a whole scan
+ */
+struct CNArm
+{
+	bool bOk = false;
+	t_real_reso dK = 0, dTheta = 0;		// calculated for k (1/A) and the signed angle (rad)
+
+	t_matfix<t_real_reso, 2> matHori;	// horizontal part, [mit84], equ. A.5
+	t_real_reso dVert = 0;			// vertical part, [mit84], equ. A.9 & A.13
+};
+
+struct CNPrecalc
+{
+	CNArm mono, ana;
+};
+
+extern void calc_cn_precalc(const CNParams& cn, CNPrecalc& pre);
+extern ResoResults calc_cn(const CNParams& cn, const CNPrecalc* pPre = nullptr);
 
 extern std::tuple<t_real_reso, t_real_reso, t_real_reso>
 	get_scatter_factors(std::size_t flags,
@@ -80,7 +100,7 @@ extern std::tuple<t_real_reso, t_real_reso, t_real_reso>
 		const tl::t_angle_si<t_real_reso>& thetaa,
 		const tl::t_wavenumber_si<t_real_reso>& kf);
 
-extern ublas::matrix<t_real_reso> get_trafo_dkidkf_dQdE(
+extern t_matfix<t_real_reso, 6> get_trafo_dkidkf_dQdE(
 	const tl::t_angle_si<t_real_reso>& ki_Q, const tl::t_angle_si<t_real_reso>& kf_Q,
 	const tl::t_wavenumber_si<t_real_reso>& ki, const tl::t_wavenumber_si<t_real_reso>& kf);
 
@@ -0,0 +1,136 @@
+/**
+ * gauss-hermite cubature over the resolution ellipsoid
+ * @author agent <agent@local>
+ * @date oct-2026
+ * @license GPLv2
+ */
+
+#ifndef __RESO_CUBATURE_H__
+#define __RESO_CUBATURE_H__
+
+#include <vector>
+#include <cmath>
+
+#include "ellipse.h"
+#include "mc.h"
+
+
+/**
+ * nodes and weights of the gauss-hermite quadrature of order iOrder for the
+ * standard normal distribution, i.e. sum_i w_i f(x_i) ~ int N(x; 0, 1) f(x) dx
+ * @see W. H. Press et al., "Numerical Recipes", 2nd ed., sec. 4.5 (gauher)
+ */
+template<class t_real = double>
+void gauss_hermite(unsigned iOrder, std::vector<t_real>& vecX, std::vector<t_real>& vecW)
+{
+	vecX.resize(iOrder);
+	vecW.resize(iOrder);
+	if(iOrder == 0) return;
+
+	const t_real dEps = t_real(3e-14);
+	const t_real dPiM4 = std::pow(tl::get_pi<t_real>(), t_real(-0.25));
+	const int iMaxIter = 32;
+	const t_real dN = t_real(iOrder);
+
+	// nodes for the weight function exp(-x^2), only the positive half is searched
+	std::vector<t_real> vecXPhys(iOrder), vecWPhys(iOrder);
+	t_real z = 0;
+	for(unsigned i=0; i<(iOrder+1)/2; ++i)
+	{
+		// initial guesses
+		if(i == 0)
+			z = std::sqrt(t_real(2)*dN + t_real(1)) -
+				t_real(1.85575)*std::pow(t_real(2)*dN + t_real(1), t_real(-0.16667));
+		else if(i == 1)
+			z -= t_real(1.14)*std::pow(dN, t_real(0.426)) / z;
+		else if(i == 2)
+			z = t_real(1.86)*z - t_real(0.86)*vecXPhys[0];
+		else if(i == 3)
+			z = t_real(1.91)*z - t_real(0.91)*vecXPhys[1];
+		else
+			z = t_real(2)*z - vecXPhys[i-2];
+
+		// newton iteration on the normalised hermite polynomials
+		t_real dDeriv = 0;
+		for(int iIter=0; iIter<iMaxIter; ++iIter)
+		{
+			t_real p1 = dPiM4, p2 = 0;
+			for(unsigned j=0; j<iOrder; ++j)
+			{
+				t_real p3 = p2;
+				p2 = p1;
+				p1 = z*std::sqrt(t_real(2)/t_real(j+1))*p2 - std::sqrt(t_real(j)/t_real(j+1))*p3;
+			}
+			dDeriv = std::sqrt(t_real(2)*dN) * p2;
+
+			t_real z1 = z;
+			z = z1 - p1/dDeriv;
+			if(std::abs(z-z1) <= dEps)
+				break;
+		}
+
+		vecXPhys[i] = z;
+		vecXPhys[iOrder-1-i] = -z;
+		vecWPhys[i] = vecWPhys[iOrder-1-i] = t_real(2) / (dDeriv*dDeriv);
+	}
+
+	// transform to the standard normal distribution, x -> sqrt(2) x
+	const t_real dSqrt2 = std::sqrt(t_real(2));
+	const t_real dNorm = t_real(1) / std::sqrt(tl::get_pi<t_real>());
+	for(unsigned i=0; i<iOrder; ++i)
+	{
+		vecX[i] = dSqrt2 * vecXPhys[i];
+		vecW[i] = dNorm * vecWPhys[i];
+	}
+}
+
+
+/**
+ * nodes and weights of a tensor-product gauss-hermite cubature over the resolution
+ * ellipsoid with iOrder[i] points along its principal axis i.
+ * the nodes are written into a neutron bank, so they can be evaluated like mc neutrons.
+ * returns the number of nodes.
+ */
+template<class t_vec = ublas::vector<double>, class t_mat = ublas::matrix<double>>
+std::size_t cubature_neutrons(const Ellipsoid4d<typename t_vec::value_type>& ell4d,
+	const unsigned (&iOrder)[4], const McNeutronOpts<t_mat>& opts,
+	McNeutrons<typename t_vec::value_type>& nodes, std::vector<typename t_vec::value_type>& vecWeights)
+{
+	using t_real = typename t_vec::value_type;
+
+	std::vector<t_real> vecX[4], vecW[4];
+	std::size_t iNum = 1;
+	for(int iAxis=0; iAxis<4; ++iAxis)
+	{
+		gauss_hermite<t_real>(std::max(iOrder[iAxis], 1u), vecX[iAxis], vecW[iAxis]);
+		iNum *= vecX[iAxis].size();
+	}
+
+	t_real dMat[4][4], dTrans[4];
+	mc_neutron_trafo<t_mat>(ell4d, opts, dMat, dTrans);
+
+	nodes.resize(iNum);
+	vecWeights.resize(iNum);
+
+	std::size_t iNode = 0;
+	for(std::size_t i0=0; i0<vecX[0].size(); ++i0)
+	for(std::size_t i1=0; i1<vecX[1].size(); ++i1)
+	for(std::size_t i2=0; i2<vecX[2].size(); ++i2)
+	for(std::size_t i3=0; i3<vecX[3].size(); ++i3)
+	{
+		const t_real z[4] = { vecX[0][i0], vecX[1][i1], vecX[2][i2], vecX[3][i3] };
+		for(int i=0; i<4; ++i)
+		{
+			nodes.data(i)[iNode] = dTrans[i] + dMat[i][0]*z[0] + dMat[i][1]*z[1]
+				+ dMat[i][2]*z[2] + dMat[i][3]*z[3];
+		}
+
+		vecWeights[iNode] = vecW[0][i0] * vecW[1][i1] * vecW[2][i2] * vecW[3][i3];
+		++iNode;
+	}
+
+	return iNum;
+}
+
+
+#endif
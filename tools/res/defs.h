@@ -18,6 +18,7 @@
 namespace ublas = boost::numeric::ublas;
 
 using t_real_reso = ::t_real_glob;
+using t_real_fast = float;		// optional single-precision mc path
 
 enum ResoFlags : std::size_t
 {
@@ -16,7 +16,6 @@
 #include "ellipse.h"
 
 #include <tuple>
-#include <future>
 #include <string>
 #include <iostream>
 
@@ -40,8 +39,7 @@ static const t_real pi = tl::get_pi<t_real>();
 static const t_real sig2fwhm = tl::get_SIGMA2FWHM<t_real>();
 
 
-static std::tuple<t_mat, t_vec, t_real, t_real, t_real>
-get_mono_vals(const length& src_w, const length& src_h,
+static EckArm get_mono_vals(const length& src_w, const length& src_h,
 	const length& mono_w, const length& mono_h,
 	const length& dist_src_mono, const length& dist_mono_sample,
 	const wavenumber& ki, const angle& thetam,
@@ -49,11 +47,14 @@ get_mono_vals(const length& src_w, const length& src_h,
 	const angle& coll_v_pre_mono, const angle& coll_v_pre_sample,
 	const angle& mono_mosaic, const angle& mono_mosaic_v,
 	const inv_length& inv_mono_curvh, const inv_length& inv_mono_curvv,
-	const length& pos_x , const length& pos_y, const length& pos_z,
 	t_real dRefl)
 {
+	// unit sample position, see get_pos_vals
+	const length pos_y = t_real(1)*cm;
+	const length pos_z = t_real(1)*cm;
+
 	// A matrix: formula 26 in [eck14]
-	t_mat A = ublas::identity_matrix<t_real>(3);
+	t_matfix<t_real, 3> A = fix_unit<t_real, 3>();
 	{
 		const auto A_t0 = t_real(1) / mono_mosaic;
 		const auto A_tx = inv_mono_curvh*dist_mono_sample / units::abs(units::sin(thetam));
@@ -91,7 +92,7 @@ get_mono_vals(const length& src_w, const length& src_h,
 	// some typos in paper leading to the (false) result of a better Qz resolution when focusing
 	// => trying to match terms in Av with corresponding terms in A
 	// corresponding pre-mono terms commented out in Av, as they are not considered there
-	t_mat Av(2,2);
+	t_matfix<t_real, 2> Av;
 	{
 		const auto Av_t0 = t_real(0.5) / (mono_mosaic_v*units::abs(units::sin(thetam)));
 		const auto Av_t1 = inv_mono_curvv*dist_mono_sample / mono_mosaic_v;
@@ -123,7 +124,7 @@ get_mono_vals(const length& src_w, const length& src_h,
 	}
 
 	// B vector: formula 27 in [eck14]
-	t_vec B(3);
+	t_vecfix<t_real, 3> B = fix_zero_vec<t_real, 3>();
 	{
 		const auto B_t0 = inv_mono_curvh / (mono_mosaic*mono_mosaic*units::abs(units::sin(thetam)));
 
@@ -143,7 +144,7 @@ get_mono_vals(const length& src_w, const length& src_h,
 	}
 
 	// Bv vector: formula 39 in [eck14]
-	t_vec Bv(2);
+	t_vecfix<t_real, 2> Bv;
 	{
 		const auto Bv_t0 = inv_mono_curvv/(mono_mosaic_v*mono_mosaic_v);
 
@@ -182,66 +183,163 @@ get_mono_vals(const length& src_w, const length& src_h,
 	// z components, [eck14], equ. 42
 	A(2,2) = Av(0,0) - Av(0,1)*Av(0,1)/Av(1,1);
 	B[2] = Bv[0] - Bv[1]*Av(0,1)/Av(1,1);
-	t_real D = Cv - t_real(0.25)*Bv[1]/Av(1,1);
 
+	EckArm arm;
+	arm.dK = ki*angs;
+	arm.dTheta = thetam/rads;
+	arm.dReflIn = dRefl;
+	arm.A = A;
+	arm.B = B;
+	arm.C = C;
+	arm.Dzz = Cv;
+	arm.Dz = -t_real(0.25)*Bv[1]/Av(1,1);
 
 	// [eck14], equ. 54
-	t_real refl = dRefl * std::sqrt(pi/Av(1,1));
-
+	arm.refl = dRefl * std::sqrt(pi/Av(1,1));
 
-	return std::make_tuple(A, B, C, D, refl);
+	arm.bOk = true;
+	return arm;
 }
 
 
-ResoResults calc_eck(const EckParams& eck)
+/**
+ * scales the position-dependent terms of an arm to the sample position
+ */
+static std::tuple<t_matfix<t_real, 3>, t_vecfix<t_real, 3>, t_real, t_real, t_real>
+get_pos_vals(const EckArm& arm, const length& pos_y, const length& pos_z)
 {
-	angle twotheta = eck.twotheta * eck.dsample_sense;
-	angle thetaa = eck.thetaa * eck.dana_sense;
-	angle thetam = eck.thetam * eck.dmono_sense;
-	angle ki_Q = eck.angle_ki_Q * eck.dsample_sense;
-	angle kf_Q = eck.angle_kf_Q * eck.dsample_sense;
-	//kf_Q = ki_Q + twotheta;
+	const t_real y = pos_y/cm;
+	const t_real z = pos_z/cm;
 
+	t_vecfix<t_real, 3> B = arm.B;
+	B[0] *= y;
+	B[1] *= y;
+	B[2] *= z;
 
-	// --------------------------------------------------------------------
-	// mono/ana focus
-	length mono_curvh = eck.mono_curvh, mono_curvv = eck.mono_curvv;
-	length ana_curvh = eck.ana_curvh, ana_curvv = eck.ana_curvv;
+	t_real C = arm.C * y*y;
+	t_real D = arm.Dzz * z*z + arm.Dz * z;
 
+	return std::make_tuple(arm.A, B, C, D, arm.refl);
+}
+
+
+/**
+ * mono arm, including its focusing
+ */
+static EckArm calc_eck_mono_arm(const EckParams& eck)
+{
+	const angle thetam = eck.thetam * eck.dmono_sense;
+
+	length mono_curvh = eck.mono_curvh, mono_curvv = eck.mono_curvv;
 	if(eck.bMonoIsOptimallyCurvedH) mono_curvh = tl::foc_curv(eck.dist_src_mono, eck.dist_mono_sample, units::abs(t_real(2)*thetam), false);
 	if(eck.bMonoIsOptimallyCurvedV) mono_curvv = tl::foc_curv(eck.dist_src_mono, eck.dist_mono_sample, units::abs(t_real(2)*thetam), true);
-	if(eck.bAnaIsOptimallyCurvedH) ana_curvh = tl::foc_curv(eck.dist_sample_ana, eck.dist_ana_det, units::abs(t_real(2)*thetaa), false);
-	if(eck.bAnaIsOptimallyCurvedV) ana_curvv = tl::foc_curv(eck.dist_sample_ana, eck.dist_ana_det, units::abs(t_real(2)*thetaa), true);
-
 	//mono_curvh *= eck.dmono_sense; mono_curvv *= eck.dmono_sense;
-	//ana_curvh *= eck.dana_sense; ana_curvv *= eck.dana_sense;
 
 	inv_length inv_mono_curvh = t_real(0)/cm, inv_mono_curvv = t_real(0)/cm;
-	inv_length inv_ana_curvh = t_real(0)/cm, inv_ana_curvv = t_real(0)/cm;
-
 	if(eck.bMonoIsCurvedH) inv_mono_curvh = t_real(1)/mono_curvh;
 	if(eck.bMonoIsCurvedV) inv_mono_curvv = t_real(1)/mono_curvv;
-	if(eck.bAnaIsCurvedH) inv_ana_curvh = t_real(1)/ana_curvh;
-	if(eck.bAnaIsCurvedV) inv_ana_curvv = t_real(1)/ana_curvv;
-
 	//if(eck.bMonoIsCurvedH) tl::log_debug("mono curv h: ", mono_curvh);
 	//if(eck.bMonoIsCurvedV) tl::log_debug("mono curv v: ", mono_curvv);
-	//if(eck.bAnaIsCurvedH) tl::log_debug("ana curv h: ", ana_curvh);
-	//if(eck.bAnaIsCurvedV) tl::log_debug("ana curv v: ", ana_curvv);
-	// --------------------------------------------------------------------
-
-
-	const length lam = tl::k2lam(eck.ki);
 
 	angle coll_h_pre_mono = eck.coll_h_pre_mono;
 	angle coll_v_pre_mono = eck.coll_v_pre_mono;
 
 	if(eck.bGuide)
 	{
+		const length lam = tl::k2lam(eck.ki);
 		coll_h_pre_mono = lam*(eck.guide_div_h/angs);
 		coll_v_pre_mono = lam*(eck.guide_div_v/angs);
 	}
 
+	// - if the instruments works in kf=const mode and the scans are counted for
+	//   or normalised to monitor counts no ki^3 or kf^3 factor is needed.
+	// - if the instrument works in ki=const mode the kf^3 factor is needed.
+	const auto tupScFact = get_scatter_factors(eck.flags, eck.thetam, eck.ki, eck.thetaa, eck.kf);
+	t_real dmono_refl = eck.dmono_refl * std::get<0>(tupScFact);
+
+	return get_mono_vals(
+		eck.src_w, eck.src_h,
+		eck.mono_w, eck.mono_h,
+		eck.dist_src_mono, eck.dist_mono_sample,
+		eck.ki, thetam,
+		coll_h_pre_mono, eck.coll_h_pre_sample,
+		coll_v_pre_mono, eck.coll_v_pre_sample,
+		eck.mono_mosaic, eck.mono_mosaic_v,
+		inv_mono_curvh, inv_mono_curvv,
+		dmono_refl);
+}
+
+
+/**
+ * ana arm, including its focusing
+ */
+static EckArm calc_eck_ana_arm(const EckParams& eck)
+{
+	const angle thetaa = eck.thetaa * eck.dana_sense;
+
+	length ana_curvh = eck.ana_curvh, ana_curvv = eck.ana_curvv;
+	if(eck.bAnaIsOptimallyCurvedH) ana_curvh = tl::foc_curv(eck.dist_sample_ana, eck.dist_ana_det, units::abs(t_real(2)*thetaa), false);
+	if(eck.bAnaIsOptimallyCurvedV) ana_curvv = tl::foc_curv(eck.dist_sample_ana, eck.dist_ana_det, units::abs(t_real(2)*thetaa), true);
+	//ana_curvh *= eck.dana_sense; ana_curvv *= eck.dana_sense;
+
+	inv_length inv_ana_curvh = t_real(0)/cm, inv_ana_curvv = t_real(0)/cm;
+	if(eck.bAnaIsCurvedH) inv_ana_curvh = t_real(1)/ana_curvh;
+	if(eck.bAnaIsCurvedV) inv_ana_curvv = t_real(1)/ana_curvv;
+	//if(eck.bAnaIsCurvedH) tl::log_debug("ana curv h: ", ana_curvh);
+	//if(eck.bAnaIsCurvedV) tl::log_debug("ana curv v: ", ana_curvv);
+
+	const auto tupScFact = get_scatter_factors(eck.flags, eck.thetam, eck.ki, eck.thetaa, eck.kf);
+	t_real dana_effic = eck.dana_effic * std::get<1>(tupScFact);
+
+	return get_mono_vals(
+		eck.det_w, eck.det_h,
+		eck.ana_w, eck.ana_h,
+		eck.dist_ana_det, eck.dist_sample_ana,
+		eck.kf, -thetaa,
+		eck.coll_h_post_ana, eck.coll_h_post_sample,
+		eck.coll_v_post_ana, eck.coll_v_post_sample,
+		eck.ana_mosaic, eck.ana_mosaic_v,
+		inv_ana_curvh, inv_ana_curvv,
+		dana_effic);
+}
+
+
+static bool arm_matches(const EckArm& arm, const wavenumber& k, const angle& theta, t_real dRefl)
+{
+	return arm.bOk && tl::float_equal<t_real>(arm.dK, k*angs)
+		&& tl::float_equal<t_real>(arm.dTheta, theta/rads)
+		&& tl::float_equal<t_real>(arm.dReflIn, dRefl);
+}
+
+
+/**
+ * (re-)calculates the arms which do not match the current k, angles and reflectivities
+ */
+void calc_eck_precalc(const EckParams& eck, EckPrecalc& pre)
+{
+	const auto tupScFact = get_scatter_factors(eck.flags, eck.thetam, eck.ki, eck.thetaa, eck.kf);
+
+	if(!arm_matches(pre.mono, eck.ki, eck.thetam * eck.dmono_sense,
+		eck.dmono_refl * std::get<0>(tupScFact)))
+		pre.mono = calc_eck_mono_arm(eck);
+	if(!arm_matches(pre.ana, eck.kf, -eck.thetaa * eck.dana_sense,
+		eck.dana_effic * std::get<1>(tupScFact)))
+		pre.ana = calc_eck_ana_arm(eck);
+}
+
+
+/**
+ * the arms are taken from pPre if they match, see calc_eck_precalc
+ */
+ResoResults calc_eck(const EckParams& eck, const EckPrecalc* pPre)
+{
+	angle twotheta = eck.twotheta * eck.dsample_sense;
+	angle thetaa = eck.thetaa * eck.dana_sense;
+	angle thetam = eck.thetam * eck.dmono_sense;
+	angle ki_Q = eck.angle_ki_Q * eck.dsample_sense;
+	angle kf_Q = eck.angle_kf_Q * eck.dsample_sense;
+	//kf_Q = ki_Q + twotheta;
+
 
 	//std::cout << "thetaM = " << t_real(thetam/rads/M_PI*180.) << " deg"<< std::endl;
 	//std::cout << "thetaA = " << t_real(thetaa/rads/M_PI*180.) << " deg"<< std::endl;
@@ -263,9 +361,6 @@ ResoResults calc_eck(const EckParams& eck)
 
 	// -------------------------------------------------------------------------
 
-	// - if the instruments works in kf=const mode and the scans are counted for
-	//   or normalised to monitor counts no ki^3 or kf^3 factor is needed.
-	// - if the instrument works in ki=const mode the kf^3 factor is needed.
 	const auto tupScFact = get_scatter_factors(eck.flags, eck.thetam, eck.ki, eck.thetaa, eck.kf);
 
 	t_real dmono_refl = eck.dmono_refl * std::get<0>(tupScFact);
@@ -274,57 +369,41 @@ ResoResults calc_eck(const EckParams& eck)
 
 
 	//--------------------------------------------------------------------------
-	// mono part
-
-	std::launch lpol = /*std::launch::deferred |*/ std::launch::async;
-	std::future<std::tuple<t_mat, t_vec, t_real, t_real, t_real>> futMono
-		= std::async(lpol, get_mono_vals,
-			eck.src_w, eck.src_h,
-			eck.mono_w, eck.mono_h,
-			eck.dist_src_mono, eck.dist_mono_sample,
-			eck.ki, thetam,
-			coll_h_pre_mono, eck.coll_h_pre_sample,
-			coll_v_pre_mono, eck.coll_v_pre_sample,
-			eck.mono_mosaic, eck.mono_mosaic_v,
-			inv_mono_curvh, inv_mono_curvv,
-			eck.pos_x , eck.pos_y, eck.pos_z,
-			dmono_refl);
+	// mono and ana parts, only calculated if not available in pPre
 
-	//--------------------------------------------------------------------------
+	EckArm armMono, armAna;
+	const EckArm *pMono = nullptr, *pAna = nullptr;
+	if(pPre && arm_matches(pPre->mono, eck.ki, thetam, dmono_refl))
+		pMono = &pPre->mono;
+	if(pPre && arm_matches(pPre->ana, eck.kf, -thetaa, dana_effic))
+		pAna = &pPre->ana;
 
+	// computed inline, calc_eck already runs on the worker threads for a scan
+	if(!pMono)
+		armMono = calc_eck_mono_arm(eck);
+	if(!pAna)
+		armAna = calc_eck_ana_arm(eck);
 
-	//--------------------------------------------------------------------------
-	// ana part
+	if(!pMono) pMono = &armMono;
+	if(!pAna) pAna = &armAna;
 
 	// equ 43 in [eck14]
 	length pos_y2 = - eck.pos_x*units::sin(twotheta)
 		+ eck.pos_y*units::cos(twotheta);
-	std::future<std::tuple<t_mat, t_vec, t_real, t_real, t_real>> futAna
-		= std::async(lpol, get_mono_vals,
-			eck.det_w, eck.det_h,
-			eck.ana_w, eck.ana_h,
-			eck.dist_ana_det, eck.dist_sample_ana,
-			eck.kf, -thetaa,
-			eck.coll_h_post_ana, eck.coll_h_post_sample,
-			eck.coll_v_post_ana, eck.coll_v_post_sample,
-			eck.ana_mosaic, eck.ana_mosaic_v,
-			inv_ana_curvh, inv_ana_curvv,
-			eck.pos_x, pos_y2, eck.pos_z,
-			dana_effic);
 
 	//--------------------------------------------------------------------------
-	// get mono & ana results
+	// get mono & ana results at the sample position
 
-	std::tuple<t_mat, t_vec, t_real, t_real, t_real> tupMono = futMono.get();
-	const t_mat& A = std::get<0>(tupMono);
-	const t_vec& B = std::get<1>(tupMono);
+	auto tupMono = get_pos_vals(*pMono, eck.pos_y, eck.pos_z);
+	const t_matfix<t_real, 3>& A = std::get<0>(tupMono);
+	const t_vecfix<t_real, 3>& B = std::get<1>(tupMono);
 	const t_real& C = std::get<2>(tupMono);
 	const t_real& D = std::get<3>(tupMono);
 	const t_real& dReflM = std::get<4>(tupMono);
 
-	std::tuple<t_mat, t_vec, t_real, t_real, t_real> tupAna = futAna.get();
-	const t_mat& E = std::get<0>(tupAna);
-	const t_vec& F = std::get<1>(tupAna);
+	auto tupAna = get_pos_vals(*pAna, pos_y2, eck.pos_z);
+	const t_matfix<t_real, 3>& E = std::get<0>(tupAna);
+	const t_vecfix<t_real, 3>& F = std::get<1>(tupAna);
 	const t_real& G = std::get<2>(tupAna);
 	const t_real& H = std::get<3>(tupAna);
 	const t_real& dReflA = std::get<4>(tupAna);
@@ -354,7 +433,7 @@ ResoResults calc_eck(const EckParams& eck)
 	const t_real ksq2E = tl::get_KSQ2E<t_real>();
 
 	// trafo, equ 52 in [eck14]
-	t_mat T = ublas::identity_matrix<t_real>(6);
+	t_matfix<t_real, 6> T = fix_unit<t_real, 6>();
 	T(0,3) = T(1,4) = T(2,5) = -1.;
 	T(3,0) = t_real(2)*ksq2E * kipara * angs;
 	T(3,3) = t_real(2)*ksq2E * kfpara * angs;
@@ -362,8 +441,8 @@ ResoResults calc_eck(const EckParams& eck)
 	T(3,4) = t_real(-2)*ksq2E * kperp * angs;
 	T(4,1) = T(5,2) = (0.5 - dE);
 	T(4,4) = T(5,5) = (0.5 + dE);
-	t_mat Tinv;
-	if(!tl::inverse(T, Tinv))
+	t_matfix<t_real, 6> Tinv;
+	if(!fix_inverse(T, Tinv))
 	{
 		res.bOk = false;
 		res.strErr = "Matrix T cannot be inverted.";
@@ -373,38 +452,45 @@ ResoResults calc_eck(const EckParams& eck)
 	//std::cout << "Tinv = " << Tinv << std::endl;
 
 	// equ 54 in [eck14]
-	t_mat Dalph_i = tl::rotation_matrix_3d_z(-ki_Q/rads);
-	t_mat Dalph_f = tl::rotation_matrix_3d_z(-kf_Q/rads);
-	t_mat Arot = tl::transform(A, Dalph_i, 1);
-	t_mat Erot = tl::transform(E, Dalph_f, 1);
-
-	t_mat matAE = ublas::zero_matrix<t_real>(6,6);
-	tl::submatrix_copy(matAE, Arot, 0,0);
-	tl::submatrix_copy(matAE, Erot, 3,3);
+	// rotations around z by -ki_Q and -kf_Q
+	t_matfix<t_real, 3> Dalph_i = fix_unit<t_real, 3>(), Dalph_f = fix_unit<t_real, 3>();
+	Dalph_i(0,0) = Dalph_i(1,1) = units::cos(ki_Q);
+	Dalph_i(1,0) = -units::sin(ki_Q);
+	Dalph_i(0,1) = -Dalph_i(1,0);
+	Dalph_f(0,0) = Dalph_f(1,1) = units::cos(kf_Q);
+	Dalph_f(1,0) = -units::sin(kf_Q);
+	Dalph_f(0,1) = -Dalph_f(1,0);
+
+	t_matfix<t_real, 6> matAE = fix_zero<t_real, 6>();
+	fix_submatrix_copy(matAE, fix_transform(A, Dalph_i), 0,0);
+	fix_submatrix_copy(matAE, fix_transform(E, Dalph_f), 3,3);
 	//std::cout << "AE = " << matAE << std::endl;
 
 	// U1 matrix
-	t_mat U1 = tl::transform(matAE, Tinv, 1);	// typo in paper in quadric trafo in equ 54 (top)?
+	const t_matfix<t_real, 6> U1 = fix_transform(matAE, Tinv);	// typo in paper in quadric trafo in equ 54 (top)?
 	//std::cout << "U1 = " << U1 << std::endl;
 
 	// V1 vector
-	t_vec vecBF = ublas::zero_vector<t_real>(6);
-	t_vec vecBrot = ublas::prod(ublas::trans(Dalph_i), B);
-	t_vec vecFrot = ublas::prod(ublas::trans(Dalph_f), F);
-	tl::subvector_copy(vecBF, vecBrot, 0);
-	tl::subvector_copy(vecBF, vecFrot, 3);
-	t_vec V1 = ublas::prod(vecBF, Tinv);
+	t_vecfix<t_real, 6> vecBF;
+	const t_vecfix<t_real, 3> vecBrot = fix_prod_trans(Dalph_i, B);
+	const t_vecfix<t_real, 3> vecFrot = fix_prod_trans(Dalph_f, F);
+	for(std::size_t i=0; i<3; ++i)
+	{
+		vecBF[i] = vecBrot[i];
+		vecBF[i+3] = vecFrot[i];
+	}
+	const t_vecfix<t_real, 6> V1 = fix_prod_trans(Tinv, vecBF);
 
 
 
 	//--------------------------------------------------------------------------
 	// integrate last 2 vars -> equs 57 & 58 in [eck14]
 
-	t_mat U2 = ellipsoid_gauss_int(U1, 5);
-	t_mat U = ellipsoid_gauss_int(U2, 4);
+	const t_matfix<t_real, 5> U2 = fix_gauss_int(U1, 5);
+	const t_matfix<t_real, 4> U = fix_gauss_int(U2, 4);
 
-	t_vec V2 = ellipsoid_gauss_int(V1, U1, 5);
-	t_vec V = ellipsoid_gauss_int(V2, U2, 4);
+	const t_vecfix<t_real, 5> V2 = fix_gauss_int(V1, U1, 5);
+	const t_vecfix<t_real, 4> V = fix_gauss_int(V2, U2, 4);
 
 	t_real W = (C + D + G + H) - 0.25*V1[5]/U1(5,5) - 0.25*V2[4]/U2(4,4);
 
@@ -421,19 +507,25 @@ ResoResults calc_eck(const EckParams& eck)
 
 	// quadratic part of quadric (matrix U)
 	// careful: factor -0.5*... missing in U matrix compared to normal gaussian!
-	res.reso = t_real(2) * U;
+	t_matfix<t_real, 4> reso = t_real(2) * U;
 	// linear (vector V) and constant (scalar W) part of quadric
-	res.reso_v = V;
+	t_vecfix<t_real, 4> reso_v = V;
 	res.reso_s = W;
 
 	if(eck.dsample_sense < 0.)
 	{
 		// mirror Q_perp
-		t_mat matMirror = tl::mirror_matrix<t_mat>(res.reso.size1(), 1);
-		res.reso = tl::transform(res.reso, matMirror, true);
-		res.reso_v[1] = -res.reso_v[1];
+		for(std::size_t i=0; i<4; ++i)
+		{
+			if(i == 1) continue;
+			reso(1,i) = reso(i,1) = -reso(i,1);
+		}
+		reso_v[1] = -reso_v[1];
 	}
 
+	res.reso = fix_to_dyn(reso);
+	res.reso_v = fix_to_dyn(reso_v);
+
 	// prefactor and volume
 	res.dResVol = tl::get_ellipsoid_volume(res.reso);
 	res.dR0 = Z*std::exp(-W) /** res.dResVol*/;
@@ -25,7 +25,31 @@ struct EckParams : public PopParams
 };
 
 
-extern ResoResults calc_eck(const EckParams& eck);
+/**
+ * terms of the mono or ana arm, [eck14], equs. 26-28 & 38-42, which only depend on the
+ * instrument, on k and on the crystal angle; the terms depending on the sample position
+ * are calculated for pos_y = pos_z = 1 cm and scaled in calc_eck
+ */
+struct EckArm
+{
+	bool bOk = false;
+	t_real_reso dK = 0, dTheta = 0;		// calculated for k (1/A) and the signed angle (rad)
+	t_real_reso dReflIn = 0;		// and for this reflectivity
+
+	t_matfix<t_real_reso, 3> A;		// equ. 26 & 42
+	t_vecfix<t_real_reso, 3> B;		// equ. 27 & 42, linear in pos_y (0, 1) and pos_z (2)
+	t_real_reso C = 0;			// equ. 28, quadratic in pos_y
+	t_real_reso Dzz = 0, Dz = 0;		// equ. 42, quadratic and linear parts in pos_z
+	t_real_reso refl = 0;			// equ. 54
+};
+
+struct EckPrecalc
+{
+	EckArm mono, ana;
+};
+
+extern void calc_eck_precalc(const EckParams& eck, EckPrecalc& pre);
+extern ResoResults calc_eck(const EckParams& eck, const EckPrecalc* pPre = nullptr);
 
 
 #endif
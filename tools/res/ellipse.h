@@ -18,6 +18,7 @@
 #include <ostream>
 #include <cmath>
 #include <vector>
+#include <array>
 
 #include <boost/numeric/ublas/vector.hpp>
 #include <boost/numeric/ublas/matrix.hpp>
@@ -29,6 +30,7 @@ namespace ublas = boost::numeric::ublas;
 #include "tlibs/math/quat.h"
 #include "tlibs/math/math.h"
 #include "defs.h"
+#include "fixmat.h"
 
 
 template<class t_real = t_real_reso>
@@ -232,6 +234,34 @@ static void elli_gauss_int(tl::QuadEllipsoid<T>& quad, std::size_t iIdx)
 }
 
 
+/**
+ * principal axes of an N-dimensional quadric using the fixed-size symmetric eigensolvers,
+ * same conventions as tl::QuadEllipsoid::GetPrincipalAxes
+ */
+template<std::size_t N, class T = t_real_reso>
+static bool elli_principal_axes(const tl::QuadEllipsoid<T>& quad, ublas::matrix<T>& matEvecs,
+	std::vector<T>& vecEvals, tl::QuadEllipsoid<T>& quadPrincipal)
+{
+	t_matfix<T, N> Q, evecs;
+	fix_from_dyn(quad.GetQ(), Q);
+
+	T evals[N];
+	if(!fix_eigenvec_sym(Q, evecs, evals))
+	{
+		tl::log_err("Cannot determine eigenvectors.");
+		return false;
+	}
+
+	matEvecs = fix_to_dyn(evecs);
+	vecEvals.assign(evals, evals+N);
+
+	quadPrincipal.SetDim(N);
+	quadPrincipal.SetQ(fix_to_dyn(fix_diag(evals)));
+	quadPrincipal.SetR(ublas::prod(ublas::trans(matEvecs), quad.GetR()));
+	return true;
+}
+
+
 static const std::string g_strLabelsCentre[] = {"Q_{para}-<Q> (1/A)", "Q_{ortho}-<Q> (1/A)", "Q_z-<Q> (1/A)", "E (meV)"};
 static const std::string g_strLabels[] = {"Q_{para} (1/A)", "Q_{ortho} (1/A)", "Q_z (1/A)", "E (meV)"};
 static const std::string g_strLabelsHKLCentre[] = {"h-<h> (rlu)", "k-<k> (rlu)", "l-<l> (rlu)", "E (meV)"};
@@ -258,6 +288,82 @@ static inline const std::string& ellipse_labels(int iCoord, EllipseCoordSys sys,
 }
 
 
+/**
+ * principal axes, widths and offsets of an already projected or sliced 2d ellipse,
+ * iX, iY: indices into the reduced Q_offs
+ */
+template<class t_real = t_real_reso>
+void calc_res_ellipse_axes(Ellipse2d<t_real>& ell, const ublas::vector<t_real>& Q_offs, int iX, int iY)
+{
+	std::vector<t_real> evals;
+
+	tl::QuadEllipsoid<t_real> quad(2);
+	elli_principal_axes<2>(ell.quad, ell.rot, evals, quad);
+	//tl::log_debug("old: ", ell.quad.GetR(), ", new: ", quad.GetR());
+
+	ell.phi = tl::rotation_angle(ell.rot)[0];
+
+	// test: set rotation directly
+	//ublas::matrix<t_real> matEvecs = tl::rotation_matrix_2d(ell.phi);
+	//quad.SetR(ublas::prod(matEvecs, ell.quad.GetR()));
+
+	ell.x_hwhm = tl::get_SIGMA2HWHM<t_real>() * quad.GetRadius(0);
+	ell.y_hwhm = tl::get_SIGMA2HWHM<t_real>() * quad.GetRadius(1);
+
+	ell.x_offs = Q_offs[iX];
+	ell.y_offs = Q_offs[iY];
+
+
+	// calculate bounding rect
+	std::tie(ell.x_hwhm_bound, ell.y_hwhm_bound)
+		= [&ell]() -> std::pair<t_real, t_real>
+	{
+		t_real t0deg = ell.phi / (tl::get_pi<t_real>()*t_real(2));
+		t_real t90deg = (ell.phi + tl::get_pi<t_real>()/t_real(2))
+			/ (tl::get_pi<t_real>()*t_real(2));
+
+		ublas::vector<t_real> vec1 = ell(t0deg, false);
+		ublas::vector<t_real> vec2 = ell(t90deg, false);
+
+		t_real dX = std::max(std::abs(vec1[0]), std::abs(vec2[0]));
+		t_real dY = std::max(std::abs(vec1[1]), std::abs(vec2[1]));
+
+		return std::pair<t_real, t_real>(dX, dY);
+	}();
+
+
+	// linear part of quadric
+	const ublas::vector<t_real> vecTrans = ublas::prod(ell.rot, quad.GetPrincipalOffset());
+
+	if(vecTrans.size() == 2)
+	{
+		ell.x_offs += vecTrans[0];
+		ell.y_offs += vecTrans[1];
+	}
+	else
+	{
+		tl::log_err("Invalid ellipse shift.");
+	}
+
+	ell.area = quad.GetVolume();
+	ell.slope = std::tan(ell.phi);
+
+
+#ifndef NDEBUG
+	// sanity check, see Shirane p. 267
+	ublas::matrix<t_real> res_mat0 = ell.quad.GetQ();
+	t_real dMyPhi = tl::r2d(ell.phi);
+	t_real dPhiShirane = tl::r2d(t_real(0.5)*atan(2.*res_mat0(0,1) / (res_mat0(0,0)-res_mat0(1,1))));
+	if(!tl::float_equal(dMyPhi, dPhiShirane, 0.01)
+		&& !tl::float_equal(dMyPhi-90., dPhiShirane, 0.01))
+	{
+		tl::log_warn("Calculated ellipse phi = ", dMyPhi, " deg",
+			" deviates from theoretical phi = ", dPhiShirane, " deg.");
+	}
+#endif
+}
+
+
 /*
  * this is a 1:1 C++ reimplementation of 'proj_elip' from 'mcresplot' and 'rescal5'
  * iX, iY: dimensions to plot
@@ -317,77 +423,49 @@ Ellipse2d<t_real> calc_res_ellipse(
 		if(iY>=iInt) --iY;
 	}
 
-	std::vector<t_real> evals;
-
-	tl::QuadEllipsoid<t_real> quad(2);
-	ell.quad.GetPrincipalAxes(ell.rot, evals, &quad);
-	//tl::log_debug("old: ", ell.quad.GetR(), ", new: ", quad.GetR());
+	calc_res_ellipse_axes(ell, Q_offs, iX, iY);
+	return ell;
+}
 
-	ell.phi = tl::rotation_angle(ell.rot)[0];
+// --------------------------------------------------------------------------------
 
-	// test: set rotation directly
-	//ublas::matrix<t_real> matEvecs = tl::rotation_matrix_2d(ell.phi);
-	//quad.SetR(ublas::prod(matEvecs, ell.quad.GetR()));
+/**
+ * principal axes, widths and offsets of an already projected or sliced 3d ellipsoid,
+ * iX, iY, iZ: indices into the reduced Q_offs
+ */
+template<class t_real = t_real_reso>
+void calc_res_ellipsoid_axes(Ellipsoid3d<t_real>& ell, const ublas::vector<t_real>& Q_offs, int iX, int iY, int iZ)
+{
+	std::vector<t_real> evals;
+	tl::QuadEllipsoid<t_real> quad(3);
+	elli_principal_axes<3>(ell.quad, ell.rot, evals, quad);
 
+	//tl::log_info("Principal axes: ", quad.GetQ());
 	ell.x_hwhm = tl::get_SIGMA2HWHM<t_real>() * quad.GetRadius(0);
 	ell.y_hwhm = tl::get_SIGMA2HWHM<t_real>() * quad.GetRadius(1);
+	ell.z_hwhm = tl::get_SIGMA2HWHM<t_real>() * quad.GetRadius(2);
 
 	ell.x_offs = Q_offs[iX];
 	ell.y_offs = Q_offs[iY];
-
-
-	// calculate bounding rect
-	std::tie(ell.x_hwhm_bound, ell.y_hwhm_bound)
-		= [&ell]() -> std::pair<t_real, t_real>
-	{
-		t_real t0deg = ell.phi / (tl::get_pi<t_real>()*t_real(2));
-		t_real t90deg = (ell.phi + tl::get_pi<t_real>()/t_real(2))
-			/ (tl::get_pi<t_real>()*t_real(2));
-
-		ublas::vector<t_real> vec1 = ell(t0deg, false);
-		ublas::vector<t_real> vec2 = ell(t90deg, false);
-
-		t_real dX = std::max(std::abs(vec1[0]), std::abs(vec2[0]));
-		t_real dY = std::max(std::abs(vec1[1]), std::abs(vec2[1]));
-
-		return std::pair<t_real, t_real>(dX, dY);
-	}();
-
+	ell.z_offs = Q_offs[iZ];
 
 	// linear part of quadric
 	const ublas::vector<t_real> vecTrans = ublas::prod(ell.rot, quad.GetPrincipalOffset());
 
-	if(vecTrans.size() == 2)
+	if(vecTrans.size() == 3)
 	{
 		ell.x_offs += vecTrans[0];
 		ell.y_offs += vecTrans[1];
+		ell.z_offs += vecTrans[2];
 	}
 	else
 	{
-		tl::log_err("Invalid ellipse shift.");
-	}
-
-	ell.area = quad.GetVolume();
-	ell.slope = std::tan(ell.phi);
-
-
-#ifndef NDEBUG
-	// sanity check, see Shirane p. 267
-	ublas::matrix<t_real> res_mat0 = ell.quad.GetQ();
-	t_real dMyPhi = tl::r2d(ell.phi);
-	t_real dPhiShirane = tl::r2d(t_real(0.5)*atan(2.*res_mat0(0,1) / (res_mat0(0,0)-res_mat0(1,1))));
-	if(!tl::float_equal(dMyPhi, dPhiShirane, 0.01)
-		&& !tl::float_equal(dMyPhi-90., dPhiShirane, 0.01))
-	{
-		tl::log_warn("Calculated ellipse phi = ", dMyPhi, " deg",
-			" deviates from theoretical phi = ", dPhiShirane, " deg.");
+		tl::log_err("Invalid ellipsoid shift.");
 	}
-#endif
 
-	return ell;
+	ell.vol = quad.GetVolume();
 }
 
-// --------------------------------------------------------------------------------
 
 template<class t_real = t_real_reso>
 Ellipsoid3d<t_real> calc_res_ellipsoid(
@@ -434,34 +512,7 @@ Ellipsoid3d<t_real> calc_res_ellipsoid(
 		if(iZ>=iInt) --iZ;
 	}
 
-	std::vector<t_real> evals;
-	tl::QuadEllipsoid<t_real> quad(3);
-	ell.quad.GetPrincipalAxes(ell.rot, evals, &quad);
-
-	//tl::log_info("Principal axes: ", quad.GetQ());
-	ell.x_hwhm = tl::get_SIGMA2HWHM<t_real>() * quad.GetRadius(0);
-	ell.y_hwhm = tl::get_SIGMA2HWHM<t_real>() * quad.GetRadius(1);
-	ell.z_hwhm = tl::get_SIGMA2HWHM<t_real>() * quad.GetRadius(2);
-
-	ell.x_offs = Q_offs[iX];
-	ell.y_offs = Q_offs[iY];
-	ell.z_offs = Q_offs[iZ];
-
-	// linear part of quadric
-	const ublas::vector<t_real> vecTrans = ublas::prod(ell.rot, quad.GetPrincipalOffset());
-
-	if(vecTrans.size() == 3)
-	{
-		ell.x_offs += vecTrans[0];
-		ell.y_offs += vecTrans[1];
-		ell.z_offs += vecTrans[2];
-	}
-	else
-	{
-		tl::log_err("Invalid ellipsoid shift.");
-	}
-
-	ell.vol = quad.GetVolume();
+	calc_res_ellipsoid_axes(ell, Q_offs, iX, iY, iZ);
 	return ell;
 }
 
@@ -482,7 +533,7 @@ Ellipsoid4d<t_real> calc_res_ellipsoid4d(
 
 	std::vector<t_real> evals;
 	tl::QuadEllipsoid<t_real> quad(4);
-	ell.quad.GetPrincipalAxes(ell.rot, evals, &quad);
+	elli_principal_axes<4>(ell.quad, ell.rot, evals, quad);
 
 	ell.x_hwhm = tl::get_SIGMA2HWHM<t_real>() * quad.GetRadius(0);
 	ell.y_hwhm = tl::get_SIGMA2HWHM<t_real>() * quad.GetRadius(1);
@@ -520,4 +571,185 @@ Ellipsoid4d<t_real> calc_res_ellipsoid4d(
 	return ell;
 }
 
+
+// --------------------------------------------------------------------------------
+
+/**
+ * ellipse projections and slices, see calc_res_projections
+ */
+template<class t_real = t_real_reso>
+struct ResoProjections
+{
+	std::vector<Ellipse2d<t_real>> ell2d;
+	std::vector<Ellipsoid3d<t_real>> ell3d;
+};
+
+
+/**
+ * 4d quadric x^T M x + r x as gaussian: covariance C = M^(-1) and centre mu = -C r / 2;
+ * slices (removed dims, x_rem = 0) are conditional distributions, which follow from
+ * rank-1 updates of C and mu, projections (integrated dims) are marginal distributions,
+ * for which the rows and columns are simply dropped from C.
+ * writes the reduced quadric and the kept dimensions into quad and iKept.
+ */
+template<std::size_t N, class t_real = t_real_reso>
+static bool elli_reduce_cov(const t_matfix<t_real, 4>& C4, const t_vecfix<t_real, 4>& mu4,
+	const bool (&bRem)[4], const bool (&bInt)[4],
+	tl::QuadEllipsoid<t_real>& quad, int (&iKept)[N])
+{
+	t_matfix<t_real, 4> C = C4;
+	t_vecfix<t_real, 4> mu = mu4;
+
+	// conditioning on the removed dimensions
+	for(std::size_t iRem=0; iRem<4; ++iRem)
+	{
+		if(!bRem[iRem]) continue;
+
+		const t_real dInvC = t_real(1) / C(iRem, iRem);
+		const t_real dMu = mu[iRem];
+		t_real dCol[4];
+		for(std::size_t i=0; i<4; ++i)
+			dCol[i] = C(i, iRem);
+
+		for(std::size_t i=0; i<4; ++i)
+		{
+			mu[i] -= dCol[i] * dMu * dInvC;
+			for(std::size_t j=0; j<4; ++j)
+				C(i,j) -= dCol[i] * dCol[j] * dInvC;
+		}
+	}
+
+	// marginal over the rest
+	t_matfix<t_real, N> Csub;
+	t_vecfix<t_real, N> musub;
+	std::size_t iNumKept = 0;
+	for(std::size_t i=0; i<4; ++i)
+	{
+		if(bRem[i] || bInt[i]) continue;
+		if(iNumKept >= N) return false;
+		iKept[iNumKept++] = int(i);
+	}
+	if(iNumKept != N) return false;
+
+	for(std::size_t i=0; i<N; ++i)
+	{
+		musub[i] = mu[iKept[i]];
+		for(std::size_t j=0; j<N; ++j)
+			Csub(i,j) = C(iKept[i], iKept[j]);
+	}
+
+	t_matfix<t_real, N> M;
+	if(!fix_inverse(Csub, M))
+		return false;
+
+	const t_vecfix<t_real, N> r = t_real(-2) * fix_prod(M, musub);
+
+	quad.SetDim(N);
+	quad.SetQ(fix_to_dyn(M));
+	quad.SetR(fix_to_dyn(r));
+	return true;
+}
+
+
+/**
+ * all 2d ellipses and 3d ellipsoids from one inversion of the 4d resolution matrix
+ * vecParams2d: { iX, iY, iInt, iRem1, iRem2 } per ellipse, as in calc_res_ellipse
+ * vecParams3d: { iX, iY, iZ, iInt, iRem } per ellipsoid, as in calc_res_ellipsoid
+ * falls back to the individual calculations if the matrix is singular
+ */
+template<class t_real = t_real_reso>
+ResoProjections<t_real> calc_res_projections(
+	const ublas::matrix<t_real>& reso,
+	const ublas::vector<t_real>& reso_vec,
+	t_real reso_const,
+	const ublas::vector<t_real>& Q_avg,
+	const std::vector<std::array<int, 5>>& vecParams2d,
+	const std::vector<std::array<int, 5>>& vecParams3d = {})
+{
+	ResoProjections<t_real> proj;
+	proj.ell2d.resize(vecParams2d.size());
+	proj.ell3d.resize(vecParams3d.size());
+
+	t_matfix<t_real, 4> M4, C4;
+	t_vecfix<t_real, 4> r4 = fix_zero_vec<t_real, 4>(), mu4;
+	fix_from_dyn(reso, M4);
+	for(std::size_t i=0; i<std::min<std::size_t>(4, reso_vec.size()); ++i)
+		r4[i] = reso_vec[i];
+
+	const bool bFactorised = reso.size1()==4 && reso.size2()==4 && fix_inverse(M4, C4);
+	if(bFactorised)
+		mu4 = t_real(-0.5) * fix_prod(C4, r4);
+
+	auto in_range = [](int i) -> bool { return i >= 0 && i < 4; };
+
+	for(std::size_t iEll=0; iEll<vecParams2d.size(); ++iEll)
+	{
+		const std::array<int, 5>& iP = vecParams2d[iEll];
+		Ellipse2d<t_real>& ell = proj.ell2d[iEll];
+
+		bool bRem[4] = { 0, 0, 0, 0 }, bInt[4] = { 0, 0, 0, 0 };
+		if(in_range(iP[2])) bInt[iP[2]] = 1;
+		if(in_range(iP[3])) bRem[iP[3]] = 1;
+		if(in_range(iP[4])) bRem[iP[4]] = 1;
+
+		int iKept[2];
+		if(!bFactorised || !elli_reduce_cov<2>(C4, mu4, bRem, bInt, ell.quad, iKept))
+		{
+			ell = calc_res_ellipse<t_real>(reso, reso_vec, reso_const, Q_avg,
+				iP[0], iP[1], iP[2], iP[3], iP[4]);
+			continue;
+		}
+
+		ell.x_lab = g_strLabels[iP[0]];
+		ell.y_lab = g_strLabels[iP[1]];
+
+		ublas::vector<t_real> Q_offs(2);
+		int iX = 0, iY = 0;
+		for(int i=0; i<2; ++i)
+		{
+			Q_offs[i] = Q_avg[iKept[i]];
+			if(iKept[i] == iP[0]) iX = i;
+			if(iKept[i] == iP[1]) iY = i;
+		}
+
+		calc_res_ellipse_axes(ell, Q_offs, iX, iY);
+	}
+
+	for(std::size_t iEll=0; iEll<vecParams3d.size(); ++iEll)
+	{
+		const std::array<int, 5>& iP = vecParams3d[iEll];
+		Ellipsoid3d<t_real>& ell = proj.ell3d[iEll];
+
+		bool bRem[4] = { 0, 0, 0, 0 }, bInt[4] = { 0, 0, 0, 0 };
+		if(in_range(iP[3])) bInt[iP[3]] = 1;
+		if(in_range(iP[4])) bRem[iP[4]] = 1;
+
+		int iKept[3];
+		if(!bFactorised || !elli_reduce_cov<3>(C4, mu4, bRem, bInt, ell.quad, iKept))
+		{
+			ell = calc_res_ellipsoid<t_real>(reso, reso_vec, reso_const, Q_avg,
+				iP[0], iP[1], iP[2], iP[3], iP[4]);
+			continue;
+		}
+
+		ell.x_lab = g_strLabels[iP[0]];
+		ell.y_lab = g_strLabels[iP[1]];
+		ell.z_lab = g_strLabels[iP[2]];
+
+		ublas::vector<t_real> Q_offs(3);
+		int iX = 0, iY = 0, iZ = 0;
+		for(int i=0; i<3; ++i)
+		{
+			Q_offs[i] = Q_avg[iKept[i]];
+			if(iKept[i] == iP[0]) iX = i;
+			if(iKept[i] == iP[1]) iY = i;
+			if(iKept[i] == iP[2]) iZ = i;
+		}
+
+		calc_res_ellipsoid_axes(ell, Q_offs, iX, iY, iZ);
+	}
+
+	return proj;
+}
+
 #endif
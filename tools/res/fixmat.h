@@ -0,0 +1,768 @@
+/**
+ * fixed-size matrices for the resolution algorithms
+ * @author agent <agent@local>
+ * @date oct-2026
+ * @license GPLv2
+ *
+ * the matrices of the resolution calculations have small sizes known at compile time
+ * (4x4 up to 13x13), so they are kept on the stack (ublas::c_matrix) and the kernels
+ * below use loops with constant bounds, which the compiler can unroll.
+ */
+
+#ifndef __RESO_FIXMAT_H__
+#define __RESO_FIXMAT_H__
+
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
+#include <limits>
+
+#include <boost/numeric/ublas/vector.hpp>
+#include <boost/numeric/ublas/matrix.hpp>
+
+namespace ublas = boost::numeric::ublas;
+
+
+template<class t_real, std::size_t N, std::size_t M = N>
+using t_matfix = ublas::c_matrix<t_real, N, M>;
+
+template<class t_real, std::size_t N>
+using t_vecfix = ublas::c_vector<t_real, N>;
+
+
+// ----------------------------------------------------------------------------
+// construction and conversion
+
+template<class t_real, std::size_t N, std::size_t M = N>
+t_matfix<t_real, N, M> fix_zero()
+{
+	t_matfix<t_real, N, M> mat;
+	for(std::size_t i=0; i<N; ++i)
+		for(std::size_t j=0; j<M; ++j)
+			mat(i,j) = t_real(0);
+	return mat;
+}
+
+template<class t_real, std::size_t N>
+t_vecfix<t_real, N> fix_zero_vec()
+{
+	t_vecfix<t_real, N> vec;
+	for(std::size_t i=0; i<N; ++i)
+		vec[i] = t_real(0);
+	return vec;
+}
+
+template<class t_real, std::size_t N>
+t_matfix<t_real, N, N> fix_unit()
+{
+	t_matfix<t_real, N, N> mat = fix_zero<t_real, N, N>();
+	for(std::size_t i=0; i<N; ++i)
+		mat(i,i) = t_real(1);
+	return mat;
+}
+
+template<class t_real, std::size_t N>
+t_matfix<t_real, N, N> fix_diag(const t_real (&dDiag)[N])
+{
+	t_matfix<t_real, N, N> mat = fix_zero<t_real, N, N>();
+	for(std::size_t i=0; i<N; ++i)
+		mat(i,i) = dDiag[i];
+	return mat;
+}
+
+/**
+ * copies src into dst, starting at row iRow and column iCol of dst
+ */
+template<class t_real, std::size_t N, std::size_t M, std::size_t N2, std::size_t M2>
+void fix_submatrix_copy(t_matfix<t_real, N, M>& dst, const t_matfix<t_real, N2, M2>& src,
+	std::size_t iRow, std::size_t iCol)
+{
+	for(std::size_t i=0; i<N2; ++i)
+		for(std::size_t j=0; j<M2; ++j)
+			dst(iRow+i, iCol+j) = src(i,j);
+}
+
+template<class t_real, std::size_t N, std::size_t M>
+ublas::matrix<t_real> fix_to_dyn(const t_matfix<t_real, N, M>& mat)
+{
+	ublas::matrix<t_real> matDyn(N, M);
+	for(std::size_t i=0; i<N; ++i)
+		for(std::size_t j=0; j<M; ++j)
+			matDyn(i,j) = mat(i,j);
+	return matDyn;
+}
+
+template<class t_real, std::size_t N>
+ublas::vector<t_real> fix_to_dyn(const t_vecfix<t_real, N>& vec)
+{
+	ublas::vector<t_real> vecDyn(N);
+	for(std::size_t i=0; i<N; ++i)
+		vecDyn[i] = vec[i];
+	return vecDyn;
+}
+
+/**
+ * copies the upper left NxM part of a dynamic matrix
+ */
+template<class t_real, std::size_t N, std::size_t M>
+void fix_from_dyn(const ublas::matrix<t_real>& matDyn, t_matfix<t_real, N, M>& mat)
+{
+	mat = fix_zero<t_real, N, M>();
+	for(std::size_t i=0; i<std::min(N, matDyn.size1()); ++i)
+		for(std::size_t j=0; j<std::min(M, matDyn.size2()); ++j)
+			mat(i,j) = matDyn(i,j);
+}
+// ----------------------------------------------------------------------------
+
+
+// ----------------------------------------------------------------------------
+// products
+
+template<class t_real, std::size_t N, std::size_t K, std::size_t M>
+t_matfix<t_real, N, M> fix_prod(const t_matfix<t_real, N, K>& A, const t_matfix<t_real, K, M>& B)
+{
+	t_matfix<t_real, N, M> C;
+	for(std::size_t i=0; i<N; ++i)
+	{
+		for(std::size_t j=0; j<M; ++j)
+		{
+			t_real dSum = t_real(0);
+			for(std::size_t k=0; k<K; ++k)
+				dSum += A(i,k) * B(k,j);
+			C(i,j) = dSum;
+		}
+	}
+	return C;
+}
+
+template<class t_real, std::size_t N, std::size_t M>
+t_vecfix<t_real, N> fix_prod(const t_matfix<t_real, N, M>& A, const t_vecfix<t_real, M>& vec)
+{
+	t_vecfix<t_real, N> vecRes;
+	for(std::size_t i=0; i<N; ++i)
+	{
+		t_real dSum = t_real(0);
+		for(std::size_t j=0; j<M; ++j)
+			dSum += A(i,j) * vec[j];
+		vecRes[i] = dSum;
+	}
+	return vecRes;
+}
+
+/**
+ * A^T * vec
+ */
+template<class t_real, std::size_t N, std::size_t M>
+t_vecfix<t_real, M> fix_prod_trans(const t_matfix<t_real, N, M>& A, const t_vecfix<t_real, N>& vec)
+{
+	t_vecfix<t_real, M> vecRes;
+	for(std::size_t j=0; j<M; ++j)
+	{
+		t_real dSum = t_real(0);
+		for(std::size_t i=0; i<N; ++i)
+			dSum += A(i,j) * vec[i];
+		vecRes[j] = dSum;
+	}
+	return vecRes;
+}
+
+/**
+ * congruence transformation T^T * A * T of a symmetric matrix A,
+ * same as tl::transform(A, T, 1); only the upper triangle is calculated
+ */
+template<class t_real, std::size_t N, std::size_t M>
+t_matfix<t_real, M, M> fix_transform(const t_matfix<t_real, N, N>& A, const t_matfix<t_real, N, M>& T)
+{
+	const t_matfix<t_real, N, M> AT = fix_prod(A, T);
+
+	t_matfix<t_real, M, M> R;
+	for(std::size_t i=0; i<M; ++i)
+	{
+		for(std::size_t j=i; j<M; ++j)
+		{
+			t_real dSum = t_real(0);
+			for(std::size_t k=0; k<N; ++k)
+				dSum += T(k,i) * AT(k,j);
+			R(i,j) = R(j,i) = dSum;
+		}
+	}
+	return R;
+}
+
+/**
+ * congruence transformation T * A * T^T of a symmetric matrix A,
+ * same as tl::transform_inv(A, T, 1); only the upper triangle is calculated
+ */
+template<class t_real, std::size_t N, std::size_t M>
+t_matfix<t_real, N, N> fix_transform_inv(const t_matfix<t_real, M, M>& A, const t_matfix<t_real, N, M>& T)
+{
+	// (A T^T)(k,j) = sum_l A(k,l) T(j,l)
+	t_matfix<t_real, M, N> ATt;
+	for(std::size_t k=0; k<M; ++k)
+	{
+		for(std::size_t j=0; j<N; ++j)
+		{
+			t_real dSum = t_real(0);
+			for(std::size_t l=0; l<M; ++l)
+				dSum += A(k,l) * T(j,l);
+			ATt(k,j) = dSum;
+		}
+	}
+
+	t_matfix<t_real, N, N> R;
+	for(std::size_t i=0; i<N; ++i)
+	{
+		for(std::size_t j=i; j<N; ++j)
+		{
+			t_real dSum = t_real(0);
+			for(std::size_t k=0; k<M; ++k)
+				dSum += T(i,k) * ATt(k,j);
+			R(i,j) = R(j,i) = dSum;
+		}
+	}
+	return R;
+}
+// ----------------------------------------------------------------------------
+
+
+// ----------------------------------------------------------------------------
+// inversion and determinant
+
+/**
+ * determinant via lu decomposition with partial pivoting
+ */
+template<class t_real, std::size_t N>
+t_real fix_determinant(t_matfix<t_real, N, N> A)
+{
+	t_real dDet = t_real(1);
+
+	for(std::size_t iCol=0; iCol<N; ++iCol)
+	{
+		std::size_t iPivot = iCol;
+		for(std::size_t iRow=iCol+1; iRow<N; ++iRow)
+			if(std::abs(A(iRow, iCol)) > std::abs(A(iPivot, iCol)))
+				iPivot = iRow;
+
+		if(A(iPivot, iCol) == t_real(0))
+			return t_real(0);
+
+		if(iPivot != iCol)
+		{
+			for(std::size_t j=0; j<N; ++j)
+				std::swap(A(iPivot, j), A(iCol, j));
+			dDet = -dDet;
+		}
+
+		const t_real dPivot = A(iCol, iCol);
+		dDet *= dPivot;
+
+		for(std::size_t iRow=iCol+1; iRow<N; ++iRow)
+		{
+			const t_real dFact = A(iRow, iCol) / dPivot;
+			for(std::size_t j=iCol+1; j<N; ++j)
+				A(iRow, j) -= dFact * A(iCol, j);
+		}
+	}
+
+	return dDet;
+}
+
+
+/**
+ * gauss-jordan inversion with partial pivoting, returns false for singular matrices
+ */
+template<class t_real, std::size_t N>
+bool fix_inverse(t_matfix<t_real, N, N> A, t_matfix<t_real, N, N>& Ainv, std::false_type)
+{
+	Ainv = fix_unit<t_real, N>();
+
+	for(std::size_t iCol=0; iCol<N; ++iCol)
+	{
+		std::size_t iPivot = iCol;
+		for(std::size_t iRow=iCol+1; iRow<N; ++iRow)
+			if(std::abs(A(iRow, iCol)) > std::abs(A(iPivot, iCol)))
+				iPivot = iRow;
+
+		if(A(iPivot, iCol) == t_real(0))
+			return false;
+
+		if(iPivot != iCol)
+		{
+			for(std::size_t j=0; j<N; ++j)
+			{
+				std::swap(A(iPivot, j), A(iCol, j));
+				std::swap(Ainv(iPivot, j), Ainv(iCol, j));
+			}
+		}
+
+		const t_real dInvPivot = t_real(1) / A(iCol, iCol);
+		for(std::size_t j=0; j<N; ++j)
+		{
+			A(iCol, j) *= dInvPivot;
+			Ainv(iCol, j) *= dInvPivot;
+		}
+
+		for(std::size_t iRow=0; iRow<N; ++iRow)
+		{
+			if(iRow == iCol) continue;
+
+			const t_real dFact = A(iRow, iCol);
+			if(dFact == t_real(0)) continue;
+
+			for(std::size_t j=0; j<N; ++j)
+			{
+				A(iRow, j) -= dFact * A(iCol, j);
+				Ainv(iRow, j) -= dFact * Ainv(iCol, j);
+			}
+		}
+	}
+
+	return true;
+}
+
+
+/**
+ * closed-form 4x4 inversion via the 2x2 sub-determinants (cofactors)
+ */
+template<class t_real>
+bool fix_inverse(const t_matfix<t_real, 4, 4>& m, t_matfix<t_real, 4, 4>& inv, std::true_type)
+{
+	const t_real s0 = m(0,0)*m(1,1) - m(1,0)*m(0,1);
+	const t_real s1 = m(0,0)*m(1,2) - m(1,0)*m(0,2);
+	const t_real s2 = m(0,0)*m(1,3) - m(1,0)*m(0,3);
+	const t_real s3 = m(0,1)*m(1,2) - m(1,1)*m(0,2);
+	const t_real s4 = m(0,1)*m(1,3) - m(1,1)*m(0,3);
+	const t_real s5 = m(0,2)*m(1,3) - m(1,2)*m(0,3);
+
+	const t_real c5 = m(2,2)*m(3,3) - m(3,2)*m(2,3);
+	const t_real c4 = m(2,1)*m(3,3) - m(3,1)*m(2,3);
+	const t_real c3 = m(2,1)*m(3,2) - m(3,1)*m(2,2);
+	const t_real c2 = m(2,0)*m(3,3) - m(3,0)*m(2,3);
+	const t_real c1 = m(2,0)*m(3,2) - m(3,0)*m(2,2);
+	const t_real c0 = m(2,0)*m(3,1) - m(3,0)*m(2,1);
+
+	const t_real dDet = s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0;
+	if(dDet == t_real(0) || !std::isfinite(dDet))
+		return false;
+	const t_real d = t_real(1) / dDet;
+
+	inv(0,0) = ( m(1,1)*c5 - m(1,2)*c4 + m(1,3)*c3) * d;
+	inv(0,1) = (-m(0,1)*c5 + m(0,2)*c4 - m(0,3)*c3) * d;
+	inv(0,2) = ( m(3,1)*s5 - m(3,2)*s4 + m(3,3)*s3) * d;
+	inv(0,3) = (-m(2,1)*s5 + m(2,2)*s4 - m(2,3)*s3) * d;
+
+	inv(1,0) = (-m(1,0)*c5 + m(1,2)*c2 - m(1,3)*c1) * d;
+	inv(1,1) = ( m(0,0)*c5 - m(0,2)*c2 + m(0,3)*c1) * d;
+	inv(1,2) = (-m(3,0)*s5 + m(3,2)*s2 - m(3,3)*s1) * d;
+	inv(1,3) = ( m(2,0)*s5 - m(2,2)*s2 + m(2,3)*s1) * d;
+
+	inv(2,0) = ( m(1,0)*c4 - m(1,1)*c2 + m(1,3)*c0) * d;
+	inv(2,1) = (-m(0,0)*c4 + m(0,1)*c2 - m(0,3)*c0) * d;
+	inv(2,2) = ( m(3,0)*s4 - m(3,1)*s2 + m(3,3)*s0) * d;
+	inv(2,3) = (-m(2,0)*s4 + m(2,1)*s2 - m(2,3)*s0) * d;
+
+	inv(3,0) = (-m(1,0)*c3 + m(1,1)*c1 - m(1,2)*c0) * d;
+	inv(3,1) = ( m(0,0)*c3 - m(0,1)*c1 + m(0,2)*c0) * d;
+	inv(3,2) = (-m(3,0)*s3 + m(3,1)*s1 - m(3,2)*s0) * d;
+	inv(3,3) = ( m(2,0)*s3 - m(2,1)*s1 + m(2,2)*s0) * d;
+
+	return true;
+}
+
+
+/**
+ * inverse of a fixed-size matrix, returns false for singular matrices
+ */
+template<class t_real, std::size_t N>
+bool fix_inverse(const t_matfix<t_real, N, N>& A, t_matfix<t_real, N, N>& Ainv)
+{
+	return fix_inverse(A, Ainv, std::integral_constant<bool, N==4>());
+}
+// ----------------------------------------------------------------------------
+
+
+// ----------------------------------------------------------------------------
+// gaussian integration of the quadric, see ellipsoid_gauss_int in ellipse.h
+
+/**
+ * integration of the quadratic part over row/column iIdx
+ */
+template<class t_real, std::size_t N>
+t_matfix<t_real, N-1, N-1> fix_gauss_int(const t_matfix<t_real, N, N>& mat, std::size_t iIdx)
+{
+	t_real b[N-1];
+	for(std::size_t i=0, iSub=0; i<N; ++i)
+	{
+		if(i == iIdx) continue;
+		b[iSub++] = t_real(0.5) * (mat(i, iIdx) + mat(iIdx, i));
+	}
+
+	const t_real dInvDiag = t_real(1) / mat(iIdx, iIdx);
+
+	t_matfix<t_real, N-1, N-1> m;
+	for(std::size_t i=0, iSub=0; i<N; ++i)
+	{
+		if(i == iIdx) continue;
+		for(std::size_t j=0, jSub=0; j<N; ++j)
+		{
+			if(j == iIdx) continue;
+			m(iSub, jSub) = mat(i,j) - b[iSub]*b[jSub]*dInvDiag;
+			++jSub;
+		}
+		++iSub;
+	}
+	return m;
+}
+
+/**
+ * integration of the linear part over element iIdx
+ */
+template<class t_real, std::size_t N>
+t_vecfix<t_real, N-1> fix_gauss_int(const t_vecfix<t_real, N>& vec,
+	const t_matfix<t_real, N, N>& mat, std::size_t iIdx)
+{
+	const t_real dFact = vec[iIdx] / mat(iIdx, iIdx);
+
+	t_vecfix<t_real, N-1> vecInt;
+	for(std::size_t i=0, iSub=0; i<N; ++i)
+	{
+		if(i == iIdx) continue;
+		vecInt[iSub++] = vec[i] - mat(i, iIdx)*dFact;
+	}
+	return vecInt;
+}
+// ----------------------------------------------------------------------------
+
+
+// ----------------------------------------------------------------------------
+// symmetric eigensolvers
+
+/**
+ * sorts the eigenvalues in ascending order (i.e. by descending ellipsoid radius,
+ * as tl::QuadEllipsoid does) and makes the eigenvector matrix a proper rotation
+ */
+template<class t_real, std::size_t N>
+void fix_eigenvec_sort(t_matfix<t_real, N, N>& evecs, t_real (&evals)[N])
+{
+	for(std::size_t i=0; i<N; ++i)
+	{
+		std::size_t iMin = i;
+		for(std::size_t j=i+1; j<N; ++j)
+			if(evals[j] < evals[iMin])
+				iMin = j;
+
+		if(iMin != i)
+		{
+			std::swap(evals[i], evals[iMin]);
+			for(std::size_t k=0; k<N; ++k)
+				std::swap(evecs(k,i), evecs(k,iMin));
+		}
+	}
+
+	if(fix_determinant(evecs) < t_real(0))
+	{
+		for(std::size_t k=0; k<N; ++k)
+			evecs(k,0) = -evecs(k,0);
+	}
+}
+
+
+/**
+ * cyclic jacobi rotations with a fixed maximum number of sweeps
+ * @see W. H. Press et al., "Numerical Recipes", 2nd ed., sec. 11.1 (jacobi)
+ */
+template<class t_real, std::size_t N>
+bool fix_eigenvec_sym_jacobi(t_matfix<t_real, N, N> A, t_matfix<t_real, N, N>& evecs, t_real (&evals)[N])
+{
+	const std::size_t iMaxSweeps = 16;
+	evecs = fix_unit<t_real, N>();
+
+	for(std::size_t iSweep=0; iSweep<iMaxSweeps; ++iSweep)
+	{
+		t_real dOff = t_real(0), dDiag = t_real(0);
+		for(std::size_t i=0; i<N; ++i)
+		{
+			dDiag += A(i,i)*A(i,i);
+			for(std::size_t j=i+1; j<N; ++j)
+				dOff += A(i,j)*A(i,j);
+		}
+		if(dOff <= std::numeric_limits<t_real>::epsilon()*std::numeric_limits<t_real>::epsilon() * dDiag)
+			break;
+
+		for(std::size_t p=0; p<N; ++p)
+		{
+			for(std::size_t q=p+1; q<N; ++q)
+			{
+				const t_real apq = A(p,q);
+				if(apq == t_real(0))
+					continue;
+
+				// rotation angle which zeroes A(p,q)
+				const t_real theta = (A(q,q) - A(p,p)) / (t_real(2)*apq);
+				t_real t = t_real(1) / (std::abs(theta) + std::sqrt(theta*theta + t_real(1)));
+				if(theta < t_real(0)) t = -t;
+				const t_real c = t_real(1) / std::sqrt(t*t + t_real(1));
+				const t_real s = t*c;
+
+				for(std::size_t k=0; k<N; ++k)
+				{
+					const t_real akp = A(k,p), akq = A(k,q);
+					A(k,p) = c*akp - s*akq;
+					A(k,q) = s*akp + c*akq;
+				}
+				for(std::size_t k=0; k<N; ++k)
+				{
+					const t_real apk = A(p,k), aqk = A(q,k);
+					A(p,k) = c*apk - s*aqk;
+					A(q,k) = s*apk + c*aqk;
+				}
+				for(std::size_t k=0; k<N; ++k)
+				{
+					const t_real vkp = evecs(k,p), vkq = evecs(k,q);
+					evecs(k,p) = c*vkp - s*vkq;
+					evecs(k,q) = s*vkp + c*vkq;
+				}
+			}
+		}
+	}
+
+	for(std::size_t i=0; i<N; ++i)
+	{
+		evals[i] = A(i,i);
+		if(!std::isfinite(evals[i]))
+			return false;
+	}
+
+	fix_eigenvec_sort(evecs, evals);
+	return true;
+}
+
+
+/**
+ * closed-form 2x2 solution
+ */
+template<class t_real>
+bool fix_eigenvec_sym(const t_matfix<t_real, 2, 2>& A, t_matfix<t_real, 2, 2>& evecs, t_real (&evals)[2],
+	std::integral_constant<std::size_t, 2>)
+{
+	const t_real b = t_real(0.5) * (A(0,1) + A(1,0));
+	const t_real dMean = t_real(0.5) * (A(0,0) + A(1,1));
+	const t_real dHalfDiff = t_real(0.5) * (A(0,0) - A(1,1));
+	const t_real dRad = std::sqrt(dHalfDiff*dHalfDiff + b*b);
+	const t_real dAngle = t_real(0.5) * std::atan2(b, dHalfDiff);
+	const t_real c = std::cos(dAngle), s = std::sin(dAngle);
+
+	// first column belongs to the smaller eigenvalue
+	evals[0] = dMean - dRad;
+	evals[1] = dMean + dRad;
+	evecs(0,0) = s; evecs(0,1) = c;
+	evecs(1,0) = -c; evecs(1,1) = s;
+
+	return std::isfinite(evals[0]) && std::isfinite(evals[1]);
+}
+
+
+/**
+ * closed-form 3x3 solution, the eigenvalues are the roots of the characteristic polynomial
+ * in trigonometric form, the eigenvectors are calculated via cross products
+ * @see D. Eberly, "A Robust Eigensolver for 3x3 Symmetric Matrices" (2014)
+ */
+template<class t_real>
+bool fix_eigenvec_sym(const t_matfix<t_real, 3, 3>& Ain, t_matfix<t_real, 3, 3>& evecs, t_real (&evals)[3],
+	std::integral_constant<std::size_t, 3>)
+{
+	typedef t_vecfix<t_real, 3> t_vec3;
+
+	auto cross = [](const t_vec3& a, const t_vec3& b) -> t_vec3
+	{
+		t_vec3 c;
+		c[0] = a[1]*b[2] - a[2]*b[1];
+		c[1] = a[2]*b[0] - a[0]*b[2];
+		c[2] = a[0]*b[1] - a[1]*b[0];
+		return c;
+	};
+	auto dot = [](const t_vec3& a, const t_vec3& b) -> t_real
+	{
+		return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+	};
+
+	// orthonormal vectors perpendicular to the unit vector w
+	auto complement = [&cross](const t_vec3& w, t_vec3& u, t_vec3& v)
+	{
+		if(std::abs(w[0]) > std::abs(w[1]))
+		{
+			const t_real dInvLen = t_real(1) / std::sqrt(w[0]*w[0] + w[2]*w[2]);
+			u[0] = -w[2]*dInvLen; u[1] = t_real(0); u[2] = w[0]*dInvLen;
+		}
+		else
+		{
+			const t_real dInvLen = t_real(1) / std::sqrt(w[1]*w[1] + w[2]*w[2]);
+			u[0] = t_real(0); u[1] = w[2]*dInvLen; u[2] = -w[1]*dInvLen;
+		}
+		v = cross(w, u);
+	};
+
+	// scale to avoid over- and underflows
+	t_real dScale = t_real(0);
+	for(std::size_t i=0; i<3; ++i)
+		for(std::size_t j=0; j<3; ++j)
+			dScale = std::max(dScale, std::abs(Ain(i,j)));
+	if(!std::isfinite(dScale))
+		return false;
+	if(dScale == t_real(0))
+	{
+		evecs = fix_unit<t_real, 3>();
+		evals[0] = evals[1] = evals[2] = t_real(0);
+		return true;
+	}
+
+	t_matfix<t_real, 3, 3> A;
+	for(std::size_t i=0; i<3; ++i)
+		for(std::size_t j=0; j<3; ++j)
+			A(i,j) = t_real(0.5) * (Ain(i,j) + Ain(j,i)) / dScale;
+
+	const t_real dOff = A(0,1)*A(0,1) + A(0,2)*A(0,2) + A(1,2)*A(1,2);
+	if(dOff == t_real(0))
+	{
+		// already diagonal
+		evecs = fix_unit<t_real, 3>();
+		for(std::size_t i=0; i<3; ++i)
+			evals[i] = A(i,i) * dScale;
+		fix_eigenvec_sort(evecs, evals);
+		return true;
+	}
+
+	// eigenvalues of B = (A - q*1) / p
+	const t_real q = (A(0,0) + A(1,1) + A(2,2)) / t_real(3);
+	const t_real b00 = A(0,0)-q, b11 = A(1,1)-q, b22 = A(2,2)-q;
+	const t_real p = std::sqrt((b00*b00 + b11*b11 + b22*b22 + t_real(2)*dOff) / t_real(6));
+	const t_real dHalfDet = t_real(0.5) / (p*p*p) * (b00*(b11*b22 - A(1,2)*A(1,2))
+		- A(0,1)*(A(0,1)*b22 - A(1,2)*A(0,2))
+		+ A(0,2)*(A(0,1)*A(1,2) - b11*A(0,2)));
+	const t_real dPhi = std::acos(std::min(std::max(dHalfDet, t_real(-1)), t_real(1))) / t_real(3);
+
+	const t_real dTwoThirdsPi = t_real(2)*std::acos(t_real(-1)) / t_real(3);
+	const t_real dEvMax = q + t_real(2)*p*std::cos(dPhi);
+	const t_real dEvMin = q + t_real(2)*p*std::cos(dPhi + dTwoThirdsPi);
+	const t_real dEvMid = t_real(3)*q - dEvMax - dEvMin;
+
+	// eigenvector of the well-separated eigenvalue from the largest cross product of the rows of A - ev*1
+	auto evec0 = [&](t_real dEv) -> t_vec3
+	{
+		t_vec3 r0, r1, r2;
+		for(std::size_t j=0; j<3; ++j)
+		{
+			r0[j] = A(0,j); r1[j] = A(1,j); r2[j] = A(2,j);
+		}
+		r0[0] -= dEv; r1[1] -= dEv; r2[2] -= dEv;
+
+		const t_vec3 c[3] = { cross(r0, r1), cross(r0, r2), cross(r1, r2) };
+		std::size_t iMax = 0;
+		t_real dMax = dot(c[0], c[0]);
+		for(std::size_t i=1; i<3; ++i)
+		{
+			const t_real dLen = dot(c[i], c[i]);
+			if(dLen > dMax) { dMax = dLen; iMax = i; }
+		}
+
+		t_vec3 v = c[iMax];
+		if(dMax > t_real(0))
+		{
+			v /= std::sqrt(dMax);
+		}
+		else
+		{
+			v[0] = t_real(1); v[1] = v[2] = t_real(0);
+		}
+		return v;
+	};
+
+	// second eigenvector in the plane perpendicular to the first one
+	auto evec1 = [&](const t_vec3& v0, t_real dEv) -> t_vec3
+	{
+		t_vec3 u, v;
+		complement(v0, u, v);
+
+		const t_vec3 Au = fix_prod(A, u), Av = fix_prod(A, v);
+		t_real m00 = dot(u, Au) - dEv;
+		t_real m01 = dot(u, Av);
+		t_real m11 = dot(v, Av) - dEv;
+
+		const t_real a00 = std::abs(m00), a01 = std::abs(m01), a11 = std::abs(m11);
+		if(a00 >= a11)
+		{
+			if(std::max(a00, a01) > t_real(0))
+			{
+				if(a00 >= a01) { m01 /= m00; m00 = t_real(1)/std::sqrt(t_real(1) + m01*m01); m01 *= m00; }
+				else { m00 /= m01; m01 = t_real(1)/std::sqrt(t_real(1) + m00*m00); m00 *= m01; }
+				return m01*u - m00*v;
+			}
+		}
+		else
+		{
+			if(std::max(a11, a01) > t_real(0))
+			{
+				if(a11 >= a01) { m01 /= m11; m11 = t_real(1)/std::sqrt(t_real(1) + m01*m01); m01 *= m11; }
+				else { m11 /= m01; m01 = t_real(1)/std::sqrt(t_real(1) + m11*m11); m11 *= m01; }
+				return m11*u - m01*v;
+			}
+		}
+
+		// degenerate
+		return u;
+	};
+
+	t_vec3 v[3];
+	if(dHalfDet >= t_real(0))
+	{
+		v[2] = evec0(dEvMax);
+		v[1] = evec1(v[2], dEvMid);
+		v[0] = cross(v[1], v[2]);
+	}
+	else
+	{
+		v[0] = evec0(dEvMin);
+		v[1] = evec1(v[0], dEvMid);
+		v[2] = cross(v[0], v[1]);
+	}
+
+	t_matfix<t_real, 3, 3> V;
+	for(std::size_t i=0; i<3; ++i)
+		for(std::size_t j=0; j<3; ++j)
+			V(j,i) = v[i][j];
+
+	// the roots lose precision for nearly degenerate eigenvalues,
+	// V^T A V is almost diagonal, so a jacobi sweep polishes the result
+	t_matfix<t_real, 3, 3> W;
+	if(!fix_eigenvec_sym_jacobi(fix_transform(A, V), W, evals))
+		return false;
+	evecs = fix_prod(V, W);
+
+	for(std::size_t i=0; i<3; ++i)
+		evals[i] *= dScale;
+	return std::isfinite(evals[0]) && std::isfinite(evals[2]);
+}
+
+
+template<class t_real, std::size_t N, std::size_t iTag>
+bool fix_eigenvec_sym(const t_matfix<t_real, N, N>& A, t_matfix<t_real, N, N>& evecs, t_real (&evals)[N],
+	std::integral_constant<std::size_t, iTag>)
+{
+	return fix_eigenvec_sym_jacobi(A, evecs, evals);
+}
+
+
+/**
+ * eigenvalues and eigenvectors (columns) of a symmetric matrix:
+ * closed-form for 2x2 and 3x3, jacobi rotations otherwise.
+ * the eigenvalues are sorted in ascending order and evecs is a rotation matrix.
+ */
+template<class t_real, std::size_t N>
+bool fix_eigenvec_sym(const t_matfix<t_real, N, N>& A, t_matfix<t_real, N, N>& evecs, t_real (&evals)[N])
+{
+	return fix_eigenvec_sym(A, evecs, evals, std::integral_constant<std::size_t, N>());
+}
+// ----------------------------------------------------------------------------
+
+#endif
@@ -13,9 +13,16 @@
 #include <ostream>
 #include <cmath>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <cstring>
 
 #include <boost/numeric/ublas/vector.hpp>
 #include <boost/numeric/ublas/matrix.hpp>
+#include <boost/align/aligned_allocator.hpp>
 namespace ublas = boost::numeric::ublas;
 
 #include "tlibs/math/math.h"
@@ -29,6 +36,13 @@ enum class McNeutronCoords
 	RLU = 2
 };
 
+enum class McSampler
+{
+	PSEUDO = 0,	// pseudo-random numbers
+	SOBOL = 1,	// sobol sequence with a random digital shift (quasi-mc)
+	STRATIFIED = 2	// latin hypercube, stratified along the principal axes
+};
+
 template<class t_mat = ublas::matrix<double>>
 struct McNeutronOpts
 {
@@ -40,9 +54,561 @@ struct McNeutronOpts
 	real_type dAngleQVec0;
 
 	bool bCenter;
+
+	McSampler sampler = McSampler::PSEUDO;
+	std::uint32_t iScramble = 0;	// seed for the qmc digital shift
 };
 
 
+// alignment of the neutron bank arrays in bytes (cache line)
+#define MC_NEUTR_ALIGN 64
+
+/**
+ * aligned allocator which leaves new elements uninitialised, so that the memory
+ * is first touched by the (possibly pinned) worker generating the neutrons
+ * and its pages are placed on that worker's numa node
+ */
+template<class T>
+struct McAllocator : public boost::alignment::aligned_allocator<T, MC_NEUTR_ALIGN>
+{
+	using t_base = boost::alignment::aligned_allocator<T, MC_NEUTR_ALIGN>;
+
+	template<class U> struct rebind { using other = McAllocator<U>; };
+
+	McAllocator() = default;
+	template<class U> McAllocator(const McAllocator<U>&) noexcept {}
+
+	using t_base::construct;
+	template<class U> void construct(U* p) { ::new((void*)p) U; }
+};
+
+
+/**
+ * contiguous bank of mc neutrons in structure-of-arrays layout
+ * (resizing to a smaller size keeps the capacity, so a bank can be reused
+ * without reallocation as long as it does not exceed its largest size;
+ * new elements are not initialised)
+ */
+template<class t_real = double>
+struct McNeutrons
+{
+	using value_type = t_real;
+	using t_arr = std::vector<t_real, McAllocator<t_real>>;
+
+	t_arr h, k, l, E;
+
+	std::size_t size() const { return h.size(); }
+
+	void resize(std::size_t iNum)
+	{
+		if(size() == iNum) return;
+		for(t_arr* pArr : {&h, &k, &l, &E})
+			pArr->resize(iNum);
+	}
+
+	// component iComp (0..3) of all neutrons
+	t_real* data(int iComp)
+	{
+		switch(iComp)
+		{
+			case 0: return h.data();
+			case 1: return k.data();
+			case 2: return l.data();
+			default: return E.data();
+		}
+	}
+
+	const t_real* data(int iComp) const
+	{ return const_cast<McNeutrons<t_real>*>(this)->data(iComp); }
+};
+
+
+
+// number of neutrons generated per block
+#define MC_NEUTR_BLOCK 256
+
+// number of neutrons per block in fused generation and convolution (fits in l1/l2 cache)
+#define MC_CONVO_BLOCK 1024
+
+// number of neutrons per partial sum in the convolution, divides MC_CONVO_BLOCK
+#define MC_REDUCE_BLOCK 128
+
+/**
+ * fills pOut with iNum standard normal variates using the Box-Muller method;
+ * the uniform numbers are drawn first, so the transformation loop has no
+ * dependencies and can be vectorised
+ */
+template<class t_real = double>
+void rand_norm_block(t_real* pOut, std::size_t iNum)
+{
+	const std::size_t iNumPairs = (iNum+1) / 2;
+	const t_real dTwoPi = t_real(2)*tl::get_pi<t_real>();
+
+	t_real dU1[MC_NEUTR_BLOCK/2], dU2[MC_NEUTR_BLOCK/2];
+	t_real dNorm[MC_NEUTR_BLOCK];
+
+	for(std::size_t iBlock=0; iBlock<iNumPairs; iBlock+=MC_NEUTR_BLOCK/2)
+	{
+		const std::size_t iPairs = std::min<std::size_t>(MC_NEUTR_BLOCK/2, iNumPairs-iBlock);
+
+		// u1 in (0, 1] to avoid log(0)
+		for(std::size_t i=0; i<iPairs; ++i)
+		{
+			dU1[i] = t_real(1) - tl::rand_real<t_real>(t_real(0), t_real(1));
+			dU2[i] = tl::rand_real<t_real>(t_real(0), t_real(1));
+		}
+
+		for(std::size_t i=0; i<iPairs; ++i)
+		{
+			const t_real dR = std::sqrt(t_real(-2) * std::log(dU1[i]));
+			const t_real dPhi = dTwoPi * dU2[i];
+			dNorm[i] = dR * std::cos(dPhi);
+			dNorm[i + iPairs] = dR * std::sin(dPhi);
+		}
+
+		const std::size_t iOffs = 2*iBlock;
+		const std::size_t iNumOut = std::min<std::size_t>(2*iPairs, iNum-iOffs);
+		std::copy(dNorm, dNorm+iNumOut, pOut+iOffs);
+	}
+}
+
+
+/**
+ * inverse of the standard normal cdf
+ * @see P. J. Acklam's rational approximation, rel. error < 1.15e-9
+ */
+template<class t_real = double>
+t_real norm_cdf_inv(t_real p)
+{
+	static const t_real a[] = { -3.969683028665376e+01, 2.209460984245205e+02,
+		-2.759285104469687e+02, 1.383577518672690e+02,
+		-3.066479806614716e+01, 2.506628277459239e+00 };
+	static const t_real b[] = { -5.447609879822406e+01, 1.615858368580409e+02,
+		-1.556989798598866e+02, 6.680131188771972e+01, -1.328068155288572e+01 };
+	static const t_real c[] = { -7.784894002430293e-03, -3.223964580411365e-01,
+		-2.400758277161838e+00, -2.549732539343734e+00,
+		4.374664141464968e+00, 2.938163982698783e+00 };
+	static const t_real d[] = { 7.784695709041462e-03, 3.224671290700398e-01,
+		2.445134137142996e+00, 3.754408661907416e+00 };
+	const t_real pLow = 0.02425;
+
+	if(p < pLow)
+	{
+		t_real q = std::sqrt(t_real(-2)*std::log(p));
+		return (((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) /
+			((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+t_real(1));
+	}
+	else if(p > t_real(1)-pLow)
+	{
+		t_real q = std::sqrt(t_real(-2)*std::log(t_real(1)-p));
+		return -(((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) /
+			((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+t_real(1));
+	}
+
+	t_real q = p - t_real(0.5);
+	t_real r = q*q;
+	return (((((a[0]*r+a[1])*r+a[2])*r+a[3])*r+a[4])*r+a[5])*q /
+		(((((b[0]*r+b[1])*r+b[2])*r+b[3])*r+b[4])*r+t_real(1));
+}
+
+
+/**
+ * fills pOut with iNum <= MC_NEUTR_BLOCK standard normal variates, one in each of
+ * iNum equiprobable strata, in random order. called for every principal axis of
+ * the ellipsoid, this gives a latin hypercube sample of the block.
+ */
+template<class t_real = double>
+void strat_norm_block(t_real* pOut, std::size_t iNum)
+{
+	if(iNum == 0) return;
+
+	// random permutation of the strata (fisher-yates)
+	std::size_t iStrata[MC_NEUTR_BLOCK];
+	for(std::size_t i=0; i<iNum; ++i)
+		iStrata[i] = i;
+	for(std::size_t i=iNum-1; i>0; --i)
+	{
+		std::size_t j = std::size_t(tl::rand_real<t_real>(t_real(0), t_real(i+1)));
+		std::swap(iStrata[i], iStrata[std::min(j, i)]);
+	}
+
+	const t_real dScale = t_real(1) / t_real(iNum);
+	const t_real dEps = std::numeric_limits<t_real>::epsilon();
+	for(std::size_t i=0; i<iNum; ++i)
+	{
+		t_real dU = (t_real(iStrata[i]) + tl::rand_real<t_real>(t_real(0), t_real(1))) * dScale;
+		dU = std::min(std::max(dU, dEps), t_real(1)-dEps);
+		pOut[i] = norm_cdf_inv<t_real>(dU);
+	}
+}
+
+
+/**
+ * 4d sobol sequence with a random digital shift
+ * @see S. Joe and F. Y. Kuo, SIAM J. Sci. Comput. 30, 2635 (2008)
+ */
+class SobolSeq4d
+{
+protected:
+	static constexpr int BITS = 32;
+	std::uint32_t m_iDir[4][BITS];
+	std::uint32_t m_iShift[4];
+
+public:
+	SobolSeq4d(std::uint32_t iScramble = 0)
+	{
+		// dimension 0: van der corput
+		for(int iBit=0; iBit<BITS; ++iBit)
+			m_iDir[0][iBit] = std::uint32_t(1) << (BITS-1-iBit);
+
+		// dimensions 1-3: degree s, coefficients a, initial direction numbers m
+		static const unsigned int s[] = { 1, 2, 3 };
+		static const unsigned int a[] = { 0, 1, 1 };
+		static const std::uint32_t m[][3] = { {1, 0, 0}, {1, 3, 0}, {1, 3, 1} };
+
+		for(int iDim=1; iDim<4; ++iDim)
+		{
+			std::uint32_t* v = m_iDir[iDim];
+			const unsigned int iDeg = s[iDim-1];
+
+			for(unsigned int iBit=0; iBit<iDeg; ++iBit)
+				v[iBit] = m[iDim-1][iBit] << (BITS-1-iBit);
+			for(unsigned int iBit=iDeg; iBit<BITS; ++iBit)
+			{
+				v[iBit] = v[iBit-iDeg] ^ (v[iBit-iDeg] >> iDeg);
+				for(unsigned int k=1; k<iDeg; ++k)
+					if((a[iDim-1] >> (iDeg-1-k)) & 1)
+						v[iBit] ^= v[iBit-k];
+			}
+		}
+
+		// random digital shift, derived from the seed; a shift is also applied for
+		// seed 0, otherwise all positions would share the unshifted point set
+		std::uint64_t iState = iScramble;
+		for(int iDim=0; iDim<4; ++iDim)
+		{
+			// splitmix64
+			std::uint64_t z = (iState += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			m_iShift[iDim] = std::uint32_t((z ^ (z >> 31)) >> 32);
+		}
+	}
+
+	/**
+	 * point iIdx of the sequence, mapped to (0, 1);
+	 * the origin of the sequence is skipped, it would map to the tails in all dimensions
+	 */
+	template<class t_real = double>
+	void GetPoint(std::size_t iIdx, t_real* pPt) const
+	{
+		++iIdx;
+		std::uint32_t iPt[4] = { m_iShift[0], m_iShift[1], m_iShift[2], m_iShift[3] };
+		for(int iBit=0; iBit<BITS && iIdx; ++iBit, iIdx>>=1)
+		{
+			if(iIdx & 1)
+				for(int iDim=0; iDim<4; ++iDim)
+					iPt[iDim] ^= m_iDir[iDim][iBit];
+		}
+
+		const t_real dScale = t_real(1) / t_real(std::uint64_t(1) << BITS);
+		for(int iDim=0; iDim<4; ++iDim)
+		{
+			pPt[iDim] = (t_real(iPt[iDim]) + t_real(0.5)) * dScale;
+			// the sum can be rounded to 1 in single precision
+			if(pPt[iDim] >= t_real(1))
+				pPt[iDim] = t_real(1) - std::numeric_limits<t_real>::epsilon();
+		}
+	}
+};
+
+
+/**
+ * standard normal variates from the sobol points [iStart, iStart+iNum)
+ */
+template<class t_real = double>
+void sobol_norm_block(const SobolSeq4d& seq, std::size_t iStart, std::size_t iNum,
+	t_real (*pOut)[MC_NEUTR_BLOCK])
+{
+	for(std::size_t iCur=0; iCur<iNum; ++iCur)
+	{
+		t_real dPt[4];
+		seq.GetPoint<t_real>(iStart+iCur, dPt);
+		for(int iDim=0; iDim<4; ++iDim)
+			pOut[iDim][iCur] = norm_cdf_inv<t_real>(dPt[iDim]);
+	}
+}
+
+
+/**
+ * sub-streams of the counter-based random numbers
+ */
+enum class McRngSub : std::uint32_t
+{
+	NEUTRONS = 0,		// normal variates (and stratum jitter) of the neutrons
+	STRATA = 1,		// permutations of the strata
+	IMPORTANCE = 2,		// importance sampling
+	SAMPLE_POS = 3,		// random sample positions
+	SCRAMBLE = 4		// digital shift of the sobol sequence
+};
+
+
+/**
+ * counter-based random numbers (philox-4x32-10):
+ * the numbers of item iIdx (e.g. a neutron) are a pure function of
+ * (seed, scan point, sample position, iIdx, sub-stream), so they can be
+ * regenerated on demand and no state is shared between threads
+ * @see J. K. Salmon et al., SC '11, doi: 10.1145/2063384.2063405
+ */
+struct McRngStream
+{
+	std::uint64_t iSeed = 0;
+	std::uint32_t iPoint = 0;	// scan point, see HashPoint
+	std::uint32_t iPos = 0;		// sample position
+
+	/**
+	 * four random 32 bit numbers of item iIdx in sub-stream sub
+	 */
+	void Raw(std::uint64_t iIdx, McRngSub sub, std::uint32_t (&iOut)[4]) const
+	{
+		std::uint32_t ctr[4] = { iPoint, iPos, std::uint32_t(iIdx),
+			std::uint32_t((iIdx >> 32) & 0x00ffffff) | (std::uint32_t(sub) << 24) };
+		std::uint32_t key[2] = { std::uint32_t(iSeed), std::uint32_t(iSeed >> 32) };
+
+		for(int iRound=0; iRound<10; ++iRound)
+		{
+			const std::uint64_t iProd0 = std::uint64_t(0xd2511f53u) * ctr[0];
+			const std::uint64_t iProd1 = std::uint64_t(0xcd9e8d57u) * ctr[2];
+
+			ctr[0] = std::uint32_t(iProd1 >> 32) ^ ctr[1] ^ key[0];
+			ctr[1] = std::uint32_t(iProd1);
+			ctr[2] = std::uint32_t(iProd0 >> 32) ^ ctr[3] ^ key[1];
+			ctr[3] = std::uint32_t(iProd0);
+
+			key[0] += 0x9e3779b9u;
+			key[1] += 0xbb67ae85u;
+		}
+
+		for(int i=0; i<4; ++i)
+			iOut[i] = ctr[i];
+	}
+
+	/**
+	 * four uniform numbers in (0, 1)
+	 */
+	template<class t_real = double>
+	void Uniform(std::uint64_t iIdx, McRngSub sub, t_real (&dOut)[4]) const
+	{
+		std::uint32_t iRaw[4];
+		Raw(iIdx, sub, iRaw);
+
+		const t_real dScale = t_real(1) / t_real(std::uint64_t(1) << 32);
+		for(int i=0; i<4; ++i)
+		{
+			dOut[i] = (t_real(iRaw[i]) + t_real(0.5)) * dScale;
+			// the sum can be rounded to 1 in single precision
+			if(dOut[i] >= t_real(1))
+				dOut[i] = t_real(1) - std::numeric_limits<t_real>::epsilon();
+		}
+	}
+
+	/**
+	 * four standard normal variates (box-muller)
+	 */
+	template<class t_real = double>
+	void Normal(std::uint64_t iIdx, McRngSub sub, t_real (&dOut)[4]) const
+	{
+		t_real dU[4];
+		Uniform<t_real>(iIdx, sub, dU);
+
+		const t_real dTwoPi = t_real(2)*tl::get_pi<t_real>();
+		for(int iPair=0; iPair<2; ++iPair)
+		{
+			const t_real dR = std::sqrt(t_real(-2) * std::log(dU[2*iPair]));
+			const t_real dPhi = dTwoPi * dU[2*iPair + 1];
+			dOut[2*iPair] = dR * std::cos(dPhi);
+			dOut[2*iPair + 1] = dR * std::sin(dPhi);
+		}
+	}
+
+	/**
+	 * identifier of a scan point from its coordinates
+	 */
+	template<class t_real = double>
+	static std::uint32_t HashPoint(t_real h, t_real k, t_real l, t_real E)
+	{
+		std::uint64_t iHash = 0;
+		for(double dVal : { double(h), double(k), double(l), double(E) })
+		{
+			// no distinction between -0 and +0
+			if(dVal == 0.) dVal = 0.;
+
+			std::uint64_t iBits = 0;
+			std::memcpy(&iBits, &dVal, sizeof(iBits));
+
+			// splitmix64
+			std::uint64_t z = (iHash += 0x9e3779b97f4a7c15ull ^ iBits);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			iHash = z ^ (z >> 31);
+		}
+		return std::uint32_t(iHash ^ (iHash >> 32));
+	}
+};
+
+
+/**
+ * standard normal variates for the neutrons [iStart, iStart+iNum) of a stream
+ */
+template<class t_real = double>
+void rng_norm_block(const McRngStream& rng, std::uint64_t iStart, std::size_t iNum,
+	t_real (*pOut)[MC_NEUTR_BLOCK])
+{
+	for(std::size_t iCur=0; iCur<iNum; ++iCur)
+	{
+		t_real dNorm[4];
+		rng.Normal<t_real>(iStart+iCur, McRngSub::NEUTRONS, dNorm);
+		for(int iDim=0; iDim<4; ++iDim)
+			pOut[iDim][iCur] = dNorm[iDim];
+	}
+}
+
+
+/**
+ * stratified standard normal variates for the neutrons [iStart, iStart+iNum) of a stream.
+ * the strata are defined on the aligned blocks of MC_NEUTR_BLOCK neutrons of the stream,
+ * so the numbers do not depend on how the neutrons are split up between the threads.
+ */
+template<class t_real = double>
+void rng_strat_norm_block(const McRngStream& rng, std::uint64_t iStart, std::size_t iNum,
+	t_real (*pOut)[MC_NEUTR_BLOCK])
+{
+	const t_real dScale = t_real(1) / t_real(MC_NEUTR_BLOCK);
+	const t_real dEps = std::numeric_limits<t_real>::epsilon();
+	std::uint32_t iStrata[4][MC_NEUTR_BLOCK];
+	std::uint64_t iCurAligned = std::uint64_t(-1);
+
+	for(std::size_t iCur=0; iCur<iNum; ++iCur)
+	{
+		const std::uint64_t iIdx = iStart + iCur;
+		const std::uint64_t iAligned = iIdx / MC_NEUTR_BLOCK;
+
+		// permutations of the strata of the aligned block (fisher-yates)
+		if(iAligned != iCurAligned)
+		{
+			for(int iDim=0; iDim<4; ++iDim)
+				for(std::uint32_t i=0; i<MC_NEUTR_BLOCK; ++i)
+					iStrata[iDim][i] = i;
+
+			for(std::uint32_t i=MC_NEUTR_BLOCK-1; i>0; --i)
+			{
+				std::uint32_t iRnd[4];
+				rng.Raw(iAligned*MC_NEUTR_BLOCK + i, McRngSub::STRATA, iRnd);
+				for(int iDim=0; iDim<4; ++iDim)
+				{
+					std::uint32_t j = std::uint32_t((std::uint64_t(iRnd[iDim]) * (i+1)) >> 32);
+					std::swap(iStrata[iDim][i], iStrata[iDim][j]);
+				}
+			}
+
+			iCurAligned = iAligned;
+		}
+
+		t_real dJitter[4];
+		rng.Uniform<t_real>(iIdx, McRngSub::NEUTRONS, dJitter);
+
+		const std::size_t iInBlock = std::size_t(iIdx % MC_NEUTR_BLOCK);
+		for(int iDim=0; iDim<4; ++iDim)
+		{
+			t_real dU = (t_real(iStrata[iDim][iInBlock]) + dJitter[iDim]) * dScale;
+			dU = std::min(std::max(dU, dEps), t_real(1)-dEps);
+			pOut[iDim][iCur] = norm_cdf_inv<t_real>(dU);
+		}
+	}
+}
+
+
+/**
+ * standard normal variates [iSeqOffs, iSeqOffs+iNum) of the given sampler,
+ * pSobol has to be set for the sobol sampler
+ */
+template<class t_real = double>
+void mc_norm_block(McSampler sampler, const SobolSeq4d* pSobol, const McRngStream* pRng,
+	std::size_t iSeqOffs, std::size_t iNum, t_real (*pOut)[MC_NEUTR_BLOCK])
+{
+	if(sampler == McSampler::SOBOL && pSobol)
+	{
+		sobol_norm_block<t_real>(*pSobol, iSeqOffs, iNum, pOut);
+	}
+	else if(pRng && sampler == McSampler::STRATIFIED)
+	{
+		rng_strat_norm_block<t_real>(*pRng, iSeqOffs, iNum, pOut);
+	}
+	else if(pRng)
+	{
+		rng_norm_block<t_real>(*pRng, iSeqOffs, iNum, pOut);
+	}
+	else if(sampler == McSampler::STRATIFIED)
+	{
+		for(int j=0; j<4; ++j)
+			strat_norm_block<t_real>(pOut[j], iNum);
+	}
+	else
+	{
+		for(int j=0; j<4; ++j)
+			rand_norm_block<t_real>(pOut[j], iNum);
+	}
+}
+
+
+/**
+ * folds the scaling (sigmas), the ellipsoid rotation and translation and
+ * the coordinate transformation into one 4x4 matrix and one translation vector
+ */
+template<class t_mat = ublas::matrix<double>>
+void mc_neutron_trafo(const Ellipsoid4d<typename t_mat::value_type>& ell4d,
+	const McNeutronOpts<t_mat>& opts,
+	typename t_mat::value_type (&dMat)[4][4], typename t_mat::value_type (&dTrans)[4])
+{
+	using t_real = typename t_mat::value_type;
+	using t_vec = ublas::vector<t_real>;
+
+	t_mat matQVec0 = tl::rotation_matrix_2d(-opts.dAngleQVec0);
+	tl::resize_unity(matQVec0, 4);
+
+	t_mat matCoord = tl::unit_matrix<t_mat>(4);
+	if(opts.coords == McNeutronCoords::ANGS)
+		matCoord = matQVec0;
+	else if(opts.coords == McNeutronCoords::RLU)
+		matCoord = ublas::prod(opts.matUBinv, matQVec0);
+
+	const t_real dSig[4] =
+	{
+		ell4d.x_hwhm*tl::get_HWHM2SIGMA<t_real>(),
+		ell4d.y_hwhm*tl::get_HWHM2SIGMA<t_real>(),
+		ell4d.z_hwhm*tl::get_HWHM2SIGMA<t_real>(),
+		ell4d.w_hwhm*tl::get_HWHM2SIGMA<t_real>()
+	};
+
+	// coord * rot * diag(sigma)
+	t_mat matRot = ell4d.rot;
+	for(int i=0; i<4; ++i)
+		for(int j=0; j<4; ++j)
+			matRot(i,j) *= dSig[j];
+	t_mat matTot = ublas::prod(matCoord, matRot);
+
+	// coord * offset
+	t_vec vecTrans = tl::make_vec<t_vec>({ell4d.x_offs, ell4d.y_offs, ell4d.z_offs, ell4d.w_offs});
+	t_vec vecTransTot = ublas::prod(matCoord, vecTrans);
+
+	for(int i=0; i<4; ++i)
+	{
+		dTrans[i] = opts.bCenter ? t_real(0) : vecTransTot[i];
+		for(int j=0; j<4; ++j)
+			dMat[i][j] = matTot(i,j);
+	}
+}
+
 
 /**
  * Ellipsoid E in Q||... coord. system in 1/A
@@ -50,6 +616,136 @@ struct McNeutronOpts
  * matQVec0: trafo from Q||... to orient1, orient2 system in 1/A
  * Uinv * matQVec0: trafo from Q||... system to lab 1/A system
  * Binv * Uinv * matQVec0: trafo from Q||... system to crystal rlu system
+ *
+ * writes the neutrons into the bank at index iOffs;
+ * iSeqOffs is the index of the first neutron in the quasi-mc sequence or
+ * in the counter-based stream pRng (for chunks of the same ellipsoid generated in parallel).
+ * without pRng, the thread's pseudo-random engine is used.
+ *
+ * the bank may have a lower precision t_real_bank (e.g. float) than the ellipsoid,
+ * then the random numbers and the transformation also use t_real_bank.
+ */
+template<class t_vec = ublas::vector<double>, class t_mat = ublas::matrix<double>,
+	class t_real_bank = typename t_vec::value_type>
+void mc_neutrons(const Ellipsoid4d<typename t_vec::value_type>& ell4d,
+	std::size_t iNum, const McNeutronOpts<t_mat>& opts,
+	McNeutrons<t_real_bank>& neutrons, std::size_t iOffs,
+	std::size_t iSeqOffs = 0, const McRngStream* pRng = nullptr)
+{
+	using t_real_ell = typename t_vec::value_type;
+	using t_real = t_real_bank;
+
+	t_real_ell dMatEll[4][4], dTransEll[4];
+	mc_neutron_trafo<t_mat>(ell4d, opts, dMatEll, dTransEll);
+
+	t_real dMat[4][4], dTrans[4];
+	for(int i=0; i<4; ++i)
+	{
+		dTrans[i] = t_real(dTransEll[i]);
+		for(int j=0; j<4; ++j)
+			dMat[i][j] = t_real(dMatEll[i][j]);
+	}
+
+	t_real *pOut[4] = { neutrons.data(0)+iOffs, neutrons.data(1)+iOffs,
+		neutrons.data(2)+iOffs, neutrons.data(3)+iOffs };
+
+	std::unique_ptr<SobolSeq4d> pSobol;
+	if(opts.sampler == McSampler::SOBOL)
+		pSobol.reset(new SobolSeq4d(opts.iScramble));
+
+	// standard normal variates, one array per component
+	t_real dRnd[4][MC_NEUTR_BLOCK];
+
+	for(std::size_t iBlock=0; iBlock<iNum; iBlock+=MC_NEUTR_BLOCK)
+	{
+		const std::size_t iBlockLen = std::min<std::size_t>(MC_NEUTR_BLOCK, iNum-iBlock);
+		mc_norm_block<t_real>(opts.sampler, pSobol.get(), pRng, iSeqOffs+iBlock, iBlockLen, dRnd);
+
+		// apply the folded affine trafo to the whole block
+		for(int i=0; i<4; ++i)
+		{
+			t_real *pOutComp = pOut[i] + iBlock;
+			const t_real dM0 = dMat[i][0], dM1 = dMat[i][1],
+				dM2 = dMat[i][2], dM3 = dMat[i][3];
+			const t_real dT = dTrans[i];
+
+			for(std::size_t iCur=0; iCur<iBlockLen; ++iCur)
+			{
+				pOutComp[iCur] = dT + dM0*dRnd[0][iCur] + dM1*dRnd[1][iCur]
+					+ dM2*dRnd[2][iCur] + dM3*dRnd[3][iCur];
+			}
+		}
+	}
+}
+
+
+/**
+ * draws iNum standard normal 4d variates with the sampler of opts into the bank at index iOffs.
+ * such a unit-sphere bank only has to be drawn once, it can then be mapped onto
+ * the ellipsoids of all scan points with mc_neutrons_warp.
+ */
+template<class t_mat = ublas::matrix<double>, class t_real = typename t_mat::value_type>
+void mc_unit_neutrons(std::size_t iNum, const McNeutronOpts<t_mat>& opts,
+	McNeutrons<t_real>& unit, std::size_t iOffs,
+	std::size_t iSeqOffs = 0, const McRngStream* pRng = nullptr)
+{
+	std::unique_ptr<SobolSeq4d> pSobol;
+	if(opts.sampler == McSampler::SOBOL)
+		pSobol.reset(new SobolSeq4d(opts.iScramble));
+
+	t_real dRnd[4][MC_NEUTR_BLOCK];
+
+	for(std::size_t iBlock=0; iBlock<iNum; iBlock+=MC_NEUTR_BLOCK)
+	{
+		const std::size_t iBlockLen = std::min<std::size_t>(MC_NEUTR_BLOCK, iNum-iBlock);
+		mc_norm_block<t_real>(opts.sampler, pSobol.get(), pRng, iSeqOffs+iBlock, iBlockLen, dRnd);
+
+		for(int i=0; i<4; ++i)
+			std::copy(dRnd[i], dRnd[i]+iBlockLen, unit.data(i)+iOffs+iBlock);
+	}
+}
+
+
+/**
+ * maps iNum neutrons of a unit-sphere bank (see mc_unit_neutrons), starting at index iUnitOffs,
+ * onto the ellipsoid and writes them into the bank at index iOffs.
+ * no random numbers are needed, and as all points use the same variates,
+ * the point-to-point noise of a scan is reduced.
+ */
+template<class t_vec = ublas::vector<double>, class t_mat = ublas::matrix<double>,
+	class t_real_unit = typename t_vec::value_type, class t_real_bank = typename t_vec::value_type>
+void mc_neutrons_warp(const Ellipsoid4d<typename t_vec::value_type>& ell4d,
+	std::size_t iNum, const McNeutronOpts<t_mat>& opts,
+	const McNeutrons<t_real_unit>& unit, std::size_t iUnitOffs,
+	McNeutrons<t_real_bank>& neutrons, std::size_t iOffs)
+{
+	using t_real_ell = typename t_vec::value_type;
+	using t_real = t_real_bank;
+
+	t_real_ell dMatEll[4][4], dTransEll[4];
+	mc_neutron_trafo<t_mat>(ell4d, opts, dMatEll, dTransEll);
+
+	const t_real_unit *pIn[4] = { unit.data(0)+iUnitOffs, unit.data(1)+iUnitOffs,
+		unit.data(2)+iUnitOffs, unit.data(3)+iUnitOffs };
+
+	for(int i=0; i<4; ++i)
+	{
+		t_real *pOutComp = neutrons.data(i) + iOffs;
+		const t_real dM0 = t_real(dMatEll[i][0]), dM1 = t_real(dMatEll[i][1]),
+			dM2 = t_real(dMatEll[i][2]), dM3 = t_real(dMatEll[i][3]);
+		const t_real dT = t_real(dTransEll[i]);
+
+		for(std::size_t iCur=0; iCur<iNum; ++iCur)
+		{
+			pOutComp[iCur] = dT + dM0*t_real(pIn[0][iCur]) + dM1*t_real(pIn[1][iCur])
+				+ dM2*t_real(pIn[2][iCur]) + dM3*t_real(pIn[3][iCur]);
+		}
+	}
+}
+
+
+/**
+ * same as above, but writes the neutrons as vectors into iterResult
  */
 template<class t_vec = ublas::vector<double>, class t_mat = ublas::matrix<double>,
 	class t_iter = typename std::vector<t_vec>::iterator>
@@ -58,38 +754,250 @@ void mc_neutrons(const Ellipsoid4d<typename t_vec::value_type>& ell4d,
 {
 	using t_real = typename t_vec::value_type;
 
-	t_vec vecTrans = tl::make_vec<t_vec>({ell4d.x_offs, ell4d.y_offs, ell4d.z_offs, ell4d.w_offs});
-	const t_mat& rot = ell4d.rot;
-	//if(vecResult.size() != iNum)
-	//	vecResult.resize(iNum);
+	McNeutrons<t_real> neutrons;
+	neutrons.resize(iNum);
+	mc_neutrons<t_vec, t_mat>(ell4d, iNum, opts, neutrons, 0);
 
-	//tl::log_debug("rot: ", rot);
-	//tl::log_debug("Qvec0 = ", opts.dAngleQVec0/M_PI*180.);
-	t_mat matQVec0 = tl::rotation_matrix_2d(-opts.dAngleQVec0);
-	tl::resize_unity(matQVec0, 4);
+	for(std::size_t iCur=0; iCur<iNum; ++iCur)
+	{
+		iterResult[iCur] = tl::make_vec<t_vec>({ neutrons.h[iCur], neutrons.k[iCur],
+			neutrons.l[iCur], neutrons.E[iCur] });
+	}
+}
 
-	t_mat matUBinvQVec0 = ublas::prod(opts.matUBinv, matQVec0);
 
-	for(std::size_t iCur=0; iCur<iNum; ++iCur)
+/**
+ * importance sampling of the neutron energies towards the dispersion branches.
+ *
+ * for given Q, a neutron's energy is either kept, i.e. drawn from the conditional
+ * resolution function p(E|Q), or, with probability dMix, drawn from narrow gaussians
+ * around the branches E_j(Q). the branches are linearised around the ellipsoid centre,
+ * so the dispersion only has to be evaluated a few times per ellipsoid.
+ * the weight p(E|Q) / q(E|Q) of each neutron keeps the estimate unbiased,
+ * it is bounded by 1/(1-dMix).
+ */
+template<class t_real = double>
+struct McImportance
+{
+	bool bOk = false;
+	t_real dMix = 0.5;
+
+	// ellipsoid centre and conditional distribution of E given Q:
+	// mean dE0 + dCondGrad*(Q-dQ0), standard deviation dCondSig
+	t_real dQ0[3] = {0, 0, 0}, dE0 = 0;
+	t_real dCondGrad[3] = {0, 0, 0};
+	t_real dCondSig = 0;
+
+	// linearised branches: energy at the centre, gradient, normalised weight
+	t_real dBranchSig = 0;
+	std::vector<t_real> vecBranchE, vecBranchGrad, vecBranchW;
+};
+
+
+/**
+ * sets up the importance sampling for the ellipsoid given by the folded
+ * trafo of mc_neutron_trafo (which has to be in rlu and not centred)
+ *
+ * fktDisp(h, k, l) returns the branch energies and weights, see SqwBase::disp.
+ * dWidth is the width of the branch gaussians relative to the conditional energy resolution.
+ * returns false if importance sampling is not possible, e.g. for no branch in range.
+ */
+template<class t_real, class t_fktDisp>
+bool mc_importance_init(const t_real (&dMat)[4][4], const t_real (&dTrans)[4],
+	const t_fktDisp& fktDisp, t_real dMix, t_real dWidth, McImportance<t_real>& imp)
+{
+	imp = McImportance<t_real>();
+	imp.dMix = dMix;
+	if(dMix <= t_real(0) || dMix >= t_real(1) || dWidth <= t_real(0))
+		return false;
+
+	// covariance of the neutrons
+	t_real C[4][4];
+	for(int i=0; i<4; ++i)
+		for(int j=0; j<4; ++j)
+			C[i][j] = dMat[i][0]*dMat[j][0] + dMat[i][1]*dMat[j][1]
+				+ dMat[i][2]*dMat[j][2] + dMat[i][3]*dMat[j][3];
+
+	// inverse of the Q block
+	t_real dInv[3][3];
+	dInv[0][0] = C[1][1]*C[2][2] - C[1][2]*C[2][1];
+	dInv[0][1] = C[0][2]*C[2][1] - C[0][1]*C[2][2];
+	dInv[0][2] = C[0][1]*C[1][2] - C[0][2]*C[1][1];
+	dInv[1][0] = C[1][2]*C[2][0] - C[1][0]*C[2][2];
+	dInv[1][1] = C[0][0]*C[2][2] - C[0][2]*C[2][0];
+	dInv[1][2] = C[0][2]*C[1][0] - C[0][0]*C[1][2];
+	dInv[2][0] = C[1][0]*C[2][1] - C[1][1]*C[2][0];
+	dInv[2][1] = C[0][1]*C[2][0] - C[0][0]*C[2][1];
+	dInv[2][2] = C[0][0]*C[1][1] - C[0][1]*C[1][0];
+	const t_real dDet = C[0][0]*dInv[0][0] + C[0][1]*dInv[1][0] + C[0][2]*dInv[2][0];
+	if(!(std::abs(dDet) > std::numeric_limits<t_real>::min()))
+		return false;
+
+	// conditional mean and variance of E
+	t_real dCondVar = C[3][3];
+	for(int i=0; i<3; ++i)
+	{
+		imp.dCondGrad[i] = (dInv[i][0]*C[0][3] + dInv[i][1]*C[1][3] + dInv[i][2]*C[2][3]) / dDet;
+		dCondVar -= C[3][i]*imp.dCondGrad[i];
+	}
+	if(!(dCondVar > t_real(0)))
+		return false;
+
+	imp.dCondSig = std::sqrt(dCondVar);
+	imp.dBranchSig = dWidth * imp.dCondSig;
+	for(int i=0; i<3; ++i)
+		imp.dQ0[i] = dTrans[i];
+	imp.dE0 = dTrans[3];
+
+	// branches at the centre
+	std::vector<t_real> vecE, vecW;
+	std::tie(vecE, vecW) = fktDisp(imp.dQ0[0], imp.dQ0[1], imp.dQ0[2]);
+	const std::size_t iNumBranches = vecE.size();
+	if(iNumBranches == 0)
+		return false;
+
+	// gradients from central differences, one sigma along each axis
+	std::vector<t_real> vecGrad(3*iNumBranches, t_real(0));
+	for(int iAxis=0; iAxis<3; ++iAxis)
+	{
+		const t_real dDelta = std::sqrt(C[iAxis][iAxis]);
+		t_real dQp[3] = { imp.dQ0[0], imp.dQ0[1], imp.dQ0[2] };
+		t_real dQm[3] = { imp.dQ0[0], imp.dQ0[1], imp.dQ0[2] };
+		dQp[iAxis] += dDelta;
+		dQm[iAxis] -= dDelta;
+
+		std::vector<t_real> vecEp, vecEm, vecDummy;
+		std::tie(vecEp, vecDummy) = fktDisp(dQp[0], dQp[1], dQp[2]);
+		std::tie(vecEm, vecDummy) = fktDisp(dQm[0], dQm[1], dQm[2]);
+
+		// branches can only be matched if their number does not change
+		if(vecEp.size() != iNumBranches || vecEm.size() != iNumBranches)
+			continue;
+		for(std::size_t iBranch=0; iBranch<iNumBranches; ++iBranch)
+			vecGrad[3*iBranch + iAxis] = (vecEp[iBranch] - vecEm[iBranch]) / (t_real(2)*dDelta);
+	}
+
+	// weight the branches by the overlap with the energy resolution
+	const t_real dSigE2 = C[3][3] + imp.dBranchSig*imp.dBranchSig;
+	t_real dTotW = 0;
+	for(std::size_t iBranch=0; iBranch<iNumBranches; ++iBranch)
+	{
+		t_real dW = iBranch < vecW.size() ? std::abs(vecW[iBranch]) : t_real(1);
+		const t_real dDiff = vecE[iBranch] - imp.dE0;
+		dW *= std::exp(-t_real(0.5) * dDiff*dDiff / dSigE2);
+
+		if(!(dW > t_real(0)))
+			continue;
+
+		imp.vecBranchE.push_back(vecE[iBranch]);
+		imp.vecBranchW.push_back(dW);
+		for(int iAxis=0; iAxis<3; ++iAxis)
+			imp.vecBranchGrad.push_back(vecGrad[3*iBranch + iAxis]);
+		dTotW += dW;
+	}
+	if(!(dTotW > t_real(0)))
+		return false;
+
+	for(t_real& dW : imp.vecBranchW)
+		dW /= dTotW;
+
+	imp.bOk = true;
+	return true;
+}
+
+
+/**
+ * moves the energies of iNum neutrons towards the branches and writes their weights.
+ * with pRng, the random numbers are taken from the counter-based stream,
+ * iSeqOffs being the index of the first neutron.
+ * the weights are calculated in t_real, also for banks of lower precision.
+ */
+template<class t_real = double, class t_real_bank = t_real>
+void mc_importance_block(const McImportance<t_real>& imp,
+	McNeutrons<t_real_bank>& neutrons, std::size_t iNum, t_real_bank* pWeight,
+	const McRngStream* pRng = nullptr, std::uint64_t iSeqOffs = 0)
+{
+	if(!imp.bOk)
+	{
+		std::fill(pWeight, pWeight+iNum, t_real_bank(1));
+		return;
+	}
+
+	const t_real dSqrtTwoPi = std::sqrt(t_real(2)*tl::get_pi<t_real>());
+	const t_real dNormCond = t_real(1) / (dSqrtTwoPi*imp.dCondSig);
+	const t_real dNormBranch = t_real(1) / (dSqrtTwoPi*imp.dBranchSig);
+	const std::size_t iNumBranches = imp.vecBranchE.size();
+
+	// branch energies at the current Q
+	t_real dBranchE[16];
+	std::vector<t_real> vecBranchE;
+	t_real *pBranchE = dBranchE;
+	if(iNumBranches > sizeof(dBranchE)/sizeof(*dBranchE))
+	{
+		vecBranchE.resize(iNumBranches);
+		pBranchE = vecBranchE.data();
+	}
+
+	for(std::size_t iNeutr=0; iNeutr<iNum; ++iNeutr)
 	{
-		t_vec vecMC = tl::make_vec<t_vec, std::vector>(
-			tl::rand_norm_nd<t_real, std::vector>
-				({0.,0.,0.,0.},
-				{ ell4d.x_hwhm*tl::get_HWHM2SIGMA<t_real>(),
-				ell4d.y_hwhm*tl::get_HWHM2SIGMA<t_real>(),
-				ell4d.z_hwhm*tl::get_HWHM2SIGMA<t_real>(),
-				ell4d.w_hwhm*tl::get_HWHM2SIGMA<t_real>() }));
+		const t_real dQ[3] = { t_real(neutrons.h[iNeutr]) - imp.dQ0[0],
+			t_real(neutrons.k[iNeutr]) - imp.dQ0[1], t_real(neutrons.l[iNeutr]) - imp.dQ0[2] };
+
+		const t_real dCondMean = imp.dE0 + imp.dCondGrad[0]*dQ[0]
+			+ imp.dCondGrad[1]*dQ[1] + imp.dCondGrad[2]*dQ[2];
+		for(std::size_t iBranch=0; iBranch<iNumBranches; ++iBranch)
+		{
+			const t_real *pGrad = imp.vecBranchGrad.data() + 3*iBranch;
+			pBranchE[iBranch] = imp.vecBranchE[iBranch] +
+				pGrad[0]*dQ[0] + pGrad[1]*dQ[1] + pGrad[2]*dQ[2];
+		}
+
+		// mixture choice, branch choice and two numbers for a normal variate
+		t_real dU[4];
+		if(pRng)
+		{
+			pRng->Uniform<t_real>(iSeqOffs+iNeutr, McRngSub::IMPORTANCE, dU);
+		}
+		else
+		{
+			for(int i=0; i<4; ++i)
+				dU[i] = t_real(1) - tl::rand_real<t_real>(t_real(0), t_real(1));
+		}
+
+		// otherwise keep the energy, which is already distributed according to p(E|Q)
+		t_real dE = t_real(neutrons.E[iNeutr]);
+		if(dU[0] < imp.dMix)
+		{
+			// choose a branch according to its weight
+			t_real dRnd = dU[1];
+			std::size_t iBranch = 0;
+			for(; iBranch+1<iNumBranches; ++iBranch)
+			{
+				dRnd -= imp.vecBranchW[iBranch];
+				if(dRnd < t_real(0))
+					break;
+			}
+
+			const t_real dNorm = std::sqrt(t_real(-2) * std::log(dU[2])) *
+				std::cos(t_real(2)*tl::get_pi<t_real>() * dU[3]);
+			// the weight belongs to the energy as stored in the bank
+			neutrons.E[iNeutr] = t_real_bank(pBranchE[iBranch] + imp.dBranchSig*dNorm);
+			dE = t_real(neutrons.E[iNeutr]);
+		}
 
-		vecMC = ublas::prod(rot, vecMC);
-		if(!opts.bCenter)
-			vecMC += vecTrans;
+		// p(E|Q) and the mixture density q(E|Q)
+		const t_real dCondDiff = (dE - dCondMean) / imp.dCondSig;
+		const t_real dP = dNormCond * std::exp(-t_real(0.5)*dCondDiff*dCondDiff);
 
-		if(opts.coords == McNeutronCoords::ANGS)
-			vecMC = ublas::prod(matQVec0, vecMC);
-		else if(opts.coords == McNeutronCoords::RLU)
-			vecMC = ublas::prod(matUBinvQVec0, vecMC);
+		t_real dQBranches = 0;
+		for(std::size_t iBranch=0; iBranch<iNumBranches; ++iBranch)
+		{
+			const t_real dDiff = (dE - pBranchE[iBranch]) / imp.dBranchSig;
+			dQBranches += imp.vecBranchW[iBranch] * std::exp(-t_real(0.5)*dDiff*dDiff);
+		}
 
-		iterResult[iCur] = std::move(vecMC);
+		const t_real dMixture = (t_real(1)-imp.dMix)*dP + imp.dMix*dNormBranch*dQBranches;
+		pWeight[iNeutr] = t_real_bank(dMixture > t_real(0) ? dP/dMixture : t_real(0));
 	}
 }
 
@@ -37,45 +37,23 @@ static const auto cm = tl::get_one_centimeter<t_real>();
 static const t_real sig2fwhm = tl::get_SIGMA2FWHM<t_real>();
 
 
-ResoResults calc_pop(const PopParams& pop)
+/**
+ * collimator covariance matrix G, [pop75], Appendix 1
+ */
+static t_matfix<t_real, 8> get_pop_G(const PopParams& pop)
 {
-	ResoResults res;
-
-	res.Q_avg.resize(4);
-	res.Q_avg[0] = pop.Q * angs;
-	res.Q_avg[1] = 0.;
-	res.Q_avg[2] = 0.;
-	res.Q_avg[3] = pop.E / meV;
-
-
-	length lam = tl::k2lam(pop.ki);
-	angle twotheta = pop.twotheta;
-	angle thetaa = pop.thetaa * pop.dana_sense;
-	angle thetam = pop.thetam * pop.dmono_sense;
-	angle ki_Q = pop.angle_ki_Q;
-	angle kf_Q = pop.angle_kf_Q;
-	//kf_Q = ki_Q + twotheta;
-
-	twotheta *= pop.dsample_sense;
-	ki_Q *= pop.dsample_sense;
-	kf_Q *= pop.dsample_sense;
-
-	// B matrix, [pop75], Appendix 1 -> U matrix in CN
-	t_mat B = get_trafo_dkidkf_dQdE(ki_Q, kf_Q, pop.ki, pop.kf);
-	B.resize(4,6, true);
-
 	angle coll_h_pre_mono = pop.coll_h_pre_mono;
 	angle coll_v_pre_mono = pop.coll_v_pre_mono;
 
 	if(pop.bGuide)
 	{
+		const length lam = tl::k2lam(pop.ki);
 		coll_h_pre_mono = lam*(pop.guide_div_h/angs);
 		coll_v_pre_mono = lam*(pop.guide_div_v/angs);
 	}
 
-
-	// collimator covariance matrix G, [pop75], Appendix 1
-	t_mat G = tl::diag_matrix({
+	const t_real dG[] =
+	{
 		t_real(1)/(coll_h_pre_mono*coll_h_pre_mono /rads/rads),
 		t_real(1)/(pop.coll_h_pre_sample*pop.coll_h_pre_sample /rads/rads),
 
@@ -87,39 +65,34 @@ ResoResults calc_pop(const PopParams& pop)
 
 		t_real(1)/(pop.coll_v_post_sample*pop.coll_v_post_sample /rads/rads),
 		t_real(1)/(pop.coll_v_post_ana*pop.coll_v_post_ana /rads/rads)
-	});
+	};
+
+	return fix_diag(dG);
+}
+
+
+/**
+ * matrices which only depend on the instrument
+ */
+static bool calc_pop_instr(const PopParams& pop, PopPrecalc& pre)
+{
+	pre.bHasG = !pop.bGuide;
+	if(pre.bHasG)
+		pre.G = get_pop_G(pop);
 
 
 	const angle mono_mosaic_spread = pop.mono_mosaic;
 	const angle ana_mosaic_spread = pop.ana_mosaic;
-	const angle sample_mosaic_spread = pop.sample_mosaic;
 
 	// crystal mosaic covariance matrix F, [pop75], Appendix 1
-	t_mat F = tl::diag_matrix(
+	const t_real dF[] =
 	{
 		t_real(1)/(pop.mono_mosaic*pop.mono_mosaic /rads/rads),
 		t_real(1)/(mono_mosaic_spread*mono_mosaic_spread /rads/rads),
 		t_real(1)/(pop.ana_mosaic*pop.ana_mosaic /rads/rads),
 		t_real(1)/(ana_mosaic_spread*ana_mosaic_spread /rads/rads)
-	});
-
-	// C matrix, [pop75], Appendix 1
-	t_mat C = ublas::zero_matrix<t_real>(4,8);
-	C(2,5) = C(2,4) = C(0,1) = C(0,0) = 0.5;
-	C(1,2) = t_real(0.5)/units::sin(thetam);
-	C(1,3) /*C(2,2)*/ = t_real(-0.5)/units::sin(thetam);	// Popovici says C(2,2), not C(1,3)
-	C(3,6) = t_real(0.5)/units::sin(thetaa);
-	C(3,7) = t_real(-0.5)/units::sin(thetaa);
-
-	// A matrix, [pop75], Appendix 1
-	t_mat A = ublas::zero_matrix<t_real>(6,8);
-	A(0,0) = t_real(0.5) * pop.ki*angs * units::cos(thetam)/units::sin(thetam);
-	A(0,1) = t_real(-0.5) * pop.ki*angs * units::cos(thetam)/units::sin(thetam);
-	A(2,3) = A(1,1) = pop.ki * angs;
-	A(3,4) = t_real(0.5) * pop.kf*angs * units::cos(thetaa)/units::sin(thetaa);
-	A(3,5) = t_real(-0.5) * pop.kf*angs * units::cos(thetaa)/units::sin(thetaa);
-	A(5,6) = A(4,4) = pop.kf * angs;
-
+	};
+	pre.F = fix_diag(dF);
 
 
 	// covariance matrix of component geometries, S, [pop75], Appendix 2
@@ -167,43 +140,170 @@ ResoResults calc_pop(const PopParams& pop)
 		dMult * pop.det_h*pop.det_h /cm/cm
 	};
 
-	t_mat SI = tl::diag_matrix({dSiSrc[0], dSiSrc[1],
+	const t_real dSI[] = {dSiSrc[0], dSiSrc[1],
 		dSiMono[0], dSiMono[1], dSiMono[2],
 		dSiSample[0], dSiSample[1], dSiSample[2],
 		dSiAna[0], dSiAna[1], dSiAna[2],
-		dSiDet[0], dSiDet[1]});
+		dSiDet[0], dSiDet[1]};
 
-	SI *= sig2fwhm*sig2fwhm;
+	pre.SI = fix_diag(dSI);
+	pre.SI *= sig2fwhm*sig2fwhm;
 
-	t_mat S;
-	if(!tl::inverse(SI, S))
+	if(!fix_inverse(pre.SI, pre.S))
 	{
-		res.bOk = false;
-		res.strErr = "S matrix cannot be inverted.";
-		return res;
+		pre.strErr = "S matrix cannot be inverted.";
+		return false;
 	}
 
+	pre.dDetS = fix_determinant(pre.S);
+	pre.dDetF = fix_determinant(pre.F);
+	return true;
+}
+
 
-	// --------------------------------------------------------------------
-	// mono/ana focus
-	length mono_curvh = pop.mono_curvh, mono_curvv = pop.mono_curvv;
-	length ana_curvh = pop.ana_curvh, ana_curvv = pop.ana_curvv;
+/**
+ * mono/ana focus
+ */
+static PopArm calc_pop_arm(const angle& theta, const length& dist_pre, const length& dist_post,
+	length curvh, length curvv, bool bCurvedH, bool bCurvedV,
+	bool bOptimallyCurvedH, bool bOptimallyCurvedV, t_real dSense)
+{
+	PopArm arm;
+	arm.dTheta = theta / rads;
+
+	if(bOptimallyCurvedH) curvh = tl::foc_curv(dist_pre, dist_post, units::abs(t_real(2)*theta), false);
+	if(bOptimallyCurvedV) curvv = tl::foc_curv(dist_pre, dist_post, units::abs(t_real(2)*theta), true);
+
+	curvh *= dSense; curvv *= dSense;
+
+	if(bCurvedH) arm.dInvCurvH = cm / curvh;
+	if(bCurvedV) arm.dInvCurvV = cm / curvv;
 
-	if(pop.bMonoIsOptimallyCurvedH) mono_curvh = tl::foc_curv(pop.dist_src_mono, pop.dist_mono_sample, units::abs(t_real(2)*thetam), false);
-	if(pop.bMonoIsOptimallyCurvedV) mono_curvv = tl::foc_curv(pop.dist_src_mono, pop.dist_mono_sample, units::abs(t_real(2)*thetam), true);
-	if(pop.bAnaIsOptimallyCurvedH) ana_curvh = tl::foc_curv(pop.dist_sample_ana, pop.dist_ana_det, units::abs(t_real(2)*thetaa), false);
-	if(pop.bAnaIsOptimallyCurvedV) ana_curvv = tl::foc_curv(pop.dist_sample_ana, pop.dist_ana_det, units::abs(t_real(2)*thetaa), true);
+	arm.bOk = true;
+	return arm;
+}
 
-	mono_curvh *= pop.dmono_sense; mono_curvv *= pop.dmono_sense;
-	ana_curvh *= pop.dana_sense; ana_curvv *= pop.dana_sense;
+static PopArm calc_pop_mono_arm(const PopParams& pop)
+{
+	return calc_pop_arm(pop.thetam * pop.dmono_sense, pop.dist_src_mono, pop.dist_mono_sample,
+		pop.mono_curvh, pop.mono_curvv, pop.bMonoIsCurvedH, pop.bMonoIsCurvedV,
+		pop.bMonoIsOptimallyCurvedH, pop.bMonoIsOptimallyCurvedV, pop.dmono_sense);
+}
 
-	inv_length inv_mono_curvh = t_real(0)/cm, inv_mono_curvv = t_real(0)/cm;
-	inv_length inv_ana_curvh = t_real(0)/cm, inv_ana_curvv = t_real(0)/cm;
+static PopArm calc_pop_ana_arm(const PopParams& pop)
+{
+	return calc_pop_arm(pop.thetaa * pop.dana_sense, pop.dist_sample_ana, pop.dist_ana_det,
+		pop.ana_curvh, pop.ana_curvv, pop.bAnaIsCurvedH, pop.bAnaIsCurvedV,
+		pop.bAnaIsOptimallyCurvedH, pop.bAnaIsOptimallyCurvedV, pop.dana_sense);
+}
 
-	if(pop.bMonoIsCurvedH) inv_mono_curvh = t_real(1)/mono_curvh;
-	if(pop.bMonoIsCurvedV) inv_mono_curvv = t_real(1)/mono_curvv;
-	if(pop.bAnaIsCurvedH) inv_ana_curvh = t_real(1)/ana_curvh;
-	if(pop.bAnaIsCurvedV) inv_ana_curvv = t_real(1)/ana_curvv;
+static bool arm_matches(const PopArm& arm, const angle& theta)
+{
+	return arm.bOk && tl::float_equal<t_real>(arm.dTheta, theta/rads);
+}
+
+
+/**
+ * calculates the instrument matrices if not yet done and the arms
+ * which do not match the current angles
+ */
+bool calc_pop_precalc(const PopParams& pop, PopPrecalc& pre)
+{
+	if(!pre.bOk)
+	{
+		pre.bOk = calc_pop_instr(pop, pre);
+		if(!pre.bOk)
+			return false;
+	}
+
+	if(!arm_matches(pre.mono, pop.thetam * pop.dmono_sense))
+		pre.mono = calc_pop_mono_arm(pop);
+	if(!arm_matches(pre.ana, pop.thetaa * pop.dana_sense))
+		pre.ana = calc_pop_ana_arm(pop);
+
+	return pre.bOk;
+}
+
+
+/**
+ * the instrument matrices and the arms are taken from pPre if available, see calc_pop_precalc
+ */
+ResoResults calc_pop(const PopParams& pop, const PopPrecalc* pPre)
+{
+	ResoResults res;
+
+	res.Q_avg.resize(4);
+	res.Q_avg[0] = pop.Q * angs;
+	res.Q_avg[1] = 0.;
+	res.Q_avg[2] = 0.;
+	res.Q_avg[3] = pop.E / meV;
+
+
+	angle twotheta = pop.twotheta;
+	angle thetaa = pop.thetaa * pop.dana_sense;
+	angle thetam = pop.thetam * pop.dmono_sense;
+	angle ki_Q = pop.angle_ki_Q;
+	angle kf_Q = pop.angle_kf_Q;
+	//kf_Q = ki_Q + twotheta;
+
+	twotheta *= pop.dsample_sense;
+	ki_Q *= pop.dsample_sense;
+	kf_Q *= pop.dsample_sense;
+
+	// B matrix, [pop75], Appendix 1 -> U matrix in CN
+	const t_matfix<t_real, 6> U = get_trafo_dkidkf_dQdE(ki_Q, kf_Q, pop.ki, pop.kf);
+	t_matfix<t_real, 4, 6> B;
+	for(std::size_t i=0; i<4; ++i)
+		for(std::size_t j=0; j<6; ++j)
+			B(i,j) = U(i,j);
+
+
+	// instrument matrices G, F, S
+	PopPrecalc preCur;
+	if(!pPre || !pPre->bOk)
+	{
+		if(!calc_pop_instr(pop, preCur))
+		{
+			res.bOk = false;
+			res.strErr = preCur.strErr;
+			return res;
+		}
+		pPre = &preCur;
+	}
+
+	t_matfix<t_real, 8> matG;
+	const t_matfix<t_real, 8>& G = pPre->bHasG ? pPre->G : (matG = get_pop_G(pop));
+	const t_matfix<t_real, 4>& F = pPre->F;
+	const t_matfix<t_real, 13>& SI = pPre->SI;
+	const t_matfix<t_real, 13>& S = pPre->S;
+	const angle sample_mosaic_spread = pop.sample_mosaic;
+
+
+	// C matrix, [pop75], Appendix 1
+	t_matfix<t_real, 4, 8> C = fix_zero<t_real, 4, 8>();
+	C(2,5) = C(2,4) = C(0,1) = C(0,0) = 0.5;
+	C(1,2) = t_real(0.5)/units::sin(thetam);
+	C(1,3) /*C(2,2)*/ = t_real(-0.5)/units::sin(thetam);	// Popovici says C(2,2), not C(1,3)
+	C(3,6) = t_real(0.5)/units::sin(thetaa);
+	C(3,7) = t_real(-0.5)/units::sin(thetaa);
+
+	// A matrix, [pop75], Appendix 1
+	t_matfix<t_real, 6, 8> A = fix_zero<t_real, 6, 8>();
+	A(0,0) = t_real(0.5) * pop.ki*angs * units::cos(thetam)/units::sin(thetam);
+	A(0,1) = t_real(-0.5) * pop.ki*angs * units::cos(thetam)/units::sin(thetam);
+	A(2,3) = A(1,1) = pop.ki * angs;
+	A(3,4) = t_real(0.5) * pop.kf*angs * units::cos(thetaa)/units::sin(thetaa);
+	A(3,5) = t_real(-0.5) * pop.kf*angs * units::cos(thetaa)/units::sin(thetaa);
+	A(5,6) = A(4,4) = pop.kf * angs;
+
+
+	// --------------------------------------------------------------------
+	// mono/ana focus
+	const PopArm armMono = arm_matches(pPre->mono, thetam) ? pPre->mono : calc_pop_mono_arm(pop);
+	const PopArm armAna = arm_matches(pPre->ana, thetaa) ? pPre->ana : calc_pop_ana_arm(pop);
+
+	const inv_length inv_mono_curvh = armMono.dInvCurvH / cm, inv_mono_curvv = armMono.dInvCurvV / cm;
+	const inv_length inv_ana_curvh = armAna.dInvCurvH / cm, inv_ana_curvv = armAna.dInvCurvV / cm;
 
 
 	const auto tupScFact = get_scatter_factors(pop.flags, pop.thetam, pop.ki, pop.thetaa, pop.kf);
@@ -213,16 +313,16 @@ ResoResults calc_pop(const PopParams& pop)
 	t_real dxsec = std::get<2>(tupScFact);
 
 
-	//if(pop.bMonoIsCurvedH) tl::log_debug("mono curv h: ", mono_curvh);
-	//if(pop.bMonoIsCurvedV) tl::log_debug("mono curv v: ", mono_curvv);
-	//if(pop.bAnaIsCurvedH) tl::log_debug("ana curv h: ", ana_curvh);
-	//if(pop.bAnaIsCurvedV) tl::log_debug("ana curv v: ", ana_curvv);
+	//if(pop.bMonoIsCurvedH) tl::log_debug("mono curv h: ", t_real(1)/inv_mono_curvh);
+	//if(pop.bMonoIsCurvedV) tl::log_debug("mono curv v: ", t_real(1)/inv_mono_curvv);
+	//if(pop.bAnaIsCurvedH) tl::log_debug("ana curv h: ", t_real(1)/inv_ana_curvh);
+	//if(pop.bAnaIsCurvedV) tl::log_debug("ana curv v: ", t_real(1)/inv_ana_curvv);
 	// --------------------------------------------------------------------
 
 
 
 	// T matrix to transform the mosaic cov. matrix, [pop75], Appendix 2
-	t_mat T = ublas::zero_matrix<t_real>(4,13);
+	t_matfix<t_real, 4, 13> T = fix_zero<t_real, 4, 13>();
 	T(0,0) = t_real(-0.5) / (pop.dist_src_mono / cm);
 	T(0,2) = t_real(0.5) * units::cos(thetam) *
 		(t_real(1)/(pop.dist_mono_sample/cm) - t_real(1)/(pop.dist_src_mono/cm));
@@ -255,7 +355,7 @@ ResoResults calc_pop(const PopParams& pop)
 
 
 	// D matrix to transform the spatial and the mosaic cov. matrices, [pop75], Appendix 2
-	t_mat D = ublas::zero_matrix<t_real>(8,13);
+	t_matfix<t_real, 8, 13> D = fix_zero<t_real, 8, 13>();
 	D(0,0) = t_real(-1) / (pop.dist_src_mono/cm);
 	D(0,2) = -cos(thetam) / (pop.dist_src_mono/cm);
 	D(0,3) = sin(thetam) / (pop.dist_src_mono/cm);
@@ -281,42 +381,42 @@ ResoResults calc_pop(const PopParams& pop)
 
 
 	// [pop75], equ. 20
-	t_mat M0 = S + tl::transform(F, T, 1);
-	t_mat M0i;
-	if(!tl::inverse(M0, M0i))
+	const t_matfix<t_real, 13> M0 = S + fix_transform(F, T);
+	t_matfix<t_real, 13> M0i;
+	if(!fix_inverse(M0, M0i))
 	{
 		res.bOk = false;
 		res.strErr = "Matrix M0 cannot be inverted.";
 		return res;
 	}
 
-	t_mat M1 = tl::transform_inv(M0i, D, 1);
-	t_mat M1i;
-	if(!tl::inverse(M1, M1i))
+	const t_matfix<t_real, 8> M1 = fix_transform_inv(M0i, D);
+	t_matfix<t_real, 8> M1i;
+	if(!fix_inverse(M1, M1i))
 	{
 		res.bOk = false;
 		res.strErr = "Matrix M1 cannot be inverted.";
 		return res;
 	}
 
-	t_mat M2 = M1i + G;
-	t_mat M2i;
-	if(!tl::inverse(M2, M2i))
+	const t_matfix<t_real, 8> M2 = M1i + G;
+	t_matfix<t_real, 8> M2i;
+	if(!fix_inverse(M2, M2i))
 	{
 		res.bOk = false;
 		res.strErr = "Matrix M2 cannot be inverted.";
 		return res;
 	}
 
-	t_mat BA = ublas::prod(B,A);
-	t_mat ABt = ublas::prod(ublas::trans(A), ublas::trans(B));
-	t_mat M2iABt = ublas::prod(M2i, ABt);
-	t_mat MI = ublas::prod(BA, M2iABt);
+	// BA M2i (BA)^T
+	const t_matfix<t_real, 4, 8> BA = fix_prod(B, A);
+	t_matfix<t_real, 4> MI = fix_transform_inv(M2i, BA);
 
 	MI(1,1) += pop.Q*pop.Q*angs*angs * pop.sample_mosaic*pop.sample_mosaic /rads/rads;
 	MI(2,2) += pop.Q*pop.Q*angs*angs * sample_mosaic_spread*sample_mosaic_spread /rads/rads;
 
-	if(!tl::inverse(MI, res.reso))
+	t_matfix<t_real, 4> reso;
+	if(!fix_inverse(MI, reso))
 	{
 		res.bOk = false;
 		res.strErr = "Covariance matrix cannot be inverted.";
@@ -327,18 +427,22 @@ ResoResults calc_pop(const PopParams& pop)
 	// -------------------------------------------------------------------------
 
 
-	res.reso *= sig2fwhm*sig2fwhm;
-	res.reso_v = ublas::zero_vector<t_real>(4);
-	res.reso_s = 0.;
+	reso *= sig2fwhm*sig2fwhm;
 
 	if(pop.dsample_sense < 0.)
 	{
 		// mirror Q_perp
-		t_mat matMirror = tl::mirror_matrix<t_mat>(res.reso.size1(), 1);
-		res.reso = tl::transform(res.reso, matMirror, true);
-		res.reso_v[1] = -res.reso_v[1];
+		for(std::size_t i=0; i<4; ++i)
+		{
+			if(i == 1) continue;
+			reso(1,i) = reso(i,1) = -reso(i,1);
+		}
 	}
 
+	res.reso = fix_to_dyn(reso);
+	res.reso_v = ublas::zero_vector<t_real>(4);
+	res.reso_s = 0.;
+
 
 	res.dResVol = tl::get_ellipsoid_volume(res.reso);
 	res.dR0 = 0.;
@@ -347,9 +451,9 @@ ResoResults calc_pop(const PopParams& pop)
 	{
 		// resolution volume, [pop75], equ. 13a & 16
 		// [D] = 1/cm, [SI] = cm^2
-		t_mat DSiDt = tl::transform_inv(SI, D, 1);
-		t_mat DSiDti;
-		if(!tl::inverse(DSiDt, DSiDti))
+		const t_matfix<t_real, 8> DSiDt = fix_transform_inv(SI, D);
+		t_matfix<t_real, 8> DSiDti;
+		if(!fix_inverse(DSiDt, DSiDti))
 		{
 			res.bOk = false;
 			res.strErr = "Resolution volume cannot be calculated.";
@@ -358,15 +462,15 @@ ResoResults calc_pop(const PopParams& pop)
 		DSiDti += G;
 		t_real dP0 = dmono_refl*dana_effic *
 			t_real((2.*pi)*(2.*pi)*(2.*pi)*(2.*pi)) /
-			std::sqrt(tl::determinant(DSiDti));
+			std::sqrt(fix_determinant(DSiDti));
 		dP0 *= dxsec;
 
 		// [T] = 1/cm, [F] = 1/rad^2, [pop75], equ. 15
-		t_mat K = S + tl::transform(F, T, 1);
+		const t_matfix<t_real, 13>& K = M0;
 
-		t_real dDetS = tl::determinant(S);
-		t_real dDetF = tl::determinant(F);
-		t_real dDetK = tl::determinant(K);
+		t_real dDetS = pPre->dDetS;
+		t_real dDetF = pPre->dDetF;
+		t_real dDetK = fix_determinant(K);
 
 		// [pop75], equ. 16
 		res.dR0 = dP0 / (t_real(8.*pi*8.*pi) * units::sin(thetam)*units::sin(thetaa));
@@ -14,6 +14,7 @@
 #define __TAKIN_POP_H__
 
 #include "cn.h"
+#include <string>
 
 /**
  * TAS parameters in fwhm
@@ -62,6 +63,35 @@ struct PopParams : public CNParams
 };
 
 
-extern ResoResults calc_pop(const PopParams& pop);
+/**
+ * focusing of the mono or ana arm, only depends on the instrument and the crystal angle
+ */
+struct PopArm
+{
+	bool bOk = false;
+	t_real_reso dTheta = 0;				// calculated for the signed angle (rad)
+	t_real_reso dInvCurvH = 0, dInvCurvV = 0;	// inverse curvatures (1/cm)
+};
+
+/**
+ * instrument-invariant matrices of [pop75], Appendices 1 & 2, and the arms
+ */
+struct PopPrecalc
+{
+	bool bOk = false;
+	std::string strErr;
+
+	// the collimator matrix is k-dependent with a guide
+	bool bHasG = false;
+	t_matfix<t_real_reso, 8> G;
+	t_matfix<t_real_reso, 4> F;
+	t_matfix<t_real_reso, 13> SI, S;
+	t_real_reso dDetS = 0, dDetF = 0;
+
+	PopArm mono, ana;
+};
+
+extern bool calc_pop_precalc(const PopParams& pop, PopPrecalc& pre);
+extern ResoResults calc_pop(const PopParams& pop, const PopPrecalc* pPre = nullptr);
 
 #endif
@@ -0,0 +1,124 @@
+/**
+ * analytic convolution of dispersion lines with a resolution ellipsoid
+ * @author agent <agent@local>
+ * @license GPLv2
+ */
+
+// gcc -O2 -I../.. -o tst_analytic tst_analytic.cpp ../../tlibs/math/rand.cpp ../../tlibs/log/log.cpp -lstdc++ -lm -std=c++11
+
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <cmath>
+#include "tools/res/ellipse.h"
+#include "tools/res/analytic.h"
+
+using t_real = double;
+using t_mat = ublas::matrix<t_real>;
+
+
+// sine-shaped phonon branches around (100) with gaussian and lorentzian line widths
+static const t_real g_dAmp = 20., g_dFreq = 1.5, g_dSig = 0.1, g_dHWHM = 0.15;
+
+static bool lines(t_real h, t_real k, t_real l, std::vector<t_real>& vecE, std::vector<t_real>& vecW,
+	t_real& dSigma, t_real& dHWHM)
+{
+	const t_real dq = std::sqrt((h-1.)*(h-1.) + k*k + l*l);
+	vecE = { g_dAmp*std::sin(dq*g_dFreq), -g_dAmp*std::sin(dq*g_dFreq) };
+	vecW = { 1., 0.5 };
+	dSigma = g_dSig;
+	dHWHM = g_dHWHM;
+	return true;
+}
+
+
+int main()
+{
+	// faddeeva function on the imaginary axis: w(iy) = exp(y^2) erfc(y)
+	t_real dMaxW = 0.;
+	for(t_real y : { 0.01, 0.5, 1., 3., 10. })
+	{
+		const t_real dExact = std::exp(y*y) * std::erfc(y);
+		dMaxW = std::max(dMaxW, std::abs(faddeeva<t_real>(std::complex<t_real>(0., y)).real() - dExact) / dExact);
+	}
+
+	// voigt profile against the numerical convolution of a gaussian and a lorentzian
+	t_real dMaxV = 0.;
+	for(t_real x=-2.; x<=2.; x+=0.37)
+	{
+		const t_real dStep = 1e-3;
+		t_real dNum = 0.;
+		for(t_real u=-40.; u<40.; u+=dStep)
+			dNum += dStep * voigt_profile<t_real>(u, 0.3, 0.) * voigt_profile<t_real>(x-u, 0., 0.2);
+		dMaxV = std::max(dMaxV, std::abs(dNum - voigt_profile<t_real>(x, 0.3, 0.2)));
+	}
+
+	std::cout << "# faddeeva: " << dMaxW << ", voigt: " << dMaxV << std::endl;
+	bool bOk = (dMaxW < 1e-12 && dMaxV < 1e-8);
+
+
+	Ellipsoid4d<t_real> ell4d;
+	ell4d.rot = tl::unit_matrix<t_mat>(4);
+	ell4d.rot(0,0) = ell4d.rot(3,3) = std::cos(0.05);
+	ell4d.rot(0,3) = -std::sin(0.05);
+	ell4d.rot(3,0) = std::sin(0.05);
+	ell4d.x_hwhm = 0.02; ell4d.y_hwhm = 0.03; ell4d.z_hwhm = 0.01; ell4d.w_hwhm = 0.5;
+	ell4d.x_offs = 1.3; ell4d.y_offs = ell4d.z_offs = 0.;
+
+	McNeutronOpts<t_mat> opts;
+	opts.coords = McNeutronCoords::DIRECT;
+	opts.bCenter = 0;
+	opts.dAngleQVec0 = 0.;
+
+	// scan over the phonon at E ~ 8.7 meV against mc neutrons
+	std::cout << "# E           analytic        mc              rel. diff\n";
+	std::mt19937 rng(1234);
+	std::normal_distribution<t_real> dist(0., 1.);
+	for(t_real dE : { 7., 8., 8.7, 9.5, 10. })
+	{
+		ell4d.w_offs = dE;
+
+		t_real dS = 0., dPos[4];
+		if(!analytic_convo<t_mat>(ell4d, opts, lines, 0.1, dS, dPos))
+		{
+			std::cout << "# analytic convolution not applicable at E = " << dE << std::endl;
+			bOk = false;
+			continue;
+		}
+
+		t_real dMat[4][4], dTrans[4];
+		mc_neutron_trafo<t_mat>(ell4d, opts, dMat, dTrans);
+
+		const std::size_t iNum = 1000000;
+		t_real dSum = 0.;
+		for(std::size_t iNeutr=0; iNeutr<iNum; ++iNeutr)
+		{
+			const t_real z[4] = { dist(rng), dist(rng), dist(rng), dist(rng) };
+			t_real x[4];
+			for(int i=0; i<4; ++i)
+				x[i] = dTrans[i] + dMat[i][0]*z[0] + dMat[i][1]*z[1] + dMat[i][2]*z[2] + dMat[i][3]*z[3];
+
+			std::vector<t_real> vecE, vecW;
+			t_real dSig, dHWHM;
+			lines(x[0], x[1], x[2], vecE, vecW, dSig, dHWHM);
+			for(std::size_t iBranch=0; iBranch<vecE.size(); ++iBranch)
+				dSum += vecW[iBranch] * voigt_profile<t_real>(x[3]-vecE[iBranch], dSig, dHWHM);
+		}
+		const t_real dMC = dSum / t_real(iNum);
+		const t_real dDiff = std::abs(dS - dMC) / dMC;
+
+		std::cout << std::left << std::setw(14) << dE << std::setw(16) << dS
+			<< std::setw(16) << dMC << std::setw(16) << dDiff << std::endl;
+		if(dDiff > 0.03)
+			bOk = false;
+	}
+
+	// the kink of the branches at the bragg peak is not linear over the ellipsoid
+	ell4d.x_offs = 1.;
+	t_real dS = 0., dPos[4];
+	if(analytic_convo<t_mat>(ell4d, opts, lines, 0.1, dS, dPos))
+		bOk = false;
+
+	std::cout << (bOk ? "# OK" : "# FAILED") << std::endl;
+	return bOk ? 0 : -1;
+}
@@ -0,0 +1,92 @@
+/**
+ * gauss-hermite cubature over a resolution ellipsoid
+ * @author agent <agent@local>
+ * @license GPLv2
+ */
+
+// gcc -O2 -I../.. -o tst_cubature tst_cubature.cpp ../../tlibs/math/rand.cpp ../../tlibs/log/log.cpp -lstdc++ -lm -std=c++11
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include "tools/res/ellipse.h"
+#include "tools/res/cubature.h"
+
+using t_real = double;
+using t_vec = ublas::vector<t_real>;
+using t_mat = ublas::matrix<t_real>;
+
+
+// smooth test model: exp(-sum_i c_i x_i^2)
+static const t_real g_dC[4] = { 0.5, 1.0, 2.0, 0.25 };
+
+static t_real model(t_real h, t_real k, t_real l, t_real E)
+{
+	return std::exp(-(g_dC[0]*h*h + g_dC[1]*k*k + g_dC[2]*l*l + g_dC[3]*E*E));
+}
+
+
+int main()
+{
+	// moments of the 1d rules: sum w = 1, sum w x^2 = 1, sum w x^4 = 3
+	std::cout << "# order, sum w, sum w x^2, sum w x^4\n";
+	for(unsigned iOrder : { 1u, 2u, 3u, 5u, 10u, 20u })
+	{
+		std::vector<t_real> vecX, vecW;
+		gauss_hermite<t_real>(iOrder, vecX, vecW);
+
+		t_real dMom[3] = { 0., 0., 0. };
+		for(unsigned i=0; i<iOrder; ++i)
+		{
+			dMom[0] += vecW[i];
+			dMom[1] += vecW[i]*vecX[i]*vecX[i];
+			dMom[2] += vecW[i]*vecX[i]*vecX[i]*vecX[i]*vecX[i];
+		}
+
+		std::cout << std::left << std::setw(8) << iOrder
+			<< std::setw(16) << dMom[0] << std::setw(16) << dMom[1]
+			<< std::setw(16) << dMom[2] << "\n";
+	}
+
+
+	Ellipsoid4d<t_real> ell4d;
+	ell4d.rot = tl::unit_matrix<t_mat>(4);
+	ell4d.x_hwhm = 0.5; ell4d.y_hwhm = 0.25; ell4d.z_hwhm = 0.75; ell4d.w_hwhm = 1.;
+	ell4d.x_offs = ell4d.y_offs = ell4d.z_offs = ell4d.w_offs = 0.;
+
+	// analytic convolution: prod_i 1/sqrt(1 + 2 c_i sigma_i^2)
+	const t_real dHwhm[4] = { ell4d.x_hwhm, ell4d.y_hwhm, ell4d.z_hwhm, ell4d.w_hwhm };
+	t_real dExact = 1.;
+	for(int i=0; i<4; ++i)
+	{
+		t_real dSig = dHwhm[i] * tl::get_HWHM2SIGMA<t_real>();
+		dExact /= std::sqrt(1. + 2.*g_dC[i]*dSig*dSig);
+	}
+
+	McNeutronOpts<t_mat> opts;
+	opts.coords = McNeutronCoords::DIRECT;
+	opts.bCenter = 1;
+	opts.dAngleQVec0 = 0.;
+
+	std::cout << "\n# exact value: " << dExact << "\n";
+	std::cout << std::left << std::setw(8) << "# order" << std::setw(12) << "nodes"
+		<< std::setw(16) << "error" << "\n";
+
+	McNeutrons<t_real> nodes;
+	std::vector<t_real> vecWeights;
+	for(unsigned iOrder=1; iOrder<=9; ++iOrder)
+	{
+		const unsigned iOrders[4] = { iOrder, iOrder, iOrder, iOrder };
+		std::size_t iNum = cubature_neutrons<t_vec, t_mat>(ell4d, iOrders, opts, nodes, vecWeights);
+
+		t_real dS = 0.;
+		for(std::size_t iNode=0; iNode<iNum; ++iNode)
+			dS += vecWeights[iNode] * model(nodes.h[iNode], nodes.k[iNode],
+				nodes.l[iNode], nodes.E[iNode]);
+
+		std::cout << std::left << std::setw(8) << iOrder << std::setw(12) << iNum
+			<< std::setw(16) << (dS-dExact) << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,127 @@
+/**
+ * symmetric eigensolvers for the resolution ellipsoids
+ * @author agent <agent@local>
+ * @license GPLv2
+ */
+
+// gcc -O2 -I../.. -o tst_eigen tst_eigen.cpp -lstdc++ -lm -std=c++11
+
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include "tools/res/fixmat.h"
+
+using t_real = double;
+
+
+/**
+ * checks A v_i = ev_i v_i, orthonormality, the ordering and the handedness,
+ * returns the largest residual
+ */
+template<std::size_t N>
+static t_real check(const t_matfix<t_real, N, N>& A, bool bJacobi=false)
+{
+	t_matfix<t_real, N, N> evecs;
+	t_real evals[N];
+	bool bOk = bJacobi ? fix_eigenvec_sym_jacobi(A, evecs, evals) : fix_eigenvec_sym(A, evecs, evals);
+	if(!bOk)
+		return std::numeric_limits<t_real>::infinity();
+
+	t_real dNorm = 1.;
+	for(std::size_t i=0; i<N; ++i)
+		for(std::size_t j=0; j<N; ++j)
+			dNorm = std::max(dNorm, std::abs(A(i,j)));
+
+	t_real dMax = 0.;
+	const t_matfix<t_real, N, N> AV = fix_prod(A, evecs);
+	for(std::size_t i=0; i<N; ++i)
+	{
+		for(std::size_t k=0; k<N; ++k)
+			dMax = std::max(dMax, std::abs(AV(k,i) - evals[i]*evecs(k,i)) / dNorm);
+
+		for(std::size_t j=0; j<N; ++j)
+		{
+			t_real dDot = 0.;
+			for(std::size_t k=0; k<N; ++k)
+				dDot += evecs(k,i)*evecs(k,j);
+			dMax = std::max(dMax, std::abs(dDot - (i==j ? 1. : 0.)));
+		}
+
+		if(i>0 && evals[i] < evals[i-1])
+			return std::numeric_limits<t_real>::infinity();
+	}
+
+	if(fix_determinant(evecs) < 0.)
+		return std::numeric_limits<t_real>::infinity();
+
+	return dMax;
+}
+
+
+template<std::size_t N>
+static bool test(std::mt19937& rng)
+{
+	std::uniform_real_distribution<t_real> dist(-1., 1.);
+	t_real dMax = 0., dMaxJacobi = 0.;
+
+	for(int iIter=0; iIter<1000; ++iIter)
+	{
+		// random symmetric matrices, including ones with very different scales
+		const t_real dScale = std::pow(10., t_real(iIter%7) - 3.);
+		t_matfix<t_real, N, N> A;
+		for(std::size_t i=0; i<N; ++i)
+			for(std::size_t j=i; j<N; ++j)
+				A(i,j) = A(j,i) = dist(rng) * dScale;
+
+		dMax = std::max(dMax, check<N>(A));
+		dMaxJacobi = std::max(dMaxJacobi, check<N>(A, true));
+	}
+
+	// degenerate cases: zero, unit, diagonal and rotated matrices with repeated eigenvalues
+	t_matfix<t_real, N, N> A0 = fix_zero<t_real, N, N>(), A1 = fix_unit<t_real, N>();
+	dMax = std::max(dMax, check<N>(A0));
+	dMax = std::max(dMax, check<N>(A1));
+
+	t_real dDiag[N];
+	for(std::size_t i=0; i<N; ++i)
+		dDiag[i] = t_real(N-i);
+	dMax = std::max(dMax, check<N>(fix_diag(dDiag)));
+
+	dDiag[0] = dDiag[1];
+	t_matfix<t_real, N, N> rot = fix_unit<t_real, N>();
+	rot(0,0) = rot(N-1,N-1) = std::cos(0.3);
+	rot(0,N-1) = -std::sin(0.3);
+	rot(N-1,0) = std::sin(0.3);
+	dMax = std::max(dMax, check<N>(fix_transform(fix_diag(dDiag), rot)));
+
+	const bool bOk = dMax < 1e-10 && dMaxJacobi < 1e-10;
+	std::cout << std::left << std::setw(8) << N << std::setw(16) << dMax
+		<< std::setw(16) << dMaxJacobi << (bOk ? "ok" : "failed") << std::endl;
+	return bOk;
+}
+
+
+int main()
+{
+	std::mt19937 rng(1234);
+	bool bOk = true;
+
+	std::cout << "# N     residual        jacobi\n";
+	bOk = test<2>(rng) && bOk;
+	bOk = test<3>(rng) && bOk;
+	bOk = test<4>(rng) && bOk;
+
+	// eigenvalues of a known 3x3 matrix: 1, 2, 4
+	t_matfix<t_real, 3, 3> A = fix_zero<t_real, 3, 3>();
+	A(0,0) = 3.; A(0,1) = A(1,0) = 1.;
+	A(1,1) = 3.; A(2,2) = 1.;
+	t_matfix<t_real, 3, 3> evecs;
+	t_real evals[3];
+	fix_eigenvec_sym(A, evecs, evals);
+	std::cout << "# eigenvalues: " << evals[0] << ", " << evals[1] << ", " << evals[2] << std::endl;
+	if(std::abs(evals[0]-1.) > 1e-12 || std::abs(evals[1]-2.) > 1e-12 || std::abs(evals[2]-4.) > 1e-12)
+		bOk = false;
+
+	std::cout << (bOk ? "# OK" : "# FAILED") << std::endl;
+	return bOk ? 0 : -1;
+}
@@ -0,0 +1,118 @@
+/**
+ * fixed-size matrix kernels of the resolution algorithms
+ * @author agent <agent@local>
+ * @license GPLv2
+ */
+
+// gcc -O2 -I../.. -o tst_fixmat tst_fixmat.cpp -lstdc++ -lm -std=c++11
+
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <boost/numeric/ublas/lu.hpp>
+#include "tools/res/fixmat.h"
+
+using t_real = double;
+using t_mat = ublas::matrix<t_real>;
+
+
+// reference inverse and determinant via ublas' lu decomposition
+static bool ref_inverse(const t_mat& mat, t_mat& matInv, t_real& dDet)
+{
+	t_mat lu = mat;
+	ublas::permutation_matrix<std::size_t> perm(mat.size1());
+	if(ublas::lu_factorize(lu, perm) != 0)
+		return false;
+
+	dDet = 1.;
+	for(std::size_t i=0; i<lu.size1(); ++i)
+	{
+		dDet *= lu(i,i);
+		if(perm(i) != i)
+			dDet = -dDet;
+	}
+
+	matInv = ublas::identity_matrix<t_real>(mat.size1());
+	ublas::lu_substitute(lu, perm, matInv);
+	return true;
+}
+
+template<std::size_t N>
+static t_real max_diff(const t_matfix<t_real, N, N>& mat, const t_mat& matRef)
+{
+	t_real dMax = 0.;
+	for(std::size_t i=0; i<N; ++i)
+		for(std::size_t j=0; j<N; ++j)
+			dMax = std::max(dMax, std::abs(mat(i,j) - matRef(i,j)));
+	return dMax;
+}
+
+template<std::size_t N>
+static bool test(std::mt19937& rng)
+{
+	std::uniform_real_distribution<t_real> dist(-1., 1.);
+	bool bOk = true;
+
+	for(int iIter=0; iIter<100; ++iIter)
+	{
+		// random, diagonally dominant matrix
+		t_matfix<t_real, N, N> mat;
+		for(std::size_t i=0; i<N; ++i)
+			for(std::size_t j=0; j<N; ++j)
+				mat(i,j) = dist(rng) + (i==j ? t_real(N) : 0.);
+
+		t_mat matRefInv; t_real dRefDet;
+		ref_inverse(fix_to_dyn(mat), matRefInv, dRefDet);
+
+		t_matfix<t_real, N, N> matInv;
+		if(!fix_inverse(mat, matInv))
+			bOk = false;
+		const t_real dInvDiff = max_diff<N>(matInv, matRefInv);
+		const t_real dDetDiff = std::abs(fix_determinant(mat) - dRefDet) / std::abs(dRefDet);
+
+		// congruence transformations against the plain products
+		t_matfix<t_real, N, N> matSym = fix_prod(mat, t_matfix<t_real, N, N>(ublas::trans(mat)));
+		t_mat matTrafo = ublas::prod(ublas::trans(fix_to_dyn(mat)), t_mat(ublas::prod(fix_to_dyn(matSym), fix_to_dyn(mat))));
+		t_mat matTrafoInv = ublas::prod(fix_to_dyn(mat), t_mat(ublas::prod(fix_to_dyn(matSym), ublas::trans(fix_to_dyn(mat)))));
+		const t_real dTrafoDiff = std::max(max_diff<N>(fix_transform(matSym, mat), matTrafo),
+			max_diff<N>(fix_transform_inv(matSym, mat), matTrafoInv));
+
+		if(dInvDiff > 1e-10 || dDetDiff > 1e-10 || dTrafoDiff > 1e-10)
+		{
+			std::cout << "# N = " << N << ", inverse: " << dInvDiff << ", determinant: " << dDetDiff
+				<< ", transformation: " << dTrafoDiff << std::endl;
+			bOk = false;
+		}
+	}
+
+	// singular matrix
+	t_matfix<t_real, N, N> matSing = fix_zero<t_real, N, N>(), matInv;
+	if(fix_inverse(matSing, matInv) || fix_determinant(matSing) != 0.)
+		bOk = false;
+
+	std::cout << std::left << std::setw(8) << N << (bOk ? "ok" : "failed") << std::endl;
+	return bOk;
+}
+
+
+int main()
+{
+	std::mt19937 rng(1234);
+	bool bOk = true;
+
+	std::cout << "# N     result\n";
+	bOk = test<3>(rng) && bOk;
+	bOk = test<4>(rng) && bOk;
+	bOk = test<6>(rng) && bOk;
+	bOk = test<8>(rng) && bOk;
+	bOk = test<13>(rng) && bOk;
+
+	// gaussian integration of a diagonal quadric only drops the row and column
+	t_real dDiag[4] = { 1., 2., 3., 4. };
+	t_matfix<t_real, 3, 3> matInt = fix_gauss_int(fix_diag(dDiag), 1);
+	if(matInt(0,0) != 1. || matInt(1,1) != 3. || matInt(2,2) != 4.)
+		bOk = false;
+
+	std::cout << (bOk ? "# OK" : "# FAILED") << std::endl;
+	return bOk ? 0 : -1;
+}
@@ -0,0 +1,111 @@
+/**
+ * compares single- and double-precision mc convolutions
+ * @author agent <agent@local>
+ * @license GPLv2
+ */
+
+// gcc -O2 -I../.. -o tst_float tst_float.cpp ../../tlibs/math/rand.cpp ../../tlibs/log/log.cpp -lstdc++ -lm -std=c++11
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include "tlibs/math/rand.h"
+#include "tools/res/ellipse.h"
+#include "tools/res/mc.h"
+
+using t_real = double;
+using t_vec = ublas::vector<t_real>;
+using t_mat = ublas::matrix<t_real>;
+
+
+// test model: damped dispersion branch E(q) = +-a*|sin(f*q)| around a bragg peak
+template<class T>
+T model(T h, T k, T l, T E)
+{
+	const T dq = std::sqrt((h-T(1))*(h-T(1)) + k*k + l*l);
+	const T dE0 = T(20)*std::abs(std::sin(T(1.5)*dq));
+	const T dHWHM = T(0.5);
+
+	T dS = 0;
+	for(T dBranch : { dE0, -dE0 })
+		dS += dHWHM / ((E-dBranch)*(E-dBranch) + dHWHM*dHWHM);
+	return dS;
+}
+
+
+/**
+ * mc convolution in precision t_real_bank with double accumulators,
+ * returns the mean and its statistical error
+ */
+template<class t_real_bank>
+void convo(const Ellipsoid4d<t_real>& ell4d, const McNeutronOpts<t_mat>& opts,
+	const McRngStream& rng, std::size_t iNum, t_real& dMean, t_real& dErr)
+{
+	McNeutrons<t_real_bank> neutrons;
+	neutrons.resize(iNum);
+	mc_neutrons<t_vec>(ell4d, iNum, opts, neutrons, 0, 0, &rng);
+
+	t_real dSum = 0., dSum2 = 0.;
+	for(std::size_t iNeutr=0; iNeutr<iNum; ++iNeutr)
+	{
+		t_real dS = t_real(model<t_real_bank>(neutrons.h[iNeutr], neutrons.k[iNeutr],
+			neutrons.l[iNeutr], neutrons.E[iNeutr]));
+		dSum += dS;
+		dSum2 += dS*dS;
+	}
+
+	dMean = dSum / t_real(iNum);
+	dErr = std::sqrt(std::max(dSum2/t_real(iNum) - dMean*dMean, t_real(0)) / t_real(iNum));
+}
+
+
+int main()
+{
+	// resolution ellipsoid near (1.1 0 0), 3 meV
+	Ellipsoid4d<t_real> ell4d;
+	ell4d.rot = tl::unit_matrix<t_mat>(4);
+	ell4d.x_hwhm = 0.02; ell4d.y_hwhm = 0.01; ell4d.z_hwhm = 0.03; ell4d.w_hwhm = 0.5;
+	ell4d.x_offs = 1.1; ell4d.y_offs = 0.; ell4d.z_offs = 0.; ell4d.w_offs = 3.;
+
+	McNeutronOpts<t_mat> opts;
+	opts.coords = McNeutronCoords::DIRECT;
+	opts.bCenter = 0;
+	opts.dAngleQVec0 = 0.;
+
+	std::cout << "# same random numbers in both precisions\n";
+	std::cout << std::left << std::setw(10) << "# sampler" << std::setw(10) << "N"
+		<< std::setw(16) << "S (double)" << std::setw(16) << "S (float)"
+		<< std::setw(16) << "mc error" << std::setw(16) << "diff/error" << "\n";
+
+	const char* pcSamplers[] = { "pseudo", "sobol", "strat" };
+	bool bOk = true;
+
+	for(int iSampler=0; iSampler<3; ++iSampler)
+	{
+		opts.sampler = McSampler(iSampler);
+		opts.iScramble = 0x1234567u;
+
+		for(std::size_t iNum=1<<10; iNum<=(1<<18); iNum<<=4)
+		{
+			McRngStream rng;
+			rng.iSeed = 1234;
+			rng.iPoint = McRngStream::HashPoint<t_real>(1.1, 0., 0., 3.);
+
+			t_real dD, dDErr, dF, dFErr;
+			convo<double>(ell4d, opts, rng, iNum, dD, dDErr);
+			convo<float>(ell4d, opts, rng, iNum, dF, dFErr);
+
+			const t_real dRatio = std::abs(dF-dD) / dDErr;
+			// the rounding errors have to be far below the statistical ones
+			if(dRatio > 0.1)
+				bOk = false;
+
+			std::cout << std::left << std::setw(10) << pcSamplers[iSampler] << std::setw(10) << iNum
+				<< std::setw(16) << dD << std::setw(16) << dF
+				<< std::setw(16) << dDErr << std::setw(16) << dRatio << std::endl;
+		}
+	}
+
+	std::cout << (bOk ? "# OK" : "# FAILED") << std::endl;
+	return bOk ? 0 : -1;
+}
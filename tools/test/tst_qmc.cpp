@@ -0,0 +1,93 @@
+/**
+ * compares the convergence of pseudo-random, quasi-random and stratified mc neutrons
+ * @author agent <agent@local>
+ * @license GPLv2
+ */
+
+// gcc -O2 -I../.. -o tst_qmc tst_qmc.cpp ../../tlibs/math/rand.cpp ../../tlibs/log/log.cpp -lstdc++ -lm -std=c++11
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include "tlibs/math/rand.h"
+#include "tools/res/ellipse.h"
+#include "tools/res/mc.h"
+
+using t_real = double;
+using t_vec = ublas::vector<t_real>;
+using t_mat = ublas::matrix<t_real>;
+
+
+// smooth test model: exp(-sum_i c_i x_i^2)
+static const t_real g_dC[4] = { 0.5, 1.0, 2.0, 0.25 };
+
+static t_real model(t_real h, t_real k, t_real l, t_real E)
+{
+	return std::exp(-(g_dC[0]*h*h + g_dC[1]*k*k + g_dC[2]*l*l + g_dC[3]*E*E));
+}
+
+
+int main()
+{
+	Ellipsoid4d<t_real> ell4d;
+	ell4d.rot = tl::unit_matrix<t_mat>(4);
+	ell4d.x_hwhm = 0.5; ell4d.y_hwhm = 0.25; ell4d.z_hwhm = 0.75; ell4d.w_hwhm = 1.;
+	ell4d.x_offs = ell4d.y_offs = ell4d.z_offs = ell4d.w_offs = 0.;
+
+	// analytic convolution: prod_i 1/sqrt(1 + 2 c_i sigma_i^2)
+	const t_real dHwhm[4] = { ell4d.x_hwhm, ell4d.y_hwhm, ell4d.z_hwhm, ell4d.w_hwhm };
+	t_real dExact = 1.;
+	for(int i=0; i<4; ++i)
+	{
+		t_real dSig = dHwhm[i] * tl::get_HWHM2SIGMA<t_real>();
+		dExact /= std::sqrt(1. + 2.*g_dC[i]*dSig*dSig);
+	}
+
+	McNeutronOpts<t_mat> opts;
+	opts.coords = McNeutronCoords::DIRECT;
+	opts.bCenter = 1;
+	opts.dAngleQVec0 = 0.;
+
+	const int iNumRuns = 32;
+	tl::init_rand_seed(1234);
+
+	std::cout << "# exact value: " << dExact << "\n";
+	std::cout << "# rms errors over " << iNumRuns << " runs\n";
+	std::cout << std::left << std::setw(12) << "# N"
+		<< std::setw(16) << "pseudo" << std::setw(16) << "sobol"
+		<< std::setw(16) << "stratified" << "\n";
+
+	McNeutrons<t_real> neutrons;
+	for(std::size_t iNum=1<<6; iNum<=(1<<18); iNum<<=2)
+	{
+		neutrons.resize(iNum);
+		t_real dErr[3] = { 0., 0., 0. };
+
+		for(int iSampler=0; iSampler<3; ++iSampler)
+		{
+			opts.sampler = McSampler(iSampler);
+
+			for(int iRun=0; iRun<iNumRuns; ++iRun)
+			{
+				opts.iScramble = std::uint32_t(iRun+1) * 2654435761u;
+				mc_neutrons<t_vec, t_mat>(ell4d, iNum, opts, neutrons, 0);
+
+				t_real dS = 0.;
+				for(std::size_t iNeutr=0; iNeutr<iNum; ++iNeutr)
+					dS += model(neutrons.h[iNeutr], neutrons.k[iNeutr],
+						neutrons.l[iNeutr], neutrons.E[iNeutr]);
+				dS /= t_real(iNum);
+
+				dErr[iSampler] += (dS-dExact)*(dS-dExact);
+			}
+
+			dErr[iSampler] = std::sqrt(dErr[iSampler] / t_real(iNumRuns));
+		}
+
+		std::cout << std::left << std::setw(12) << iNum
+			<< std::setw(16) << dErr[0] << std::setw(16) << dErr[1]
+			<< std::setw(16) << dErr[2] << std::endl;
+	}
+
+	return 0;
+}
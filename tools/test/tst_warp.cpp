@@ -0,0 +1,85 @@
+/**
+ * maps a unit-sphere neutron bank onto resolution ellipsoids
+ * @author agent <agent@local>
+ * @license GPLv2
+ */
+
+// gcc -O2 -I../.. -o tst_warp tst_warp.cpp ../../tlibs/math/rand.cpp ../../tlibs/log/log.cpp -lstdc++ -lm -std=c++11
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include "tlibs/math/rand.h"
+#include "tools/res/ellipse.h"
+#include "tools/res/mc.h"
+
+using t_real = double;
+using t_vec = ublas::vector<t_real>;
+using t_mat = ublas::matrix<t_real>;
+
+
+int main()
+{
+	const std::size_t iNum = 10000;
+
+	McNeutronOpts<t_mat> opts;
+	opts.coords = McNeutronCoords::DIRECT;
+	opts.bCenter = 0;
+	opts.dAngleQVec0 = 0.;
+
+	McRngStream rng;
+	rng.iSeed = 1234;
+
+	// the unit bank is drawn only once
+	McNeutrons<t_real> unit, warped, direct;
+	unit.resize(iNum);
+	warped.resize(iNum);
+	direct.resize(iNum);
+
+	const char* pcSamplers[] = { "pseudo", "sobol", "strat" };
+	bool bOk = true;
+
+	std::cout << std::left << std::setw(10) << "# sampler" << std::setw(10) << "point"
+		<< std::setw(16) << "max. diff" << "\n";
+
+	for(int iSampler=0; iSampler<3; ++iSampler)
+	{
+		opts.sampler = McSampler(iSampler);
+		opts.iScramble = 0x1234567u;
+		mc_unit_neutrons<t_mat>(iNum, opts, unit, 0, 0, &rng);
+
+		// ellipsoids along a scan, rotated in the (Q_par, E) plane
+		for(int iPoint=0; iPoint<4; ++iPoint)
+		{
+			const t_real dAngle = t_real(iPoint) * 0.3;
+
+			Ellipsoid4d<t_real> ell4d;
+			ell4d.rot = tl::unit_matrix<t_mat>(4);
+			ell4d.rot(0,0) = ell4d.rot(3,3) = std::cos(dAngle);
+			ell4d.rot(0,3) = -std::sin(dAngle);
+			ell4d.rot(3,0) = std::sin(dAngle);
+			ell4d.x_hwhm = 0.02; ell4d.y_hwhm = 0.01; ell4d.z_hwhm = 0.03; ell4d.w_hwhm = 0.5;
+			ell4d.x_offs = 1. + 0.05*t_real(iPoint); ell4d.y_offs = 0.; ell4d.z_offs = 0.;
+			ell4d.w_offs = 2. + t_real(iPoint);
+
+			// with the same random numbers, the mapped unit bank has to equal the drawn neutrons
+			mc_neutrons_warp<t_vec, t_mat>(ell4d, iNum, opts, unit, 0, warped, 0);
+			mc_neutrons<t_vec, t_mat>(ell4d, iNum, opts, direct, 0, 0, &rng);
+
+			t_real dMaxDiff = 0.;
+			for(int iComp=0; iComp<4; ++iComp)
+				for(std::size_t iNeutr=0; iNeutr<iNum; ++iNeutr)
+					dMaxDiff = std::max(dMaxDiff, std::abs(warped.data(iComp)[iNeutr]
+						- direct.data(iComp)[iNeutr]));
+
+			if(dMaxDiff > 1e-12)
+				bOk = false;
+
+			std::cout << std::left << std::setw(10) << pcSamplers[iSampler] << std::setw(10) << iPoint
+				<< std::setw(16) << dMaxDiff << std::endl;
+		}
+	}
+
+	std::cout << (bOk ? "# OK" : "# FAILED") << std::endl;
+	return bOk ? 0 : -1;
+}